@@ -7,12 +7,13 @@
 
 #include "25LC1024.h"
 #include "25LC1024-Commands.h"
+#include "transaction_queue.h"
 
-#include <string.h>
+#include <stddef.h> //NULL
 
 #include "SPI.h"
 
-typedef enum {QUEUED, WAKE, WRITE_EN, ACTION, CHECK_STAT, SLEEP, DONE} eeprom_state_t;
+typedef enum {QUEUED, WAIT_WIP, WAKE, ACTION, CHECK_STAT, SLEEP, MERGED, DELIVER, DONE} eeprom_state_t;
 
 typedef struct {
     /** A unique identifer for this transaction */
@@ -30,20 +31,26 @@ typedef struct {
     /** The data buffer used in this transaction */
     uint8_t *data;
     /** The number of bytes to be read or written in this transaction */
-    uint8_t length;
+    uint16_t length;
+    /** The ID of the transaction which this write was merged into */
+    uint8_t leader;
     
     /** Whether this is a write transaction */
     uint8_t write: 1;
     /** Whether this is an erase transaction */
     uint8_t erase: 1;
+    /** Whether this transaction only puts the eeprom to sleep */
+    uint8_t sleep: 1;
+    /** Whether this is a streaming read */
+    uint8_t stream: 1;
 } eeprom_transaction_t;
 
 // MARK: Constants
 #define QUEUE_LENGTH    5   // The number of SPI transactions which can be queued
 #define BUFFER_LENGTH   260 // The size of the output buffer
+#define CHAIN_LENGTH    (QUEUE_LENGTH + 4)  // The largest number of SPI segments used for one step of a transaction
 
 #define ID_INVALID   0  // The transaction ID for an unused transaction
-#define ID_FIRST     1  // The first valid transaction ID
 
 // MARK: Variable Definitions
 /** The chip select pin for the first eeprom */
@@ -56,11 +63,50 @@ static eeprom_transaction_t queue[QUEUE_LENGTH];
 /** The index of the head of the transaction queue */
 static uint8_t queue_head;
 
-/** The transaction id that should be given to the next new transaction */
-static uint8_t next_id = ID_FIRST;
+/** The generation of each slot in the queue, used to create transaction IDs */
+static uint8_t generations[QUEUE_LENGTH];
 
 /** The buffer used in communications with the EEPROM*/
 static uint8_t buffer[BUFFER_LENGTH];
+/** The number of data bytes in the action currently being performed */
+static uint16_t action_length;
+
+/** The SPI segments for the current step of the active transaction */
+static struct spi_segment chain[CHAIN_LENGTH];
+/** The number of segments which have been added to the chain */
+static uint8_t chain_length;
+/** Whether the chain could not be started because the SPI queue was full, it is started again by the service */
+static uint8_t chain_pending;
+/** The state which the active transaction enters once the pending chain is started */
+static eeprom_state_t pending_state;
+/** Single byte commands, kept in memory so that they can be sent as segments of a chain */
+static uint8_t cmd_wren = WREN;
+static uint8_t cmd_rdsr = RDSR;
+static uint8_t cmd_dpd = DPD;
+static uint8_t cmd_ce = CE;
+/** The status register as read before the current step, the rest of the step is skipped if WIP is still set */
+static uint8_t status_before;
+/** The status register as read after the action of the current step */
+static uint8_t status_after;
+
+/** Whether the eeproms should be left awake between transactions */
+static uint8_t keep_awake;
+/** Bit 0 is set if the first eeprom is known to be awake, bit 1 is set if the second is */
+static uint8_t awake_mask;
+/** Bit 0 is set if the first eeprom might still be in a write cycle, bit 1 is set if the second might be */
+static uint8_t busy_mask;
+/** The IDs of the transactions used to put each eeprom to sleep */
+static uint8_t sleep_transaction_id[2];
+
+/** The function to which data from the current streaming read is passed, NULL if there is no streaming read */
+static eeprom_25lc1024_stream_callback_t stream_callback;
+/** The number of bytes left to be read in the current streaming read, including the current chunk */
+static uint32_t stream_remaining;
+/** The number of bytes in the current chunk which have been accepted by the stream callback */
+static uint16_t stream_offset;
+
+uint32_t eeprom_25lc1024_overhead_bytes;
+uint32_t eeprom_25lc1024_payload_bytes;
 
 // MARK: Function Definitions
 void init_25lc1024(uint8_t eeprom_cs_num_0, uint8_t eeprom_cs_num_1)
@@ -69,119 +115,494 @@ void init_25lc1024(uint8_t eeprom_cs_num_0, uint8_t eeprom_cs_num_1)
     cs_num_1 = eeprom_cs_num_1;
 }
 
+static void start_action (eeprom_transaction_t *t);
+static void end_transaction (eeprom_transaction_t *t);
+static uint8_t queue_sleep(uint8_t *transaction_id, uint8_t cs_num);
+
+/**
+ *  Called from the main loop when an SPI transaction started by this driver is done so that the next step of the
+ *  transaction is not delayed until the next time the service is run
+ */
+static void spi_done (uint8_t transaction_id, void *context)
+{
+    eeprom_25lc1024_service();
+}
+
+/**
+ *  Get the bit in awake_mask for the eeprom used by a transaction
+ */
+static inline uint8_t chip_bit (eeprom_transaction_t *t)
+{
+    return (t->cs_num == cs_num_0) ? (1<<0) : (1<<1);
+}
+
+/**
+ *  Get the SPI priority class used for the steps of a transaction
+ */
+static inline spi_priority_t spi_priority (eeprom_transaction_t *t)
+{
+    if (t->stream || t->erase) {
+        // Downloading or erasing the flight log
+        return SPI_PRIORITY_BULK;
+    } else if (t->write) {
+        // Storing the flight log
+        return SPI_PRIORITY_CRITICAL;
+    }
+    return SPI_PRIORITY_NORMAL;
+}
+
+/**
+ *  Add a segment to the chain for the next step of a transaction
+ *  @param repeat_mask The bits of the last byte received which cause the segment to be repeated
+ *  @param hold_cs 1 if the segment is continued by the next one rather than being a command on its own
+ */
+static void add_segment (uint8_t *out_buffer, uint16_t out_length, uint8_t *in_buffer, uint16_t in_length,
+                         uint8_t repeat_mask, uint8_t hold_cs)
+{
+    struct spi_segment *segment = chain + chain_length;
+    segment->next = NULL;
+    segment->out_buffer = out_buffer;
+    segment->out_length = out_length;
+    segment->in_buffer = in_buffer;
+    segment->in_length = in_length;
+    segment->repeat_mask = repeat_mask;
+    segment->hold_cs = hold_cs;
+    
+    if (chain_length != 0) {
+        chain[chain_length - 1].next = segment;
+    }
+    chain_length++;
+}
+
+/**
+ *  Add a single byte command which is not part of the data being read or written to the chain
+ *  @param command The command to be sent
+ *  @param response The memory in which a one byte response is placed, NULL if there is no response
+ *  @param repeat_mask The bits of the response which cause the command to be repeated
+ */
+static void add_command (uint8_t *command, uint8_t *response, uint8_t repeat_mask)
+{
+    uint8_t response_length = (response != NULL) ? 1 : 0;
+    eeprom_25lc1024_overhead_bytes += 1 + response_length;
+    add_segment(command, 1, response, response_length, repeat_mask, 0);
+}
+
+/**
+ *  Start the chain which has been built for the next step of a transaction. The segments are performed back to back
+ *  by the SPI ISR, with CS toggled between them, so other SPI transactions can not be interleaved.
+ *  @note If the chain can not be started the transaction stays in its current state and the chain is kept so that the
+ *        service can try again
+ *  @param next_state The state which the transaction enters once the chain has been started
+ *  @return 0 if the chain was started
+ */
+static uint8_t start_chain (eeprom_transaction_t *t, eeprom_state_t next_state)
+{
+    if (spi_start_chain(&t->spi_id, t->cs_num, chain) ||
+        (spi_set_priority(t->spi_id, spi_priority(t)) && !spi_transaction_done(t->spi_id))) {
+        // The SPI queue is full, setting the priority only fails for a transaction which exists if it is already done
+        t->spi_id = 0;
+        chain_pending = 1;
+        pending_state = next_state;
+        return 1;
+    }
+    spi_set_callback(t->spi_id, spi_done, NULL);
+    chain_length = 0;
+    chain_pending = 0;
+    t->state = next_state;
+    return 0;
+}
+
+/**
+ *  Start a transaction on an eeprom which is awake by enabling writes and performing the action
+ */
+static void start_awake (eeprom_transaction_t *t)
+{
+    if (t->sleep) {
+        // Enter deep power down
+        add_command(&cmd_dpd, NULL, 0);
+        start_chain(t, SLEEP);
+    } else {
+        if (t->write || t->erase) {
+            // Enable writes, the latch is set when CS is de-asserted before the action
+            add_command(&cmd_wren, NULL, 0);
+        }
+        start_action(t);
+    }
+}
+
+/**
+ *  Start a transaction by waking the eeprom if it might be asleep
+ */
+static void start_transaction (eeprom_transaction_t *t)
+{
+    status_before = 0;
+    if (!(awake_mask & chip_bit(t)) && !t->sleep) {
+        // Start transaction by waking the eeprom, this is not chained with the next step because the eeprom does not
+        // accept commands for a while after leaving deep power down
+        buffer[0] = RDID;
+        eeprom_25lc1024_overhead_bytes += 5;
+        add_segment(buffer, 4, buffer + 4, 1, 0, 0);
+        start_chain(t, WAKE);
+        return;
+    }
+    
+    if (busy_mask & chip_bit(t)) {
+        // The last write to this eeprom has not been confirmed to be finished, wait for WIP to be cleared. The rest of
+        // the chain is only performed once it is, so the eeprom is no longer considered busy.
+        add_command(&cmd_rdsr, &status_before, (1<<SR_WIP));
+        busy_mask &= ~chip_bit(t);
+        
+        if (t->stream) {
+            // Streaming reads hold CS between chunks, so they are started separately
+            start_chain(t, WAIT_WIP);
+            return;
+        }
+    }
+    start_awake(t);
+}
+
 /**
  *  Determine the next pending transaction and start it.
+ *  Transactions for an eeprom which is not in a write cycle are started first so that the write cycle of one eeprom
+ *  overlaps with transfers to the other. Transactions for the same eeprom are always started in order.
  *  Does nothing if there is already an active transaction or if there are no pending transactions.
  */
 static void eeprom_start_next_transaction (void)
 {
-    if ((queue[queue_head].state != QUEUED) && (queue[queue_head].state != DONE)) return;
+    if (chain_pending || ((queue[queue_head].state != QUEUED) && (queue[queue_head].state != DONE))) return;
     
+    uint8_t first = QUEUE_LENGTH;
     uint8_t i = queue_head;
     do {
         if ((queue[i].id != ID_INVALID) && (queue[i].state == QUEUED)) {
-            queue_head = i;
-            // Start transaction by waking the eeprom
-            buffer[0] = RDID;
-            spi_start_half_duplex(&queue[i].spi_id, queue[i].cs_num, buffer, 4,  buffer + 4, 1);
-            queue[i].state = WAKE;
-            return;
+            if (!(busy_mask & chip_bit(queue + i))) {
+                first = i;
+                break;
+            } else if (first == QUEUE_LENGTH) {
+                first = i;
+            }
         }
         i = (i + 1) % QUEUE_LENGTH;
     } while (i != queue_head);
+    
+    if (first != QUEUE_LENGTH) {
+        queue_head = first;
+        start_transaction(queue + first);
+    }
+}
+
+/**
+ *  Add queued writes which continue on from the end of a write to the chain, their data is sent from where it is
+ *  @note Merged writes are marked as done along with the write they where merged into
+ *  @param leader The write which is being performed
+ *  @param end The address following the last byte of the write
+ *  @param space The number of bytes left in the page
+ *  @return The number of bytes added to the write
+ */
+static uint16_t merge_writes (eeprom_transaction_t *leader, uint32_t end, uint16_t space)
+{
+    uint16_t merged = 0;
+    uint8_t found;
+    do {
+        found = 0;
+        for (eeprom_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
+            if ((i->id != ID_INVALID) && (i->state == QUEUED) && i->write && (i->cs_num == leader->cs_num) &&
+                (i->address == end) && (i->length <= (space - merged))) {
+                if (i->length != 0) {
+                    add_segment(i->data, i->length, NULL, 0, 0, 1);
+                }
+                merged += i->length;
+                end += i->length;
+                i->state = MERGED;
+                i->leader = leader->id;
+                found = 1;
+            }
+        }
+    } while (found);
+    return merged;
+}
+
+/**
+ *  Read the next chunk of a streaming read into the buffer
+ *  @note CS is left asserted after each chunk so that the READ command continues on through the rest of the eeprom
+ *  @note If the chunk can not be queued CS is released and the transaction ends without reading the rest of the stream
+ *  @param out_length The number of bytes at the start of the buffer to be sent before the chunk is read
+ */
+static void read_stream_chunk (eeprom_transaction_t *t, uint8_t out_length)
+{
+    uint32_t chip_remaining = (MAX_ADDRESS + 1) - t->address;
+    action_length = EEPROM_25LC1024_PAGE_LENGTH;
+    if (action_length > stream_remaining) {
+        action_length = stream_remaining;
+    }
+    if (action_length > chip_remaining) {
+        action_length = chip_remaining;
+    }
+    stream_offset = 0;
+    eeprom_25lc1024_payload_bytes += action_length;
+    
+    uint8_t ret;
+    if ((action_length < stream_remaining) && (action_length < chip_remaining)) {
+        ret = spi_start_half_duplex_held(&t->spi_id, t->cs_num, buffer, out_length, buffer + 4, action_length);
+    } else {
+        ret = spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, out_length, buffer + 4, action_length);
+    }
+    if (ret) {
+        // The SPI queue is full. The READ command can not be continued once CS is released, so the stream is aborted
+        // rather than holding CS, and with it the rest of the SPI bus, until a transaction is free.
+        t->spi_id = 0;
+        spi_release_cs(t->cs_num);
+        stream_callback = NULL;
+        stream_remaining = 0;
+        end_transaction(t);
+        return;
+    }
+    spi_set_priority(t->spi_id, SPI_PRIORITY_BULK);
+    spi_set_callback(t->spi_id, spi_done, NULL);
+    t->state = ACTION;
+}
+
+/**
+ *  Perform the read, write or erase for a transaction, along with any commands which can follow it right away
+ */
+static void start_action (eeprom_transaction_t *t)
+{
+    eeprom_state_t next_state = ACTION;
+    
+    if (t->erase) {
+        add_command(&cmd_ce, NULL, 0);
+        add_command(&cmd_rdsr, &status_after, 0);
+        start_chain(t, next_state);
+        return;
+    }
+    
+    buffer[0] = (t->write) ? WRITE : READ;
+    buffer[1] = ((uint8_t*)(&t->address))[2];
+    buffer[2] = ((uint8_t*)(&t->address))[1];
+    buffer[3] = ((uint8_t*)(&t->address))[0];
+    eeprom_25lc1024_overhead_bytes += 4;
+    
+    if (t->write) {
+        // Writes which cross a page boundry are split, the rest of the page can be filled by other writes
+        uint16_t space = EEPROM_25LC1024_PAGE_LENGTH - (t->address % EEPROM_25LC1024_PAGE_LENGTH);
+        action_length = (t->length < space) ? t->length : space;
+        // The command and the data are sent as one write without copying the data into the buffer
+        add_segment(buffer, 4, NULL, 0, 0, 1);
+        if (action_length != 0) {
+            add_segment(t->data, action_length, NULL, 0, 0, 1);
+        }
+        uint16_t merged = merge_writes(t, t->address + action_length, space - action_length);
+        // The write cycle starts when CS is released after the last byte of data
+        chain[chain_length - 1].hold_cs = 0;
+        
+        eeprom_25lc1024_payload_bytes += action_length + merged;
+        
+        // Assume that the write cycle is in progress unless the status is read after the write
+        status_after = (1<<SR_WIP);
+        if (!keep_awake) {
+            add_command(&cmd_rdsr, &status_after, 0);
+        }
+    } else if (t->stream) {
+        read_stream_chunk(t, 4);
+        return;
+    } else {
+        action_length = t->length;
+        eeprom_25lc1024_payload_bytes += action_length;
+        add_segment(buffer, 4, t->data, action_length, 0, 0);
+        
+        if (!keep_awake) {
+            // Reads do not start a write cycle, so the eeprom can be put to sleep in the same chain
+            add_command(&cmd_dpd, NULL, 0);
+            next_state = SLEEP;
+        }
+    }
+    start_chain(t, next_state);
+}
+
+/**
+ *  Clean up after a transaction and start the next one
+ */
+static void finish_transaction (eeprom_transaction_t *t)
+{
+    if (t->erase && (t->cs_num == cs_num_0)) {
+        // If this is an erase transaction we need to restart from the begining to erase the second chip
+        t->cs_num = cs_num_1;
+        start_transaction(t);
+    } else {
+        t->state = DONE;
+        for (eeprom_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
+            if ((i->state == MERGED) && (i->leader == t->id)) {
+                i->state = DONE;
+            }
+        }
+        queue_head = (queue_head + 1) % QUEUE_LENGTH;
+        eeprom_start_next_transaction();
+    }
+}
+
+/**
+ *  Finish a transaction which is done with the eeprom, putting the eeprom to sleep unless it should be left awake
+ */
+static void end_transaction (eeprom_transaction_t *t)
+{
+    if (keep_awake) {
+        // Leave the eeprom awake for the next transaction
+        finish_transaction(t);
+    } else {
+        // Enter sleep
+        add_command(&cmd_dpd, NULL, 0);
+        start_chain(t, SLEEP);
+    }
+}
+
+/**
+ *  Pass the current chunk of a streaming read to the callback and start reading the next chunk once it has all been
+ *  accepted
+ */
+static void deliver_stream (eeprom_transaction_t *t)
+{
+    stream_offset += stream_callback(buffer + 4 + stream_offset, action_length - stream_offset);
+    if (stream_offset < action_length) {
+        // Try again in the next iteration of the main loop, CS is held so the read can continue where it left off
+        t->state = DELIVER;
+        return;
+    }
+    
+    t->address += action_length;
+    stream_remaining -= action_length;
+    
+    if (stream_remaining == 0) {
+        stream_callback = NULL;
+        end_transaction(t);
+    } else if (t->address > MAX_ADDRESS) {
+        // Continue on to the second eeprom with a new READ command
+        if (!keep_awake && (sleep_transaction_id[0] == 0)) {
+            queue_sleep(&sleep_transaction_id[0], cs_num_0);
+        }
+        t->cs_num = cs_num_1;
+        t->address = 0;
+        start_transaction(t);
+    } else {
+        read_stream_chunk(t, 0);
+    }
+}
+
+/**
+ *  Start the next part of a write which crossed a page boundry, or finish the transaction if the write is complete
+ */
+static void continue_write (eeprom_transaction_t *t)
+{
+    if (t->length == 0) {
+        finish_transaction(t);
+        return;
+    } else if ((t->cs_num == cs_num_0) && (t->address > MAX_ADDRESS)) {
+        // Continue on to the second eeprom
+        t->cs_num = cs_num_1;
+        t->address -= MAX_ADDRESS + 1;
+    }
+    start_transaction(t);
 }
 
 void eeprom_25lc1024_service(void)
 {
+    for (uint8_t i = 0; i < 2; i++) {
+        if ((sleep_transaction_id[i] != 0) && !eeprom_25lc1024_clear_transaction(sleep_transaction_id[i])) {
+            sleep_transaction_id[i] = 0;
+        }
+    }
+    
     eeprom_transaction_t *t = queue + queue_head;
+    if (t->state == DELIVER) {
+        // The stream callback did not accept all of the last chunk
+        deliver_stream(t);
+        return;
+    } else if (chain_pending) {
+        // The SPI queue was full when the current step was started
+        start_chain(t, pending_state);
+        return;
+    }
+    
     if (!spi_transaction_done(t->spi_id)) return;
     spi_clear_transaction(t->spi_id);
+    // The ID may be reused by another driver once it is cleared, it must not be polled again
+    t->spi_id = 0;
+    
+    if (status_before & (1<<SR_WIP)) {
+        // The eeprom was still in a write cycle, so the rest of the chain was skipped. The segments are unchanged so
+        // the same chain can be started again.
+        start_chain(t, t->state);
+        return;
+    }
     
     switch (t->state) {
         case QUEUED:
             // Shouldn't happen
             break;
+        case WAIT_WIP:
+            // WIP is clear, start the streaming read
+            start_awake(t);
+            break;
         case WAKE:
-            // Finished reading SIG, move on to read action or right enable
-            if (t->write || t->erase) {
-                // WIP cleared, we need to enable writes now
-                buffer[0] = WREN;
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 1, NULL, 0);
-                t->state = WRITE_EN;
-                break;
-            }
-            // If we make it here we are ready to start a read transaction by falling through to write_en done
-        case WRITE_EN:
-            // Write EN done. Perform action
-            if (!t->erase) {
-                buffer[0] = (t->write) ? WRITE : READ;
-                buffer[1] = ((uint8_t*)(&t->address))[2];
-                buffer[2] = ((uint8_t*)(&t->address))[1];
-                buffer[3] = ((uint8_t*)(&t->address))[0];
-                if (t->write) memcpy(buffer + 4, t->data, t->length);
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, (t->write) ? t->length + 4 : 4,  buffer + 4,
-                                      (t->write) ? 0 : t->length);
-            } else {
-                buffer[0] = CE;
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 1, NULL, 0);
-            }
-            t->state = ACTION;
+            // Finished reading SIG, move on to the rest of the transaction
+            awake_mask |= chip_bit(t);
+            start_transaction(t);
             break;
         case ACTION:
-            // Action finished. Check stat
-            if (t->write) {
-                buffer[0] = RDSR;
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 1,  buffer + 1, 1);
-                t->state = CHECK_STAT;
+            // Action finished
+            if (t->stream) {
+                deliver_stream(t);
+                break;
+            } else if (t->write) {
+                // Skip past the part of the write which has been performed
+                t->address += action_length;
+                t->data += action_length;
+                t->length -= action_length;
+            } else if (!t->erase) {
+                end_transaction(t);
+                break;
+            }
+            
+            if (t->write && keep_awake) {
+                // Do not wait for the write cycle, WIP is checked before the next transaction with this eeprom
+                busy_mask |= chip_bit(t);
+                continue_write(t);
                 break;
-            } else {
-                memcpy(t->data, buffer + 4, t->length);
-                buffer[1] = 0;
             }
         case CHECK_STAT:
-            // Finished reading STAT, check if WIP is set, if it is check stat again, if it isn't put eeprom to sleep
-            if (buffer[1] & (1<<SR_WIP)) {
+            // Check if WIP is set, if it is check stat again, if it isn't put eeprom to sleep
+            if (status_after & (1<<SR_WIP)) {
                 // WIP still set
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 1,  buffer + 1, 1);
+                add_command(&cmd_rdsr, &status_after, (1<<SR_WIP));
+                start_chain(t, CHECK_STAT);
+            } else if (t->write && (t->length != 0)) {
+                // WIP cleared, write the rest of a write which crossed a page boundry
+                continue_write(t);
             } else {
-                // WIP cleared, enter sleep
-                buffer[0] = DPD;
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 1,  NULL, 0);
-                t->state = SLEEP;
+                // WIP cleared
+                end_transaction(t);
             }
             break;
         case SLEEP:
             // Sleep mode has been entered, clean up and start the next transaction
-            if (t->erase && (t->cs_num == cs_num_0)) {
-                // If this is an erase transaction we need to restart from the begining to erase the second chip
-                t->cs_num = cs_num_1;
-                buffer[0] = RDID;
-                spi_start_half_duplex(&t->spi_id, t->cs_num, buffer, 4, buffer + 4, 1);
-                t->state = WAKE;
-            } else {
-                t->state = DONE;
-                queue_head = (queue_head + 1) % QUEUE_LENGTH;
-                eeprom_start_next_transaction();
-            }
+            awake_mask &= ~chip_bit(t);
+            finish_transaction(t);
             break;
+        case MERGED:
+        case DELIVER:
         case DONE:
             // Shouldn't happen
             break;
     }
 }
 
-
 /**
- *  Get a transaction with a certain ID
- *  @param transaction_id The id of the transaction which should be retrieved
- *  @return A pointer the transaction with an in matching transaction_id. Null if there is no such transaction.
+ *  Get the transaction with the given ID
+ *  @param id The transaction ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
  */
 static volatile eeprom_transaction_t *get_transaction_with_id (uint8_t id)
 {
-    for (eeprom_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
-        if (i->id == id) return i;
-    }
-    return NULL;
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
 }
 
 uint8_t eeprom_25lc1024_transaction_done(uint8_t transaction_id)
@@ -206,23 +627,27 @@ uint8_t eeprom_25lc1024_clear_transaction(uint8_t transaction_id)
  */
 static eeprom_transaction_t *get_next_free_transaction(void)
 {
-    uint8_t i = queue_head;
-    do {
-        if (queue[i].id == ID_INVALID) return queue + i;
-        i = (i + 1) % QUEUE_LENGTH;
-    } while (i != queue_head);
-    return NULL;
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), queue_head);
 }
 
 
-uint8_t eeprom_25lc1024_read(uint8_t *transaction_id, uint32_t address, uint8_t length, uint8_t *data)
+uint32_t eeprom_25lc1024_stripe(uint32_t address)
+{
+    uint32_t page = address / EEPROM_25LC1024_PAGE_LENGTH;
+    uint32_t chip_address = ((page >> 1) * EEPROM_25LC1024_PAGE_LENGTH) + (address % EEPROM_25LC1024_PAGE_LENGTH);
+    return (page & 1) ? (chip_address + MAX_ADDRESS + 1) : chip_address;
+}
+
+uint8_t eeprom_25lc1024_read(uint8_t *transaction_id, uint32_t address, uint16_t length, uint8_t *data)
 {
+    if (length > EEPROM_25LC1024_PAGE_LENGTH) return 1;
+    
     eeprom_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->state = QUEUED;
     t->spi_id = 0;
@@ -234,19 +659,55 @@ uint8_t eeprom_25lc1024_read(uint8_t *transaction_id, uint32_t address, uint8_t
     
     t->write = 0;
     t->erase = 0;
+    t->sleep = 0;
+    t->stream = 0;
     
     eeprom_start_next_transaction();
     return 0;
 }
 
-uint8_t eeprom_25lc1024_write(uint8_t *transaction_id, uint32_t address, uint8_t length,  uint8_t *data)
+uint8_t eeprom_25lc1024_stream(uint8_t *transaction_id, uint32_t address, uint32_t length,
+                               eeprom_25lc1024_stream_callback_t callback)
 {
+    if ((stream_callback != NULL) || (length == 0) || ((address + length) > EEPROM_25LC1024_SIZE)) {
+        return 1;
+    }
+    
     eeprom_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    
+    t->state = QUEUED;
+    t->spi_id = 0;
+    
+    t->cs_num = (address <= MAX_ADDRESS) ? cs_num_0 : cs_num_1;
+    t->address = (address <= MAX_ADDRESS) ? address : address - MAX_ADDRESS - 1;
+    t->data = NULL;
+    t->length = 0;
+    
+    t->write = 0;
+    t->erase = 0;
+    t->sleep = 0;
+    t->stream = 1;
+    
+    stream_callback = callback;
+    stream_remaining = length;
+    
+    eeprom_start_next_transaction();
+    return 0;
+}
+
+uint8_t eeprom_25lc1024_write(uint8_t *transaction_id, uint32_t address, uint16_t length,  uint8_t *data)
+{
+    eeprom_transaction_t *t = get_next_free_transaction();
+    if (t == NULL) return 1;
+    
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->state = QUEUED;
     t->spi_id = 0;
@@ -258,6 +719,8 @@ uint8_t eeprom_25lc1024_write(uint8_t *transaction_id, uint32_t address, uint8_t
     
     t->write = 1;
     t->erase = 0;
+    t->sleep = 0;
+    t->stream = 0;
     
     eeprom_start_next_transaction();
     return 0;
@@ -268,9 +731,9 @@ uint8_t eeprom_25lc1024_chip_erase(uint8_t *transaction_id)
     eeprom_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->state = QUEUED;
     t->spi_id = 0;
@@ -282,7 +745,54 @@ uint8_t eeprom_25lc1024_chip_erase(uint8_t *transaction_id)
     
     t->write = 0;
     t->erase = 1;
+    t->sleep = 0;
+    t->stream = 0;
+    
+    eeprom_start_next_transaction();
+    return 0;
+}
+
+/**
+ *  Add a transaction to the queue which puts an eeprom into deep power down
+ *  @param transaction_id The identifier for the transaction will be stored in this memory
+ *  @param cs_num The chip select pin of the eeprom
+ */
+static uint8_t queue_sleep(uint8_t *transaction_id, uint8_t cs_num)
+{
+    eeprom_transaction_t *t = get_next_free_transaction();
+    if (t == NULL) return 1;
+    
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    
+    t->state = QUEUED;
+    t->spi_id = 0;
+    
+    t->cs_num = cs_num;
+    t->address = 0;
+    t->data = NULL;
+    t->length = 0;
+    
+    t->write = 0;
+    t->erase = 0;
+    t->sleep = 1;
+    t->stream = 0;
     
     eeprom_start_next_transaction();
     return 0;
 }
+
+void eeprom_25lc1024_set_keep_awake(uint8_t awake)
+{
+    keep_awake = awake;
+    if (awake) return;
+    
+    // Put any eeproms which where left awake to sleep
+    if ((awake_mask & (1<<0)) && (sleep_transaction_id[0] == 0)) {
+        queue_sleep(&sleep_transaction_id[0], cs_num_0);
+    }
+    if ((awake_mask & (1<<1)) && (sleep_transaction_id[1] == 0)) {
+        queue_sleep(&sleep_transaction_id[1], cs_num_1);
+    }
+}
@@ -13,6 +13,26 @@
 #include "global.h"
 
 #define EEPROM_25LC1024_MAX (0x1FFFF * 2)
+#define EEPROM_25LC1024_PAGE_LENGTH 256
+#define EEPROM_25LC1024_SIZE 0x40000    // The total number of bytes in both eeproms
+
+/**
+ *  A function to which the data from a streaming read is passed
+ *  @param data The bytes which have been read
+ *  @param length The number of bytes which have been read
+ *  @return The number of bytes which where accepted, the rest will be passed again in the next call
+ */
+typedef uint16_t (*eeprom_25lc1024_stream_callback_t)(const uint8_t *data, uint16_t length);
+
+/**
+ *  The number of bytes sent or recieved over SPI for commands, addresses and status polling
+ */
+extern uint32_t eeprom_25lc1024_overhead_bytes;
+
+/**
+ *  The number of bytes of data read from or written to the eeproms
+ */
+extern uint32_t eeprom_25lc1024_payload_bytes;
 
 /**
  *  Initilize the 25LC1024 EEPROM with the given CS num
@@ -26,6 +46,16 @@ extern void init_25lc1024(uint8_t cs_num_0, uint8_t cs_num_1);
  */
 extern void eeprom_25lc1024_service(void);
 
+/**
+ *  Set whether the eeproms are left awake between transactions
+ *  @note Leaving the eeproms awake saves waking them before and putting them into deep power down after each
+ *        transaction. Writes are also considered done as soon as the data has been sent, the end of the write cycle
+ *        is checked for before the next transaction with the same eeprom. When this is cleared any eeproms which
+ *        are awake are put to sleep.
+ *  @param awake 1 if the eeproms should be left awake
+ */
+extern void eeprom_25lc1024_set_keep_awake(uint8_t awake);
+
 /**
  *  Check if an asynchronous eeprom transaction has finished
  *  @param transaction_id The identifier for the transaction
@@ -39,25 +69,54 @@ extern uint8_t eeprom_25lc1024_transaction_done(uint8_t transaction_id);
  */
 extern uint8_t eeprom_25lc1024_clear_transaction(uint8_t transaction_id);
 
+/**
+ *  Convert an address in the striped address space to an address which can be used for reads and writes
+ *  @note In the striped address space consecutive pages alternate between the two eeproms, so that the write cycle
+ *        for one page can happen while the next page is sent to the other eeprom.
+ *  @param address The striped address
+ *  @return The address within the two eeproms
+ */
+extern uint32_t eeprom_25lc1024_stripe(uint32_t address);
+
 /**
  *  Add a read transaction to the queue
  *  @note A read operation which runs off the end of the eeprom array will loop to be begining. Reads may span multiple pages.
+ *  @note Reads may be at most EEPROM_25LC1024_PAGE_LENGTH bytes long.
+ *  @note The bytes are placed in data as they are read, its contents are not valid until the transaction is done.
  *  @param transaction_id The identifier for the transaction will be stored in this memory
  *  @param address The memory address where the read operation should start
  *  @param length The number of bytes to be read
  *  @param data The memory in which the bytes which are read will be placed
  */
-extern uint8_t eeprom_25lc1024_read(uint8_t *transaction_id, uint32_t address, uint8_t length, uint8_t *data);
+extern uint8_t eeprom_25lc1024_read(uint8_t *transaction_id, uint32_t address, uint16_t length, uint8_t *data);
+
+/**
+ *  Add a streaming read transaction to the queue
+ *  @note A single READ command is used for the whole stream on each eeprom, CS is held asserted between chunks so no
+ *        other SPI peripherals can be used until the stream is complete. Only one stream can be queued at a time.
+ *  @note The data is passed to the callback from eeprom_25lc1024_service in chunks of at most
+ *        EEPROM_25LC1024_PAGE_LENGTH bytes, the next chunk is not read until the callback has accepted all of the last.
+ *  @note If the SPI queue is full when a chunk is to be read the stream is aborted, the transaction is marked as done
+ *        without the rest of the data being passed to the callback.
+ *  @param transaction_id The identifier for the transaction will be stored in this memory
+ *  @param address The memory address where the read should start
+ *  @param length The number of bytes to be read, the read must not run off the end of the second eeprom
+ *  @param callback The function to which data will be passed
+ */
+extern uint8_t eeprom_25lc1024_stream(uint8_t *transaction_id, uint32_t address, uint32_t length,
+                                      eeprom_25lc1024_stream_callback_t callback);
 
 /**
  *  Add a write transaction to the queue
- *  @note Write operations must not cross a page boundry. Pages are 256 bytes long.
+ *  @note Writes which cross a page boundry are split into one write cycle per page. Queued writes which continue on
+ *        from the end of another write in the same page are merged into a single write cycle.
+ *  @note The data must not be modified until the transaction is done.
  *  @param transaction_id The identifier for the transaction will be stored in this memory
  *  @param address The memory address where the write operation should start
  *  @param length The number of bytes to be written
  *  @param data The memory from which the bytes will be written
  */
-extern uint8_t eeprom_25lc1024_write(uint8_t *transaction_id, uint32_t address, uint8_t length,  uint8_t *data);
+extern uint8_t eeprom_25lc1024_write(uint8_t *transaction_id, uint32_t address, uint16_t length,  uint8_t *data);
 
 /**
  *  Add a transaction to the queue which will erase the entire eeprom
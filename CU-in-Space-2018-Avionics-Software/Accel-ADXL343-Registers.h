@@ -122,6 +122,6 @@
 
 #define FIFO_STATUS         0x39    // Status information for FIFO buffer
 #define FIFO_TRIG           7       // Set if FIFO trigger event has occured
-#define FIFO_ENTRIES_MASK   0x1f    // Number of entries in FIFO buffer
+#define FIFO_ENTRIES_MASK   0x3f    // Number of entries in FIFO buffer, up to 32 plus one held in the data registers
 
 #endif /* Accel_ADXL343_Registers_h */
@@ -7,17 +7,21 @@
 
 #include "Accel-ADXL343.h"
 #include "Accel-ADXL343-Registers.h"
+
+#include <avr/io.h>
+
 #include "I2C.h"
+#include "pindefinitions.h"
 #include <math.h> // round()
 
-#define POLL_INTERVAL (1000/(ADXL343_SAMPLE_RATE)) // Calculate interval between each poll in milliseconds based on defined sample rate
 #define ROUND_DIVIDE(a,b) ( ((a)+(b)/2) / (b) ) // idea: http://www.nongnu.org/avr-libc/user-manual/FAQ.html#faq_wrong_baud_rate
 // Unlike simple divide operation that will always truncate the decimal part of the result, ROUND_DIVIDE rounds the result of a division to the nearest integer.
 
-static uint8_t fifo_setting[] = {0x0};          // disable FIFO
-static uint8_t int_setting[] = {0x0};           // not using any interrupt
+static uint8_t fifo_setting[] = {(1<<FIFO_CTL_MODE0) | ADXL343_FIFO_WATERMARK}; // stream mode, watermark on INT1
+static uint8_t fifo_bypass_setting[] = {0};     // bypass mode, clears the FIFO
+static uint8_t int_setting[] = {(1<<INT_EN_WATERMARK)}; // FIFO watermark interrupt
 static uint8_t data_format_setting[] = {0xb};   // full resolution, range -16g~16g
-static uint8_t bw_rate_setting[] = {0xd};       // output data rate = 800 Hz
+static uint8_t bw_rate_setting[] = {0xc};       // output data rate = 400 Hz
 static uint8_t power_ctl_setting[] = {(1<<PWR_CTL_MEASURE)};
 
 #define MAX_TRANSACTION_ID_NUM 5
@@ -26,11 +30,21 @@ static uint8_t power_ctl_setting[] = {(1<<PWR_CTL_MEASURE)};
 #define OFFSET_SCALE_FACTOR 0.0156 // 15.6mg per LSB for offset registers
 #define OFFSET_TO_ACCEL_CONV_FACTOR ((int8_t)round(OFFSET_SCALE_FACTOR/ACCEL_SCALE_FACTOR))
 
+#define RING_MASK (ADXL343_RING_LENGTH - 1) // ADXL343_RING_LENGTH must be a power of two
+
 static uint8_t accel_data_buffer[ACCEL_DATA_BUFFER_SIZE];
 static uint8_t accel_transaction_id[MAX_TRANSACTION_ID_NUM];
-typedef enum {ACCEL_INIT, ACCEL_WAIT, ACCEL_READ, ACCEL_CALIB_WAIT, ACCEL_CALIB_START, ACCEL_CALIB_READ} sensor_state;
+typedef enum {ACCEL_INIT, ACCEL_WAIT, ACCEL_STATUS, ACCEL_READ, ACCEL_READ_WAIT, ACCEL_FIFO_RESET, ACCEL_FIFO_RESET_WAIT, ACCEL_CALIB_WAIT, ACCEL_CALIB_START, ACCEL_CALIB_READ} sensor_state;
 static sensor_state state;
 
+static uint8_t fifo_status;         // FIFO_STATUS as read when draining started
+static uint32_t drain_time;         // The value of millis when FIFO_STATUS was read
+static uint8_t drain_index;         // The number of samples which have been read from the FIFO since draining started
+static uint8_t batch_length;        // The number of reads in the batch currently in progress
+
+struct adxl343_sample adxl343_samples[ADXL343_RING_LENGTH];
+uint16_t adxl343_sample_count;
+
 uint32_t adxl343_sample_time;
 int16_t adxl343_accel_x;
 int16_t adxl343_accel_y;
@@ -51,6 +65,14 @@ uint8_t init_adxl343(void)
 	return 0;
 }
 
+/**
+ *  Called from the main loop when the FIFO status read or the last read of a batch is done
+ */
+static void i2c_done(uint8_t transaction_id, void *context)
+{
+	adxl343_service();
+}
+
 void adxl343_service(void)
 {
 	switch(state) {
@@ -72,23 +94,82 @@ void adxl343_service(void)
 			}
 			break;
 		case ACCEL_WAIT:
-			// Send the command to read in x,y,z data registers from the I2C bus
-			if ((millis - adxl343_sample_time) >= POLL_INTERVAL) {
-				if (!i2c_read(&accel_transaction_id[0], ADDRESS, DATAX0, &accel_data_buffer[0], 6)) 
-					// Multibyte reading starting from DATAX0 to guarantee atomic reading of the data registers
-					// If i2c_read queue allocation is successful (i.e. it returns 0), change the state
+			// Wait for the FIFO to reach the watermark, then find out how many samples it holds
+			if (ACCEL_INT_PIN & (1<<ACCEL_INT_NUM)) {
+				if (!i2c_read(&accel_transaction_id[0], ADDRESS, FIFO_STATUS, &fifo_status, 1)) {
+					i2c_set_callback(accel_transaction_id[0], i2c_done, NULL);
+					drain_time = millis;
+					state = ACCEL_STATUS;
+				}
+			}
+			break;
+		case ACCEL_STATUS:
+			if (i2c_transaction_done(accel_transaction_id[0])) {
+				i2c_clear_transaction(accel_transaction_id[0]);
+				accel_transaction_id[0] = 0;
+				fifo_status &= FIFO_ENTRIES_MASK;
+				drain_index = 0;
+				// A full FIFO has overrun and lost its oldest samples, but the remaining ones are still timestamped
+				// correctly from the newest one so it is drained as usual
+				if (fifo_status != 0) {
 					state = ACCEL_READ;
+				} else if (ACCEL_INT_PIN & (1<<ACCEL_INT_NUM)) {
+					// The interupt is still asserted with nothing to read, clear the FIFO so that it can start over
+					state = ACCEL_FIFO_RESET;
+				} else {
+					state = ACCEL_WAIT;
+				}
 			}
 			break;
 		case ACCEL_READ:
-			// Waiting the transaction to be done, then copy the data register values into accel variables.
-			if (i2c_transaction_done(accel_transaction_id[0])) {
-				adxl343_sample_time = millis;
+			// Queue a batch of reads, each one pops a single entry from the FIFO. The data registers are little endian
+			// like the AVR, so they are read directly into the x, y and z fields of the next ring buffer entries.
+			batch_length = 0;
+			while ((batch_length < MAX_TRANSACTION_ID_NUM) && ((drain_index + batch_length) < fifo_status)) {
+				struct adxl343_sample *sample = adxl343_samples + ((adxl343_sample_count + batch_length) & RING_MASK);
+				if (i2c_read(&accel_transaction_id[batch_length], ADDRESS, DATAX0, (uint8_t*)&sample->x, 6)) break;
+				batch_length++;
+			}
+			if (batch_length != 0) {
+				// The reads are normally done in the order they were queued, if not the main loop picks up the rest
+				i2c_set_callback(accel_transaction_id[batch_length - 1], i2c_done, NULL);
+				state = ACCEL_READ_WAIT;
+			}
+			break;
+		case ACCEL_READ_WAIT:
+			// Wait for the whole batch to be done, then timestamp the new samples based on their position in the FIFO
+			for (uint8_t i = 0; i < batch_length; i++) {
+				if (!i2c_transaction_done(accel_transaction_id[i])) return;
+			}
+			for (uint8_t i = 0; i < batch_length; i++) {
+				i2c_clear_transaction(accel_transaction_id[i]);
+				accel_transaction_id[i] = 0;
+				
+				struct adxl343_sample *sample = adxl343_samples + (adxl343_sample_count & RING_MASK);
+				sample->time = drain_time - ((uint16_t)(fifo_status - 1 - drain_index) * 1000 / ADXL343_DATA_RATE);
+				adxl343_sample_count++;
+				drain_index++;
+				
+				adxl343_accel_x = sample->x;
+				adxl343_accel_y = sample->y;
+				adxl343_accel_z = sample->z;
+			}
+			adxl343_sample_time = millis;
+			state = (drain_index < fifo_status) ? ACCEL_READ : ACCEL_WAIT;
+			break;
+		case ACCEL_FIFO_RESET:
+			// Switch the FIFO to bypass mode to empty it, then back to stream mode
+			if (!accel_transaction_id[0] &&
+				i2c_write(&accel_transaction_id[0], ADDRESS, FIFO_CTL, fifo_bypass_setting, 1)) break;
+			if (i2c_write(&accel_transaction_id[1], ADDRESS, FIFO_CTL, fifo_setting, 1)) break;
+			state = ACCEL_FIFO_RESET_WAIT;
+			break;
+		case ACCEL_FIFO_RESET_WAIT:
+			if (i2c_transaction_done(accel_transaction_id[0]) && i2c_transaction_done(accel_transaction_id[1])) {
 				i2c_clear_transaction(accel_transaction_id[0]);
+				i2c_clear_transaction(accel_transaction_id[1]);
 				accel_transaction_id[0] = 0;
-				adxl343_accel_x = ((accel_data_buffer[1] << 8) | accel_data_buffer[0]);
-				adxl343_accel_y = ((accel_data_buffer[3] << 8) | accel_data_buffer[2]);
-				adxl343_accel_z = ((accel_data_buffer[5] << 8) | accel_data_buffer[4]);
+				accel_transaction_id[1] = 0;
 				state = ACCEL_WAIT;
 			}
 			break;
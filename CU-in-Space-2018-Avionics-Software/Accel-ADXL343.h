@@ -12,24 +12,52 @@
 #include "global.h"
 
 // MARK: Constants
-#define ADXL343_SAMPLE_RATE   5   // The number of times per second that the sensor should be polled
+#define ADXL343_DATA_RATE       400 // The output data rate of the sensor in Hz, must match the setting for BW_RATE
+#define ADXL343_FIFO_WATERMARK  16  // The number of samples in the sensor's FIFO at which it is drained
+#define ADXL343_RING_LENGTH     32  // The number of samples kept in the ring buffer
+
+// MARK: Types
+/**
+ *  A single acceleration sample
+ */
+struct adxl343_sample {
+    /** The estimated value of millis when the sample was taken */
+    uint32_t time;
+    /** The acceleration in the x axis in 3.9mg per least signifigant bit */
+    int16_t x;
+    /** The acceleration in the y axis in 3.9mg per least signifigant bit */
+    int16_t y;
+    /** The acceleration in the z axis in 3.9mg per least signifigant bit */
+    int16_t z;
+};
 
 // MARK: Variables
+/**
+ *  The most recent samples recieved from the sensor, oldest samples are overwritten when the buffer is full
+ */
+extern struct adxl343_sample adxl343_samples[ADXL343_RING_LENGTH];
+
+/**
+ *  The total number of samples which have been placed in the ring buffer, wraps around on overflow
+ *  @note The most recent sample is at index (adxl343_sample_count - 1) % ADXL343_RING_LENGTH
+ */
+extern uint16_t adxl343_sample_count;
+
 /**
  *  The value of the global millis variable when the last sample was recieved from the sensor
  */
 extern uint32_t adxl343_sample_time;
 
 /**
- *  The acceleration in the x axis as recieved from the sensor
+ *  The acceleration in the x axis from the most recent sample
  */
 extern int16_t adxl343_accel_x;
 /**
- *  The acceleration in the y axis as recieved from the sensor
+ *  The acceleration in the y axis from the most recent sample
  */
 extern int16_t adxl343_accel_y;
 /**
- *  The acceleration in the z axis as recieved from the sensor
+ *  The acceleration in the z axis from the most recent sample
  */
 extern int16_t adxl343_accel_z;
 
@@ -13,11 +13,14 @@
 #include "pindefinitions.h"
 #include "I2C.h"
 
-#define SAMPLE_PERIOD (1000 / MPL3115A2_SAMPLE_RATE)
 #define WARMUP_TIME 1000
 
+// Oversample ratio of 32, each measurment takes about 130ms
+#define CTRL1_OVERSAMPLE    ((1<<CTRL_REG1_OS2) | (1<<CTRL_REG1_OS0))
+// Active altimeter mode and start a measurment immediately
+#define CTRL1_MEASURE       ((1<<CTRL_REG1_ALT) | CTRL1_OVERSAMPLE | (1<<CTRL_REG1_OST) | (1<<CTRL_REG1_SBYB))
+
 // MARK: States
-#define STATE_REQ_SAMPLE_PERIOD     7
 #define STATE_REQ_INTERUPT          6
 #define STATE_REQ_I2C_DONE          5
 
@@ -35,7 +38,8 @@
 #define S_WRITE_BARO        ((1<<STATE_REQ_I2C_DONE) | 12)
 #define S_START_ALTITUDE    ((1<<STATE_REQ_INTERUPT) | 13)
 #define S_READ_ALTITUDE     ((1<<STATE_REQ_I2C_DONE) | 14)
-#define S_WAIT              ((1<<STATE_REQ_SAMPLE_PERIOD) | (1<<STATE_REQ_INTERUPT) | 15)
+#define S_WAIT              ((1<<STATE_REQ_INTERUPT) | 15)
+#define S_TRIGGER           ((1<<STATE_REQ_I2C_DONE) | 16)
 
 // MARK: Variables
 uint32_t mpl3115a2_sample_time;
@@ -53,8 +57,18 @@ static uint8_t state = S_IDLE;
 static uint8_t buffer[6];
 /** The i2c transaction ID of the transaction used by the sensor */
 static uint8_t i2c_id;
+/** The value of millis when the measurment currently being read was ready */
+static uint32_t ready_time;
 
 // MARK: Functions
+/**
+ *  Called from the main loop when the current I2C transaction is done
+ */
+static void i2c_done(uint8_t transaction_id, void *context)
+{
+    mpl3115a2_service();
+}
+
 void init_mpl3115a2(void)
 {
     if (state != S_IDLE) {
@@ -66,11 +80,10 @@ void init_mpl3115a2(void)
 
 void mpl3115a2_service(void)
 {
-    // Return if the current state is not finished
+    // Return if the current state is not finished, the interupt pin is active high (IPOL1) once data is ready
     if ((state == S_IDLE) ||
         ((state == S_WARMUP) && (millis < WARMUP_TIME)) ||
-        ((state & (1<<STATE_REQ_SAMPLE_PERIOD)) && ((millis - mpl3115a2_sample_time) < SAMPLE_PERIOD)) ||
-        ((state & (1<<STATE_REQ_INTERUPT)) && (ALT_INT_PIN & (1<<ALT_INT_NUM)))) {
+        ((state & (1<<STATE_REQ_INTERUPT)) && !(ALT_INT_PIN & (1<<ALT_INT_NUM)))) {
         return;
     } else if ((state & (1<<STATE_REQ_I2C_DONE))) {
         if (!i2c_transaction_done(i2c_id)) return;  // Do not continue if the I2C transaction is not yet finished
@@ -78,13 +91,16 @@ void mpl3115a2_service(void)
         uint8_t success = i2c_transaction_successful(i2c_id);
         i2c_clear_transaction(i2c_id);
         
-        if ((state != S_READ_ALTITUDE) && !success) {
+        if ((state != S_READ_ALTITUDE) && (state != S_TRIGGER) && !success) {
             // If we are in the init process and a transaction fails we jump back to the idle state.
             state = S_IDLE;
             return;
         } else if (!success) {
-            // If a transaction fails after initilization we try to read again by going back to S_WAIT.
-            state = S_WAIT;
+            // If a transaction fails after initilization we start a new measurment
+            buffer[0] = CTRL1_MEASURE;
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG1, buffer, 1);
+            i2c_set_callback(i2c_id, i2c_done, NULL);
+            state = S_TRIGGER;
             return;
         }
     }
@@ -155,16 +171,16 @@ void mpl3115a2_service(void)
             state = S_WRITE_BARO;
             break;
         case S_WRITE_BARO:
-            // Write control register 1 to start continuous altitude measurments
-            buffer[0] = (1<<CTRL_REG1_ALT) | (1<<CTRL_REG1_OS0) | (1<<CTRL_REG1_OS1) | (1<<CTRL_REG1_OS2) |
-                (1<<CTRL_REG1_SBYB);
+            // Write control register 1 to start the first altitude measurment
+            buffer[0] = CTRL1_MEASURE;
             i2c_write(&i2c_id, ADDRESS, CTRL_REG1, buffer, 1);
             state = S_START_ALTITUDE;
             break;
         case S_START_ALTITUDE:
             // Start reading first altitude and temperature measurments
         case S_WAIT:
-            // Start reading altitude and temperature measurments
+            // The measurment is ready, start reading altitude and temperature
+            ready_time = millis;
             i2c_read(&i2c_id, ADDRESS, OUT_P_MSB, buffer, 5);
             state = S_READ_ALTITUDE;
             break;
@@ -175,7 +191,8 @@ void mpl3115a2_service(void)
             mpl3115a2_alt_lsb = buffer[2];
             mpl3115a2_temp_msb = buffer[3];
             mpl3115a2_temp_lsb = buffer[4];
-            // Store previous sample
+            // Store previous sample, the time is only updated along with the altitude so that they always match
+            mpl3115a2_sample_time = ready_time;
             mpl3115a2_prev_alt = mpl3115a2_alt;
             // Zero out previous value
             mpl3115a2_alt = 0;
@@ -186,8 +203,13 @@ void mpl3115a2_service(void)
             mpl3115a2_alt >>= 12;
             // OR the fractional part into the altitude value
             mpl3115a2_alt |= (mpl3115a2_alt_lsb >> 4);
-            // Update sample time
-            mpl3115a2_sample_time = millis;
+            // Start the next measurment right away rather than waiting for the auto acquisition period (at least 1s)
+            buffer[0] = CTRL1_MEASURE;
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG1, buffer, 1);
+            state = S_TRIGGER;
+            break;
+        case S_TRIGGER:
+            // Wait for the measurment to be ready
             state = S_WAIT;
             break;
         default:
@@ -195,11 +217,16 @@ void mpl3115a2_service(void)
             state = S_IDLE;
             break;
     }
+    
+    if (state & (1<<STATE_REQ_I2C_DONE)) {
+        // Move on to the next state as soon as the transaction is done
+        i2c_set_callback(i2c_id, i2c_done, NULL);
+    }
 }
 
 uint8_t mpl3115a2_init_done(void)
 {
-    return (state == S_WAIT) || (state == S_READ_ALTITUDE);
+    return (state == S_WAIT) || (state == S_READ_ALTITUDE) || (state == S_TRIGGER);
 }
 
  uint8_t mpl3115a2_init_succesful(void)
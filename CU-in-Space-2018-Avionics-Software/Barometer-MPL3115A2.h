@@ -12,11 +12,12 @@
 #include "global.h"
 
 // MARK: Constants
-#define MPL3115A2_SAMPLE_RATE   5   // The number of times per second that the sensor should be polled
+#define MPL3115A2_SAMPLE_PERIOD 140 // The nominal time between samples in milliseconds, set by the oversample ratio
 
 // MARK: Variables
 /**
- *  The value of the global millis variable when the last sample was recieved from the sensor
+ *  The value of the global millis variable when the sensor signaled that the last sample was ready, 0 if there has not
+ *  been a sample yet
  */
 extern uint32_t mpl3115a2_sample_time;
 
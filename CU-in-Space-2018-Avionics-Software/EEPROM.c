@@ -6,6 +6,7 @@
 //
 
 #include "EEPROM.h"
+#include "deferred.h"
 
 #include <avr/io.h>
 #include <util/atomic.h>
@@ -15,7 +16,6 @@
 #define QUEUE_LENGTH 4  // The number of EEPROM transactions which can be queued
 
 #define ID_INVALID   0  // The transaction ID for an unused transaction
-#define ID_FIRST     1  // The first valid transaction ID
 
 // MARK: Structures
 typedef struct {
@@ -33,6 +33,11 @@ typedef struct {
     /** The number of bytes that have been read or writen*/
     uint8_t position;
     
+    /** The function to be called from the main loop when this transaction is done, or NULL */
+    transaction_callback_t callback;
+    /** The pointer passed to the callback */
+    void *context;
+    
     /** 1 if this is a write transaction */
     uint8_t write:1;
     /** 1 if this transaction is currently in progress */
@@ -47,8 +52,8 @@ static volatile eeprom_transaction_t queue[QUEUE_LENGTH];
 /** The index of the head of the transaction queue */
 static volatile uint8_t queue_head;
 
-/** The transaction id that should be given to the next new transaction */
-static uint8_t next_id = ID_FIRST;
+/** The generation of each slot in the queue, used to create transaction IDs */
+static uint8_t generations[QUEUE_LENGTH];
 
 /**
  *  Starts the next queued transaction if there is one and there is no currently active transaction.
@@ -86,6 +91,9 @@ static inline void start_next_transaction (void) {
                 }
                 t->done = 1;
                 t->active = 0;
+                if (t->callback != NULL) {
+                    defer_callback(t->callback, t->id, t->context);
+                }
                 queue_head = (queue_head + 1) % QUEUE_LENGTH;
             }
             return;
@@ -96,19 +104,20 @@ static inline void start_next_transaction (void) {
 
 void eeprom_service(void)
 {
-    start_next_transaction();
+    // The ISR can finish the transaction at the head of the queue and start the next one while the queue is searched
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_next_transaction();
+    }
 }
 
 /**
- *  Get the first transaction in the queue with the given ID
- *  @param id The transaction ID to search for
+ *  Get the transaction with the given ID
+ *  @param id The transaction ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
  */
 static volatile eeprom_transaction_t *get_transaction_with_id(uint8_t id)
 {
-    for (volatile eeprom_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
-        if (i->id == id) return i;
-    }
-    return NULL;
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
 }
 
 uint8_t eeprom_transaction_done(uint8_t transaction_id)
@@ -117,6 +126,27 @@ uint8_t eeprom_transaction_done(uint8_t transaction_id)
     return (t != NULL) ? (t->done) : 1;
 }
 
+uint8_t eeprom_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        volatile eeprom_transaction_t *t = get_transaction_with_id(transaction_id);
+        if (t != NULL) {
+            if (t->done) {
+                // Reads finish as soon as they are started, so this is the usual case for them
+                ret = defer_callback(callback, transaction_id, context);
+            } else {
+                t->callback = callback;
+                t->context = context;
+                ret = 0;
+            }
+        }
+    }
+    
+    return ret;
+}
+
 uint8_t eeprom_clear_transaction(uint8_t transaction_id)
 {
     volatile eeprom_transaction_t *t = get_transaction_with_id(transaction_id);
@@ -132,12 +162,7 @@ uint8_t eeprom_clear_transaction(uint8_t transaction_id)
  */
 static volatile eeprom_transaction_t *get_next_free_transaction(void)
 {
-    uint8_t i = queue_head;
-    do {
-        if (queue[i].id == ID_INVALID) return queue + i;
-        i = (i + 1) % QUEUE_LENGTH;
-    } while (i != queue_head);
-    return NULL;
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), queue_head);
 }
 
 uint8_t eeprom_write(uint8_t *transaction_id, uint16_t address, uint8_t *buffer, uint8_t length)
@@ -145,9 +170,9 @@ uint8_t eeprom_write(uint8_t *transaction_id, uint16_t address, uint8_t *buffer,
     volatile eeprom_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
 
     t->address = address;
   
@@ -159,6 +184,7 @@ uint8_t eeprom_write(uint8_t *transaction_id, uint16_t address, uint8_t *buffer,
     t->write = 1;
     t->active = 0;
     t->done = 0;
+    t->callback = NULL;
   
     eeprom_service();
     return 0;
@@ -169,9 +195,9 @@ uint8_t eeprom_read(uint8_t *transaction_id, uint16_t address, uint8_t *buffer,
     volatile eeprom_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->address = address;
     
@@ -183,6 +209,7 @@ uint8_t eeprom_read(uint8_t *transaction_id, uint16_t address, uint8_t *buffer,
     t->write = 0;
     t->active = 0;
     t->done = 0;
+    t->callback = NULL;
     
     eeprom_service();
     return 0;
@@ -216,6 +243,9 @@ ISR (EE_READY_vect)
         EECR = 0;   // Disable interupt
         t->done = 1;
         t->active = 0;
+        if (t->callback != NULL) {
+            defer_callback(t->callback, t->id, t->context);
+        }
         queue_head = (queue_head + 1) % QUEUE_LENGTH;
     }
 }
@@ -9,6 +9,7 @@
 #define EEPROM_h
 
 #include "global.h"
+#include "transaction_queue.h"
 
 /**
  *  Code to be run in each itteration of the main loop
@@ -22,6 +23,17 @@ extern void eeprom_service(void);
  */
 extern uint8_t eeprom_transaction_done(uint8_t transaction_id);
 
+/**
+ * Set a function to be called from the main loop when an EEPROM transaction is done
+ * @note If the transaction is already done the callback is queued immediately. The transaction must still be
+ *       cleared, the callback is a good place to do so.
+ * @param transaction_id The identifier for the EEPROM transaction
+ * @param callback The function to be called
+ * @param context A pointer which is passed to the callback
+ * @return 0 if the callback was set
+ */
+extern uint8_t eeprom_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context);
+
 /**
  * Clear an EEPROM transaction
  * @note This function can not clear a transaction if it is active
@@ -103,7 +103,7 @@
 #define CTRL_REG2_CFG_DRDY  3       // If set data ready interupt is routed to the INT1 pin, othewise the INT2 pin
 #define CTRL_REG2_EN_DRDY   2       // If set the data ready interupt is enabled
 #define CTRL_REG2_IPOL      1       // Sets interupt logic polarity: if set active high, otherwise active low
-#define CTRL_REG2_PP_OD     0       // Sets interupt driver configuration, if set push-pull driver
+#define CTRL_REG2_PP_OD     0       // Sets interupt driver configuration: if set open-drain, otherwise push-pull
 
 #define CTRL_REG3           0x15    // Device configuration register 3
 #define CTRL_REG3_WRAPTOONE 3       // If set auto-increment pointer rolls over to 0x01 (OUT_X_MSB), otherwise 0x00 (STATUS)
@@ -8,8 +8,218 @@
 #include "Gyro-FXAS21002C.h"
 #include "Gyro-FXAS21002C-Registers.h"
 
+#include <avr/io.h>
+
+#include "pindefinitions.h"
+#include "I2C.h"
+
+#define WARMUP_TIME 1000
+#define TEMP_PERIOD 1000    // The time between temperature readings in milliseconds
+
+#define SAMPLE_LENGTH   6   // The number of bytes in each sample read from the FIFO
+#define FIFO_LENGTH     32  // The number of samples which the sensor's FIFO can hold
+#define RING_MASK       (FXAS21002C_RING_LENGTH - 1)
+
+// Data rate bits for control register 1
+#if FXAS21002C_DATA_RATE == 800
+#define CTRL1_DATA_RATE 0
+#elif FXAS21002C_DATA_RATE == 400
+#define CTRL1_DATA_RATE (1<<CTRL_REG1_DR0)
+#elif FXAS21002C_DATA_RATE == 200
+#define CTRL1_DATA_RATE (1<<CTRL_REG1_DR1)
+#elif FXAS21002C_DATA_RATE == 100
+#define CTRL1_DATA_RATE ((1<<CTRL_REG1_DR1) | (1<<CTRL_REG1_DR0))
+#elif FXAS21002C_DATA_RATE == 50
+#define CTRL1_DATA_RATE (1<<CTRL_REG1_DR2)
+#elif FXAS21002C_DATA_RATE == 25
+#define CTRL1_DATA_RATE ((1<<CTRL_REG1_DR2) | (1<<CTRL_REG1_DR0))
+#else
+#error "Invalid FXAS21002C_DATA_RATE"
+#endif
+
+// MARK: States
+#define STATE_REQ_INTERUPT          6
+#define STATE_REQ_I2C_DONE          5
+
+#define S_IDLE              0
+#define S_WARMUP            1
+#define S_WRITE_CTRL0       ((1<<STATE_REQ_I2C_DONE) | 2)
+#define S_WRITE_CTRL2       ((1<<STATE_REQ_I2C_DONE) | 3)
+#define S_WRITE_CTRL3       ((1<<STATE_REQ_I2C_DONE) | 4)
+#define S_WRITE_F_SETUP     ((1<<STATE_REQ_I2C_DONE) | 5)
+#define S_WRITE_CTRL1       ((1<<STATE_REQ_I2C_DONE) | 6)
+#define S_WAIT              ((1<<STATE_REQ_INTERUPT) | 7)
+#define S_READ_STATUS       ((1<<STATE_REQ_I2C_DONE) | 8)
+#define S_READ_FIFO         ((1<<STATE_REQ_I2C_DONE) | 9)
+#define S_READ_TEMP         ((1<<STATE_REQ_I2C_DONE) | 10)
+
+// MARK: Variables
+struct fxas21002c_sample fxas21002c_samples[FXAS21002C_RING_LENGTH];
+uint16_t fxas21002c_sample_count;
+
 uint32_t fxas21002c_sample_time;
 int16_t fxas21002c_pitch_rate;
 int16_t fxas21002c_roll_rate;
 int16_t fxas21002c_yaw_rate;
 int8_t fxas21002c_temp;
+
+/** The current state of the sensor FSM */
+static uint8_t state = S_IDLE;
+/** The buffer used to read and write from the sensor, large enough for the contents of a full FIFO */
+static uint8_t buffer[FIFO_LENGTH * SAMPLE_LENGTH];
+/** The i2c transaction ID of the transaction used by the sensor */
+static uint8_t i2c_id;
+/** The number of samples being read from the FIFO, from F_CNT in F_STATUS */
+static uint8_t burst_length;
+/** The value of millis when F_STATUS was read for the current burst, the last sample in the burst was taken then */
+static uint32_t burst_time;
+/** The value of millis when the temperature was last read */
+static uint32_t temp_time;
+
+// MARK: Functions
+uint8_t init_fxas21002c(void)
+{
+    if (state != S_IDLE) {
+        return 1;
+    }
+    
+    state = S_WARMUP;
+    return 0;
+}
+
+/**
+ *  Move the samples from a completed burst read into the ring buffer
+ */
+static void store_burst(void)
+{
+    uint8_t *data = buffer;
+    for (uint8_t i = 0; i < burst_length; i++) {
+        struct fxas21002c_sample *sample = fxas21002c_samples + (fxas21002c_sample_count & RING_MASK);
+        // Samples are big endian, X->Roll, Y->Pitch, Z->Yaw
+        sample->roll = (data[0] << 8) | data[1];
+        sample->pitch = (data[2] << 8) | data[3];
+        sample->yaw = (data[4] << 8) | data[5];
+        sample->time = burst_time - ((uint16_t)(burst_length - 1 - i) * 1000 / FXAS21002C_DATA_RATE);
+        
+        fxas21002c_sample_count++;
+        data += SAMPLE_LENGTH;
+    }
+    
+    struct fxas21002c_sample *latest = fxas21002c_samples + ((fxas21002c_sample_count - 1) & RING_MASK);
+    fxas21002c_pitch_rate = latest->pitch;
+    fxas21002c_roll_rate = latest->roll;
+    fxas21002c_yaw_rate = latest->yaw;
+    fxas21002c_sample_time = millis;
+}
+
+void fxas21002c_service(void)
+{
+    // Return if the current state is not finished
+    if ((state == S_IDLE) ||
+        ((state == S_WARMUP) && (millis < WARMUP_TIME)) ||
+        ((state & (1<<STATE_REQ_INTERUPT)) && !(GYRO_INT_PIN & (1<<GYRO_INT_NUM)) &&
+         ((millis - temp_time) < TEMP_PERIOD))) {
+        return;
+    } else if ((state & (1<<STATE_REQ_I2C_DONE))) {
+        if (!i2c_transaction_done(i2c_id)) return;  // Do not continue if the I2C transaction is not yet finished
+        
+        uint8_t success = i2c_transaction_successful(i2c_id);
+        i2c_clear_transaction(i2c_id);
+        
+        if ((state != S_READ_STATUS) && (state != S_READ_FIFO) && (state != S_READ_TEMP) && !success) {
+            // If we are in the init process and a transaction fails we jump back to the idle state.
+            state = S_IDLE;
+            return;
+        } else if (!success) {
+            // If a transaction fails after initilization we go back to waiting for the sensor.
+            state = S_WAIT;
+            return;
+        }
+    }
+    
+    // Start the next state
+    switch (state) {
+        case S_WARMUP:
+            // Set full scale range to 2000º/s in control register 0
+            buffer[0] = 0;
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG0, buffer, 1);
+            state = S_WRITE_CTRL0;
+            break;
+        case S_WRITE_CTRL0:
+            // Enable the FIFO interupt on INT1, active high and push-pull in control register 2
+            buffer[0] = (1<<CTRL_REG2_CFG_FIFO) | (1<<CTRL_REG2_EN_FIFO) | (1<<CTRL_REG2_IPOL);
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG2, buffer, 1);
+            state = S_WRITE_CTRL2;
+            break;
+        case S_WRITE_CTRL2:
+            // Have burst reads wrap from OUT_Z_LSB to OUT_X_MSB so that many FIFO samples can be read at once
+            buffer[0] = (1<<CTRL_REG3_WRAPTOONE);
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG3, buffer, 1);
+            state = S_WRITE_CTRL3;
+            break;
+        case S_WRITE_CTRL3:
+            // Put the FIFO in circular mode with the watermark set
+            buffer[0] = (1<<F_SETUP_F_MODE0) | FXAS21002C_FIFO_WATERMARK;
+            i2c_write(&i2c_id, ADDRESS, F_SETUP, buffer, 1);
+            state = S_WRITE_F_SETUP;
+            break;
+        case S_WRITE_F_SETUP:
+            // Set the data rate and switch to active mode in control register 1
+            buffer[0] = CTRL1_DATA_RATE | (1<<CTRL_REG1_ACTIVE);
+            i2c_write(&i2c_id, ADDRESS, CTRL_REG1, buffer, 1);
+            state = S_WRITE_CTRL1;
+            break;
+        case S_WRITE_CTRL1:
+            // Wait for the FIFO to reach the watermark
+            state = S_WAIT;
+            break;
+        case S_WAIT:
+            if (GYRO_INT_PIN & (1<<GYRO_INT_NUM)) {
+                // Read F_STATUS to find how many samples are in the FIFO
+                burst_time = millis;
+                i2c_read(&i2c_id, ADDRESS, F_STATUS, buffer, 1);
+                state = S_READ_STATUS;
+            } else {
+                // Read temperature
+                temp_time = millis;
+                i2c_read(&i2c_id, ADDRESS, TEMP, buffer, 1);
+                state = S_READ_TEMP;
+            }
+            break;
+        case S_READ_STATUS:
+            // Drain every sample in the FIFO in one burst, not just the watermark, so that it can not overflow while
+            // other I2C transactions delay the next burst
+            burst_length = buffer[0] & F_STATUS_F_CNT_MASK;
+            if (burst_length > FIFO_LENGTH) {
+                burst_length = FIFO_LENGTH;
+            } else if (burst_length == 0) {
+                state = S_WAIT;
+                break;
+            }
+            i2c_read(&i2c_id, ADDRESS, OUT_X_MSB, buffer, burst_length * SAMPLE_LENGTH);
+            state = S_READ_FIFO;
+            break;
+        case S_READ_FIFO:
+            store_burst();
+            state = S_WAIT;
+            break;
+        case S_READ_TEMP:
+            fxas21002c_temp = (int8_t)buffer[0];
+            state = S_WAIT;
+            break;
+        default:
+            // We should never reach here
+            state = S_IDLE;
+            break;
+    }
+}
+
+uint8_t fxas21002c_init_done(void)
+{
+    return (state == S_WAIT) || (state == S_READ_STATUS) || (state == S_READ_FIFO) || (state == S_READ_TEMP);
+}
+
+uint8_t fxas21002c_init_succesful(void)
+{
+    return state != S_IDLE;
+}
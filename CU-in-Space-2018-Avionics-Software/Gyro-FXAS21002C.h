@@ -15,24 +15,52 @@
 #include "global.h"
 
 // MARK: Constants
-#define FXAS21002C_SAMPLE_RATE   5   // The number of times per second that the sensor should be polled
+#define FXAS21002C_DATA_RATE        200 // The output data rate in Hz (800, 400, 200, 100, 50 or 25)
+#define FXAS21002C_FIFO_WATERMARK   16  // The number of samples in the sensor's FIFO at which it is drained
+#define FXAS21002C_RING_LENGTH      64  // The number of samples kept in the ring buffer (must be a power of two)
+
+// MARK: Types
+/**
+ *  A single angular rate sample
+ */
+struct fxas21002c_sample {
+    /** The estimated value of millis when the sample was taken */
+    uint32_t time;
+    /** The pitch rate (y axis) in 1/16 º/s per least signifigant bit */
+    int16_t pitch;
+    /** The roll rate (x axis) in 1/16 º/s per least signifigant bit */
+    int16_t roll;
+    /** The yaw rate (z axis) in 1/16 º/s per least signifigant bit */
+    int16_t yaw;
+};
 
 // MARK: Variables
+/**
+ *  The most recent samples recieved from the sensor, oldest samples are overwritten when the buffer is full
+ */
+extern struct fxas21002c_sample fxas21002c_samples[FXAS21002C_RING_LENGTH];
+
+/**
+ *  The total number of samples which have been placed in the ring buffer, wraps around on overflow
+ *  @note The most recent sample is at index (fxas21002c_sample_count - 1) % FXAS21002C_RING_LENGTH
+ */
+extern uint16_t fxas21002c_sample_count;
+
 /**
  *  The value of the global millis variable when the last sample was recieved from the sensor
  */
 extern uint32_t fxas21002c_sample_time;
 
 /**
- *  The pitch rate as recieved from the sensor
+ *  The pitch rate from the most recent sample
  */
 extern int16_t fxas21002c_pitch_rate;
 /**
- *  The roll rate as recieved from the sensor
+ *  The roll rate from the most recent sample
  */
 extern int16_t fxas21002c_roll_rate;
 /**
- *  The yaw rate as recieved from the sensor
+ *  The yaw rate from the most recent sample
  */
 extern int16_t fxas21002c_yaw_rate;
 
@@ -53,4 +81,16 @@ extern uint8_t init_fxas21002c(void);
  */
 extern void fxas21002c_service(void);
 
+/**
+ *  Determine if the initilization process for the gyroscope is complete
+ *  @return 0 if the inititilization process is not yet complete
+ */
+extern uint8_t fxas21002c_init_done(void);
+
+/**
+ *  Determine if the initilization process for the gyroscope completed without error
+ *  @return 0 if the inititilization process failed
+ */
+extern uint8_t fxas21002c_init_succesful(void);
+
 #endif /* Gyro_FXAS21002C_h */
@@ -5,10 +5,12 @@
 //
 
 #include "I2C.h"
+#include "deferred.h"
 
 #include <stddef.h> //NULL
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <util/twi.h>
 
 #include "pindefinitions.h"
@@ -19,7 +21,6 @@
 #define QUEUE_LENGTH    10  // The number of SPI transactions which can be queued
 
 #define ID_INVALID      0   // The transaction ID for an unused transaction
-#define ID_FIRST        1   // The first valid transaction ID
 
 // MARK: Type Definitions
 typedef struct {
@@ -41,6 +42,11 @@ typedef struct {
     /** The number of retries which have occured*/
     uint8_t errors;
     
+    /** The function to be called from the main loop when this transaction is done, or NULL*/
+    transaction_callback_t callback;
+    /** The pointer passed to the callback*/
+    void *context;
+    
     /** 1 if this is a write transaction*/
     uint8_t write:1;
     /** 1 if this transaction is currently in progress*/
@@ -57,8 +63,8 @@ static volatile i2c_transaction_t queue[QUEUE_LENGTH];
 /** The index of the head of the transaction queue */
 static volatile uint8_t queue_head;
 
-/** The transaction id that should be given to the next new transaction */
-static uint8_t next_id = ID_FIRST;
+/** The generation of each slot in the queue, used to create transaction IDs */
+static uint8_t generations[QUEUE_LENGTH];
 
 // MARK: Function Definitions
 void init_i2c(void)
@@ -91,19 +97,20 @@ static inline void start_next_transaction (void) {
 
 void i2c_service(void)
 {
-    start_next_transaction();
+    // The ISR can finish the transaction at the head of the queue and start the next one while the queue is searched
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_next_transaction();
+    }
 }
 
 /**
- *  Get the first transaction in the queue with the given ID
- *  @param id The transaction ID to search for
+ *  Get the transaction with the given ID
+ *  @param id The transaction ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
  */
 static volatile i2c_transaction_t *get_transaction_with_id(uint8_t id)
 {
-    for (volatile i2c_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
-        if (i->id == id) return i;
-    }
-    return NULL;
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
 }
 
 uint8_t i2c_transaction_done(uint8_t transaction_id)
@@ -118,6 +125,27 @@ uint8_t i2c_transaction_successful(uint8_t transaction_id)
     return (t != NULL) ? (t->errors < I2C_MAX_ERRORS) : 1;
 }
 
+uint8_t i2c_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        volatile i2c_transaction_t *t = get_transaction_with_id(transaction_id);
+        if (t != NULL) {
+            if (t->done) {
+                // The transaction finished before the callback was set
+                ret = defer_callback(callback, transaction_id, context);
+            } else {
+                t->callback = callback;
+                t->context = context;
+                ret = 0;
+            }
+        }
+    }
+    
+    return ret;
+}
+
 uint8_t i2c_clear_transaction(uint8_t transaction_id)
 {
     volatile i2c_transaction_t *t = get_transaction_with_id(transaction_id);
@@ -133,12 +161,7 @@ uint8_t i2c_clear_transaction(uint8_t transaction_id)
  */
 static volatile i2c_transaction_t *get_next_free_transaction(void)
 {
-    uint8_t i = queue_head;
-    do {
-        if (queue[i].id == ID_INVALID) return queue + i;
-        i = (i + 1) % QUEUE_LENGTH;
-    } while (i != queue_head);
-    return NULL;
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), queue_head);
 }
 
 uint8_t i2c_write(uint8_t *transaction_id, uint8_t address, uint8_t reg, uint8_t *data, uint8_t length)
@@ -146,9 +169,9 @@ uint8_t i2c_write(uint8_t *transaction_id, uint8_t address, uint8_t reg, uint8_t
     volatile i2c_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->address = address << 1;
     t->reg = reg;
@@ -163,6 +186,7 @@ uint8_t i2c_write(uint8_t *transaction_id, uint8_t address, uint8_t reg, uint8_t
     t->active = 0;
     t->done_reg = 0;
     t->done = 0;
+    t->callback = NULL;
     
     i2c_service();
     return 0;
@@ -173,9 +197,9 @@ uint8_t i2c_read(uint8_t *transaction_id, uint8_t address, uint8_t reg, uint8_t
     volatile i2c_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->address = address << 1;
     t->reg = reg;
@@ -190,6 +214,7 @@ uint8_t i2c_read(uint8_t *transaction_id, uint8_t address, uint8_t reg, uint8_t
     t->active = 0;
     t->done_reg = 0;
     t->done = 0;
+    t->callback = NULL;
     
     i2c_service();
     return 0;
@@ -273,6 +298,9 @@ wrap_up:
     // Set flags and start next transaction if applicable
     t->done = 1;
     t->active = 0;
+    if (t->callback != NULL) {
+        defer_callback(t->callback, t->id, t->context);
+    }
     queue_head = (queue_head + 1) % QUEUE_LENGTH;
     start_next_transaction();
 }
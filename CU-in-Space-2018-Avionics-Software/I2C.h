@@ -9,6 +9,7 @@
 #define I2C_h
 
 #include "global.h"
+#include "transaction_queue.h"
 
 /**
  *  Initialize the TWI interface in fast mode (400kHz)
@@ -34,6 +35,17 @@ extern uint8_t i2c_transaction_done(uint8_t transaction_id);
  */
 extern uint8_t i2c_transaction_successful(uint8_t transaction_id);
 
+/**
+ *  Set a function to be called from the main loop when a transaction is done
+ *  @note If the transaction is already done the callback is queued immediately. The transaction must still be
+ *        cleared, the callback is a good place to do so.
+ *  @param transaction_id The transaction for which the callback is set
+ *  @param callback The function to be called
+ *  @param context A pointer which is passed to the callback
+ *  @return Zero if the callback was set
+ */
+extern uint8_t i2c_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context);
+
 /**
  *  Clear a transaction from the queue
  *  @note This function will not clear the transaction if it is active
@@ -24,8 +24,8 @@ void radio_service(void) {
     uint8_t transaction_id; //Dunno how these really work.
     uint8_t in_buffer[256];
     
-    if(RADIO_ATTN_PORT & (1 << RADIO_ATTN_NUM)) {
-        spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, 0, 0, in_buffer, RADIO_ATTN_NUM);
+    if(!(RADIO_ATTN_PIN & (1 << RADIO_ATTN_NUM))) {
+        spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, 0, 0, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
         
         uint8_t *in_buffer_pointer;
         in_buffer_pointer = &in_buffer[0];
@@ -69,7 +69,7 @@ void at_command(uint8_t frame_id, uint8_t length_msb, uint8_t length_lsb, uint8_
    // uint8_t checksum = 0xff - AT_COMMAND + frame_id + length_msb + length_lsb + command1 + command2 + parameter; old code
    //uint8_t api_packet[9] = {0x78, length_msb, length_lsb, AT_COMMAND, frame_id, command1, command2, parameter, checksum_value};
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_packet,9, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_packet,9, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
     
     //while (!spi_transaction_done(transaction_id))
 }
@@ -88,7 +88,7 @@ void at_queue_command(uint8_t frame_id, uint8_t length_msb, uint8_t length_lsb,
     // uint8_t checksum = 0xff - QUEUE_PARAMETER + frame_id + length_msb + length_lsb + command1 + command2 + parameter; old code
     //uint8_t api_queue_packet[9] = {0x78, length_msb, length_lsb, QUEUE_PARAMETER, frame_id, command1, command2, parameter, checksum};
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_queue_packet,9, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_queue_packet,9, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
     
 }
 
@@ -119,7 +119,7 @@ void transmit_request(uint8_t length_msb, uint8_t length_lsb, uint8_t frame_id,
        send out the packet
      */
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_transmit_packet, new_size, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_transmit_packet, new_size, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
     
 }
 
@@ -146,7 +146,7 @@ void explicit_zigbee_transmit_request(uint8_t length_msb, uint8_t length_lsb, ui
     checksum(api_explicit_transmit_packet_pointer, new_size);
     api_explicit_transmit_packet[new_size - 1] = checksum_value;
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_explicit_transmit_packet, new_size, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, api_explicit_transmit_packet, new_size, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
 
 }
 
@@ -158,7 +158,7 @@ void create_source_route(uint8_t length_msb, uint8_t length_lsb, uint8_t frame_i
     uint8_t checksum = 0xff - CREATE_SOURCE_ROUTE + frame_id + length_msb + length_lsb + address_16_1 + address_16_2 + address_64_1 + address_64_2 + address_64_3 + address_64_4 + address_64_5 + address_64_6 + address_64_7 + address_64_8 + address_amount + address_1_msb + address_1_lsb + address_2_msb + address_2_lsb + address_3_msb + address_3_lsb;
     uint8_t source_route_packet[23] = {0x78, length_msb, length_lsb, CREATE_SOURCE_ROUTE, frame_id, address_64_1, address_64_2, address_64_3, address_64_4, address_64_5, address_64_6, address_64_7, address_64_8, address_16_1, address_16_2, address_amount, address_1_msb, address_1_lsb, address_2_msb, address_2_lsb, address_3_msb, address_3_lsb, checksum};
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, source_route_packet, 23, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, source_route_packet, 23, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
 }
 
 
@@ -171,7 +171,7 @@ void remote_at_command_request(uint8_t length_msb, uint8_t length_lsb, uint8_t f
     
     uint8_t remote_at_command_packet[21] = {0x78, length_msb, length_lsb, REMOTE_COMMAND_REQEUEST, frame_id, address_64_1, address_64_2, address_64_3, address_64_4, address_64_5, address_64_6, address_64_7, address_64_8, address_16_1, address_16_2, remote_options, command1, command2, parameter, checksum};
     
-    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, remote_at_command_packet, 21, in_buffer, RADIO_ATTN_NUM);
+    spi_start_full_duplex(&transaction_id, RADIO_CS_NUM, remote_at_command_packet, 21, in_buffer, sizeof(in_buffer), RADIO_ATTN_NUM);
 
 }
 
@@ -6,16 +6,19 @@
 //
 
 #include "SPI.h"
+#include "deferred.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <string.h>
 
 // MARK: Constants
 #define QUEUE_LENGTH 8  // The number of SPI transactions which can be queued
 
 #define ID_INVALID 0    // The transaction ID for an unused transaction
-#define ID_FIRST 1      // The first valid transaction ID
+
+#define CS_NONE 0xFF    // The value of held_cs when no chip select pin is being held
 
 // MARK: Structures
 typedef struct {
@@ -28,22 +31,37 @@ typedef struct {
     uint8_t attn_num;
     
     /** Number of bytes to be sent*/
-    uint8_t out_length;
+    uint16_t out_length;
     /** The buffer from which data is sent */
     uint8_t *out_buffer;
     /** The number of bytes to be recieved */
-    uint8_t in_length;
+    uint16_t in_length;
     /** The buffer in which recieved data is placed */
     uint8_t *in_buffer;
     
     /** The number of bytes that have been sent */
-    uint8_t bytes_out;
+    uint16_t bytes_out;
     /** The number of bytes that have been received */
-    uint8_t bytes_in;
+    uint16_t bytes_in;
+    
+    /** The segment of a chained transaction which is being performed, NULL if this is not a chained transaction */
+    struct spi_segment *segment;
+    /** The number of times the current segment has been repeated */
+    uint8_t repeats;
+    
+#ifdef ENABLE_PROFILING
+    /** The timestamp at which this transaction was queued, replaced with its queueing delay once it is started */
+    uint32_t queued_time;
+#endif
+    
+    /** The function to be called from the main loop when this transaction is done, or NULL */
+    transaction_callback_t callback;
+    /** The pointer passed to the callback */
+    void *context;
 
     /** 1 if this transaction uses the attention pin to send and recieve data in full duplex */
     uint8_t full_duplex: 1;
-    /** The state of the attention pin the last time the interupt ran */
+    /** 1 if the attention pin was asserted when the last byte was started */
     uint8_t last_attn: 1;
     /** 1 if this transaction is currently in progress */
     uint8_t active: 1;
@@ -51,27 +69,56 @@ typedef struct {
     uint8_t done_out: 1;
     /** 1 if this transaction is complete */
     uint8_t done: 1;
+    /** 1 if the chip select pin should be left asserted when this transaction is complete */
+    uint8_t hold: 1;
+    /** The priority class of this transaction */
+    uint8_t priority: 2;
 } spi_transaction_t;
 
 // MARK: Variables
 /** The port on which the SPI pins are located */
 static volatile uint8_t *port;
+/** The input register for the same port */
+static volatile uint8_t *pin;
 
 /** The transaction queue */
 static volatile spi_transaction_t queue[QUEUE_LENGTH];
 /** The index of the head of the transaction queue */
 static volatile uint8_t queue_head;
 
-/** The transaction id that should be given to the next new transaction */
-static uint8_t next_id = ID_FIRST;
+/** The generation of each slot in the queue, used to create transaction IDs */
+static uint8_t generations[QUEUE_LENGTH];
+
+/** The chip select pin which was left asserted by the last transaction, or CS_NONE */
+static volatile uint8_t held_cs = CS_NONE;
+
+#ifdef ENABLE_PROFILING
+struct profiling_stats spi_queue_delay[SPI_NUM_PRIORITIES];
+#endif
 
 // MARK: Functions
-void init_spi(volatile uint8_t *spi_port)
+void init_spi(volatile uint8_t *spi_port, volatile uint8_t *spi_pin)
 {
     port = spi_port;
+    pin = spi_pin;
     SPCR |= (1<<SPIE)|(1<<SPE)|(1<<MSTR);  // Enable SPI interface in master mode with interupts
 }
 
+/**
+ *  Send the first byte of a transaction, or of the current segment of a chained transaction
+ */
+static inline void send_first_byte (volatile spi_transaction_t *t)
+{
+    if (t->out_length > 0) {
+        t->bytes_out = 1;
+        SPDR = t->out_buffer[0];
+    } else {
+        // Send dummy byte, for half duplex transactions the byte recieved in exchange is the first input byte
+        t->done_out = !t->full_duplex;
+        SPDR = 0;
+    }
+}
+
 /**
  *  Starts the next queued transaction if there is one and there is no currently active transaction.
  *  This function is inline so that is can be safely called from an ISR
@@ -79,43 +126,52 @@ void init_spi(volatile uint8_t *spi_port)
 static inline void start_next_transaction (void) {
     if (queue[queue_head].active) return;
     
+    // Find the first pending transaction in the highest priority class, searching from the head of the queue so that
+    // transactions in the same class are started in turn
+    uint8_t next = QUEUE_LENGTH;
     uint8_t i = queue_head;
     do {
-        if ((queue[i].id != ID_INVALID) && !queue[i].active && !queue[i].done) {
-            queue_head = i;
-            // Start transaction
-            queue[i].active = 1;
-            
-            *port &= ~(1<<queue[i].cs_num); // Assert CS pin
-            if (queue[i].out_length > 0) {
-                // Send first byte
-                queue[i].bytes_out = 1;
-                SPDR = queue[i].out_buffer[0];
-            } else {
-                // Send dummy byte
-                SPDR = 0;
-            }
-            return;
+        if ((queue[i].id != ID_INVALID) && !queue[i].active && !queue[i].done &&
+            ((held_cs == CS_NONE) || (queue[i].cs_num == held_cs)) &&
+            ((next == QUEUE_LENGTH) || (queue[i].priority < queue[next].priority))) {
+            next = i;
+            if (queue[i].priority == SPI_PRIORITY_CRITICAL) break;
         }
         i = (i + 1) % QUEUE_LENGTH;
     } while (i != queue_head);
+    
+    if (next == QUEUE_LENGTH) return;
+    
+    volatile spi_transaction_t *t = queue + next;
+    queue_head = next;
+    // Start transaction
+    t->active = 1;
+#ifdef ENABLE_PROFILING
+    t->queued_time = profiling_timestamp() - t->queued_time;
+#endif
+    
+    *port &= ~(1<<t->cs_num); // Assert CS pin
+    // Bytes are only valid if the attention pin (active low) was asserted before they were clocked
+    t->last_attn = t->full_duplex && !(*pin & (1 << t->attn_num));
+    send_first_byte(t);
 }
 
 void spi_service(void)
 {
-    start_next_transaction();
+    // The ISR can finish the transaction at the head of the queue and start the next one while the queue is searched
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_next_transaction();
+    }
 }
 
 /**
- *  Get the first transaction in the queue with the given ID
- *  @param id The transaction ID to search for
+ *  Get the transaction with the given ID
+ *  @param id The transaction ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
  */
 static volatile spi_transaction_t *get_transaction_with_id(uint8_t id)
 {
-    for (volatile spi_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
-        if (i->id == id) return i;
-    }
-    return NULL;
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
 }
 
 uint8_t spi_transaction_done(uint8_t transaction_id)
@@ -124,6 +180,55 @@ uint8_t spi_transaction_done(uint8_t transaction_id)
     return (t != NULL) ? (t->done) : 0;
 }
 
+uint8_t spi_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        volatile spi_transaction_t *t = get_transaction_with_id(transaction_id);
+        if (t != NULL) {
+            if (t->done) {
+                // The transaction finished before the callback was set
+                ret = defer_callback(callback, transaction_id, context);
+            } else {
+                t->callback = callback;
+                t->context = context;
+                ret = 0;
+            }
+        }
+    }
+    
+    return ret;
+}
+
+uint8_t spi_set_priority(uint8_t transaction_id, spi_priority_t priority)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        volatile spi_transaction_t *t = get_transaction_with_id(transaction_id);
+        if ((t != NULL) && !t->done) {
+            t->priority = priority;
+            ret = 0;
+        }
+    }
+    
+    return ret;
+}
+
+void spi_reset_queue_delay(void)
+{
+#ifdef ENABLE_PROFILING
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+            spi_queue_delay[i].calls = 0;
+            spi_queue_delay[i].total = 0;
+            spi_queue_delay[i].max = 0;
+        }
+    }
+#endif
+}
+
 uint8_t spi_clear_transaction(uint8_t transaction_id)
 {
     volatile spi_transaction_t *t = get_transaction_with_id(transaction_id);
@@ -134,28 +239,58 @@ uint8_t spi_clear_transaction(uint8_t transaction_id)
     return 1;
 }
 
+uint8_t spi_release_cs(uint8_t cs_num)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if ((held_cs == cs_num) && !queue[queue_head].active) {
+            *port |= (1<<cs_num); // De-assert CS pin
+            held_cs = CS_NONE;
+            ret = 0;
+        }
+    }
+    
+    if (!ret) {
+        // Transactions with other peripherals may have been waiting for the pin to be released
+        spi_service();
+    }
+    return ret;
+}
+
 /**
  *  Get the next transaction slot which is not currently in use
  */
 static volatile spi_transaction_t *get_next_free_transaction(void)
 {
-    uint8_t i = queue_head;
-    do {
-        if (queue[i].id == ID_INVALID) return queue + i;
-        i = (i + 1) % QUEUE_LENGTH;
-    } while (i != queue_head);
-    return NULL;
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), queue_head);
 }
 
-uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint8_t out_length,
-                              uint8_t * in_buffer, uint8_t in_length)
+/**
+ *  Put a new transaction in the default priority class and note when it was queued
+ */
+static void init_priority(volatile spi_transaction_t *t)
+{
+    t->priority = SPI_PRIORITY_NORMAL;
+#ifdef ENABLE_PROFILING
+    t->queued_time = profiling_timestamp();
+#endif
+}
+
+/**
+ *  Add a half duplex transaction to the queue
+ *  @param hold 1 if the chip select pin should be left asserted when the transaction is complete
+ */
+static uint8_t start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                                 uint8_t * in_buffer, uint16_t in_length, uint8_t hold)
 {
     volatile spi_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    init_priority(t);
     
     t->bytes_out = 0;
     t->bytes_in = 0;
@@ -164,6 +299,9 @@ uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *
     t->active = 0;
     t->done_out = 0;
     t->done = 0;
+    t->hold = hold;
+    t->callback = NULL;
+    t->segment = NULL;
     
     t->cs_num = cs_num;
     t->attn_num = 0;
@@ -176,15 +314,33 @@ uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *
     return 0;
 }
 
-uint8_t spi_start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint8_t out_length,
-                              uint8_t * in_buffer, uint8_t attn_num)
+uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                              uint8_t * in_buffer, uint16_t in_length)
+{
+    return start_half_duplex(transaction_id, cs_num, out_buffer, out_length, in_buffer, in_length, 0);
+}
+
+uint8_t spi_start_half_duplex_held(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                                   uint8_t * in_buffer, uint16_t in_length)
+{
+    return start_half_duplex(transaction_id, cs_num, out_buffer, out_length, in_buffer, in_length, 1);
+}
+
+/**
+ *  Add a full duplex transaction to the queue
+ *  @param segment The first segment of the data to be sent, or NULL if all of the data is in out_buffer
+ */
+static uint8_t start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                                 uint8_t * in_buffer, uint16_t in_length, uint8_t attn_num,
+                                 struct spi_segment *segment)
 {
     volatile spi_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    init_priority(t);
     
     t->bytes_out = 0;
     t->bytes_in = 0;
@@ -193,46 +349,160 @@ uint8_t spi_start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *
     t->active = 0;
     t->done_out = 0;
     t->done = 0;
+    t->hold = 0;
+    t->callback = NULL;
+    t->segment = segment;
     
     t->cs_num = cs_num;
     t->attn_num = attn_num;
     t->out_buffer = out_buffer;
     t->out_length = out_length;
     t->in_buffer = in_buffer;
-    t->in_length = 0;
+    t->in_length = in_length;
+    
+    spi_service();
+    return 0;
+}
+
+uint8_t spi_start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                              uint8_t * in_buffer, uint16_t in_length, uint8_t attn_num)
+{
+    return start_full_duplex(transaction_id, cs_num, out_buffer, out_length, in_buffer, in_length, attn_num, NULL);
+}
+
+uint8_t spi_start_full_duplex_chain(uint8_t *transaction_id, uint8_t cs_num, struct spi_segment *first,
+                                    uint8_t *in_buffer, uint16_t in_length, uint8_t attn_num)
+{
+    return start_full_duplex(transaction_id, cs_num, first->out_buffer, first->out_length, in_buffer, in_length,
+                             attn_num, first);
+}
+
+/**
+ *  Load the buffers and lengths for a segment of a chained transaction
+ */
+static inline void load_segment (volatile spi_transaction_t *t, struct spi_segment *segment)
+{
+    t->segment = segment;
+    t->out_buffer = segment->out_buffer;
+    t->out_length = segment->out_length;
+    t->in_buffer = segment->in_buffer;
+    t->in_length = segment->in_length;
+    t->bytes_out = 0;
+    t->bytes_in = 0;
+    t->done_out = 0;
+}
+
+uint8_t spi_start_chain(uint8_t *transaction_id, uint8_t cs_num, struct spi_segment *first)
+{
+    volatile spi_transaction_t *t = get_next_free_transaction();
+    if (t == NULL) return 1;
+    
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    init_priority(t);
+    
+    t->full_duplex = 0;
+    t->last_attn = 0;
+    t->active = 0;
+    t->done = 0;
+    t->hold = 0;
+    t->callback = NULL;
+    
+    t->cs_num = cs_num;
+    t->attn_num = 0;
+    t->repeats = 0;
+    load_segment(t, first);
     
     spi_service();
     return 0;
 }
 
+/**
+ *  Move on to the next step of a chained transaction when a segment is finished
+ *  @return 1 if another segment was started, 0 if the chain is done
+ */
+static inline uint8_t start_next_segment (volatile spi_transaction_t *t)
+{
+    struct spi_segment *segment = t->segment;
+    
+    if (segment->repeat_mask && (t->in_buffer[t->in_length - 1] & segment->repeat_mask)) {
+        // The peripheral is not ready, poll it again or give up on the rest of the chain
+        if (t->repeats == SPI_MAX_REPEATS) return 0;
+        t->repeats++;
+        load_segment(t, segment);
+    } else if (segment->next != NULL) {
+        t->repeats = 0;
+        load_segment(t, segment->next);
+    } else {
+        return 0;
+    }
+    
+    if (!segment->hold_cs) {
+        // Pulse CS so that the peripheral treats the next segment as a new command
+        *port |= (1<<t->cs_num);
+        *port &= ~(1<<t->cs_num);
+    }
+    send_first_byte(t);
+    return 1;
+}
+
 // MARK: Interupt service routines
 ISR (SPI_STC_vect)
 {
     volatile spi_transaction_t *t = queue + queue_head;
+    // The attention pin is active low
+    uint8_t attn = t->full_duplex && !(*pin & (1 << t->attn_num));
     
     // Read
     if (!t->full_duplex && (t->done_out) && (t->bytes_in < t->in_length)) {
         // A byte should be recieved (half duplex)
         t->in_buffer[t->bytes_in++] = SPDR;
-    } else if (t->full_duplex && (t->last_attn || (*port & (1 << t->attn_num)))) {
+    } else if (t->full_duplex && t->last_attn && (t->bytes_in < t->in_length)) {
         // A byte should be recieved (full duplex)
         t->in_buffer[t->bytes_in++] = SPDR;
     }
-    t->last_attn = (*port & (1 << t->attn_num));
+    t->last_attn = attn;
     
     // Write
     if (t->bytes_out < t->out_length) {
         // A byte should be sent
         SPDR = t->out_buffer[t->bytes_out++];
-    } else if ((t->full_duplex && t->last_attn) || (!t->full_duplex && (t->bytes_in < t->in_length))) {
-        // Send dummy byte
+    } else if (t->full_duplex && (t->segment != NULL) && (t->segment->next != NULL)) {
+        // Send the first byte of the next piece of data (full duplex chain)
+        t->segment = t->segment->next;
+        t->out_buffer = t->segment->out_buffer;
+        t->out_length = t->segment->out_length;
+        t->bytes_out = 1;
+        SPDR = t->out_buffer[0];
+    } else if ((t->bytes_in < t->in_length) && (!t->full_duplex || t->last_attn)) {
+        // Send dummy byte, a full duplex transaction stops receiving once its buffer is full
         SPDR = 0;
         t->done_out = 1;
+    } else if (!t->full_duplex && (t->segment != NULL) && start_next_segment(t)) {
+        // Started the next segment of a chained transaction
     } else {
         // Transaction is done
-        *port |= (1<<t->cs_num); // De-assert CS pin
+        if (t->hold) {
+            // Keep CS asserted, only transactions with the same peripheral can be started until it is released
+            held_cs = t->cs_num;
+        } else {
+            *port |= (1<<t->cs_num); // De-assert CS pin
+            held_cs = CS_NONE;
+        }
         t->done = 1;
         t->active = 0;
+#ifdef ENABLE_PROFILING
+        struct profiling_stats *stats = spi_queue_delay + t->priority;
+        stats->calls++;
+        stats->total += t->queued_time;
+        if (t->queued_time > stats->max) {
+            stats->max = t->queued_time;
+        }
+#endif
+        if (t->callback != NULL) {
+            defer_callback(t->callback, t->id, t->context);
+        }
         queue_head = (queue_head + 1) % QUEUE_LENGTH;
         
         start_next_transaction();
@@ -9,13 +9,68 @@
 #define SPI_h
 
 #include "global.h"
+#include "transaction_queue.h"
+#include "profiling.h"
 
+// MARK: Constants
+#define SPI_MAX_REPEATS 8   // The number of times a segment with a repeat mask can be repeated
+
+// MARK: Types
+/**
+ *  Priority classes for SPI transactions. A pending transaction is only started when there are no pending
+ *  transactions in a higher class, transactions in the same class are started in turn.
+ */
+typedef enum {
+    /** Flight critical logging, waits for at most the transaction in progress and any chip select being held */
+    SPI_PRIORITY_CRITICAL,
+    /** Radio telemetry and anything else which does not set a priority */
+    SPI_PRIORITY_NORMAL,
+    /** Downloads and diagnostics, may wait as long as there is other work for the bus */
+    SPI_PRIORITY_BULK,
+    SPI_NUM_PRIORITIES
+} spi_priority_t;
+
+/**
+ *  One step of a chained SPI transaction, or one piece of the data sent in a full duplex transaction
+ */
+struct spi_segment {
+    /** The segment which follows this one, NULL if this is the last segment */
+    struct spi_segment *next;
+    
+    /** The buffer from which data is sent */
+    uint8_t *out_buffer;
+    /** The buffer in which received data is placed */
+    uint8_t *in_buffer;
+    /** The number of bytes to be sent */
+    uint16_t out_length;
+    /** The number of bytes to be received */
+    uint16_t in_length;
+    
+    /**
+     *  If not 0 the segment is repeated while any of these bits are set in the last byte received, up to
+     *  SPI_MAX_REPEATS times. If they are still set after that the rest of the chain is skipped.
+     */
+    uint8_t repeat_mask;
+    /** 1 if the chip select pin is left asserted between this segment and the next */
+    uint8_t hold_cs: 1;
+};
+
+// MARK: Variables
+#ifdef ENABLE_PROFILING
+/**
+ *  The time between each transaction being queued and being started in timer 1 ticks, for each priority class
+ */
+extern struct profiling_stats spi_queue_delay[SPI_NUM_PRIORITIES];
+#endif
+
+// MARK: Function declarations
 /**
  *  Initializes the SPI interface.
  *  Clock will be 3MHz
  *  @param spi_port The output register for the IO port that the SPI pins (including CS pins) are on
+ *  @param spi_pin The input register for the same IO port, from which attention pins are read
  */
-extern void init_spi(volatile uint8_t *spi_port);
+extern void init_spi(volatile uint8_t *spi_port, volatile uint8_t *spi_pin);
 
 /**
  *  Code to be run in each itteration of the main loop
@@ -29,6 +84,32 @@ extern void spi_service(void);
  */
 uint8_t spi_transaction_done(uint8_t transaction_id);
 
+/**
+ * Set a function to be called from the main loop when an SPI transaction is done
+ * @note If the transaction is already done the callback is queued immediately. The transaction must still be
+ *       cleared, the callback is a good place to do so.
+ * @param transaction_id The identifier for the SPI transaction
+ * @param callback The function to be called
+ * @param context A pointer which is passed to the callback
+ * @return 0 if the callback was set
+ */
+uint8_t spi_set_callback(uint8_t transaction_id, transaction_callback_t callback, void *context);
+
+/**
+ * Set the priority class of an SPI transaction, transactions are in SPI_PRIORITY_NORMAL when they are queued
+ * @note Setting the priority of a transaction which has already been started only changes the class under which its
+ *       queueing delay is recorded
+ * @param transaction_id The identifier for the SPI transaction
+ * @param priority The class of the transaction
+ * @return 0 if the priority was set
+ */
+uint8_t spi_set_priority(uint8_t transaction_id, spi_priority_t priority);
+
+/**
+ * Reset the queueing delay statistics for all priority classes
+ */
+void spi_reset_queue_delay(void);
+
 /**
  * Clear an SPI transaction
  * @note This function can not clear a transaction if it is active
@@ -37,6 +118,13 @@ uint8_t spi_transaction_done(uint8_t transaction_id);
  */
 uint8_t spi_clear_transaction(uint8_t transaction_id);
 
+/**
+ * De-assert a chip select pin which was left asserted by a held transaction without starting another transaction
+ * @param cs_num The offset within the SPI port register for the chip select pin
+ * @return 0 if the pin was released, 1 if it is not being held or a transaction is in progress
+ */
+uint8_t spi_release_cs(uint8_t cs_num);
+
 /**
  * Queue a half duplex transaction for the SPI bus
  * @param transaction_id The identifier assigned to the created transaction will be placed in this memory
@@ -47,20 +135,68 @@ uint8_t spi_clear_transaction(uint8_t transaction_id);
  * @param in_length The number of bytes to be recieved
  * @return 0 if the transaction was added to the queue
  */
-uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint8_t out_length,
-                              uint8_t * in_buffer, uint8_t in_length);
+uint8_t spi_start_half_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                              uint8_t * in_buffer, uint16_t in_length);
+
+/**
+ * Queue a half duplex transaction for the SPI bus which leaves the chip select pin asserted when it is complete
+ * @note No transactions with other peripherals will be started until a transaction with the same chip select pin
+ *       which is not held is complete. A transaction with no output bytes continues on from where the held
+ *       transaction left off, the first byte recieved is the first byte placed in the in buffer.
+ * @param transaction_id The identifier assigned to the created transaction will be placed in this memory
+ * @param cs_num The offset within the SPI port register for the chip select pin of the peripheral with which to communicate
+ * @param out_buffer The memeory from which data will be sent
+ * @param out_length The number of bytes to be sent
+ * @param in_buffer The memory in which received data will be placed
+ * @param in_length The number of bytes to be recieved
+ * @return 0 if the transaction was added to the queue
+ */
+uint8_t spi_start_half_duplex_held(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                                   uint8_t * in_buffer, uint16_t in_length);
 
 /**
  * Queue a full duplex transaction for the SPI bus
+ * @note Bytes are received while the active low attention pin is asserted. Once in_buffer is full the transaction
+ *       ends as soon as all data has been sent, the peripheral keeps the rest of its data and its attention pin
+ *       asserted until the next transaction.
  * @param transaction_id The identifier assigned to the created transaction will be placed in this memory
  * @param cs_num The offset within the SPI port register for the chip select pin of the peripheral with which to communicate
  * @param out_buffer The memeory from which data will be sent
  * @param out_length The number of bytes to be sent
  * @param in_buffer The memory in which received data will be placed
+ * @param in_length The size of in_buffer, no more than this many bytes will be received
+ * @param attn_num The offset within the SPI port register for the attention pin of the peripheral with which to communicate
+ * @return 0 if the transaction was added to the queue
+ */
+uint8_t spi_start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint16_t out_length,
+                              uint8_t * in_buffer, uint16_t in_length, uint8_t attn_num);
+
+/**
+ * Queue a chain of half duplex transfers with one peripheral which are performed one after another without any other
+ * transactions in between
+ * @note The chip select pin is de-asserted and asserted again between segments unless hold_cs is set, so each segment
+ *       can be a separate command. The segments must not be changed until the transaction is done.
+ * @param transaction_id The identifier assigned to the created transaction will be placed in this memory
+ * @param cs_num The offset within the SPI port register for the chip select pin of the peripheral with which to communicate
+ * @param first The first segment of the chain
+ * @return 0 if the transaction was added to the queue
+ */
+uint8_t spi_start_chain(uint8_t *transaction_id, uint8_t cs_num, struct spi_segment *first);
+
+/**
+ * Queue a full duplex transaction for the SPI bus which sends data gathered from several pieces of memory
+ * @note Only the out_buffer, out_length and next fields of the segments are used. The segments are sent back to back
+ *       with the chip select pin asserted throughout. No segment other than the first may be empty. The segments and
+ *       the memory they point to must not be changed until the transaction is done.
+ * @param transaction_id The identifier assigned to the created transaction will be placed in this memory
+ * @param cs_num The offset within the SPI port register for the chip select pin of the peripheral with which to communicate
+ * @param first The first segment of data to be sent
+ * @param in_buffer The memory in which received data will be placed
+ * @param in_length The size of in_buffer, no more than this many bytes will be received
  * @param attn_num The offset within the SPI port register for the attention pin of the peripheral with which to communicate
  * @return 0 if the transaction was added to the queue
  */
-uint8_t spi_start_full_duplex(uint8_t *transaction_id, uint8_t cs_num, uint8_t *out_buffer, uint8_t out_length,
-                              uint8_t * in_buffer, uint8_t attn_num);
+uint8_t spi_start_full_duplex_chain(uint8_t *transaction_id, uint8_t cs_num, struct spi_segment *first,
+                                    uint8_t *in_buffer, uint16_t in_length, uint8_t attn_num);
 
 #endif /* SPI_h */
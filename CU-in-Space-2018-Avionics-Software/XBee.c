@@ -8,27 +8,28 @@
 #include "XBee.h"
 
 #include "Radio_commands.h"
+#include "transaction_queue.h"
 #include "pindefinitions.h"
 #include "SPI.h"
 
+#include <stddef.h> //NULL
 #include <avr/io.h>
-#include <string.h>
 
 //The address configuring, initializing, and also the routing will be done in this.
 
 #define QUEUE_LENGTH    4  // The number of SPI transactions which can be queued
 
 #define ID_INVALID      0   // The transaction ID for an unused transaction
-#define ID_FIRST        1   // The first valid transaction ID
 
 typedef struct {
     /** A unique identifer for this transaction */
     uint8_t id;
     
-    /** data that will be sent */
-    uint8_t buffer[128];
+    /** The parts of the API frame which are created by the driver, the header and checksum for transmit requests */
+    uint8_t buffer[XBEE_TRANSMIT_HEADROOM + XBEE_TRANSMIT_TAILROOM];
+    /** The pieces of memory from which the frame is sent, buffer and/or memory given by the creator of the transaction */
+    struct spi_segment segments[3];
     
-    uint8_t length;
     uint8_t spi_transaction_id;
     
     /** The type for this transaction */
@@ -48,12 +49,21 @@ static xbee_transaction_t queue[QUEUE_LENGTH];
 /** The index of the head of the transaction queue */
 static uint8_t queue_head;
 
-/** The transaction id that should be given to the next new transaction */
-static uint8_t next_id = ID_FIRST;
+/** The generation of each slot in the queue, used to create transaction IDs */
+static uint8_t generations[QUEUE_LENGTH];
 
 /** The buffer used to received data from the module */
 static uint8_t in_buffer[256];
 
+#define STATUS_QUEUE_LENGTH 4   // The number of transmit status frames which can be waiting to be read
+
+/** Transmit status frames which have been received but not read */
+static struct xbee_transmit_status status_queue[STATUS_QUEUE_LENGTH];
+/** The index of the oldest unread transmit status */
+static uint8_t status_head;
+/** The number of unread transmit statuses */
+static uint8_t status_count;
+
 
 void init_xbee(void)
 {
@@ -71,13 +81,26 @@ static inline void start_next_transaction (void) {
             
             in_buffer[0] = 0;
             queue[i].active = 1;
-            spi_start_full_duplex(&queue[i].spi_transaction_id, RADIO_CS_NUM, queue[i].buffer, queue[i].length, in_buffer, RADIO_ATTN_NUM);
+            spi_start_full_duplex_chain(&queue[i].spi_transaction_id, RADIO_CS_NUM, queue[i].segments, in_buffer,
+                                        sizeof(in_buffer), RADIO_ATTN_NUM);
             return;
         }
         i = (i + 1) % QUEUE_LENGTH;
     } while (i != queue_head);
 }
 
+/**
+ *  Set the piece of memory from which a transaction is sent
+ *  @param segment The segment of the transaction to be set
+ *  @param next The segment which follows it, NULL if it is the last
+ */
+static void set_segment (struct spi_segment *segment, uint8_t *out_buffer, uint8_t out_length, struct spi_segment *next)
+{
+    segment->next = next;
+    segment->out_buffer = out_buffer;
+    segment->out_length = out_length;
+}
+
 static uint8_t has_queued_transaction (void)
 {
     
@@ -93,15 +116,13 @@ static uint8_t has_queued_transaction (void)
 }
 
 /**
- *  Get the first transaction in the queue with the given ID
- *  @param id The transaction ID to search for
+ *  Get the transaction with the given ID
+ *  @param id The transaction ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
  */
 static xbee_transaction_t *get_transaction_with_id(uint8_t id)
 {
-    for (xbee_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
-        if (i->id == id) return i;
-    }
-    return NULL;
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
 }
 
 uint8_t xbee_transaction_done(uint8_t transaction_id)
@@ -125,24 +146,19 @@ uint8_t xbee_clear_transaction(uint8_t transaction_id)
  */
 static xbee_transaction_t *get_next_free_transaction(void)
 {
-    uint8_t i = queue_head;
-    do {
-        if (queue[i].id == ID_INVALID) return queue + i;
-        i = (i + 1) % QUEUE_LENGTH;
-    } while (i != queue_head);
-    return NULL;
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), queue_head);
 }
 
 static uint8_t radio_receive(uint8_t *transaction_id) { //endians
     xbee_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->read = 1;
-    t->length = 0;
+    set_segment(t->segments, t->buffer, 0, NULL);
     t->active = 0;
     t->done = 0;
     
@@ -152,9 +168,77 @@ static uint8_t radio_receive(uint8_t *transaction_id) { //endians
     return 0;
 }
 
+/**
+ *  Store a transmit status frame so that it can be read with xbee_get_transmit_status
+ *  @param frame The API frame, starting with the frame type
+ */
+static void handle_transmit_status (uint8_t *frame)
+{
+    if (status_count == STATUS_QUEUE_LENGTH) {
+        // Drop the oldest status to make room
+        status_head = (status_head + 1) % STATUS_QUEUE_LENGTH;
+        status_count--;
+    }
+    
+    struct xbee_transmit_status *status = status_queue + ((status_head + status_count) % STATUS_QUEUE_LENGTH);
+    status->frame_id = frame[1];
+    status->retry_count = frame[4];
+    status->delivery_status = frame[5];
+    status_count++;
+}
+
+/**
+ *  Handle the API frames received from the module during the last transaction
+ */
+static void parse_received_frames (void)
+{
+    uint16_t offset = 0;
+    
+    // Frames are received back to back from the start of the buffer
+    while (((offset + 4) < sizeof(in_buffer)) && (in_buffer[offset] == DELIMITER_COMMAND)) {
+        uint16_t length = ((uint16_t)in_buffer[offset + 1] << 8) | in_buffer[offset + 2];
+        if ((length == 0) || ((offset + length + 4) > sizeof(in_buffer))) break;
+        
+        uint8_t *frame = in_buffer + offset + 3;
+        uint8_t sum = 0;
+        for (uint16_t i = 0; i <= length; i++) {
+            sum += frame[i];
+        }
+        if (sum != 0xFF) break;
+        
+        if ((frame[0] == ZIGBEE_TRANSMIT_STATUS) && (length >= 7)) {
+            handle_transmit_status(frame);
+        }
+        
+        // Clear the delimiter so that the frame is not handled again if a later transaction receives less data
+        in_buffer[offset] = 0;
+        offset += length + 4;
+    }
+}
+
+uint8_t xbee_get_transmit_status (struct xbee_transmit_status *status)
+{
+    if (status_count == 0) return 1;
+    
+    *status = status_queue[status_head];
+    status_head = (status_head + 1) % STATUS_QUEUE_LENGTH;
+    status_count--;
+    return 0;
+}
+
+uint8_t xbee_queue_occupancy (void)
+{
+    uint8_t count = 0;
+    for (xbee_transaction_t *i = queue; i < queue + QUEUE_LENGTH; i++) {
+        if ((i->id != ID_INVALID) && !i->done) count++;
+    }
+    return count;
+}
+
 void xbee_service(void) {
     
-    if(RADIO_ATTN_PORT & (1 << RADIO_ATTN_NUM) && !(has_queued_transaction()) ) {
+    // The attention pin is active low, it is asserted while the module has data to send
+    if(!(RADIO_ATTN_PIN & (1 << RADIO_ATTN_NUM)) && !(has_queued_transaction()) ) {
         uint8_t id;
         radio_receive(&id);
     }
@@ -162,10 +246,14 @@ void xbee_service(void) {
     xbee_transaction_t *t = queue + queue_head; //pointer to transaction
     if( (t->id == 0) || !spi_transaction_done(t->spi_transaction_id)) return;
     spi_clear_transaction(t->spi_transaction_id);
+    // The ID may be reused by another driver once it is cleared, it must not be polled again
+    t->spi_transaction_id = 0;
     
     t->done = 1; //transaction is done
     t->active = 0;
     
+    parse_received_frames();
+    
     if (t->read) {
         // This is an internally created read transaction, it should be freed
         t->id = ID_INVALID;
@@ -191,9 +279,9 @@ uint8_t xbee_send_at_command(uint8_t *transaction_id, uint8_t get_response, uint
     xbee_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->buffer[0] = 0x7E;
     t->buffer[1] = 0;
@@ -207,7 +295,7 @@ uint8_t xbee_send_at_command(uint8_t *transaction_id, uint8_t get_response, uint
     t->buffer[8] = calculate_checksum(t->buffer + 3, 8);
     
     t->read = 0;
-    t->length = 9;
+    set_segment(t->segments, t->buffer, 9, NULL);
     t->active = 0;
     t->done = 0;
     
@@ -222,9 +310,9 @@ uint8_t xbee_send_at_queue_command(uint8_t *transaction_id, uint8_t get_response
     xbee_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
     
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
     
     t->buffer[0] = 0x7E;
     t->buffer[1] = 0;
@@ -238,7 +326,7 @@ uint8_t xbee_send_at_queue_command(uint8_t *transaction_id, uint8_t get_response
     t->buffer[8] = calculate_checksum(t->buffer + 3, 8);
     
     t->read = 0;
-    t->length = 9;
+    set_segment(t->segments, t->buffer, 9, NULL);
     t->active = 0;
     t->done = 0;
     
@@ -249,40 +337,66 @@ uint8_t xbee_send_at_queue_command(uint8_t *transaction_id, uint8_t get_response
 }
 
 
+/**
+ *  Fill in the header of the API frame for a transmit request
+ *  @param header Memory with XBEE_TRANSMIT_HEADROOM bytes for the header
+ *  @param frame_id The frame ID of the request, 0 if no transmit status should be sent
+ *  @param data The data which will follow the header
+ *  @return The checksum which must follow the data
+ */
+static uint8_t fill_transmit_header (uint8_t *header, uint8_t frame_id, uint64_t address_64, uint16_t address_16, uint8_t broadcast_radius, uint8_t transmit_options, const uint8_t *data, uint8_t data_length)
+{
+    header[0] = 0x7E;
+    header[1] = 0;
+    header[2] = 14 + data_length;
+    header[3] = TRANSMIT_REQUEST;
+    header[4] = frame_id;
+    uint8_t *addr_64_bytes = (uint8_t*)(&address_64);
+    header[5] = addr_64_bytes[7];
+    header[6] = addr_64_bytes[6];
+    header[7] = addr_64_bytes[5];
+    header[8] = addr_64_bytes[4];
+    header[9] = addr_64_bytes[3];
+    header[10] = addr_64_bytes[2];
+    header[11] = addr_64_bytes[1];
+    header[12] = addr_64_bytes[0];
+    uint8_t *addr_16_bytes = (uint8_t*)(&address_16);
+    header[13] = addr_16_bytes[1];
+    header[14] = addr_16_bytes[0];
+    header[15] = broadcast_radius;
+    header[16] = transmit_options;
+    
+    uint8_t checksum = calculate_checksum(header + 3, 14);
+    for (uint8_t i = 0; i < data_length; i++) {
+        checksum -= data[i];
+    }
+    return checksum;
+}
+
 uint8_t xbee_transmit_command(uint8_t *transaction_id, uint8_t get_response, uint64_t address_64, uint16_t address_16, uint8_t broadcast_radius, uint8_t transmit_options, uint8_t *data, uint8_t data_size) {
     
     xbee_transaction_t *t = get_next_free_transaction();
     if (t == NULL) return 1;
 
-    t->id = next_id;
-    *transaction_id = next_id++;
-    if (next_id == ID_INVALID) next_id = ID_FIRST;
-    
-    uint8_t data_length = (data_size < 110) ? data_size : 110;
-    t->buffer[0] = 0x7E;
-    t->buffer[1] = 0;
-    t->buffer[2] = 14 + data_length;
-    t->buffer[3] = TRANSMIT_REQUEST;
-    t->buffer[4] = (get_response) ? 1 : 0;
-    uint8_t *addr_64_bytes = (uint8_t*)(&address_64);
-    t->buffer[5] = addr_64_bytes[7];
-    t->buffer[6] = addr_64_bytes[6];
-    t->buffer[7] = addr_64_bytes[5];
-    t->buffer[8] = addr_64_bytes[4];
-    t->buffer[9] = addr_64_bytes[3];
-    t->buffer[10] = addr_64_bytes[2];
-    t->buffer[11] = addr_64_bytes[1];
-    t->buffer[12] = addr_64_bytes[0];
-    uint8_t *addr_16_bytes = (uint8_t*)(&address_16);
-    t->buffer[13] = addr_16_bytes[1];
-    t->buffer[14] = addr_16_bytes[0];
-    t->buffer[15] = broadcast_radius;
-    t->buffer[16] = transmit_options;
-    memcpy(t->buffer + 17, data, data_length);
-    t->buffer[17 + data_length] = calculate_checksum(t->buffer + 3, data_length + 14);
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    
+    uint8_t data_length = (data_size < XBEE_MAX_PAYLOAD) ? data_size : XBEE_MAX_PAYLOAD;
+    // The transaction ID is used as the frame ID for the status
+    uint8_t *checksum = t->buffer + XBEE_TRANSMIT_HEADROOM;
+    *checksum = fill_transmit_header(t->buffer, (get_response) ? t->id : 0, address_64, address_16, broadcast_radius, transmit_options, data, data_length);
+    
+    // The data is sent from where it is rather than being copied in between the header and checksum
+    struct spi_segment *tail = t->segments + 2;
+    set_segment(tail, checksum, XBEE_TRANSMIT_TAILROOM, NULL);
+    if (data_length != 0) {
+        set_segment(t->segments + 1, data, data_length, tail);
+        tail = t->segments + 1;
+    }
+    set_segment(t->segments, t->buffer, XBEE_TRANSMIT_HEADROOM, tail);
     
     t->read = 0;
-    t->length = 18 + data_length;
     t->active = 0;
     t->done = 0;
     
@@ -292,3 +406,27 @@ uint8_t xbee_transmit_command(uint8_t *transaction_id, uint8_t get_response, uin
     return 0;
 }
 
+uint8_t xbee_transmit_in_place(uint8_t *transaction_id, uint8_t get_response, uint64_t address_64, uint16_t address_16, uint8_t broadcast_radius, uint8_t transmit_options, uint8_t *data, uint8_t data_size) {
+    
+    if (data_size > XBEE_TRANSMIT_IN_PLACE_MAX) return 1;
+    
+    xbee_transaction_t *t = get_next_free_transaction();
+    if (t == NULL) return 1;
+    
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    *transaction_id = t->id;
+    
+    uint8_t *frame = data - XBEE_TRANSMIT_HEADROOM;
+    data[data_size] = fill_transmit_header(frame, (get_response) ? t->id : 0, address_64, address_16, broadcast_radius, transmit_options, data, data_size);
+    
+    t->read = 0;
+    set_segment(t->segments, frame, XBEE_TRANSMIT_HEADROOM + data_size + XBEE_TRANSMIT_TAILROOM, NULL);
+    t->active = 0;
+    t->done = 0;
+    
+    start_next_transaction();
+    
+    
+    return 0;
+}
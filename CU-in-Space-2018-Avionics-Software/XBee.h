@@ -12,6 +12,25 @@
 #define XBEE_ADDRESS_64_BROADCAST   0x000000000000FFFF
 #define XBEE_ADDRESS_16_UNKOWN      0xFFFE
 
+#define XBEE_TRANSMIT_HEADROOM      17      // The space needed before data sent with xbee_transmit_in_place
+#define XBEE_TRANSMIT_TAILROOM      1       // The space needed after data sent with xbee_transmit_in_place
+#define XBEE_TRANSMIT_IN_PLACE_MAX  (255 - XBEE_TRANSMIT_HEADROOM - XBEE_TRANSMIT_TAILROOM)
+#define XBEE_MAX_PAYLOAD            84      // The largest RF payload without encryption (NP), longer ones are not delivered
+
+#define XBEE_DELIVERY_SUCCESS       0x00    // Delivery status reported when a transmission succeeded
+
+/**
+ *  The result of a transmit request, as reported by the module
+ */
+struct xbee_transmit_status {
+    /** The frame ID of the transmit request, which is the transaction ID given by xbee_transmit_command */
+    uint8_t frame_id;
+    /** The number of times that the module had to retry the transmission */
+    uint8_t retry_count;
+    /** XBEE_DELIVERY_SUCCESS or the reason that the transmission failed */
+    uint8_t delivery_status;
+};
+
 struct Transmit_Options {
     
     uint8_t disable_ack:1;
@@ -35,6 +54,19 @@ extern void xbee_service(void);
 extern uint8_t xbee_transaction_done(uint8_t transaction_id);
 extern uint8_t xbee_clear_transaction(uint8_t transaction_id);
 
+/**
+ *  Get the oldest transmit status which has been received from the module
+ *  @note Statuses are only sent for transmit requests made with get_response set. Only the most recent few are kept.
+ *  @param status Memory where the status should be stored
+ *  @return 0 if a status was available
+ */
+extern uint8_t xbee_get_transmit_status(struct xbee_transmit_status *status);
+
+/**
+ *  Get the number of transactions which are queued or in progress
+ */
+extern uint8_t xbee_queue_occupancy(void);
+
 /**
  *  Querry or set module parameters
  *  @param transaction_id Memory where the unique identifier for this transaction should be stored
@@ -59,17 +91,35 @@ extern uint8_t xbee_send_at_queue_command(uint8_t *transaction_id, uint8_t get_r
 
 /**
  *  Transmit data
+ *  @note The data is sent from where it is rather than being copied into the driver, so it may not be changed until
+ *        the transaction is done.
  *  @param transaction_id Memory where the unique identifier for this transaction should be stored
- *  @param get_response Whether or not the module should be asked for a response
+ *  @param get_response Whether or not the module should be asked for a transmit status
  *  @param address_64 The 64 bit destination address
  *  @param address_16 The 16 bit destination address
  *  @param broadcast_radius The maximum number of hops for broadcast transmitions
  *  @param transmit_options The options for this transmition
  *  @param data The data to be transmitted
- *  @param data_size The number of bytes to be transmitted
+ *  @param data_size The number of bytes to be transmitted, only the first XBEE_MAX_PAYLOAD bytes are sent
  *  
  */
 extern uint8_t xbee_transmit_command(uint8_t *transaction_id, uint8_t get_response, uint64_t address_64, uint16_t address_16, uint8_t broadcast_radius, uint8_t transmit_options, uint8_t *data, uint8_t data_size);
 
+/**
+ *  Transmit data without copying it into the driver
+ *  @note The XBEE_TRANSMIT_HEADROOM bytes before data and the XBEE_TRANSMIT_TAILROOM bytes after it are overwritten
+ *        with the rest of the API frame. None of this memory may be changed until the transaction is done.
+ *  @param transaction_id Memory where the unique identifier for this transaction should be stored
+ *  @param get_response Whether or not the module should be asked for a transmit status
+ *  @param address_64 The 64 bit destination address
+ *  @param address_16 The 16 bit destination address
+ *  @param broadcast_radius The maximum number of hops for broadcast transmitions
+ *  @param transmit_options The options for this transmition
+ *  @param data The data to be transmitted
+ *  @param data_size The number of bytes to be transmitted, at most XBEE_TRANSMIT_IN_PLACE_MAX
+ *  @return 0 if the transmition was queued
+ */
+extern uint8_t xbee_transmit_in_place(uint8_t *transaction_id, uint8_t get_response, uint64_t address_64, uint16_t address_16, uint8_t broadcast_radius, uint8_t transmit_options, uint8_t *data, uint8_t data_size);
+
 
 #endif /* XBee_h */
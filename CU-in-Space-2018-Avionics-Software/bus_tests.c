@@ -9,6 +9,7 @@
 
 #include "serial0.h"
 #include <stdlib.h>
+#include <string.h>
 
 #include "pindefinitions.h"
 #include "SPI.h"
@@ -199,6 +200,94 @@ void menu_cmd_spiconc_handler(uint8_t arg_len, char** args)
     spi_clear_transaction(write_id);
 }
 
+// SPI Priority
+const char menu_cmd_spiprio_string[] PROGMEM = "spiprio";
+const char menu_help_spiprio[] PROGMEM = "Get SPI queueing delay for each priority class as CSV, bench keeps the queue full of EEPROM status reads.\nValid Usage: spiprio [reset|bench]\n";
+
+#ifdef ENABLE_PROFILING
+static const char spiprio_string_reset[] PROGMEM = "reset";
+static const char spiprio_string_bench[] PROGMEM = "bench";
+static const char spiprio_string_header[] PROGMEM = "class,transactions,avg_cycles,max_cycles\n";
+static const char spiprio_string_critical[] PROGMEM = "critical";
+static const char spiprio_string_normal[] PROGMEM = "normal";
+static const char spiprio_string_bulk[] PROGMEM = "bulk";
+static const char * const spiprio_class_names[] PROGMEM = {spiprio_string_critical, spiprio_string_normal,
+                                                          spiprio_string_bulk};
+#else
+static const char spiprio_string_disabled[] PROGMEM = "Profiling is not enabled.\n";
+#endif
+
+#define SPIPRIO_OUTSTANDING     6   // The number of bench transactions kept queued, leaves room for the drivers
+#define SPIPRIO_TRANSACTIONS    600 // The number of bench transactions performed
+
+#ifdef ENABLE_PROFILING
+/**
+ *  Saturate the SPI queue with status register reads, assigning each new read to the next priority class in turn
+ */
+static void spiprio_bench (void)
+{
+    uint8_t ids[SPIPRIO_OUTSTANDING];
+    uint8_t status[SPIPRIO_OUTSTANDING];
+    uint8_t rdsr_cmd = 0b00000101;
+    uint8_t next_class = 0;
+    uint16_t started = 0;
+    uint16_t finished = 0;
+    
+    memset(ids, 0, sizeof(ids));
+    spi_reset_queue_delay();
+    
+    while (finished < SPIPRIO_TRANSACTIONS) {
+        for (uint8_t i = 0; i < SPIPRIO_OUTSTANDING; i++) {
+            if ((ids[i] != 0) && spi_transaction_done(ids[i])) {
+                spi_clear_transaction(ids[i]);
+                ids[i] = 0;
+                finished++;
+            }
+            if ((ids[i] == 0) && (started < SPIPRIO_TRANSACTIONS) &&
+                !spi_start_half_duplex(ids + i, EEPROM_CS_NUM, &rdsr_cmd, 1, status + i, 1)) {
+                spi_set_priority(ids[i], next_class);
+                next_class = (next_class + 1) % SPI_NUM_PRIORITIES;
+                started++;
+            }
+        }
+    }
+}
+#endif
+
+void menu_cmd_spiprio_handler(uint8_t arg_len, char** args)
+{
+#ifndef ENABLE_PROFILING
+    serial_0_put_string_P(spiprio_string_disabled);
+#else
+    if (arg_len == 2 && !strcasecmp_P(args[1], spiprio_string_reset)) {
+        spi_reset_queue_delay();
+        return;
+    } else if (arg_len == 2 && !strcasecmp_P(args[1], spiprio_string_bench)) {
+        spiprio_bench();
+    } else if (arg_len != 1) {
+        serial_0_put_string_P(menu_help_spiprio);
+        return;
+    }
+    
+    serial_0_put_string_P(spiprio_string_header);
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        struct profiling_stats stats = spi_queue_delay[i];
+        
+        serial_0_put_string_P((const char*)pgm_read_word(spiprio_class_names + i));
+        serial_0_put_byte(',');
+        ultoa(stats.calls, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte(',');
+        ultoa((stats.calls == 0) ? 0 : ((uint32_t)(stats.total / stats.calls) * PROFILING_CYCLES_PER_TICK), str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte(',');
+        ultoa(stats.max * PROFILING_CYCLES_PER_TICK, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte('\n');
+    }
+#endif
+}
+
 
 // MARK: I2C
 
@@ -27,6 +27,11 @@ extern const char menu_cmd_spiconc_string[] PROGMEM;
 extern const char menu_help_spiconc[] PROGMEM;
 extern void menu_cmd_spiconc_handler(uint8_t arg_len, char** args);
 
+// SPI Priority
+extern const char menu_cmd_spiprio_string[] PROGMEM;
+extern const char menu_help_spiprio[] PROGMEM;
+extern void menu_cmd_spiprio_handler(uint8_t arg_len, char** args);
+
 // I2C Raw
 extern const char menu_cmd_iicraw_string[] PROGMEM;
 extern const char menu_help_iicraw[] PROGMEM;
@@ -0,0 +1,43 @@
+//
+//  crc.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  CRC-16 used to protect telemetry frames and log records
+//
+
+#include "crc.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(address) (*(address))
+#endif
+
+// MARK: Constants
+/**
+ *  The CRC of each possible value of the top four bits of the CRC register
+ */
+static const uint16_t crc16_table[16] PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+// MARK: Function Definitions
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    for (; length > 0; length--) {
+        uint8_t byte = *data++;
+        crc = (crc << 4) ^ pgm_read_word(crc16_table + ((crc >> 12) ^ (byte >> 4)));
+        crc = (crc << 4) ^ pgm_read_word(crc16_table + ((crc >> 12) ^ (byte & 0x0F)));
+    }
+    return crc;
+}
+
+uint8_t crc16_check(const uint8_t *data, uint16_t length)
+{
+    if (length < 2) return 1;
+    
+    uint16_t crc = crc16(data, length - 2);
+    return (data[length - 2] != (crc & 0xFF)) || (data[length - 1] != (crc >> 8));
+}
@@ -0,0 +1,45 @@
+//
+//  crc.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  CRC-16 used to protect telemetry frames and log records
+//
+
+#ifndef crc_h
+#define crc_h
+
+#include <stdint.h>
+
+// MARK: Constants
+#define CRC16_INIT  0xFFFF  // The initial value for a CRC calculation
+
+// MARK: Function declarations
+/**
+ *  Add data to a CRC calculation
+ *  @note This is CRC-16/CCITT-FALSE (polynomial 0x1021, not reflected, no final XOR). It is computed four bits at a
+ *        time with a sixteen entry table in program memory.
+ *  @param crc The CRC of the data so far, CRC16_INIT to start a new calculation
+ *  @param data The data to be added
+ *  @param length The number of bytes of data
+ *  @return The CRC of all of the data so far
+ */
+extern uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint16_t length);
+
+/**
+ *  Calculate the CRC of a buffer
+ */
+static inline uint16_t crc16(const uint8_t *data, uint16_t length)
+{
+    return crc16_update(CRC16_INIT, data, length);
+}
+
+/**
+ *  Check a buffer which ends with the CRC of the bytes before it, stored little endian
+ *  @note This is meant for use on the ground as well as on the rocket, crc.c does not depend on anything else.
+ *  @param data The buffer, including the CRC
+ *  @param length The length of the buffer, including the CRC
+ *  @return 0 if the CRC matches
+ */
+extern uint8_t crc16_check(const uint8_t *data, uint16_t length);
+
+#endif /* crc_h */
@@ -0,0 +1,66 @@
+//
+//  deferred.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Run transaction completion callbacks from the main loop
+//
+
+#include "deferred.h"
+
+#include <util/atomic.h>
+
+// MARK: Types
+struct deferred_call {
+    transaction_callback_t callback;
+    void *context;
+    uint8_t transaction_id;
+};
+
+// MARK: Variables
+uint8_t deferred_dropped;
+
+/** Callbacks waiting to be run */
+static volatile struct deferred_call queue[DEFERRED_QUEUE_LENGTH];
+/** The index of the oldest waiting callback */
+static volatile uint8_t queue_head;
+/** The number of waiting callbacks */
+static volatile uint8_t queue_count;
+
+// MARK: Function Definitions
+uint8_t defer_callback(transaction_callback_t callback, uint8_t transaction_id, void *context)
+{
+    uint8_t ret = 1;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (queue_count < DEFERRED_QUEUE_LENGTH) {
+            volatile struct deferred_call *call = queue + ((queue_head + queue_count) % DEFERRED_QUEUE_LENGTH);
+            call->callback = callback;
+            call->context = context;
+            call->transaction_id = transaction_id;
+            queue_count++;
+            ret = 0;
+        } else {
+            deferred_dropped++;
+        }
+    }
+    
+    return ret;
+}
+
+void deferred_service(void)
+{
+    for (;;) {
+        struct deferred_call call;
+        
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (queue_count == 0) return;
+            call.callback = queue[queue_head].callback;
+            call.context = queue[queue_head].context;
+            call.transaction_id = queue[queue_head].transaction_id;
+            queue_head = (queue_head + 1) % DEFERRED_QUEUE_LENGTH;
+            queue_count--;
+        }
+        
+        call.callback(call.transaction_id, call.context);
+    }
+}
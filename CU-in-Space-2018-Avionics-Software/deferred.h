@@ -0,0 +1,39 @@
+//
+//  deferred.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Run transaction completion callbacks from the main loop
+//
+
+#ifndef deferred_h
+#define deferred_h
+
+#include "global.h"
+#include "transaction_queue.h"
+
+// MARK: Constants
+#define DEFERRED_QUEUE_LENGTH   24  // At least the total length of the SPI, I2C and EEPROM queues
+
+// MARK: Variables
+/**
+ *  The number of callbacks which could not be run because the deferred queue was full
+ */
+extern uint8_t deferred_dropped;
+
+// MARK: Function declarations
+/**
+ *  Queue a callback to be run from the main loop
+ *  @note This is safe to call from an ISR
+ *  @param callback The function to be called
+ *  @param transaction_id The transaction ID to be passed to the callback
+ *  @param context The context pointer to be passed to the callback
+ *  @return 0 if the callback was queued
+ */
+extern uint8_t defer_callback(transaction_callback_t callback, uint8_t transaction_id, void *context);
+
+/**
+ *  Run all of the callbacks which have been queued, including any which are queued by the callbacks themselves
+ */
+extern void deferred_service(void);
+
+#endif /* deferred_h */
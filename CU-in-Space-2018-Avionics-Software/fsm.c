@@ -0,0 +1,156 @@
+//
+//  fsm.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Detect transitions between states of the main FSM from sensor data
+//
+
+#include "fsm.h"
+
+#include <stdlib.h>
+
+// MARK: Variable Definitions
+const struct fsm_thresholds fsm_default_thresholds = {
+    .launch_accel = LAUNCH_ACCEL_THRESHOLD,
+    .launch_alt = LAUNCH_ALT_THRESHOLD,
+    .coasting_accel = COASTING_ACCEL_THRESHOLD,
+    .coasting_alt = COASTING_ALT_THRESOLD,
+    .altitude_range = ALTITUDE_COMPARISON_RANGE
+};
+
+#define VOTE_MASK ((1 << TRANSITION_VOTE_WINDOW) - 1)
+
+// MARK: Function Definitions
+void init_fsm_detector(struct fsm_detector *detector)
+{
+    detector->max_alt = 0;
+    detector->max_estimate = INT32_MIN;
+    init_kalman(&detector->estimator);
+    detector->accel_votes = 0;
+    detector->altitude_votes = 0;
+    detector->descending = 0;
+    detector->dropping = 0;
+}
+
+/**
+ *  Count the number of consecutive samples which met a condition
+ *  @param count The count to be updated
+ *  @param condition Non-zero if the latest sample met the condition
+ *  @param limit The value at which the count stops increasing
+ */
+static void count_consecutive(uint8_t *count, uint8_t condition, uint8_t limit)
+{
+    if (!condition) {
+        *count = 0;
+    } else if (*count < limit) {
+        (*count)++;
+    }
+}
+
+/**
+ *  Get the square of the magnitude of the acceleration in a sample
+ *  @return The squared magnitude in (3.9mg)^2 per least signifigant bit
+ */
+static uint32_t accel_magnitude_squared(const struct fsm_sample *sample)
+{
+    uint32_t x = (int32_t)sample->accel_x * sample->accel_x;
+    uint32_t y = (int32_t)sample->accel_y * sample->accel_y;
+    uint32_t z = (int32_t)sample->accel_z * sample->accel_z;
+    return x + y + z;
+}
+
+/**
+ *  Record whether a sample met the conditions for a transition
+ *  @param votes The votes for the type of sensor from which the sample came
+ *  @param condition Non-zero if the sample met the conditions
+ *  @return 1 if at least TRANSITION_VOTE_REQUIRED of the last TRANSITION_VOTE_WINDOW samples met the conditions
+ */
+static uint8_t vote(uint8_t *votes, uint8_t condition)
+{
+    *votes = ((*votes << 1) | (condition != 0)) & VOTE_MASK;
+
+    uint8_t count = 0;
+    for (uint8_t v = *votes; v != 0; v &= v - 1) {
+        count++;
+    }
+
+    if (count >= TRANSITION_VOTE_REQUIRED) {
+        *votes = 0;
+        return 1;
+    }
+    return 0;
+}
+
+global_state_t fsm_detect_transition(struct fsm_detector *detector, global_state_t state,
+                                     const struct fsm_sample *sample, const struct fsm_thresholds *thresholds)
+{
+    // Only real barometer samples are used so that the estimator is not started from an altitude and time of 0
+    uint8_t new_sample = sample->new_altitude;
+    if (new_sample) {
+        if (sample->altitude > detector->max_alt) {
+            detector->max_alt = sample->altitude;
+        }
+
+        kalman_update(&detector->estimator, sample->time, sample->altitude, sample->accel_z);
+        if (detector->estimator.altitude > detector->max_estimate) {
+            detector->max_estimate = detector->estimator.altitude;
+        }
+        // The velocity estimate only counts once the altitude estimate has also stopped rising, so that a faulty
+        // accelerometer can not pull the velocity estimate negative long before apogee
+        count_consecutive(&detector->descending,
+                          (detector->estimator.velocity < 0) && (detector->estimator.altitude < detector->max_estimate),
+                          APOGEE_VELOCITY_SAMPLES);
+        count_consecutive(&detector->dropping, (detector->max_alt - sample->altitude) > thresholds->altitude_range,
+                          APOGEE_ALTITUDE_SAMPLES);
+    }
+
+    switch (state) {
+        case STANDBY:
+            // Wait for rocket to be armed
+            if (sample->armed) {
+                return PRE_FLIGHT;
+            }
+            break;
+        case PRE_FLIGHT:
+            // Wait for engine to start, voting on every accelerometer sample with the latest altitude
+            if (sample->new_accel && vote(&detector->accel_votes,
+                                          (accel_magnitude_squared(sample) >
+                                           ((int32_t)thresholds->launch_accel * thresholds->launch_accel)) &&
+                                          (sample->altitude > thresholds->launch_alt))) {
+                return POWERED_ASCENT;
+            }
+            break;
+        case POWERED_ASCENT:
+            // Wait for engine to burn out. Acceleration is voted on for every accelerometer sample and altitude for
+            // every barometer sample.
+            if (sample->new_accel && vote(&detector->accel_votes,
+                                          accel_magnitude_squared(sample) <
+                                          ((int32_t)thresholds->coasting_accel * thresholds->coasting_accel))) {
+                return COASTING_ASCENT;
+            }
+            if (new_sample && vote(&detector->altitude_votes, sample->altitude > thresholds->coasting_alt)) {
+                return COASTING_ASCENT;
+            }
+            break;
+        case COASTING_ASCENT:
+            // Wait for apogee. The sign of the velocity estimate is only trusted once the estimator has settled and it
+            // has been negative for several samples in a row. A drop in the raw altitude which lasts for longer is a
+            // fallback in case the estimate is not converging.
+            if ((KALMAN_SETTLED(&detector->estimator) && (detector->descending >= APOGEE_VELOCITY_SAMPLES)) ||
+                (detector->dropping >= APOGEE_ALTITUDE_SAMPLES)) {
+                return DESCENT;
+            }
+            break;
+        case DESCENT:
+            // Wait for altitude to stop changing (landing)
+            if (labs(sample->prev_altitude - sample->altitude) < thresholds->altitude_range) {
+                return RECOVERY;
+            }
+            break;
+        case RECOVERY:
+            // Wait to be found
+            break;
+    }
+
+    return state;
+}
@@ -0,0 +1,104 @@
+//
+//  fsm.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Detect transitions between states of the main FSM from sensor data
+//
+
+#ifndef fsm_h
+#define fsm_h
+
+#include "global.h"
+#include "kalman.h"
+
+// MARK: Types
+/**
+ *  The thresholds used to detect transitions between flight states
+ */
+struct fsm_thresholds {
+    /** Acceleration above which the engine is considered to be burning in 3.9mg per least signifigant bit */
+    int16_t launch_accel;
+    /** Altitude above which the rocket is considered to have launched in 1/16m per least signifigant bit */
+    int32_t launch_alt;
+    /** Acceleration below which the engine is considered to have burnt out in 3.9mg per least signifigant bit */
+    int16_t coasting_accel;
+    /** Altitude above which the engine is considered to have burnt out in 1/16m per least signifigant bit */
+    int32_t coasting_alt;
+    /** Change in altitude which is considered significant in 1/16m per least signifigant bit */
+    int32_t altitude_range;
+};
+
+/**
+ *  A set of sensor readings from which transitions are detected
+ */
+struct fsm_sample {
+    /** The time at which the altitude sample was taken in milliseconds */
+    uint32_t time;
+    /** The most recent altitude in 1/16m per least signifigant bit */
+    int32_t altitude;
+    /** The altitude sample before the most recent one in 1/16m per least signifigant bit */
+    int32_t prev_altitude;
+    /** The acceleration in the x axis in 3.9mg per least signifigant bit */
+    int16_t accel_x;
+    /** The acceleration in the y axis in 3.9mg per least signifigant bit */
+    int16_t accel_y;
+    /** The acceleration in the z axis, which points up along the rocket, in 3.9mg per least signifigant bit */
+    int16_t accel_z;
+    /** 1 if both ematches are ready */
+    uint8_t armed:1;
+    /** 1 if the altitude is from a barometer sample which has not been given to the detector before */
+    uint8_t new_altitude:1;
+    /** 1 if the acceleration is from an accelerometer sample which has not been given to the detector before */
+    uint8_t new_accel:1;
+};
+
+/**
+ *  State which is kept between samples while detecting transitions
+ */
+struct fsm_detector {
+    /** The highest altitude seen so far in 1/16m per least signifigant bit */
+    int32_t max_alt;
+    /** The highest altitude estimate so far in 1/16m per least signifigant bit, with KALMAN_FRACTION_BITS fractional
+        bits */
+    int32_t max_estimate;
+    /** Altitude and vertical velocity estimates */
+    struct kalman_state estimator;
+    /** One bit for each of the most recent accelerometer samples, set if the sample met the conditions for the next
+        transition */
+    uint8_t accel_votes;
+    /** One bit for each of the most recent barometer samples, set if the sample met the conditions for the next
+        transition */
+    uint8_t altitude_votes;
+    /** The number of consecutive barometer samples for which the velocity estimate has been negative and the altitude
+        estimate has been below its highest value */
+    uint8_t descending;
+    /** The number of consecutive barometer samples which have been significantly below the highest altitude */
+    uint8_t dropping;
+};
+
+// MARK: Variables
+/**
+ *  The thresholds used in flight, as set in global.h
+ */
+extern const struct fsm_thresholds fsm_default_thresholds;
+
+// MARK: Function declarations
+/**
+ *  Reset a detector to its initial state
+ *  @param detector The detector to be reset
+ */
+extern void init_fsm_detector(struct fsm_detector *detector);
+
+/**
+ *  Determine which state the main FSM should be in based on a new sample
+ *  @note This function has no side effects outside of the detector so that it can be used to replay recorded data
+ *  @param detector The state kept between samples
+ *  @param state The current state of the main FSM
+ *  @param sample The sensor readings to check
+ *  @param thresholds The thresholds used to detect transitions
+ *  @return The state which the FSM should move to, or state if no transition is needed
+ */
+extern global_state_t fsm_detect_transition(struct fsm_detector *detector, global_state_t state,
+                                            const struct fsm_sample *sample, const struct fsm_thresholds *thresholds);
+
+#endif /* fsm_h */
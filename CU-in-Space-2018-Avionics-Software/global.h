@@ -17,6 +17,7 @@
 #define ENABLE_SENSORS_AT_RESET
 #define ENABLE_DEPLOYMENT
 #define ENABLE_DEBUG_FLASH
+// ENABLE_PROFILING is defined by bench builds (make PROFILE=1) rather than here, it slows every iteration of the main loop
 
 #define ENABLE_SPI
 #define ENABLE_I2C
@@ -24,7 +25,7 @@
 
 #define ENABLE_ALTIMETER
 #define ENABLE_ACCELEROMETER
-//#define ENABLE_GYROSCOPE
+#define ENABLE_GYROSCOPE
 #define ENABLE_GPS
 
 #define ENABLE_XBEE
@@ -39,13 +40,18 @@
 #define COASTING_ACCEL_THRESHOLD    513     // 2g in 3.9mg per least signifigant bit
 #define COASTING_ALT_THRESOLD       35200   // 2200m (7217') in 1/16m per least signifigant bit
 #define ALTITUDE_COMPARISON_RANGE   32      // 2m in 1/16m per least signifigant bit
+#define TRANSITION_VOTE_WINDOW      5       // The number of recent samples of each sensor considered for launch and burnout (max 8)
+#define TRANSITION_VOTE_REQUIRED    3       // The number of those samples which must agree for a transition
+#define APOGEE_VELOCITY_SAMPLES     3       // The number of consecutive negative velocity estimates needed for apogee
+#define APOGEE_ALTITUDE_SAMPLES     6       // The number of consecutive low altitude samples needed for apogee (fallback)
 
 #define CAP_DISCARGE_THRESHOLD      40      // About 1v
 
 // MARK: EEPROM Addresses
 #define EEPORM_ADDR_OSCCAL              0
 #define EEPROM_ADDR_FSM_STATE           1
-#define EEPROM_ADDR_TELEMETRY_LOCATION  2
+#define EEPROM_ADDR_TELEMETRY_LOCATION  2   // Page of the log from which to start the search for the newest page
+#define EEPROM_ADDR_LOGGER_PROTECTED    4
 
 // MARK: Constants
 #define TIMER_FREQUENCY     1000
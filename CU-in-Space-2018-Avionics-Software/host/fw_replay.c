@@ -0,0 +1,482 @@
+//
+//  fw_replay.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Replays flights through the whole firmware on the simulated board, faster than real time and several flights at
+//  once. The barometer, accelerometer, gyroscope, GPS and analog inputs are all driven from the trace. Prints when each
+//  state was entered and how long after the true apogee the parachute was deployed.
+//
+//  The samples which the firmware gives to fsm_detect_transition() are recorded (fw_replay is linked with
+//  --wrap=fsm_detect_transition), so that thresholds can then be swept over the same flights without running the rest
+//  of the firmware again.
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include "pindefinitions.h"
+// Firmware code is built with -fpack-struct
+#pragma pack(push, 1)
+#include "fsm.h"
+#pragma pack(pop)
+
+#define MAX_FLIGHTS         128
+#define MAX_RECORDED        200000  // Detector calls recorded per flight, enough for about 200 s of flight
+#define DEFAULT_SEEDS       2       // Seeds for each generated flight profile and noise level
+#define TRACE_PERIOD        0.01    // Seconds between samples in generated traces
+
+/**
+ *  One call to fsm_detect_transition() made by the firmware
+ */
+struct recorded_sample {
+    /** Seconds into the trace */
+    float time;
+    struct fsm_sample sample;
+};
+
+/**
+ *  What happened during one flight, kept in memory shared with the process which ran the flight
+ */
+struct flight_result {
+    /** Seconds into the trace at which each state was entered, negative if it never was */
+    double entered[RECOVERY + 1];
+    /** Seconds into the trace at which the main trigger pin went high, negative if it never did */
+    double deploy_time;
+    uint32_t recorded;
+    /** 1 if more calls were made than could be recorded */
+    uint8_t overflow;
+    /** 1 if the firmware had a valid GPS position at the end of the flight */
+    uint8_t gps_valid;
+    /** 1 if the simulation ran to the end */
+    uint8_t finished;
+};
+
+/**
+ *  The outcome of replaying one flight through the detector alone
+ */
+struct detector_result {
+    double launch;
+    double descent;
+    double recovery;
+};
+
+static struct sim_trace traces[MAX_FLIGHTS];
+static char names[MAX_FLIGHTS][48];
+static uint32_t num_flights;
+
+static struct flight_result *results;
+static struct recorded_sample *recordings;
+
+// The flight being run by this process
+static struct sim_board board;
+static struct flight_result *result;
+static struct recorded_sample *recording;
+
+extern int firmware_main(void);
+extern uint8_t fgpmmopa6h_data_valid;
+extern global_state_t __real_fsm_detect_transition(struct fsm_detector *detector, global_state_t state,
+                                                   const struct fsm_sample *sample,
+                                                   const struct fsm_thresholds *thresholds);
+
+static const char *state_names[] = {"standby", "pre-flight", "powered", "coasting", "descent", "recovery"};
+
+// MARK: Running the firmware
+static void finish(void)
+{
+    result->gps_valid = fgpmmopa6h_data_valid;
+    result->finished = 1;
+}
+
+/**
+ *  Called by main.c in place of fsm_detect_transition()
+ */
+global_state_t __wrap_fsm_detect_transition(struct fsm_detector *detector, global_state_t state,
+                                            const struct fsm_sample *sample, const struct fsm_thresholds *thresholds)
+{
+    global_state_t next = __real_fsm_detect_transition(detector, state, sample, thresholds);
+
+    // Calls without a new sample can only change the state, and only if they return a new one
+    if (sample->new_altitude || sample->new_accel || (next != state)) {
+        if (result->recorded < MAX_RECORDED) {
+            struct recorded_sample *r = recording + result->recorded++;
+            r->time = sim_flight_time();
+            r->sample = *sample;
+        } else {
+            result->overflow = 1;
+        }
+    }
+
+    if (next != state) {
+        result->entered[next] = sim_flight_time();
+        if (next == RECOVERY) {
+            sim_stop_at(sim_cycles, finish);
+        }
+    }
+    return next;
+}
+
+static void main_trigger_changed(void *context, uint8_t level)
+{
+    if (level && (result->deploy_time < 0)) {
+        result->deploy_time = sim_flight_time();
+    }
+}
+
+/**
+ *  Run the firmware through one flight, in a child process since the firmware never returns
+ */
+static void run_flight(uint32_t flight)
+{
+    result = results + flight;
+    recording = recordings + ((size_t)flight * MAX_RECORDED);
+
+    sim_board_init(&board, 1);
+    sim_watch_pin(SIM_PORT_D, MAIN_TRIGGER_NUM, main_trigger_changed, NULL);
+    sim_flight_start(traces + flight);
+    const struct sim_trace *trace = traces + flight;
+    sim_stop_at(sim_cycles + sim_ms(trace->samples[trace->length - 1].time * 1000), finish);
+    firmware_main();
+}
+
+/**
+ *  Run every flight, up to jobs at once
+ */
+static void run_flights(unsigned jobs)
+{
+    uint32_t started = 0;
+    unsigned running = 0;
+    pid_t pids[MAX_FLIGHTS];
+
+    while ((started < num_flights) || (running > 0)) {
+        if ((started < num_flights) && (running < jobs)) {
+            for (uint8_t s = 0; s <= RECOVERY; s++) {
+                results[started].entered[s] = -1;
+            }
+            results[started].deploy_time = -1;
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                exit(EXIT_FAILURE);
+            } else if (pid == 0) {
+                run_flight(started);
+                exit(EXIT_FAILURE);
+            }
+            pids[started++] = pid;
+            running++;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        running--;
+        for (uint32_t i = 0; i < started; i++) {
+            if ((pids[i] == pid) && (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))) {
+                printf("%s: simulation failed\n", names[i]);
+                results[i].finished = 0;
+            }
+        }
+    }
+}
+
+static void print_time(double t)
+{
+    if (t < 0) {
+        printf(" %9s", "-");
+    } else {
+        printf(" %9.2f", t);
+    }
+}
+
+static void print_timeline(void)
+{
+    printf("%-24s %8s %9s", "flight", "apogee", "at (s)");
+    for (uint8_t s = PRE_FLIGHT; s <= RECOVERY; s++) {
+        printf(" %9s", state_names[s]);
+    }
+    printf(" %9s %9s\n", "deploy", "latency");
+
+    double worst = -1;
+    for (uint32_t i = 0; i < num_flights; i++) {
+        const struct flight_result *r = results + i;
+        printf("%-24s %6.0f m", names[i], traces[i].apogee_altitude);
+        print_time(traces[i].apogee_time);
+        for (uint8_t s = PRE_FLIGHT; s <= RECOVERY; s++) {
+            print_time(r->entered[s]);
+        }
+        print_time(r->deploy_time);
+        if (r->deploy_time >= 0) {
+            double latency = r->deploy_time - traces[i].apogee_time;
+            printf(" %+9.2f", latency);
+            if (latency > worst) {
+                worst = latency;
+            }
+        } else {
+            printf(" %9s", "-");
+        }
+        if (!r->finished) {
+            printf("  (did not finish)");
+        } else if (r->overflow) {
+            printf("  (recording truncated)");
+        } else if (!r->gps_valid) {
+            printf("  (no GPS position)");
+        }
+        printf("\n");
+    }
+    if (worst >= 0) {
+        printf("Worst deployment latency: %.2f s after apogee\n", worst);
+    }
+}
+
+// MARK: Sweeping thresholds
+/**
+ *  Replay the samples recorded from one flight through the detector alone
+ */
+static void replay_detector(uint32_t flight, const struct fsm_thresholds *thresholds, struct detector_result *out)
+{
+    struct fsm_detector detector;
+    global_state_t state = STANDBY;
+    init_fsm_detector(&detector);
+    out->launch = -1;
+    out->descent = -1;
+    out->recovery = -1;
+
+    const struct recorded_sample *r = recordings + ((size_t)flight * MAX_RECORDED);
+    for (uint32_t i = 0; (i < results[flight].recorded) && (state != RECOVERY); i++, r++) {
+        global_state_t next = __real_fsm_detect_transition(&detector, state, &r->sample, thresholds);
+        if (next == state) {
+            continue;
+        }
+        state = next;
+        if (state == POWERED_ASCENT) {
+            out->launch = r->time;
+        } else if (state == DESCENT) {
+            out->descent = r->time;
+        } else if (state == RECOVERY) {
+            out->recovery = r->time;
+        }
+    }
+}
+
+/**
+ *  Replay every flight with one set of thresholds and print a summary
+ */
+static void sweep_row(const char *name, double factor, const struct fsm_thresholds *thresholds)
+{
+    uint32_t flights = 0;
+    uint32_t launched = 0;
+    uint32_t deployed = 0;
+    uint32_t early = 0;
+    uint32_t recovered = 0;
+    double total_latency = 0;
+    double worst_latency = 0;
+
+    for (uint32_t i = 0; i < num_flights; i++) {
+        if (!results[i].finished) continue;
+        struct detector_result r;
+        replay_detector(i, thresholds, &r);
+        flights++;
+        launched += r.launch >= 0;
+        recovered += r.recovery >= 0;
+        if (r.descent < 0) continue;
+        double latency = r.descent - traces[i].apogee_time;
+        deployed++;
+        early += latency < 0;
+        total_latency += latency;
+        if (latency > worst_latency) {
+            worst_latency = latency;
+        }
+    }
+
+    printf("%-16s %6.2f %8u %8u %8u %8u %8u", name, factor, flights, launched, deployed, early, recovered);
+    if (deployed != 0) {
+        printf(" %+10.2f %+10.2f\n", total_latency / deployed, worst_latency);
+    } else {
+        printf(" %10s %10s\n", "-", "-");
+    }
+}
+
+/**
+ *  Check that the detector alone reproduces the firmware's transitions with the thresholds used in flight, then
+ *  sweep each threshold in turn with the others left at their flight values
+ */
+static void sweep(void)
+{
+    // Firmware code counts simulated cycles as it runs
+    sim_init();
+
+    uint32_t mismatched = 0;
+    for (uint32_t i = 0; i < num_flights; i++) {
+        if (!results[i].finished) continue;
+        struct detector_result r;
+        replay_detector(i, &fsm_default_thresholds, &r);
+        // Recorded times are floats
+        if ((fabs(r.launch - results[i].entered[POWERED_ASCENT]) > 1e-3) ||
+            (fabs(r.descent - results[i].entered[DESCENT]) > 1e-3) ||
+            (fabs(r.recovery - results[i].entered[RECOVERY]) > 1e-3)) {
+            printf("%s: detector replay does not match the firmware\n", names[i]);
+            mismatched++;
+        }
+    }
+
+    static const double factors[] = {0.25, 0.5, 0.75, 1, 1.5, 2, 4};
+    printf("\n%-16s %6s %8s %8s %8s %8s %8s %10s %10s\n", "threshold", "factor", "flights", "launched", "deployed",
+           "early", "recovery", "latency", "worst");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t replays = 0;
+    for (uint8_t t = 0; t < 3; t++) {
+        for (uint8_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+            struct fsm_thresholds thresholds = fsm_default_thresholds;
+            const char *name;
+            switch (t) {
+                case 0:
+                    name = "launch accel";
+                    thresholds.launch_accel = fsm_default_thresholds.launch_accel * factors[f];
+                    break;
+                case 1:
+                    name = "coasting alt";
+                    thresholds.coasting_alt = fsm_default_thresholds.coasting_alt * factors[f];
+                    break;
+                default:
+                    name = "altitude range";
+                    thresholds.altitude_range = fsm_default_thresholds.altitude_range * factors[f];
+                    break;
+            }
+            sweep_row(name, factors[f], &thresholds);
+            replays += num_flights;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Swept %u flight replays in %.2f s\n", replays,
+           (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9));
+
+    if (mismatched != 0) {
+        sim_fail("%u flights replayed differently through the detector alone", mismatched);
+    }
+}
+
+// MARK: Flights
+static void add_flight(const char *name)
+{
+    snprintf(names[num_flights], sizeof(names[num_flights]), "%s", name);
+    num_flights++;
+}
+
+static void generate_flights(unsigned seeds)
+{
+    static const struct {
+        const char *name;
+        struct sim_flight_profile profile;
+    } profiles[] = {
+        {"low", {.pad_time = 10, .boost_accel = 5, .burn_time = 2, .drag = 0.001, .descent_rate = 20}},
+        {"nominal", {.pad_time = 10, .boost_accel = 8, .burn_time = 3, .drag = 0.0004, .descent_rate = 20}},
+        {"high", {.pad_time = 10, .boost_accel = 12, .burn_time = 4, .drag = 0.0002, .descent_rate = 25}}
+    };
+    static const struct {
+        const char *name;
+        double accel;       // g
+        double altitude;    // m
+    } noise[] = {{"quiet", 0.02, 0.5}, {"noisy", 0.1, 2.0}};
+
+    for (uint8_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        for (uint8_t n = 0; n < sizeof(noise) / sizeof(noise[0]); n++) {
+            for (unsigned seed = 1; (seed <= seeds) && (num_flights < MAX_FLIGHTS); seed++) {
+                struct sim_flight_profile profile = profiles[p].profile;
+                profile.accel_noise = noise[n].accel;
+                profile.altitude_noise = noise[n].altitude;
+                profile.seed = seed;
+                sim_trace_generate(traces + num_flights, &profile, TRACE_PERIOD);
+
+                char name[48];
+                snprintf(name, sizeof(name), "%s, %s, %u", profiles[p].name, noise[n].name, seed);
+                add_flight(name);
+            }
+        }
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n seeds] [-j jobs] [-s] [trace.csv ...]\n", name);
+    fprintf(stderr, "  -n  Seeds for each generated flight profile when no traces are given (default %u)\n",
+            DEFAULT_SEEDS);
+    fprintf(stderr, "  -j  Flights to run at once (default the number of CPUs)\n");
+    fprintf(stderr, "  -s  Sweep the launch acceleration, coasting altitude and altitude range thresholds\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seeds = DEFAULT_SEEDS;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned jobs = (cpus > 0) ? cpus : 1;
+    uint8_t sweep_thresholds = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:j:s")) != -1) {
+        switch (opt) {
+            case 'n':
+                seeds = atoi(optarg);
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                break;
+            case 's':
+                sweep_thresholds = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (jobs == 0) {
+        usage(argv[0]);
+    }
+
+    for (int i = optind; (i < argc) && (num_flights < MAX_FLIGHTS); i++) {
+        if (sim_trace_load(traces + num_flights, argv[i])) {
+            fprintf(stderr, "Could not load %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        add_flight(argv[i]);
+    }
+    if (optind == argc) {
+        generate_flights(seeds);
+    }
+
+    // Results are written by the process which runs each flight
+    results = mmap(NULL, num_flights * sizeof(*results), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    recordings = mmap(NULL, (size_t)num_flights * MAX_RECORDED * sizeof(*recordings), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if ((results == MAP_FAILED) || (recordings == MAP_FAILED)) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_flights(jobs);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Replayed %u flights in %.2f s with %u jobs, times are seconds into each trace\n\n", num_flights,
+           (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9), jobs);
+    print_timeline();
+
+    if (sweep_thresholds) {
+        sweep();
+    }
+
+    for (uint32_t i = 0; i < num_flights; i++) {
+        if (!results[i].finished) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
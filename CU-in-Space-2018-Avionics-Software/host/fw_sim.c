@@ -0,0 +1,138 @@
+//
+//  fw_sim.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Runs the firmware on the simulated board and reports main loop throughput
+//
+
+#include "sim_devices.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_DURATION    10  // Simulated seconds
+
+/** profiling_stats from profiling.h, which is packed in firmware code */
+struct fw_profiling_stats {
+    uint32_t calls;
+    uint64_t total;
+    uint32_t max;
+} __attribute__((packed));
+
+#define PROFILING_NUM_SERVICES      18
+#define PROFILING_CYCLES_PER_TICK   8
+
+// MARK: Firmware symbols
+extern int firmware_main(void);
+extern volatile uint32_t millis;
+extern uint8_t fsm_state;
+extern uint32_t radio_telemetry_period;
+extern struct fw_profiling_stats profiling_stats[PROFILING_NUM_SERVICES];
+extern const char *profiling_service_name(uint8_t service);
+
+static struct sim_board board;
+
+static struct timespec wall_start;
+static uint8_t print_profile;
+
+static double wall_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - wall_start.tv_sec) + ((now.tv_nsec - wall_start.tv_nsec) / 1e9);
+}
+
+static void print_profiling_table(void)
+{
+    if (profiling_stats[0].calls == 0) {
+        printf("\nNo profiling data, build fw_sim_profile for ENABLE_PROFILING\n");
+        return;
+    }
+    printf("\n%-24s %10s %12s %10s %10s\n", "service", "calls", "mean (cyc)", "max (cyc)", "share");
+    for (uint8_t i = 0; i < PROFILING_NUM_SERVICES; i++) {
+        const struct fw_profiling_stats *s = profiling_stats + i;
+        double mean = (s->calls != 0) ? ((double)s->total * PROFILING_CYCLES_PER_TICK / s->calls) : 0;
+        printf("%-24s %10u %12.1f %10u %9.1f%%\n", profiling_service_name(i), s->calls, mean,
+               s->max * PROFILING_CYCLES_PER_TICK, 100.0 * s->total / profiling_stats[0].total);
+    }
+}
+
+static void report(void)
+{
+    double wall = wall_time();
+    double simulated = sim_time();
+
+    printf("Simulated %.1f s in %.2f s of host time (%.1fx real time)\n", simulated, wall, simulated / wall);
+    printf("Main loop: %llu iterations, %.0f per second, %.0f cycles per iteration\n",
+           (unsigned long long)sim_stats.wdt_resets, sim_stats.wdt_resets / simulated,
+           (double)sim_cycles / sim_stats.wdt_resets);
+    printf("millis %u, FSM state %u\n", millis, fsm_state);
+
+    printf("\nInterupts:\n");
+    for (uint8_t i = 0; i < sizeof(sim_stats.interupts) / sizeof(sim_stats.interupts[0]); i++) {
+        if (sim_stats.interupts[i] != 0) {
+            printf("  %-14s %10u\n", sim_vector_name(i), sim_stats.interupts[i]);
+        }
+    }
+    printf("\nSPI: %llu bytes, %llu with more than one device selected\n", (unsigned long long)sim_stats.spi_bytes,
+           (unsigned long long)sim_stats.spi_conflicts);
+    printf("I2C: %llu bytes\n", (unsigned long long)sim_stats.i2c_bytes);
+    printf("UART overruns: %u, %u\n", sim_stats.uart_overruns[0], sim_stats.uart_overruns[1]);
+    const struct sim_xbee *xbee = &board.xbee;
+    printf("Samples: baro %u, accel %u (%u lost), gyro %u (%u lost), GPS %u\n", board.baro.samples,
+           board.accel.samples, board.accel.overruns, board.gyro.samples, board.gyro.overruns, board.gps.sentences);
+    printf("XBee: %u frames, %u transmit requests, %u over NP, %u bad checksums, largest payload %u\n", xbee->frames,
+           xbee->transmit_requests, xbee->oversized, xbee->bad_checksums, xbee->largest_payload);
+    printf("XBee: %u transmit statuses, %llu bytes read back, radio telemetry period %u ms\n", xbee->statuses,
+           (unsigned long long)xbee->bytes_read, radio_telemetry_period);
+    for (uint8_t i = 0; i < 2; i++) {
+        const struct sim_25lc1024 *chip = board.eeprom + i;
+        printf("EEPROM %u: %llu bytes written in %u write cycles, %llu read, %u errors\n", i + 1,
+               (unsigned long long)chip->bytes_written, chip->write_cycles, (unsigned long long)chip->bytes_read,
+               chip->errors);
+    }
+
+    if (print_profile) {
+        print_profiling_table();
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t seconds] [-d] [-p]\n", name);
+    fprintf(stderr, "  -t  Simulated time to run for (default %u)\n", DEFAULT_DURATION);
+    fprintf(stderr, "  -d  Leave the e-matches disconnected so that the rocket stays in standby\n");
+    fprintf(stderr, "  -p  Print the firmware's profiling table\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    double duration = DEFAULT_DURATION;
+    uint8_t armed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:dp")) != -1) {
+        switch (opt) {
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'd':
+                armed = 0;
+                break;
+            case 'p':
+                print_profile = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    sim_board_init(&board, armed);
+    sim_stop_at(sim_ms(duration * 1000), report);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    firmware_main();
+    return 1;
+}
@@ -0,0 +1,15 @@
+//
+//  eeprom.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Blocking internal EEPROM access for the host simulation build
+//
+
+#ifndef avr_eeprom_h
+#define avr_eeprom_h
+
+#include <stdint.h>
+
+extern uint8_t eeprom_read_byte(const uint8_t *address);
+
+#endif /* avr_eeprom_h */
@@ -0,0 +1,21 @@
+//
+//  interrupt.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Interrupt control for the host simulation build, ISRs are plain functions called by the simulated peripherals
+//
+
+#ifndef avr_interrupt_h
+#define avr_interrupt_h
+
+#include <avr/io.h>
+
+extern void sim_sei(void);
+extern void sim_cli(void);
+
+#define sei()   sim_sei()
+#define cli()   sim_cli()
+
+#define ISR(vector, ...)    void vector (void); void vector (void)
+
+#endif /* avr_interrupt_h */
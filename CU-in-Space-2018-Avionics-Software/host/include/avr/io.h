@@ -0,0 +1,282 @@
+//
+//  io.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  ATmega1284P registers for the host simulation build, backed by the simulated peripherals in sim.c
+//
+
+#ifndef avr_io_h
+#define avr_io_h
+
+#include <stdint.h>
+
+// MARK: Register file
+/** The I/O and extended I/O space, indexed by data memory address as on the AVR */
+extern volatile uint8_t sim_io[0x100];
+
+#define _SFR_MEM8(addr)     (*(volatile uint8_t *)(sim_io + (addr)))
+#define _SFR_MEM16(addr)    (*(volatile uint16_t *)(sim_io + (addr)))
+
+// MARK: Ports
+#define PINA    _SFR_MEM8(0x20)
+#define DDRA    _SFR_MEM8(0x21)
+#define PORTA   _SFR_MEM8(0x22)
+#define PINB    _SFR_MEM8(0x23)
+#define DDRB    _SFR_MEM8(0x24)
+#define PORTB   _SFR_MEM8(0x25)
+#define PINC    _SFR_MEM8(0x26)
+#define DDRC    _SFR_MEM8(0x27)
+#define PORTC   _SFR_MEM8(0x28)
+#define PIND    _SFR_MEM8(0x29)
+#define DDRD    _SFR_MEM8(0x2A)
+#define PORTD   _SFR_MEM8(0x2B)
+
+// MARK: Interrupt flags and external interrupts
+#define TIFR1   _SFR_MEM8(0x36)
+#define PCIFR   _SFR_MEM8(0x3B)
+#define EIFR    _SFR_MEM8(0x3C)
+#define EIMSK   _SFR_MEM8(0x3D)
+#define EICRA   _SFR_MEM8(0x69)
+#define PCICR   _SFR_MEM8(0x68)
+#define PCMSK2  _SFR_MEM8(0x6D)
+
+// MARK: EEPROM
+#define EECR    _SFR_MEM8(0x3F)
+#define EEDR    _SFR_MEM8(0x40)
+#define EEAR    _SFR_MEM16(0x41)
+#define EEARL   _SFR_MEM8(0x41)
+#define EEARH   _SFR_MEM8(0x42)
+
+// MARK: SPI
+#define SPCR    _SFR_MEM8(0x4C)
+#define SPSR    _SFR_MEM8(0x4D)
+#define SPDR    _SFR_MEM8(0x4E)
+
+// MARK: System
+#define MCUSR   _SFR_MEM8(0x54)
+#define SREG    _SFR_MEM8(0x5F)
+#define WDTCSR  _SFR_MEM8(0x60)
+#define PRR0    _SFR_MEM8(0x64)
+#define PRR1    _SFR_MEM8(0x65)
+
+// MARK: Timer 1
+#define TIMSK1  _SFR_MEM8(0x6F)
+#define TCCR1A  _SFR_MEM8(0x80)
+#define TCCR1B  _SFR_MEM8(0x81)
+#define TCCR1C  _SFR_MEM8(0x82)
+#define TCNT1   _SFR_MEM16(0x84)
+#define TCNT1L  _SFR_MEM8(0x84)
+#define TCNT1H  _SFR_MEM8(0x85)
+#define OCR1A   _SFR_MEM16(0x88)
+#define OCR1AL  _SFR_MEM8(0x88)
+#define OCR1AH  _SFR_MEM8(0x89)
+
+// MARK: ADC
+#define ADC     _SFR_MEM16(0x78)
+#define ADCL    _SFR_MEM8(0x78)
+#define ADCH    _SFR_MEM8(0x79)
+#define ADCSRA  _SFR_MEM8(0x7A)
+#define ADCSRB  _SFR_MEM8(0x7B)
+#define ADMUX   _SFR_MEM8(0x7C)
+#define DIDR0   _SFR_MEM8(0x7E)
+
+// MARK: TWI
+#define TWBR    _SFR_MEM8(0xB8)
+#define TWSR    _SFR_MEM8(0xB9)
+#define TWAR    _SFR_MEM8(0xBA)
+#define TWDR    _SFR_MEM8(0xBB)
+#define TWCR    _SFR_MEM8(0xBC)
+
+// MARK: USART 0
+#define UCSR0A  _SFR_MEM8(0xC0)
+#define UCSR0B  _SFR_MEM8(0xC1)
+#define UCSR0C  _SFR_MEM8(0xC2)
+#define UBRR0L  _SFR_MEM8(0xC4)
+#define UBRR0H  _SFR_MEM8(0xC5)
+#define UDR0    _SFR_MEM8(0xC6)
+
+// MARK: USART 1
+#define UCSR1A  _SFR_MEM8(0xC8)
+#define UCSR1B  _SFR_MEM8(0xC9)
+#define UCSR1C  _SFR_MEM8(0xCA)
+#define UBRR1L  _SFR_MEM8(0xCC)
+#define UBRR1H  _SFR_MEM8(0xCD)
+#define UDR1    _SFR_MEM8(0xCE)
+
+// MARK: Bits
+// Port pins
+#define PINA0 0
+#define PINA1 1
+#define PINA2 2
+#define PINA3 3
+#define PINA4 4
+#define PINA5 5
+#define PINA6 6
+#define PINA7 7
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PINC6 6
+#define PINC7 7
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// PCICR and PCIFR
+#define PCIE2   2
+#define PCIF2   2
+
+// TIFR1 and TIMSK1
+#define OCF1A   1
+#define OCIE1A  1
+
+// EECR
+#define EERIE   3
+#define EEMPE   2
+#define EEPE    1
+#define EERE    0
+
+// SPCR and SPSR
+#define SPIE    7
+#define SPE     6
+#define DORD    5
+#define MSTR    4
+#define CPOL    3
+#define CPHA    2
+#define SPR1    1
+#define SPR0    0
+#define SPIF    7
+#define WCOL    6
+#define SPI2X   0
+
+// MCUSR
+#define JTRF    4
+#define WDRF    3
+#define BORF    2
+#define EXTRF   1
+#define PORF    0
+
+// SREG
+#define SREG_I  7
+
+// PRR0 and PRR1
+#define PRTWI   7
+#define PRTIM2  6
+#define PRTIM0  5
+#define PRUSART1 4
+#define PRTIM1  3
+#define PRSPI   2
+#define PRUSART0 1
+#define PRADC   0
+#define PRTIM3  0
+
+// TCCR1B
+#define ICNC1   7
+#define ICES1   6
+#define WGM13   4
+#define WGM12   3
+#define CS12    2
+#define CS11    1
+#define CS10    0
+
+// ADCSRA and ADMUX
+#define ADEN    7
+#define ADSC    6
+#define ADATE   5
+#define ADIF    4
+#define ADIE    3
+#define ADPS2   2
+#define ADPS1   1
+#define ADPS0   0
+#define REFS1   7
+#define REFS0   6
+#define ADLAR   5
+
+// TWCR
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+
+// UCSRnA
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define DOR0    3
+#define U2X0    1
+#define RXC1    7
+#define TXC1    6
+#define UDRE1   5
+#define DOR1    3
+#define U2X1    1
+
+// UCSRnB
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define RXCIE1  7
+#define TXCIE1  6
+#define UDRIE1  5
+#define RXEN1   4
+#define TXEN1   3
+
+// UCSRnC
+#define UCSZ01  2
+#define UCSZ00  1
+#define UCSZ11  2
+#define UCSZ10  1
+
+#endif /* avr_io_h */
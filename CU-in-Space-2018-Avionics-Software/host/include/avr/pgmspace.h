@@ -0,0 +1,31 @@
+//
+//  pgmspace.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Program memory access for the host simulation build, program memory is ordinary memory on the host
+//
+
+#ifndef avr_pgmspace_h
+#define avr_pgmspace_h
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address)  (*(const uint8_t *)(address))
+#define pgm_read_word(address)  (*(address))
+#define pgm_read_dword(address) (*(address))
+
+#define memcpy_P        memcpy
+#define strlen_P        strlen
+#define strcpy_P        strcpy
+#define strcmp_P        strcmp
+#define strncmp_P       strncmp
+#define strcasecmp_P    strcasecmp
+#define strncasecmp_P   strncasecmp
+
+#endif /* avr_pgmspace_h */
@@ -0,0 +1,13 @@
+//
+//  power.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Power reduction for the host simulation build, the firmware writes PRR0 and PRR1 directly
+//
+
+#ifndef avr_power_h
+#define avr_power_h
+
+#include <avr/io.h>
+
+#endif /* avr_power_h */
@@ -0,0 +1,32 @@
+//
+//  wdt.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Watchdog timer for the host simulation build, a timeout stops the simulation
+//
+
+#ifndef avr_wdt_h
+#define avr_wdt_h
+
+#include <stdint.h>
+
+#define WDTO_15MS   0
+#define WDTO_30MS   1
+#define WDTO_60MS   2
+#define WDTO_120MS  3
+#define WDTO_250MS  4
+#define WDTO_500MS  5
+#define WDTO_1S     6
+#define WDTO_2S     7
+#define WDTO_4S     8
+#define WDTO_8S     9
+
+extern void sim_wdt_enable(uint8_t timeout);
+extern void sim_wdt_disable(void);
+extern void sim_wdt_reset(void);
+
+#define wdt_enable(timeout) sim_wdt_enable(timeout)
+#define wdt_disable()       sim_wdt_disable()
+#define wdt_reset()         sim_wdt_reset()
+
+#endif /* avr_wdt_h */
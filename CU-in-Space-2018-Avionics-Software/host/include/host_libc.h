@@ -0,0 +1,19 @@
+//
+//  host_libc.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  The avr-libc extensions to stdlib.h which the firmware uses, included before every firmware source file
+//
+
+#ifndef host_libc_h
+#define host_libc_h
+
+#include <stdlib.h>
+
+extern char *itoa(int value, char *str, int radix);
+extern char *utoa(unsigned int value, char *str, int radix);
+extern char *ltoa(long value, char *str, int radix);
+extern char *ultoa(unsigned long value, char *str, int radix);
+extern char *dtostrf(double value, signed char width, unsigned char precision, char *str);
+
+#endif /* host_libc_h */
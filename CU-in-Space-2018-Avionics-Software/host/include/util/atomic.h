@@ -0,0 +1,39 @@
+//
+//  atomic.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Atomic blocks for the host simulation build, implemented as in avr-libc on top of the simulated SREG
+//
+
+#ifndef util_atomic_h
+#define util_atomic_h
+
+#include <avr/interrupt.h>
+
+static __inline__ uint8_t __iCliRetVal(void)
+{
+    cli();
+    return 1;
+}
+
+static __inline__ void __iSeiParam(const uint8_t *__s)
+{
+    (void)__s;
+    sei();
+}
+
+static __inline__ void __iRestore(const uint8_t *__s)
+{
+    if (*__s & (1<<SREG_I)) {
+        sei();
+    } else {
+        cli();
+    }
+}
+
+#define ATOMIC_BLOCK(type) for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON      uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
+
+#endif /* util_atomic_h */
@@ -0,0 +1,1091 @@
+//
+//  sim.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated ATmega1284P peripherals for running the firmware on a host
+//
+
+#include "sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <util/twi.h>
+
+// MARK: Constants
+#define MAX_TIMERS          32  // The largest number of events which can be scheduled at once
+#define MAX_SPI_DEVICES     8
+#define MAX_I2C_DEVICES     8
+#define MAX_PIN_WATCHES     16
+#define UART_RX_LENGTH      4096
+
+// Approximate cost of each instrumented operation in CPU cycles. These stand in for the instructions around each
+// memory access, so loop rates are estimates. The simavr target gives exact numbers.
+#define COST_ACCESS         2   // Plus 1 for each byte accessed
+#define COST_CALL           10  // Call, return, prologue and epilogue
+
+#define EEPROM_WRITE_CYCLES 40800   // 3.4 ms
+#define TWI_START_BITS      2       // The length of a start condition in SCL periods
+
+// Register addresses
+#define ADDR_PIN(port)      (0x20 + (3 * (port)))
+#define ADDR_DDR(port)      (0x21 + (3 * (port)))
+#define ADDR_PORT(port)     (0x22 + (3 * (port)))
+#define ADDR_TIFR1      0x36
+#define ADDR_EECR       0x3F
+#define ADDR_EEDR       0x40
+#define ADDR_EEARL      0x41
+#define ADDR_EEARH      0x42
+#define ADDR_SPCR       0x4C
+#define ADDR_SPSR       0x4D
+#define ADDR_SPDR       0x4E
+#define ADDR_SREG       0x5F
+#define ADDR_TIMSK1     0x6F
+#define ADDR_ADCL       0x78
+#define ADDR_ADCH       0x79
+#define ADDR_ADCSRA     0x7A
+#define ADDR_ADMUX      0x7C
+#define ADDR_TCCR1B     0x81
+#define ADDR_TCNT1L     0x84
+#define ADDR_TCNT1H     0x85
+#define ADDR_OCR1AL     0x88
+#define ADDR_OCR1AH     0x89
+#define ADDR_TWBR       0xB8
+#define ADDR_TWSR       0xB9
+#define ADDR_TWDR       0xBB
+#define ADDR_TWCR       0xBC
+#define ADDR_UCSRA(n)   (0xC0 + (8 * (n)))
+#define ADDR_UCSRB(n)   (0xC1 + (8 * (n)))
+#define ADDR_UBRRL(n)   (0xC4 + (8 * (n)))
+#define ADDR_UBRRH(n)   (0xC5 + (8 * (n)))
+#define ADDR_UDR(n)     (0xC6 + (8 * (n)))
+
+// MARK: Interupt vectors
+// In order of priority, as in the vector table
+enum {
+    VECT_TIMER1_COMPA,
+    VECT_SPI_STC,
+    VECT_USART0_RX,
+    VECT_USART0_TX,
+    VECT_ADC,
+    VECT_EE_READY,
+    VECT_TWI,
+    VECT_USART1_RX,
+    VECT_USART1_TX,
+    NUM_VECTORS
+};
+
+extern void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern void SPI_STC_vect(void) __attribute__((weak));
+extern void USART0_RX_vect(void) __attribute__((weak));
+extern void USART0_TX_vect(void) __attribute__((weak));
+extern void ADC_vect(void) __attribute__((weak));
+extern void EE_READY_vect(void) __attribute__((weak));
+extern void TWI_vect(void) __attribute__((weak));
+extern void USART1_RX_vect(void) __attribute__((weak));
+extern void USART1_TX_vect(void) __attribute__((weak));
+
+static const char *vector_names[NUM_VECTORS] = {"TIMER1_COMPA_vect", "SPI_STC_vect", "USART0_RX_vect",
+                                                "USART0_TX_vect", "ADC_vect", "EE_READY_vect", "TWI_vect",
+                                                "USART1_RX_vect", "USART1_TX_vect"};
+
+// MARK: Variables
+volatile uint8_t sim_io[0x100];
+uint64_t sim_cycles;
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+uint16_t sim_adc_input[8];
+struct sim_stats sim_stats;
+
+/** The value of each register as last seen by the simulator, used to tell which bits a write changed */
+static uint8_t shadow[0x100];
+
+/** The register written by the last instrumented store, which is handled at the next hook */
+static uint8_t pending_addr;
+static uint8_t pending_size;
+
+/** The hooks take the slow path once sim_cycles reaches this, 0 forces the slow path at the next hook */
+static uint64_t wake;
+/** The cycle of the earliest scheduled event */
+static uint64_t next_event;
+/** Set when an interupt may have become pending */
+static uint8_t check_interupts;
+/** Set while an interupt service routine is running */
+static uint8_t in_interupt;
+
+static struct sim_timer *timers[MAX_TIMERS];
+static uint8_t num_timers;
+
+/** The levels driven onto each port from outside, for pins which are inputs */
+static uint8_t external_pins[4];
+/** The levels driven by the microcontroller on each port when they were last checked */
+static uint8_t driven_pins[4];
+
+static struct {
+    uint8_t port;
+    uint8_t num;
+    void (*fn)(void *context, uint8_t level);
+    void *context;
+} pin_watches[MAX_PIN_WATCHES];
+static uint8_t num_pin_watches;
+
+static struct sim_timer stop_timer;
+static void (*stop_callback)(void);
+
+static struct sim_timer watchdog_timer;
+static uint64_t watchdog_period;
+
+// Timer 1
+static struct sim_timer timer1_compare;
+/** The cycle at which timer 1 last counted from 0 */
+static uint64_t timer1_base;
+static uint16_t timer1_prescaler;
+
+// SPI
+static struct sim_spi_device *spi_devices[MAX_SPI_DEVICES];
+static uint8_t num_spi_devices;
+static struct sim_timer spi_transfer;
+static uint8_t spi_received;
+
+// TWI
+static struct sim_i2c_device *i2c_devices[MAX_I2C_DEVICES];
+static uint8_t num_i2c_devices;
+static struct sim_timer twi_operation;
+/** The status placed in TWSR when the current operation is done */
+static uint8_t twi_next_status;
+/** The byte placed in TWDR when the current operation is done */
+static uint8_t twi_next_data;
+/** The addressed peripheral, NULL if none */
+static struct sim_i2c_device *twi_device;
+/** 1 while the bus is held by the microcontroller */
+static uint8_t twi_bus_owned;
+/** 1 if the current transfer is a read */
+static uint8_t twi_reading;
+
+// ADC
+static struct sim_timer adc_conversion;
+
+// EEPROM
+static struct sim_timer eeprom_write;
+static uint16_t eeprom_write_address;
+static uint8_t eeprom_write_data;
+
+// UARTs
+static struct {
+    void (*tx)(void *context, uint8_t byte);
+    void *context;
+    struct sim_timer transmit;
+    struct sim_timer receive;
+    uint8_t tx_data;
+    uint8_t rx_data;
+    uint8_t rx_queue[UART_RX_LENGTH];
+    uint16_t rx_head;
+    uint16_t rx_count;
+} uarts[2];
+
+// MARK: Helpers
+static void update_wake(void)
+{
+    wake = (pending_size || check_interupts) ? 0 : next_event;
+}
+
+static void set_reg(uint8_t addr, uint8_t value)
+{
+    sim_io[addr] = value;
+    shadow[addr] = value;
+}
+
+static void set_bits(uint8_t addr, uint8_t mask)
+{
+    set_reg(addr, sim_io[addr] | mask);
+    check_interupts = 1;
+    update_wake();
+}
+
+static void clear_bits(uint8_t addr, uint8_t mask)
+{
+    set_reg(addr, sim_io[addr] & ~mask);
+}
+
+const char *sim_vector_name(uint8_t index)
+{
+    return (index < NUM_VECTORS) ? vector_names[index] : "?";
+}
+
+double sim_time(void)
+{
+    return (double)sim_cycles / SIM_F_CPU;
+}
+
+void sim_fail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "sim: %.6f s: ", sim_time());
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+// MARK: Events
+static void recompute_next_event(void)
+{
+    next_event = UINT64_MAX;
+    for (uint8_t i = 0; i < num_timers; i++) {
+        if (timers[i]->at < next_event) {
+            next_event = timers[i]->at;
+        }
+    }
+    update_wake();
+}
+
+void sim_timer_start(struct sim_timer *timer, uint64_t at)
+{
+    if (!timer->active) {
+        if (num_timers == MAX_TIMERS) {
+            sim_fail("too many events");
+        }
+        timers[num_timers++] = timer;
+        timer->active = 1;
+    }
+    timer->at = at;
+    recompute_next_event();
+}
+
+void sim_timer_stop(struct sim_timer *timer)
+{
+    if (!timer->active) return;
+
+    for (uint8_t i = 0; i < num_timers; i++) {
+        if (timers[i] == timer) {
+            timers[i] = timers[--num_timers];
+            break;
+        }
+    }
+    timer->active = 0;
+    recompute_next_event();
+}
+
+/**
+ *  Run the events which are due, in order
+ */
+static void run_events(void)
+{
+    while (next_event <= sim_cycles) {
+        struct sim_timer *due = NULL;
+        for (uint8_t i = 0; i < num_timers; i++) {
+            if ((due == NULL) || (timers[i]->at < due->at)) {
+                due = timers[i];
+            }
+        }
+        if (due->at > sim_cycles) {
+            // An event was moved later without recomputing the next event
+            recompute_next_event();
+            continue;
+        }
+        sim_timer_stop(due);
+        due->fn(due->context);
+    }
+}
+
+static void stop(void *context)
+{
+    if (stop_callback != NULL) {
+        stop_callback();
+    }
+    fflush(stdout);
+    exit(0);
+}
+
+void sim_stop_at(uint64_t at, void (*on_stop)(void))
+{
+    stop_timer.fn = stop;
+    stop_callback = on_stop;
+    sim_timer_start(&stop_timer, at);
+}
+
+// MARK: Interupts
+/**
+ *  Find the highest priority interupt which is pending and enabled
+ *  @return The vector, or NUM_VECTORS if there is none
+ */
+static uint8_t pending_interupt(void)
+{
+    if ((sim_io[ADDR_TIFR1] & (1<<OCF1A)) && (sim_io[ADDR_TIMSK1] & (1<<OCIE1A))) return VECT_TIMER1_COMPA;
+    if ((sim_io[ADDR_SPSR] & (1<<SPIF)) && (sim_io[ADDR_SPCR] & (1<<SPIE))) return VECT_SPI_STC;
+    if ((sim_io[ADDR_UCSRA(0)] & (1<<RXC0)) && (sim_io[ADDR_UCSRB(0)] & (1<<RXCIE0))) return VECT_USART0_RX;
+    if ((sim_io[ADDR_UCSRA(0)] & (1<<TXC0)) && (sim_io[ADDR_UCSRB(0)] & (1<<TXCIE0))) return VECT_USART0_TX;
+    if ((sim_io[ADDR_ADCSRA] & (1<<ADIF)) && (sim_io[ADDR_ADCSRA] & (1<<ADIE))) return VECT_ADC;
+    if (!(sim_io[ADDR_EECR] & (1<<EEPE)) && (sim_io[ADDR_EECR] & (1<<EERIE))) return VECT_EE_READY;
+    if ((sim_io[ADDR_TWCR] & (1<<TWINT)) && (sim_io[ADDR_TWCR] & (1<<TWIE))) return VECT_TWI;
+    if ((sim_io[ADDR_UCSRA(1)] & (1<<RXC1)) && (sim_io[ADDR_UCSRB(1)] & (1<<RXCIE1))) return VECT_USART1_RX;
+    if ((sim_io[ADDR_UCSRA(1)] & (1<<TXC1)) && (sim_io[ADDR_UCSRB(1)] & (1<<TXCIE1))) return VECT_USART1_TX;
+    return NUM_VECTORS;
+}
+
+/**
+ *  Run the interupt service routine for the highest priority pending interupt, if interupts are enabled
+ */
+static void dispatch_interupts(void)
+{
+    while (!in_interupt && (sim_io[ADDR_SREG] & (1<<SREG_I))) {
+        uint8_t vector = pending_interupt();
+        if (vector == NUM_VECTORS) {
+            check_interupts = 0;
+            update_wake();
+            return;
+        }
+
+        void (*isr)(void) = NULL;
+        switch (vector) {
+            case VECT_TIMER1_COMPA:
+                clear_bits(ADDR_TIFR1, (1<<OCF1A));
+                isr = TIMER1_COMPA_vect;
+                break;
+            case VECT_SPI_STC:
+                clear_bits(ADDR_SPSR, (1<<SPIF));
+                isr = SPI_STC_vect;
+                break;
+            case VECT_USART0_RX:
+                isr = USART0_RX_vect;
+                break;
+            case VECT_USART0_TX:
+                clear_bits(ADDR_UCSRA(0), (1<<TXC0));
+                isr = USART0_TX_vect;
+                break;
+            case VECT_ADC:
+                clear_bits(ADDR_ADCSRA, (1<<ADIF));
+                isr = ADC_vect;
+                break;
+            case VECT_EE_READY:
+                isr = EE_READY_vect;
+                break;
+            case VECT_TWI:
+                isr = TWI_vect;
+                break;
+            case VECT_USART1_RX:
+                isr = USART1_RX_vect;
+                break;
+            case VECT_USART1_TX:
+                clear_bits(ADDR_UCSRA(1), (1<<TXC1));
+                isr = USART1_TX_vect;
+                break;
+        }
+        if (isr == NULL) {
+            sim_fail("no handler for %s", vector_names[vector]);
+        }
+
+        sim_stats.interupts[vector]++;
+        sim_cycles += COST_CALL;
+        // The I flag is cleared while the ISR runs and set again by RETI
+        in_interupt = 1;
+        set_reg(ADDR_SREG, sim_io[ADDR_SREG] & ~(1<<SREG_I));
+        isr();
+        sim_sync();
+        set_reg(ADDR_SREG, sim_io[ADDR_SREG] | (1<<SREG_I));
+        in_interupt = 0;
+        run_events();
+    }
+}
+
+void sim_sei(void)
+{
+    set_reg(ADDR_SREG, sim_io[ADDR_SREG] | (1<<SREG_I));
+    check_interupts = 1;
+    update_wake();
+}
+
+void sim_cli(void)
+{
+    set_reg(ADDR_SREG, sim_io[ADDR_SREG] & ~(1<<SREG_I));
+}
+
+// MARK: Pins
+static uint8_t pin_levels(uint8_t port)
+{
+    uint8_t ddr = sim_io[ADDR_DDR(port)];
+    return (sim_io[ADDR_PORT(port)] & ddr) | (external_pins[port] & ~ddr);
+}
+
+/**
+ *  Call the pin watches and SPI chip selects for any output pins which have changed
+ */
+static void update_pins(uint8_t port)
+{
+    uint8_t driven = sim_io[ADDR_PORT(port)] & sim_io[ADDR_DDR(port)];
+    uint8_t changed = driven ^ driven_pins[port];
+    driven_pins[port] = driven;
+    if (!changed) return;
+
+    for (uint8_t i = 0; i < num_spi_devices; i++) {
+        struct sim_spi_device *device = spi_devices[i];
+        if ((device->cs_port == port) && (changed & (1 << device->cs_num))) {
+            device->selected = !(driven & (1 << device->cs_num));
+            if (device->select != NULL) {
+                device->select(device, device->selected);
+            }
+        }
+    }
+    for (uint8_t i = 0; i < num_pin_watches; i++) {
+        if ((pin_watches[i].port == port) && (changed & (1 << pin_watches[i].num))) {
+            pin_watches[i].fn(pin_watches[i].context, !!(driven & (1 << pin_watches[i].num)));
+        }
+    }
+}
+
+void sim_drive_pin(uint8_t port, uint8_t num, uint8_t level)
+{
+    if (level) {
+        external_pins[port] |= (1 << num);
+    } else {
+        external_pins[port] &= ~(1 << num);
+    }
+}
+
+uint8_t sim_output_pin(uint8_t port, uint8_t num)
+{
+    return !!(driven_pins[port] & (1 << num));
+}
+
+void sim_watch_pin(uint8_t port, uint8_t num, void (*fn)(void *context, uint8_t level), void *context)
+{
+    if (num_pin_watches == MAX_PIN_WATCHES) {
+        sim_fail("too many pin watches");
+    }
+    pin_watches[num_pin_watches].port = port;
+    pin_watches[num_pin_watches].num = num;
+    pin_watches[num_pin_watches].fn = fn;
+    pin_watches[num_pin_watches].context = context;
+    num_pin_watches++;
+}
+
+// MARK: Watchdog
+static void watchdog_timeout(void *context)
+{
+    sim_fail("watchdog timeout, the main loop did not run for %.0f ms", watchdog_period * 1000.0 / SIM_F_CPU);
+}
+
+void sim_wdt_enable(uint8_t timeout)
+{
+    watchdog_period = sim_ms(16 << timeout);
+    watchdog_timer.fn = watchdog_timeout;
+    sim_timer_start(&watchdog_timer, sim_cycles + watchdog_period);
+}
+
+void sim_wdt_disable(void)
+{
+    sim_timer_stop(&watchdog_timer);
+}
+
+void sim_wdt_reset(void)
+{
+    sim_stats.wdt_resets++;
+    if (watchdog_timer.active) {
+        // Moving the event is only needed once it is close, which saves searching the events on every reset
+        watchdog_timer.at = sim_cycles + watchdog_period;
+    }
+    sim_sync();
+}
+
+// MARK: Timer 1
+static uint16_t timer1_top(void)
+{
+    uint16_t top = sim_io[ADDR_OCR1AL] | (sim_io[ADDR_OCR1AH] << 8);
+    return (sim_io[ADDR_TCCR1B] & (1<<WGM12)) ? top : 0xFFFF;
+}
+
+static void timer1_match(void *context);
+
+static void timer1_schedule(void)
+{
+    timer1_compare.fn = timer1_match;
+    if (timer1_prescaler == 0) {
+        sim_timer_stop(&timer1_compare);
+        return;
+    }
+    sim_timer_start(&timer1_compare, timer1_base + ((uint64_t)timer1_top() + 1) * timer1_prescaler);
+}
+
+static void timer1_match(void *context)
+{
+    timer1_base = timer1_compare.at;
+    set_bits(ADDR_TIFR1, (1<<OCF1A));
+    timer1_schedule();
+}
+
+static void timer1_configure(void)
+{
+    static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    uint16_t prescaler = prescalers[sim_io[ADDR_TCCR1B] & 0x07];
+    if (prescaler != timer1_prescaler) {
+        // Keep the count when the clock changes
+        uint16_t count = (timer1_prescaler != 0) ? (sim_cycles - timer1_base) / timer1_prescaler : 0;
+        timer1_base = sim_cycles - (uint64_t)count * prescaler;
+        timer1_prescaler = prescaler;
+    }
+    timer1_schedule();
+}
+
+static void timer1_read(void)
+{
+    uint16_t count = (timer1_prescaler != 0) ? (sim_cycles - timer1_base) / timer1_prescaler : 0;
+    set_reg(ADDR_TCNT1L, count & 0xFF);
+    set_reg(ADDR_TCNT1H, count >> 8);
+}
+
+// MARK: SPI
+static void spi_done(void *context)
+{
+    set_reg(ADDR_SPDR, spi_received);
+    set_bits(ADDR_SPSR, (1<<SPIF));
+}
+
+static void spi_start(void)
+{
+    if ((sim_io[ADDR_SPCR] & ((1<<SPE) | (1<<MSTR))) != ((1<<SPE) | (1<<MSTR))) return;
+
+    uint8_t out = sim_io[ADDR_SPDR];
+    uint8_t received = 0xFF;
+    uint8_t num_selected = 0;
+    for (uint8_t i = 0; i < num_spi_devices; i++) {
+        if (spi_devices[i]->selected) {
+            // Open MISO lines are pulled high, two peripherals driving the bus at once is an error
+            received &= spi_devices[i]->exchange(spi_devices[i], out);
+            num_selected++;
+        }
+    }
+    sim_stats.spi_bytes++;
+    if (num_selected > 1) {
+        sim_stats.spi_conflicts++;
+    }
+    spi_received = received;
+
+    static const uint8_t dividers[4] = {4, 16, 64, 128};
+    uint16_t divider = dividers[sim_io[ADDR_SPCR] & 0x03];
+    if (sim_io[ADDR_SPSR] & (1<<SPI2X)) {
+        divider /= 2;
+    }
+    spi_transfer.fn = spi_done;
+    sim_timer_start(&spi_transfer, sim_cycles + (8 * divider));
+}
+
+// MARK: TWI
+static uint32_t twi_bit_cycles(void)
+{
+    static const uint8_t prescalers[4] = {1, 4, 16, 64};
+    return 16 + (2 * sim_io[ADDR_TWBR] * prescalers[shadow[ADDR_TWSR] & 0x03]);
+}
+
+static void twi_done(void *context)
+{
+    set_reg(ADDR_TWSR, (sim_io[ADDR_TWSR] & 0x07) | twi_next_status);
+    set_reg(ADDR_TWDR, twi_next_data);
+    set_bits(ADDR_TWCR, (1<<TWINT));
+}
+
+static void twi_end_transfer(void)
+{
+    if ((twi_device != NULL) && (twi_device->stop != NULL)) {
+        twi_device->stop(twi_device);
+    }
+    twi_device = NULL;
+}
+
+/**
+ *  Start the operation requested by a write to TWCR which cleared TWINT
+ */
+static void twi_start_operation(uint8_t control)
+{
+    uint32_t bits = 9;
+    twi_next_data = sim_io[ADDR_TWDR];
+
+    if (control & (1<<TWSTO)) {
+        // Stop condition, there is no interupt when it is done
+        twi_end_transfer();
+        twi_bus_owned = 0;
+        if (!(control & (1<<TWSTA))) return;
+    }
+
+    if (control & (1<<TWSTA)) {
+        twi_end_transfer();
+        twi_next_status = twi_bus_owned ? TW_REP_START : TW_START;
+        twi_bus_owned = 1;
+        bits = TWI_START_BITS;
+    } else if (!twi_bus_owned) {
+        return;
+    } else if ((TW_STATUS == TW_START) || (TW_STATUS == TW_REP_START)) {
+        // Address the peripheral
+        uint8_t sla = sim_io[ADDR_TWDR];
+        twi_reading = sla & TW_READ;
+        twi_device = NULL;
+        for (uint8_t i = 0; i < num_i2c_devices; i++) {
+            if (i2c_devices[i]->address == (sla >> 1)) {
+                twi_device = i2c_devices[i];
+            }
+        }
+        if (twi_device != NULL) {
+            twi_device->start(twi_device, twi_reading);
+            twi_next_status = twi_reading ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+        } else {
+            twi_next_status = twi_reading ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+        }
+    } else if (twi_device == NULL) {
+        twi_next_status = twi_reading ? TW_MR_DATA_NACK : TW_MT_DATA_NACK;
+    } else if (twi_reading) {
+        uint8_t ack = !!(control & (1<<TWEA));
+        twi_next_data = twi_device->read(twi_device, ack);
+        twi_next_status = ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+        sim_stats.i2c_bytes++;
+    } else {
+        twi_next_status = twi_device->write(twi_device, sim_io[ADDR_TWDR]) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK;
+        sim_stats.i2c_bytes++;
+    }
+
+    twi_operation.fn = twi_done;
+    sim_timer_start(&twi_operation, sim_cycles + (bits * twi_bit_cycles()));
+}
+
+static void twi_control_written(uint8_t previous)
+{
+    uint8_t control = sim_io[ADDR_TWCR];
+    if (!(control & (1<<TWEN))) {
+        sim_timer_stop(&twi_operation);
+        twi_end_transfer();
+        twi_bus_owned = 0;
+        set_reg(ADDR_TWCR, control & ~(1<<TWINT));
+        return;
+    }
+    if (control & (1<<TWINT)) {
+        // Writing a one clears the flag and starts the next operation
+        set_reg(ADDR_TWCR, control & ~((1<<TWINT) | (1<<TWSTO)));
+        twi_start_operation(control);
+    } else {
+        // Writing a zero leaves the flag alone
+        set_reg(ADDR_TWCR, control | (previous & (1<<TWINT)));
+    }
+}
+
+// MARK: ADC
+static void adc_done(void *context)
+{
+    uint16_t value = sim_adc_input[sim_io[ADDR_ADMUX] & 0x07] & 0x3FF;
+    set_reg(ADDR_ADCL, value & 0xFF);
+    set_reg(ADDR_ADCH, value >> 8);
+    clear_bits(ADDR_ADCSRA, (1<<ADSC));
+    set_bits(ADDR_ADCSRA, (1<<ADIF));
+}
+
+static void adc_control_written(uint8_t previous)
+{
+    uint8_t control = sim_io[ADDR_ADCSRA];
+    // Writing a one to ADIF clears it, ADSC can not be cleared by writing
+    control = (control & ~(1<<ADIF)) | (previous & ~control & (1<<ADIF));
+    if (!(control & (1<<ADEN))) {
+        sim_timer_stop(&adc_conversion);
+        control &= ~(1<<ADSC);
+    } else if ((control & (1<<ADSC)) && !adc_conversion.active) {
+        // 13 ADC clock cycles, 25 for the first conversion after the ADC is enabled
+        uint16_t prescaler = 1 << (control & 0x07);
+        if (prescaler == 1) prescaler = 2;
+        uint8_t clocks = (previous & (1<<ADEN)) ? 13 : 25;
+        adc_conversion.fn = adc_done;
+        sim_timer_start(&adc_conversion, sim_cycles + ((uint32_t)clocks * prescaler));
+    } else if (adc_conversion.active) {
+        control |= (1<<ADSC);
+    }
+    set_reg(ADDR_ADCSRA, control);
+    check_interupts = 1;
+}
+
+// MARK: EEPROM
+static void eeprom_write_done(void *context)
+{
+    sim_eeprom[eeprom_write_address] = eeprom_write_data;
+    clear_bits(ADDR_EECR, (1<<EEPE));
+    check_interupts = 1;
+    update_wake();
+}
+
+static void eeprom_control_written(uint8_t previous)
+{
+    uint8_t control = sim_io[ADDR_EECR];
+    uint16_t address = (sim_io[ADDR_EEARL] | (sim_io[ADDR_EEARH] << 8)) % SIM_EEPROM_SIZE;
+
+    if (eeprom_write.active) {
+        // EEPE stays set until the write is done and reads are ignored
+        control |= (1<<EEPE);
+        control &= ~(1<<EERE);
+    }
+    if (control & (1<<EERE)) {
+        // The CPU is halted for 4 cycles while the byte is read
+        set_reg(ADDR_EEDR, sim_eeprom[address]);
+        sim_cycles += 4;
+        control &= ~(1<<EERE);
+    }
+    if ((control & (1<<EEPE)) && !eeprom_write.active) {
+        if (!(previous & (1<<EEMPE))) {
+            // Write was not enabled
+            control &= ~(1<<EEPE);
+        } else {
+            eeprom_write_address = address;
+            eeprom_write_data = sim_io[ADDR_EEDR];
+            eeprom_write.fn = eeprom_write_done;
+            sim_timer_start(&eeprom_write, sim_cycles + EEPROM_WRITE_CYCLES);
+        }
+        control &= ~(1<<EEMPE);
+    }
+    set_reg(ADDR_EECR, control);
+    check_interupts = 1;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address)
+{
+    return sim_eeprom[(uintptr_t)address % SIM_EEPROM_SIZE];
+}
+
+// MARK: UARTs
+static uint32_t uart_byte_cycles(uint8_t n)
+{
+    uint16_t ubrr = sim_io[ADDR_UBRRL(n)] | ((sim_io[ADDR_UBRRH(n)] & 0x0F) << 8);
+    uint8_t samples = (sim_io[ADDR_UCSRA(n)] & (1<<U2X0)) ? 8 : 16;
+    // Start bit, 8 data bits and a stop bit
+    return 10UL * samples * (ubrr + 1);
+}
+
+static void uart_transmit_done(void *context)
+{
+    uint8_t n = (uint8_t)(uintptr_t)context;
+    if (uarts[n].tx != NULL) {
+        uarts[n].tx(uarts[n].context, uarts[n].tx_data);
+    }
+    set_bits(ADDR_UCSRA(n), (1<<TXC0) | (1<<UDRE0));
+}
+
+static void uart_data_written(uint8_t n)
+{
+    if (!(sim_io[ADDR_UCSRB(n)] & (1<<TXEN0))) return;
+
+    // The transmit buffer is not modeled, each byte is sent on its own
+    uarts[n].tx_data = sim_io[ADDR_UDR(n)];
+    clear_bits(ADDR_UCSRA(n), (1<<UDRE0) | (1<<TXC0));
+    uarts[n].transmit.fn = uart_transmit_done;
+    uarts[n].transmit.context = (void*)(uintptr_t)n;
+    sim_timer_start(&uarts[n].transmit, sim_cycles + uart_byte_cycles(n));
+}
+
+static void uart_receive(void *context)
+{
+    uint8_t n = (uint8_t)(uintptr_t)context;
+    if (uarts[n].rx_count == 0) return;
+
+    uint8_t byte = uarts[n].rx_queue[uarts[n].rx_head];
+    uarts[n].rx_head = (uarts[n].rx_head + 1) % UART_RX_LENGTH;
+    uarts[n].rx_count--;
+
+    if (sim_io[ADDR_UCSRB(n)] & (1<<RXEN0)) {
+        if (sim_io[ADDR_UCSRA(n)] & (1<<RXC0)) {
+            // The last byte has not been read, this one is lost
+            sim_stats.uart_overruns[n]++;
+            set_bits(ADDR_UCSRA(n), (1<<DOR0));
+        } else {
+            uarts[n].rx_data = byte;
+            set_bits(ADDR_UCSRA(n), (1<<RXC0));
+        }
+    }
+    if (uarts[n].rx_count != 0) {
+        sim_timer_start(&uarts[n].receive, sim_cycles + uart_byte_cycles(n));
+    }
+}
+
+static void uart_data_read(uint8_t n)
+{
+    set_reg(ADDR_UDR(n), uarts[n].rx_data);
+    clear_bits(ADDR_UCSRA(n), (1<<RXC0) | (1<<DOR0));
+}
+
+void sim_uart_attach(uint8_t uart, void (*tx)(void *context, uint8_t byte), void *context)
+{
+    uarts[uart].tx = tx;
+    uarts[uart].context = context;
+}
+
+void sim_uart_send(uint8_t uart, const uint8_t *data, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++) {
+        if (uarts[uart].rx_count == UART_RX_LENGTH) {
+            sim_fail("UART %u receive queue is full", uart);
+        }
+        uarts[uart].rx_queue[(uarts[uart].rx_head + uarts[uart].rx_count) % UART_RX_LENGTH] = data[i];
+        uarts[uart].rx_count++;
+    }
+    if (!uarts[uart].receive.active && (uarts[uart].rx_count != 0)) {
+        uarts[uart].receive.fn = uart_receive;
+        uarts[uart].receive.context = (void*)(uintptr_t)uart;
+        sim_timer_start(&uarts[uart].receive, sim_cycles + uart_byte_cycles(uart));
+    }
+}
+
+// MARK: Buses
+void sim_spi_attach(struct sim_spi_device *device)
+{
+    if (num_spi_devices == MAX_SPI_DEVICES) {
+        sim_fail("too many SPI devices");
+    }
+    device->selected = 0;
+    spi_devices[num_spi_devices++] = device;
+}
+
+void sim_i2c_attach(struct sim_i2c_device *device)
+{
+    if (num_i2c_devices == MAX_I2C_DEVICES) {
+        sim_fail("too many I2C devices");
+    }
+    i2c_devices[num_i2c_devices++] = device;
+}
+
+// MARK: Register access
+/**
+ *  Handle a write to a register once the store is done
+ */
+static void register_written(uint8_t addr)
+{
+    uint8_t previous = shadow[addr];
+    shadow[addr] = sim_io[addr];
+
+    switch (addr) {
+        case 0x20: case 0x23: case 0x26: case 0x29:
+            // Writing a one to a PIN register toggles the PORT bit
+            set_reg(addr + 2, sim_io[addr + 2] ^ sim_io[addr]);
+            update_pins((addr - 0x20) / 3);
+            break;
+        case 0x21: case 0x22: case 0x24: case 0x25: case 0x27: case 0x28: case 0x2A: case 0x2B:
+            update_pins((addr - 0x20) / 3);
+            break;
+        case ADDR_TIFR1:
+            // Flags are cleared by writing a one
+            set_reg(addr, previous & ~sim_io[addr]);
+            break;
+        case ADDR_EECR:
+            eeprom_control_written(previous);
+            break;
+        case ADDR_SPSR:
+            // Only SPI2X is writable
+            set_reg(addr, (previous & ~(1<<SPI2X)) | (sim_io[addr] & (1<<SPI2X)));
+            break;
+        case ADDR_SPDR:
+            spi_start();
+            break;
+        case ADDR_SREG:
+        case ADDR_TIMSK1:
+        case ADDR_SPCR:
+            check_interupts = 1;
+            break;
+        case ADDR_ADCSRA:
+            adc_control_written(previous);
+            break;
+        case ADDR_TCCR1B:
+        case ADDR_OCR1AL:
+        case ADDR_OCR1AH:
+            timer1_configure();
+            break;
+        case ADDR_TCNT1L:
+        case ADDR_TCNT1H:
+            timer1_base = sim_cycles - (uint64_t)(sim_io[ADDR_TCNT1L] | (sim_io[ADDR_TCNT1H] << 8)) * timer1_prescaler;
+            timer1_schedule();
+            break;
+        case ADDR_TWSR:
+            // Only the prescaler bits are writable
+            set_reg(addr, (previous & ~0x03) | (sim_io[addr] & 0x03));
+            break;
+        case ADDR_TWCR:
+            twi_control_written(previous);
+            break;
+        case 0xC0: case 0xC8:
+            // Only U2X is writable, TXC is cleared by writing a one
+            set_reg(addr, (previous & ~((1<<U2X0) | (sim_io[addr] & (1<<TXC0)))) | (sim_io[addr] & (1<<U2X0)));
+            break;
+        case 0xC1: case 0xC9:
+            check_interupts = 1;
+            break;
+        case 0xC6: case 0xCE:
+            uart_data_written((addr - 0xC0) / 8);
+            break;
+    }
+}
+
+/**
+ *  Update a register before it is read
+ */
+static void register_read(uint8_t addr)
+{
+    switch (addr) {
+        case 0x20: case 0x23: case 0x26: case 0x29:
+            set_reg(addr, pin_levels((addr - 0x20) / 3));
+            break;
+        case ADDR_TCNT1L:
+        case ADDR_TCNT1H:
+            timer1_read();
+            break;
+        case 0xC6: case 0xCE:
+            uart_data_read((addr - 0xC0) / 8);
+            break;
+    }
+}
+
+static void flush_pending(void)
+{
+    while (pending_size) {
+        uint8_t addr = pending_addr;
+        uint8_t size = pending_size;
+        pending_size = 0;
+        update_wake();
+        for (uint8_t i = 0; i < size; i++) {
+            register_written(addr + i);
+        }
+    }
+}
+
+/**
+ *  Catch up with simulated time: handle the last register write, run due events and dispatch interupts
+ */
+static void slow_path(void)
+{
+    flush_pending();
+    run_events();
+    if (check_interupts) {
+        dispatch_interupts();
+    }
+    update_wake();
+}
+
+void sim_sync(void)
+{
+    slow_path();
+    // Host code writes to the port registers without going through the hooks
+    for (uint8_t port = 0; port < sizeof(driven_pins); port++) {
+        update_pins(port);
+    }
+}
+
+void sim_idle(uint64_t cycles)
+{
+    uint64_t end = sim_cycles + cycles;
+    slow_path();
+    while (sim_cycles < end) {
+        sim_cycles = (next_event < end) ? next_event : end;
+        slow_path();
+    }
+}
+
+void sim_init(void)
+{
+    memset((void*)sim_io, 0, sizeof(sim_io));
+    memset(shadow, 0, sizeof(shadow));
+    // Power on reset, the SPI and TWI data registers and the UART data register empty flags are set
+    set_reg(0x54, (1<<PORF));
+    set_reg(ADDR_TWSR, TW_NO_INFO);
+    set_reg(ADDR_TWDR, 0xFF);
+    set_reg(ADDR_UCSRA(0), (1<<UDRE0));
+    set_reg(ADDR_UCSRA(1), (1<<UDRE1));
+    set_reg(ADDR_OCR1AL, 0);
+    memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+    recompute_next_event();
+}
+
+// MARK: Instrumentation hooks
+static inline uint8_t is_register(const void *address)
+{
+    return ((uintptr_t)address - (uintptr_t)sim_io) < sizeof(sim_io);
+}
+
+static inline void access(unsigned size)
+{
+    sim_cycles += COST_ACCESS + size;
+    if (sim_cycles >= wake) {
+        slow_path();
+    }
+}
+
+static inline void volatile_read(const void *address, unsigned size)
+{
+    sim_cycles += COST_ACCESS + size;
+    slow_path();
+    if (is_register(address)) {
+        uint8_t addr = (uintptr_t)address - (uintptr_t)sim_io;
+        for (unsigned i = 0; i < size; i++) {
+            register_read(addr + i);
+        }
+    }
+}
+
+static inline void volatile_write(const void *address, unsigned size)
+{
+    sim_cycles += COST_ACCESS + size;
+    slow_path();
+    if (is_register(address)) {
+        pending_addr = (uintptr_t)address - (uintptr_t)sim_io;
+        pending_size = size;
+        wake = 0;
+    }
+}
+
+/**
+ *  16 bit registers are accessed through a pointer which gcc can not prove is aligned, these accesses are instrumented
+ *  as unaligned or range accesses and lose their volatile qualifier
+ */
+static inline void unaligned_read(const void *address, unsigned size)
+{
+    if (is_register(address)) {
+        volatile_read(address, size);
+    } else {
+        access((size > 4) ? 4 : size);
+    }
+}
+
+static inline void unaligned_write(const void *address, unsigned size)
+{
+    if (is_register(address)) {
+        volatile_write(address, size);
+    } else {
+        access((size > 4) ? 4 : size);
+    }
+}
+
+void __tsan_init(void) {}
+void __tsan_func_entry(void *caller) { sim_cycles += COST_CALL; if (sim_cycles >= wake) slow_path(); }
+void __tsan_func_exit(void) { if (sim_cycles >= wake) slow_path(); }
+
+void __tsan_read1(void *p) { access(1); }
+void __tsan_read2(void *p) { access(2); }
+void __tsan_read4(void *p) { access(4); }
+void __tsan_read8(void *p) { access(4); }
+void __tsan_read16(void *p) { access(4); }
+void __tsan_write1(void *p) { access(1); }
+void __tsan_write2(void *p) { access(2); }
+void __tsan_write4(void *p) { access(4); }
+void __tsan_write8(void *p) { access(4); }
+void __tsan_write16(void *p) { access(4); }
+void __tsan_unaligned_read2(void *p) { unaligned_read(p, 2); }
+void __tsan_unaligned_read4(void *p) { unaligned_read(p, 4); }
+void __tsan_unaligned_read8(void *p) { unaligned_read(p, 8); }
+void __tsan_unaligned_read16(void *p) { unaligned_read(p, 16); }
+void __tsan_unaligned_write2(void *p) { unaligned_write(p, 2); }
+void __tsan_unaligned_write4(void *p) { unaligned_write(p, 4); }
+void __tsan_unaligned_write8(void *p) { unaligned_write(p, 8); }
+void __tsan_unaligned_write16(void *p) { unaligned_write(p, 16); }
+void __tsan_read_range(void *p, unsigned long size) { unaligned_read(p, size); }
+void __tsan_write_range(void *p, unsigned long size) { unaligned_write(p, size); }
+
+void __tsan_volatile_read1(void *p) { volatile_read(p, 1); }
+void __tsan_volatile_read2(void *p) { volatile_read(p, 2); }
+void __tsan_volatile_read4(void *p) { volatile_read(p, 4); }
+void __tsan_volatile_read8(void *p) { volatile_read(p, 8); }
+void __tsan_volatile_read16(void *p) { volatile_read(p, 16); }
+void __tsan_volatile_write1(void *p) { volatile_write(p, 1); }
+void __tsan_volatile_write2(void *p) { volatile_write(p, 2); }
+void __tsan_volatile_write4(void *p) { volatile_write(p, 4); }
+void __tsan_volatile_write8(void *p) { volatile_write(p, 8); }
+void __tsan_volatile_write16(void *p) { volatile_write(p, 16); }
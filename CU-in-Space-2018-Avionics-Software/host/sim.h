@@ -0,0 +1,202 @@
+//
+//  sim.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated ATmega1284P peripherals for running the firmware on a host
+//
+//  Firmware sources are compiled with -fsanitize=thread but linked without the thread sanitizer runtime. The
+//  instrumentation calls the hooks in sim.c before every memory access and function entry, which is used to count
+//  simulated CPU cycles, to see each register access as it happens and to run interupt service routines between
+//  accesses, as the AVR does between instructions.
+//
+
+#ifndef sim_h
+#define sim_h
+
+#include <stdint.h>
+
+
+// MARK: Constants
+#define SIM_F_CPU           12000000UL  // The simulated system clock in Hz
+
+#define SIM_PORT_A          0
+#define SIM_PORT_B          1
+#define SIM_PORT_C          2
+#define SIM_PORT_D          3
+
+#define SIM_UART_0          0
+#define SIM_UART_1          1
+
+#define SIM_EEPROM_SIZE     4096        // The size of the internal EEPROM in bytes
+
+// MARK: Types
+/**
+ *  An event which is run once the simulated clock reaches a given cycle
+ */
+struct sim_timer {
+    /** The cycle at which the event is run */
+    uint64_t at;
+    /** The function which is called when the event is run */
+    void (*fn)(void *context);
+    /** The pointer passed to fn */
+    void *context;
+    /** 1 while the event is scheduled */
+    uint8_t active;
+};
+
+/**
+ *  A peripheral on the SPI bus, selected by an active low chip select pin
+ */
+struct sim_spi_device {
+    /** The port and pin number of the chip select pin */
+    uint8_t cs_port;
+    uint8_t cs_num;
+    /** Called when the chip select pin changes, may be NULL */
+    void (*select)(struct sim_spi_device *device, uint8_t selected);
+    /** Called for each byte exchanged while selected, returns the byte shifted out by the peripheral */
+    uint8_t (*exchange)(struct sim_spi_device *device, uint8_t out);
+    /** 1 while the chip select pin is asserted */
+    uint8_t selected;
+};
+
+/**
+ *  A peripheral on the I2C bus
+ */
+struct sim_i2c_device {
+    /** The 7 bit address of the peripheral */
+    uint8_t address;
+    /** Called when the peripheral is addressed, read is 1 for a read */
+    void (*start)(struct sim_i2c_device *device, uint8_t read);
+    /** Called for each byte written to the peripheral, returns 1 to acknowledge it */
+    uint8_t (*write)(struct sim_i2c_device *device, uint8_t byte);
+    /** Called for each byte read from the peripheral, ack is 0 for the last byte of a read */
+    uint8_t (*read)(struct sim_i2c_device *device, uint8_t ack);
+    /** Called at a stop condition or a repeated start, may be NULL */
+    void (*stop)(struct sim_i2c_device *device);
+};
+
+/**
+ *  Counters kept by the simulator
+ */
+struct sim_stats {
+    /** The number of times that each interupt vector has been run, in the order of sim_vector_name */
+    uint32_t interupts[9];
+    /** The number of times the watchdog timer was reset, which happens once per iteration of the main loop */
+    uint64_t wdt_resets;
+    /** The number of bytes exchanged over each bus */
+    uint64_t spi_bytes;
+    uint64_t i2c_bytes;
+    /** The number of SPI bytes which were exchanged with more than one chip select asserted */
+    uint64_t spi_conflicts;
+    /** The number of bytes received by each UART which were lost because the last one had not been read */
+    uint32_t uart_overruns[2];
+};
+
+// MARK: Variables
+/** The number of CPU cycles which have been simulated */
+extern uint64_t sim_cycles;
+
+/** The contents of the internal EEPROM */
+extern uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+
+/** The 10 bit value returned by each ADC channel */
+extern uint16_t sim_adc_input[8];
+
+/** Counters kept by the simulator */
+extern struct sim_stats sim_stats;
+
+// MARK: Function declarations
+/**
+ *  Reset the simulated microcontroller, must be called before any firmware code is run
+ */
+extern void sim_init(void);
+
+/**
+ *  Convert a time to a number of CPU cycles
+ */
+static inline uint64_t sim_ms(double ms)
+{
+    return (uint64_t)(ms * (SIM_F_CPU / 1000));
+}
+
+/**
+ *  Get the simulated time in seconds
+ */
+extern double sim_time(void);
+
+/**
+ *  Schedule an event, an event which is already scheduled is moved
+ */
+extern void sim_timer_start(struct sim_timer *timer, uint64_t at);
+
+/**
+ *  Cancel an event
+ */
+extern void sim_timer_stop(struct sim_timer *timer);
+
+/**
+ *  Stop the simulation once the simulated clock reaches a given cycle
+ *  @param at The cycle at which to stop
+ *  @param on_stop Called before the process exits with status 0, may be NULL
+ */
+extern void sim_stop_at(uint64_t at, void (*on_stop)(void));
+
+/**
+ *  Report an error and exit with status 1
+ */
+extern void sim_fail(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+/**
+ *  Finish any register write made by firmware code and run events which are due. Must be called by host code which
+ *  calls into firmware code and then looks at the simulated peripherals, or which sets up pins through the port
+ *  registers itself.
+ */
+extern void sim_sync(void);
+
+/**
+ *  Let simulated time pass without running firmware code other than interupt service routines
+ */
+extern void sim_idle(uint64_t cycles);
+
+/**
+ *  Set the level driven onto a pin from outside the microcontroller
+ */
+extern void sim_drive_pin(uint8_t port, uint8_t num, uint8_t level);
+
+/**
+ *  Get the level of an output pin, or 0 if the pin is an input
+ */
+extern uint8_t sim_output_pin(uint8_t port, uint8_t num);
+
+/**
+ *  Call a function whenever the level driven by the microcontroller on a pin changes
+ */
+extern void sim_watch_pin(uint8_t port, uint8_t num, void (*fn)(void *context, uint8_t level), void *context);
+
+/**
+ *  Connect a peripheral to the SPI bus
+ */
+extern void sim_spi_attach(struct sim_spi_device *device);
+
+/**
+ *  Connect a peripheral to the I2C bus
+ */
+extern void sim_i2c_attach(struct sim_i2c_device *device);
+
+/**
+ *  Call a function for every byte transmitted by a UART
+ */
+extern void sim_uart_attach(uint8_t uart, void (*tx)(void *context, uint8_t byte), void *context);
+
+/**
+ *  Queue bytes to be received by a UART, they arrive back to back at the configured baud rate
+ */
+extern void sim_uart_send(uint8_t uart, const uint8_t *data, uint16_t length);
+
+/**
+ *  Get the name of an interupt vector by its index in sim_stats.interupts
+ */
+extern const char *sim_vector_name(uint8_t index);
+
+
+#endif /* sim_h */
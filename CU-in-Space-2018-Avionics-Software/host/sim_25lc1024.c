@@ -0,0 +1,144 @@
+//
+//  sim_25lc1024.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated 25LC1024 SPI EEPROM
+//
+
+#include "sim_devices.h"
+
+#include <string.h>
+
+#include "25LC1024-Commands.h"
+
+#define WRITE_CYCLE_MS      5.0     // Maximum page write time
+#define ERASE_CYCLE_MS      10.0    // Maximum chip erase time
+#define SIGNATURE           0x29    // Electronic signature returned by RDID
+
+static uint8_t is_busy(struct sim_25lc1024 *chip)
+{
+    return sim_cycles < chip->busy_until;
+}
+
+static void select(struct sim_spi_device *device, uint8_t selected)
+{
+    struct sim_25lc1024 *chip = (struct sim_25lc1024 *)device;
+
+    if (selected) {
+        chip->count = 0;
+        chip->command = 0;
+        chip->address = 0;
+        memset(chip->page_loaded, 0, sizeof(chip->page_loaded));
+        return;
+    }
+
+    // Commands take effect when CS is released, and only once the whole command has been clocked in
+    switch (chip->command) {
+        case WREN:
+            chip->write_enabled = 1;
+            break;
+        case WRDI:
+            chip->write_enabled = 0;
+            break;
+        case DPD:
+            chip->asleep = 1;
+            break;
+        case RDID:
+            chip->asleep = 0;
+            break;
+        case CE:
+            if (!chip->write_enabled) {
+                chip->errors++;
+                break;
+            }
+            memset(chip->memory, 0xFF, sizeof(chip->memory));
+            chip->write_enabled = 0;
+            chip->write_cycles++;
+            chip->busy_until = sim_cycles + sim_ms(ERASE_CYCLE_MS);
+            break;
+        case WRITE:
+            if (chip->count <= 4) break;
+            if (!chip->write_enabled) {
+                chip->errors++;
+                break;
+            }
+            for (uint16_t i = 0; i < 256; i++) {
+                if (chip->page_loaded[i / 8] & (1 << (i % 8))) {
+                    chip->memory[chip->page_address | i] = chip->page[i];
+                }
+            }
+            chip->write_enabled = 0;
+            chip->write_cycles++;
+            chip->busy_until = sim_cycles + sim_ms(WRITE_CYCLE_MS);
+            break;
+    }
+    chip->command = 0;
+}
+
+static uint8_t exchange(struct sim_spi_device *device, uint8_t out)
+{
+    struct sim_25lc1024 *chip = (struct sim_25lc1024 *)device;
+    uint32_t index = chip->count++;
+
+    if (index == 0) {
+        chip->command = out;
+        if (chip->asleep && (out != RDID)) {
+            // Only RDID wakes the part from deep power-down
+            chip->errors++;
+            chip->command = 0;
+        } else if (is_busy(chip) && (out != RDSR)) {
+            // Only RDSR is accepted during a write cycle
+            chip->errors++;
+            chip->command = 0;
+        }
+        return 0xFF;
+    }
+
+    switch (chip->command) {
+        case RDSR:
+            return (is_busy(chip) << SR_WIP) | (chip->write_enabled << SR_WEL);
+        case RDID:
+            // A dummy address is followed by the signature
+            return (index >= 4) ? SIGNATURE : 0xFF;
+        case READ:
+            if (index < 4) {
+                chip->address = ((chip->address << 8) | out) & MAX_ADDRESS;
+                return 0xFF;
+            }
+            chip->bytes_read++;
+            {
+                uint8_t data = chip->memory[chip->address];
+                chip->address = (chip->address + 1) & MAX_ADDRESS;
+                return data;
+            }
+        case WRITE:
+            if (index < 4) {
+                chip->address = ((chip->address << 8) | out) & MAX_ADDRESS;
+                chip->page_address = chip->address & ~0xFFUL;
+                return 0xFF;
+            }
+            if ((index > 4) && ((chip->address & 0xFF) == 0)) {
+                // The address wraps to the start of the page, overwriting data from this command
+                chip->errors++;
+            }
+            chip->page[chip->address & 0xFF] = out;
+            chip->page_loaded[(chip->address & 0xFF) / 8] |= 1 << (chip->address % 8);
+            chip->address = chip->page_address | ((chip->address + 1) & 0xFF);
+            chip->bytes_written++;
+            return 0xFF;
+        default:
+            return 0xFF;
+    }
+}
+
+void sim_25lc1024_init(struct sim_25lc1024 *chip, uint8_t cs_port, uint8_t cs_num)
+{
+    memset(chip, 0, sizeof(*chip));
+    memset(chip->memory, 0xFF, sizeof(chip->memory));
+    chip->asleep = 1;
+    chip->spi.cs_port = cs_port;
+    chip->spi.cs_num = cs_num;
+    chip->spi.select = select;
+    chip->spi.exchange = exchange;
+    sim_spi_attach(&chip->spi);
+}
@@ -0,0 +1,145 @@
+//
+//  sim_adxl343.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated ADXL343 accelerometer in full resolution mode with its FIFO
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "Accel-ADXL343-Registers.h"
+
+#define DEVICE_ID       0xE5
+#define LSB_PER_G       256.0   // Full resolution mode
+#define OFFSET_LSB      4       // Each offset register LSB is 15.6 mg
+
+#define FIFO_BYPASS     0
+#define FIFO_FIFO       1
+#define FIFO_STREAM     2
+
+static uint8_t fifo_mode(struct sim_adxl343 *accel)
+{
+    return accel->dev.regs[FIFO_CTL] >> 6;
+}
+
+/**
+ *  Show the oldest FIFO entry in the data registers and update the FIFO status and interupt
+ */
+static void update(struct sim_adxl343 *accel)
+{
+    uint8_t *regs = accel->dev.regs;
+
+    if (accel->fifo_count != 0) {
+        int16_t *entry = accel->fifo[accel->fifo_head];
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            regs[DATAX0 + (2 * axis)] = entry[axis] & 0xFF;
+            regs[DATAX1 + (2 * axis)] = (entry[axis] >> 8) & 0xFF;
+        }
+    }
+    // The entry in the data registers is counted
+    regs[FIFO_STATUS] = accel->fifo_count;
+
+    uint8_t watermark = (fifo_mode(accel) != FIFO_BYPASS) &&
+                        (accel->fifo_count >= (regs[FIFO_CTL] & FIFO_CTL_SAMPLE_MSK));
+    regs[INT_SOURCE] = watermark ? (1<<INT_EN_WATERMARK) : 0;
+
+    uint8_t asserted = (regs[INT_SOURCE] & regs[INT_ENABLE] & ~regs[INT_MAP]) != 0;
+    uint8_t active_low = !!(regs[DATA_FORMAT] & (1<<D_F_INT_INVERT));
+    sim_drive_pin(accel->int_port, accel->int_num, asserted != active_low);
+}
+
+static void take_sample(void *context)
+{
+    struct sim_adxl343 *accel = context;
+    uint8_t *regs = accel->dev.regs;
+
+    uint8_t rate_code = regs[BW_RATE] & BW_RATE_DATA_MASK;
+    double rate = 3200.0 / (1 << (0x0F - rate_code));
+    sim_timer_start(&accel->sample, accel->sample.at + (uint64_t)(SIM_F_CPU / rate));
+
+    if (!(regs[POWER_CTL] & (1<<PWR_CTL_MEASURE))) return;
+
+    int16_t value[3];
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        double lsb = (sim_world.accel[axis] * LSB_PER_G) + ((int8_t)regs[OFSX + axis] * OFFSET_LSB);
+        // 16 g range in full resolution mode is 13 bits
+        if (lsb > 4095) lsb = 4095;
+        if (lsb < -4096) lsb = -4096;
+        value[axis] = (int16_t)lround(lsb);
+    }
+    accel->samples++;
+
+    if (fifo_mode(accel) == FIFO_BYPASS) {
+        // The data registers hold the latest sample
+        accel->fifo_head = 0;
+        accel->fifo_count = 0;
+        memcpy(accel->fifo[0], value, sizeof(value));
+        accel->fifo_count = 1;
+        update(accel);
+        accel->fifo_count = 0;
+        regs[FIFO_STATUS] = 0;
+        return;
+    }
+
+    if (accel->fifo_count == SIM_FIFO_LENGTH) {
+        accel->overruns++;
+        if (fifo_mode(accel) != FIFO_STREAM) return;
+        // Stream mode overwrites the oldest entry
+        accel->fifo_head = (accel->fifo_head + 1) % SIM_FIFO_LENGTH;
+        accel->fifo_count--;
+    }
+    memcpy(accel->fifo[(accel->fifo_head + accel->fifo_count) % SIM_FIFO_LENGTH], value, sizeof(value));
+    accel->fifo_count++;
+    update(accel);
+}
+
+static void before_read(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_adxl343 *accel = (struct sim_adxl343 *)device;
+    if ((reg >= DATAX0) && (reg <= DATAZ1)) {
+        accel->data_read = 1;
+    }
+}
+
+static void after_write(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_adxl343 *accel = (struct sim_adxl343 *)device;
+    if ((reg == FIFO_CTL) && (fifo_mode(accel) == FIFO_BYPASS)) {
+        // Bypass mode empties the FIFO
+        accel->fifo_count = 0;
+    }
+    update(accel);
+}
+
+static void end(struct sim_i2c_registers *device)
+{
+    struct sim_adxl343 *accel = (struct sim_adxl343 *)device;
+
+    // The FIFO is popped once a read of the data registers is finished
+    if (accel->data_read && (accel->fifo_count != 0) && (fifo_mode(accel) != FIFO_BYPASS)) {
+        accel->fifo_head = (accel->fifo_head + 1) % SIM_FIFO_LENGTH;
+        accel->fifo_count--;
+        update(accel);
+    }
+    accel->data_read = 0;
+}
+
+void sim_adxl343_init(struct sim_adxl343 *accel, uint8_t int_port, uint8_t int_num)
+{
+    memset(accel, 0, sizeof(*accel));
+    accel->int_port = int_port;
+    accel->int_num = int_num;
+    accel->dev.regs[DEVID] = DEVICE_ID;
+    accel->dev.regs[BW_RATE] = 0x0A;
+    accel->dev.before_read = before_read;
+    accel->dev.after_write = after_write;
+    accel->dev.end = end;
+    accel->sample.fn = take_sample;
+    accel->sample.context = accel;
+    sim_i2c_registers_attach(&accel->dev, ADDRESS);
+    sim_timer_start(&accel->sample, sim_cycles + sim_ms(10));
+    update(accel);
+}
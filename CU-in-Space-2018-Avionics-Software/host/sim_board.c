@@ -0,0 +1,35 @@
+//
+//  sim_board.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  The simulated peripherals of the avionics board, attached at the pins given in pindefinitions.h
+//
+
+#include "sim_devices.h"
+
+#include <avr/io.h>
+#include "pindefinitions.h"
+
+extern uint8_t mcusr_mirror;
+
+void sim_board_init(struct sim_board *board, uint8_t armed)
+{
+    sim_init();
+    sim_25lc1024_init(&board->eeprom[0], SIM_PORT_B, EEPROM_CS_NUM);
+    sim_25lc1024_init(&board->eeprom[1], SIM_PORT_B, EEPROM2_CS_NUM);
+    sim_xbee_init(&board->xbee, SIM_PORT_B, RADIO_CS_NUM, SIM_PORT_B, RADIO_ATTN_NUM);
+    sim_mpl3115a2_init(&board->baro, SIM_PORT_C, ALT_INT_NUM);
+    sim_adxl343_init(&board->accel, SIM_PORT_C, ACCEL_INT_NUM);
+    sim_fxas21002c_init(&board->gyro, SIM_PORT_C, GYRO_INT_NUM);
+    sim_gps_init(&board->gps, SIM_UART_1);
+
+    // Sitting on the pad after a power on reset with the reset jumper shorted
+    sim_drive_pin(SIM_PORT_C, RESET_JUMPER_NUM, 0);
+    // The e-match sense inputs read high through connected e-matches
+    sim_drive_pin(SIM_PORT_D, EMATCH_SENSE_1_NUM, armed);
+    sim_drive_pin(SIM_PORT_D, EMATCH_SENSE_2_NUM, armed);
+    sim_adc_set_voltage(BAT_REF_ANALOG_PIN, 9.0 / 2.935);
+    sim_adc_set_voltage(TEMP_1_ANALOG_PIN, 2.5);
+    sim_adc_set_voltage(TEMP_2_ANALOG_PIN, 2.5);
+    mcusr_mirror = (1<<PORF);
+}
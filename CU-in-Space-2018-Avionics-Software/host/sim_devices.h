@@ -0,0 +1,291 @@
+//
+//  sim_devices.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated peripherals attached to the simulated microcontroller in sim.c, and the flight which they measure
+//
+
+#ifndef sim_devices_h
+#define sim_devices_h
+
+#include "sim.h"
+
+#include <stdio.h>
+
+
+// MARK: World
+/**
+ *  The physical state measured by the sensors, updated by the flight model in sim_flight.c
+ */
+struct sim_world {
+    /** Height above the launch site in meters */
+    double altitude;
+    /** Height of the launch site above sea level in meters */
+    double ground_altitude;
+    /** Acceleration measured by the accelerometer in g, z is along the rocket's axis and is 1 at rest on the pad */
+    double accel[3];
+    /** Angular rate in degrees per second around the x (roll), y (pitch) and z (yaw) axes of the gyroscope */
+    double rate[3];
+    /** Air temperature in degrees C */
+    double temperature;
+    /** Position and velocity reported by the GPS, in degrees and knots */
+    double latitude;
+    double longitude;
+    double speed;
+    double course;
+    /** 1 if the GPS has a fix */
+    uint8_t gps_fix;
+};
+
+extern struct sim_world sim_world;
+
+// MARK: 25LC1024 EEPROM
+#define SIM_25LC1024_SIZE   0x20000
+
+struct sim_25lc1024 {
+    struct sim_spi_device spi;
+    /** The contents of the memory array */
+    uint8_t memory[SIM_25LC1024_SIZE];
+    /** The page buffer for the write command in progress */
+    uint8_t page[256];
+    /** The command in progress, its address and the number of bytes exchanged since CS was asserted */
+    uint8_t command;
+    uint32_t address;
+    uint32_t count;
+    /** The page being written by the command in progress */
+    uint32_t page_address;
+    /** The bits of page which have been loaded for the command in progress */
+    uint8_t page_loaded[32];
+    /** 1 while in deep power-down */
+    uint8_t asleep;
+    /** The write enable latch */
+    uint8_t write_enabled;
+    /** The cycle at which the current write cycle ends */
+    uint64_t busy_until;
+    /** The number of commands which would have been ignored or corrupted memory on the real part */
+    uint32_t errors;
+    /** The number of write cycles and the number of bytes written and read */
+    uint32_t write_cycles;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+};
+
+/**
+ *  Attach a simulated 25LC1024, it starts in deep power-down with the memory erased
+ */
+extern void sim_25lc1024_init(struct sim_25lc1024 *chip, uint8_t cs_port, uint8_t cs_num);
+
+// MARK: XBee
+#define SIM_XBEE_NP     84  // The largest RF payload in bytes (the NP parameter) with encryption off
+
+struct sim_xbee {
+    struct sim_spi_device spi;
+    /** The active low attention pin */
+    uint8_t attn_port;
+    uint8_t attn_num;
+    /** The API frame being received from the microcontroller */
+    uint8_t in[512];
+    uint16_t in_length;
+    /** API frames waiting to be sent to the microcontroller */
+    uint8_t out[512];
+    uint16_t out_head;
+    uint16_t out_count;
+    /** Called with the RF payload of each transmit request which fits in NP, may be NULL */
+    void (*on_payload)(void *context, const uint8_t *payload, uint8_t length);
+    void *context;
+    /** Counters */
+    uint32_t frames;
+    uint32_t transmit_requests;
+    uint32_t oversized;
+    uint32_t bad_checksums;
+    uint32_t largest_payload;
+    uint64_t payload_bytes;
+    /** The number of transmit status frames queued and the number of bytes of them read by the microcontroller */
+    uint32_t statuses;
+    uint64_t bytes_read;
+};
+
+/**
+ *  Attach a simulated XBee in API mode on SPI
+ */
+extern void sim_xbee_init(struct sim_xbee *xbee, uint8_t cs_port, uint8_t cs_num, uint8_t attn_port, uint8_t attn_num);
+
+// MARK: Sensors
+/**
+ *  An I2C peripheral with an auto-incrementing register file
+ */
+struct sim_i2c_registers {
+    struct sim_i2c_device i2c;
+    uint8_t regs[256];
+    /** The register pointer */
+    uint8_t pointer;
+    /** 1 if the next byte written sets the register pointer */
+    uint8_t expect_pointer;
+    /** Called before a register is read and after a register is written */
+    void (*before_read)(struct sim_i2c_registers *device, uint8_t reg);
+    void (*after_write)(struct sim_i2c_registers *device, uint8_t reg);
+    /** Returns the register which follows reg in a burst */
+    uint8_t (*next)(struct sim_i2c_registers *device, uint8_t reg);
+    /** Called at the end of each transfer, may be NULL */
+    void (*end)(struct sim_i2c_registers *device);
+};
+
+struct sim_mpl3115a2 {
+    struct sim_i2c_registers dev;
+    struct sim_timer measurement;
+    uint8_t int_port;
+    uint8_t int_num;
+    uint8_t drdy;
+    uint32_t samples;
+};
+
+#define SIM_FIFO_LENGTH 32
+
+struct sim_adxl343 {
+    struct sim_i2c_registers dev;
+    struct sim_timer sample;
+    uint8_t int_port;
+    uint8_t int_num;
+    int16_t fifo[SIM_FIFO_LENGTH][3];
+    uint8_t fifo_head;
+    uint8_t fifo_count;
+    /** 1 if the data registers were read during the current transfer */
+    uint8_t data_read;
+    uint32_t samples;
+    uint32_t overruns;
+};
+
+struct sim_fxas21002c {
+    struct sim_i2c_registers dev;
+    struct sim_timer sample;
+    uint8_t int_port;
+    uint8_t int_num;
+    int16_t fifo[SIM_FIFO_LENGTH][3];
+    uint8_t fifo_head;
+    uint8_t fifo_count;
+    uint8_t overflow;
+    uint32_t samples;
+    uint32_t overruns;
+};
+
+extern void sim_mpl3115a2_init(struct sim_mpl3115a2 *baro, uint8_t int_port, uint8_t int_num);
+extern void sim_adxl343_init(struct sim_adxl343 *accel, uint8_t int_port, uint8_t int_num);
+extern void sim_fxas21002c_init(struct sim_fxas21002c *gyro, uint8_t int_port, uint8_t int_num);
+
+/**
+ *  Attach a register file peripheral to the I2C bus
+ */
+extern void sim_i2c_registers_attach(struct sim_i2c_registers *device, uint8_t address);
+
+// MARK: GPS
+struct sim_gps {
+    struct sim_timer fix;
+    /** The time between sentences in milliseconds, set by PMTK220 */
+    uint32_t period;
+    /** The command being received from the microcontroller */
+    char command[128];
+    uint8_t command_length;
+    uint32_t sentences;
+};
+
+/**
+ *  Attach a simulated GPS module to a UART, it sends RMC sentences from sim_world
+ */
+extern void sim_gps_init(struct sim_gps *gps, uint8_t uart);
+
+// MARK: Board
+/**
+ *  The peripherals on the avionics board
+ */
+struct sim_board {
+    struct sim_25lc1024 eeprom[2];
+    struct sim_xbee xbee;
+    struct sim_mpl3115a2 baro;
+    struct sim_adxl343 accel;
+    struct sim_fxas21002c gyro;
+    struct sim_gps gps;
+};
+
+/**
+ *  Reset the simulator and attach the board's peripherals, as if sitting on the pad after a power on reset with the
+ *  reset jumper shorted
+ *  @param armed Whether the e-matches are connected
+ */
+extern void sim_board_init(struct sim_board *board, uint8_t armed);
+
+// MARK: Flight
+/**
+ *  A flight as a table of samples which are interpolated, in the column order of the trace CSV format
+ */
+struct sim_trace_sample {
+    double time;            // s
+    double altitude;        // m above the launch site
+    double accel[3];        // g
+    double rate[3];         // degrees per second
+    double latitude;        // degrees
+    double longitude;       // degrees
+    double cap_voltage;     // V
+    double battery_voltage; // V
+};
+
+struct sim_trace {
+    struct sim_trace_sample *samples;
+    uint32_t length;
+    /** The time of the highest sample */
+    double apogee_time;
+    double apogee_altitude;
+};
+
+/**
+ *  Load a trace from a CSV file with the columns t,alt,ax,ay,az,gx,gy,gz,lat,lon,cap_v,batt_v
+ *  @return 0 if successful
+ */
+extern uint8_t sim_trace_load(struct sim_trace *trace, const char *path);
+
+/**
+ *  Parameters for a generated flight
+ */
+struct sim_flight_profile {
+    /** Time on the pad before ignition in seconds */
+    double pad_time;
+    /** Thrust acceleration and burn time */
+    double boost_accel;     // g
+    double burn_time;       // s
+    /** Drag coefficient divided by mass, in 1/m, applied as k * v^2 */
+    double drag;
+    /** Descent rate under the parachute in m/s */
+    double descent_rate;
+    /** Standard deviation of the noise added to accelerometer and altitude readings */
+    double accel_noise;     // g
+    double altitude_noise;  // m
+    /** Seed for the noise */
+    uint32_t seed;
+};
+
+/**
+ *  Generate a trace for a ballistic flight with sampling period dt
+ */
+extern void sim_trace_generate(struct sim_trace *trace, const struct sim_flight_profile *profile, double dt);
+
+/**
+ *  Write a trace as CSV
+ */
+extern void sim_trace_write(const struct sim_trace *trace, FILE *file);
+
+/**
+ *  Start updating sim_world and the analog inputs from a trace every millisecond, starting from the current time
+ */
+extern void sim_flight_start(const struct sim_trace *trace);
+
+/**
+ *  Get the time into the trace in seconds
+ */
+extern double sim_flight_time(void);
+
+/**
+ *  Set an ADC input from the voltage at the pin, the reference is AVCC at 5 V
+ */
+extern void sim_adc_set_voltage(uint8_t channel, double volts);
+
+
+#endif /* sim_devices_h */
@@ -0,0 +1,237 @@
+//
+//  sim_flight.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Flight traces which drive the simulated sensors
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pindefinitions.h"
+
+#define GRAVITY             9.80665 // m/s^2
+#define UPDATE_PERIOD_MS    1.0
+#define GROUND_ALTITUDE     1400.0  // m above sea level
+#define GROUND_TEMPERATURE  20.0    // degrees C
+#define LAPSE_RATE          0.0065  // degrees C per m
+
+#define CAP_DIVIDER         5.0     // The capacitor voltage is divided by 5 before the ADC
+#define BATTERY_DIVIDER     2.935   // The battery voltage is divided by 2.935 before the ADC
+
+struct sim_world sim_world = {
+    .ground_altitude = GROUND_ALTITUDE,
+    .accel = {0, 0, 1},
+    .temperature = GROUND_TEMPERATURE
+};
+
+static const struct sim_trace *flight;
+static uint64_t flight_start;
+static uint32_t flight_index;
+static struct sim_timer flight_update;
+
+// MARK: Traces
+static void find_apogee(struct sim_trace *trace)
+{
+    trace->apogee_time = 0;
+    trace->apogee_altitude = -INFINITY;
+    for (uint32_t i = 0; i < trace->length; i++) {
+        if (trace->samples[i].altitude > trace->apogee_altitude) {
+            trace->apogee_altitude = trace->samples[i].altitude;
+            trace->apogee_time = trace->samples[i].time;
+        }
+    }
+}
+
+static void append(struct sim_trace *trace, const struct sim_trace_sample *sample, uint32_t *capacity)
+{
+    if (trace->length == *capacity) {
+        *capacity = (*capacity != 0) ? (*capacity * 2) : 1024;
+        trace->samples = realloc(trace->samples, *capacity * sizeof(*trace->samples));
+        if (trace->samples == NULL) {
+            sim_fail("out of memory for trace");
+        }
+    }
+    trace->samples[trace->length++] = *sample;
+}
+
+uint8_t sim_trace_load(struct sim_trace *trace, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 1;
+
+    uint32_t capacity = 0;
+    char line[512];
+    memset(trace, 0, sizeof(*trace));
+    while (fgets(line, sizeof(line), file) != NULL) {
+        struct sim_trace_sample s;
+        // Lines which do not start with a number, such as the header, are skipped
+        if (sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf", &s.time, &s.altitude, &s.accel[0],
+                   &s.accel[1], &s.accel[2], &s.rate[0], &s.rate[1], &s.rate[2], &s.latitude, &s.longitude,
+                   &s.cap_voltage, &s.battery_voltage) != 12) {
+            continue;
+        }
+        append(trace, &s, &capacity);
+    }
+    fclose(file);
+
+    if (trace->length == 0) return 1;
+    find_apogee(trace);
+    return 0;
+}
+
+void sim_trace_write(const struct sim_trace *trace, FILE *file)
+{
+    fprintf(file, "t,alt,ax,ay,az,gx,gy,gz,lat,lon,cap_v,batt_v\n");
+    for (uint32_t i = 0; i < trace->length; i++) {
+        const struct sim_trace_sample *s = trace->samples + i;
+        fprintf(file, "%.4f,%.3f,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f,%.6f,%.6f,%.2f,%.2f\n", s->time, s->altitude,
+                s->accel[0], s->accel[1], s->accel[2], s->rate[0], s->rate[1], s->rate[2], s->latitude, s->longitude,
+                s->cap_voltage, s->battery_voltage);
+    }
+}
+
+/**
+ *  Normally distributed noise from a xorshift generator
+ */
+static double noise(uint32_t *state, double deviation)
+{
+    double u[2];
+    for (uint8_t i = 0; i < 2; i++) {
+        *state ^= *state << 13;
+        *state ^= *state >> 17;
+        *state ^= *state << 5;
+        u[i] = (*state + 1.0) / 4294967297.0;
+    }
+    return deviation * sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]);
+}
+
+void sim_trace_generate(struct sim_trace *trace, const struct sim_flight_profile *profile, double dt)
+{
+    uint32_t capacity = 0;
+    uint32_t seed = (profile->seed != 0) ? profile->seed : 1;
+    double altitude = 0;
+    double velocity = 0;
+    uint8_t launched = 0;
+    uint8_t past_apogee = 0;
+    double landed_time = -1;
+    double apogee_time = 0;
+    double apogee_altitude = 0;
+
+    memset(trace, 0, sizeof(*trace));
+    for (double t = 0; (landed_time < 0) || (t < landed_time + 5); t += dt) {
+        double flight_time = t - profile->pad_time;
+        // Specific force along the rocket's axis, which is what the accelerometer measures
+        double force;
+
+        if (flight_time < 0) {
+            force = GRAVITY;
+        } else if (landed_time >= 0) {
+            altitude = 0;
+            velocity = 0;
+            force = GRAVITY;
+        } else {
+            launched = 1;
+            double thrust = (flight_time < profile->burn_time) ? (profile->boost_accel * GRAVITY) : 0;
+            double drag = profile->drag * velocity * fabs(velocity);
+            if (past_apogee && (velocity <= -profile->descent_rate)) {
+                // Under the parachute
+                velocity = -profile->descent_rate;
+                force = GRAVITY;
+            } else {
+                force = thrust - (past_apogee ? 0 : drag);
+                velocity += (force - GRAVITY) * dt;
+            }
+            altitude += velocity * dt;
+            if (altitude > apogee_altitude) {
+                apogee_altitude = altitude;
+                apogee_time = t;
+            }
+            if (launched && (velocity < 0)) {
+                past_apogee = 1;
+            }
+            if (past_apogee && (altitude <= 0)) {
+                altitude = 0;
+                landed_time = t;
+            }
+        }
+
+        struct sim_trace_sample s = {
+            .time = t,
+            .altitude = altitude + noise(&seed, profile->altitude_noise),
+            .accel = {noise(&seed, profile->accel_noise), noise(&seed, profile->accel_noise),
+                      (force / GRAVITY) + noise(&seed, profile->accel_noise)},
+            .rate = {((flight_time > 0) && (landed_time < 0)) ? 90 : 0, noise(&seed, 0.5), noise(&seed, 0.5)},
+            .latitude = 32.990254,
+            .longitude = -106.974998,
+            .cap_voltage = 9.0,
+            .battery_voltage = 9.0
+        };
+        append(trace, &s, &capacity);
+    }
+    // The apogee is taken from the altitude without noise
+    trace->apogee_time = apogee_time;
+    trace->apogee_altitude = apogee_altitude;
+}
+
+// MARK: Flight
+void sim_adc_set_voltage(uint8_t channel, double volts)
+{
+    double counts = volts * 1024 / 5.0;
+    sim_adc_input[channel] = (counts < 0) ? 0 : ((counts > 1023) ? 1023 : (uint16_t)counts);
+}
+
+static void update_world(void *context)
+{
+    sim_timer_start(&flight_update, flight_update.at + sim_ms(UPDATE_PERIOD_MS));
+
+    double t = sim_flight_time();
+    while (((flight_index + 1) < flight->length) && (flight->samples[flight_index + 1].time <= t)) {
+        flight_index++;
+    }
+    const struct sim_trace_sample *a = flight->samples + flight_index;
+    const struct sim_trace_sample *b = a;
+    double f = 0;
+    if ((flight_index + 1) < flight->length) {
+        b = a + 1;
+        f = (t - a->time) / (b->time - a->time);
+        if (f < 0) f = 0;
+    }
+
+    sim_world.altitude = a->altitude + f * (b->altitude - a->altitude);
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        sim_world.accel[axis] = a->accel[axis] + f * (b->accel[axis] - a->accel[axis]);
+        sim_world.rate[axis] = a->rate[axis] + f * (b->rate[axis] - a->rate[axis]);
+    }
+    sim_world.latitude = a->latitude;
+    sim_world.longitude = a->longitude;
+    sim_world.temperature = GROUND_TEMPERATURE - (LAPSE_RATE * sim_world.altitude);
+    sim_world.gps_fix = 1;
+    if (b != a) {
+        // Knots
+        sim_world.speed = fabs(b->altitude - a->altitude) / (b->time - a->time) * 1.943844;
+    }
+
+    sim_adc_set_voltage(CAP_REF_ANALOG_PIN, a->cap_voltage / CAP_DIVIDER);
+    sim_adc_set_voltage(BAT_REF_ANALOG_PIN, a->battery_voltage / BATTERY_DIVIDER);
+    // About 25 degrees C on the thermistor inputs
+    sim_adc_set_voltage(TEMP_1_ANALOG_PIN, 2.5);
+    sim_adc_set_voltage(TEMP_2_ANALOG_PIN, 2.5);
+}
+
+void sim_flight_start(const struct sim_trace *trace)
+{
+    flight = trace;
+    flight_start = sim_cycles;
+    flight_index = 0;
+    flight_update.fn = update_world;
+    sim_timer_start(&flight_update, sim_cycles);
+}
+
+double sim_flight_time(void)
+{
+    return (double)(sim_cycles - flight_start) / SIM_F_CPU;
+}
@@ -0,0 +1,161 @@
+//
+//  sim_fxas21002c.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated FXAS21002C gyroscope with its FIFO
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "Gyro-FXAS21002C-Registers.h"
+
+#define DEVICE_ID       0xD7
+
+#define FIFO_OFF        0
+#define FIFO_CIRCULAR   1
+
+/** Sensitivity in degrees per second per LSB for each full scale range setting */
+static const double sensitivity[4] = {0.0625, 0.03125, 0.015625, 0.0078125};
+
+static uint8_t fifo_mode(struct sim_fxas21002c *gyro)
+{
+    uint8_t mode = gyro->dev.regs[F_SETUP] >> F_SETUP_F_MODE0;
+    return (mode > FIFO_CIRCULAR) ? 2 : mode;
+}
+
+static void load_output(struct sim_fxas21002c *gyro, const int16_t *sample)
+{
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        gyro->dev.regs[OUT_X_MSB + (2 * axis)] = (sample[axis] >> 8) & 0xFF;
+        gyro->dev.regs[OUT_X_LSB + (2 * axis)] = sample[axis] & 0xFF;
+    }
+}
+
+/**
+ *  Show the oldest FIFO entry in the output registers and update the status registers and interupt
+ */
+static void update(struct sim_fxas21002c *gyro)
+{
+    uint8_t *regs = gyro->dev.regs;
+    uint8_t asserted = 0;
+
+    if (fifo_mode(gyro) != FIFO_OFF) {
+        if (gyro->fifo_count != 0) {
+            load_output(gyro, gyro->fifo[gyro->fifo_head]);
+        }
+        uint8_t watermark = regs[F_SETUP] & F_SETUP_F_WMRK_MASK;
+        uint8_t watermark_flag = (watermark != 0) && (gyro->fifo_count >= watermark);
+        regs[F_STATUS] = (gyro->overflow << F_STATUS_F_OVF) | (watermark_flag << F_STATUS_F_WMKF) | gyro->fifo_count;
+        // STATUS is an alias of F_STATUS while the FIFO is enabled
+        regs[STATUS] = regs[F_STATUS];
+        asserted = (watermark_flag || gyro->overflow) && (regs[CTRL_REG2] & (1<<CTRL_REG2_EN_FIFO)) &&
+                   (regs[CTRL_REG2] & (1<<CTRL_REG2_CFG_FIFO));
+    } else {
+        regs[STATUS] = regs[DR_STATUS];
+    }
+
+    uint8_t active_high = !!(regs[CTRL_REG2] & (1<<CTRL_REG2_IPOL));
+    sim_drive_pin(gyro->int_port, gyro->int_num, asserted ? active_high : !active_high);
+}
+
+static void take_sample(void *context)
+{
+    struct sim_fxas21002c *gyro = context;
+    uint8_t *regs = gyro->dev.regs;
+
+    uint8_t rate_code = (regs[CTRL_REG1] >> CTRL_REG1_DR0) & 0x07;
+    double rate = (rate_code >= 6) ? 12.5 : (800.0 / (1 << rate_code));
+    sim_timer_start(&gyro->sample, gyro->sample.at + (uint64_t)(SIM_F_CPU / rate));
+
+    if (!(regs[CTRL_REG1] & (1<<CTRL_REG1_ACTIVE))) return;
+
+    int16_t value[3];
+    double scale = sensitivity[regs[CTRL_REG0] & 0x03];
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        double lsb = sim_world.rate[axis] / scale;
+        if (lsb > 32767) lsb = 32767;
+        if (lsb < -32768) lsb = -32768;
+        value[axis] = (int16_t)lround(lsb);
+    }
+    regs[TEMP] = (int8_t)lround(sim_world.temperature);
+    gyro->samples++;
+
+    if (fifo_mode(gyro) == FIFO_OFF) {
+        load_output(gyro, value);
+        regs[DR_STATUS] |= (1<<DR_STATUS_ZYXDR) | (1<<DR_STATUS_ZDR) | (1<<DR_STATUS_YDR) | (1<<DR_STATUS_XDR);
+        update(gyro);
+        return;
+    }
+
+    if (gyro->fifo_count == SIM_FIFO_LENGTH) {
+        gyro->overruns++;
+        gyro->overflow = 1;
+        if (fifo_mode(gyro) != FIFO_CIRCULAR) {
+            // Stop mode keeps the oldest samples
+            update(gyro);
+            return;
+        }
+        gyro->fifo_head = (gyro->fifo_head + 1) % SIM_FIFO_LENGTH;
+        gyro->fifo_count--;
+    }
+    memcpy(gyro->fifo[(gyro->fifo_head + gyro->fifo_count) % SIM_FIFO_LENGTH], value, sizeof(value));
+    gyro->fifo_count++;
+    update(gyro);
+}
+
+static void before_read(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_fxas21002c *gyro = (struct sim_fxas21002c *)device;
+    if (reg == F_STATUS || reg == STATUS) {
+        // Reading the status clears the overflow flag once it has been reported
+        update(gyro);
+    }
+}
+
+static uint8_t next(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_fxas21002c *gyro = (struct sim_fxas21002c *)device;
+
+    if (reg != OUT_Z_LSB) return reg + 1;
+
+    // A full sample has been read, the next one is popped from the FIFO
+    if ((fifo_mode(gyro) != FIFO_OFF) && (gyro->fifo_count != 0)) {
+        gyro->fifo_head = (gyro->fifo_head + 1) % SIM_FIFO_LENGTH;
+        gyro->fifo_count--;
+        gyro->overflow = 0;
+        update(gyro);
+    } else if (fifo_mode(gyro) == FIFO_OFF) {
+        device->regs[DR_STATUS] = 0;
+        update(gyro);
+    }
+    return (device->regs[CTRL_REG3] & (1<<CTRL_REG3_WRAPTOONE)) ? OUT_X_MSB : STATUS;
+}
+
+static void after_write(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_fxas21002c *gyro = (struct sim_fxas21002c *)device;
+    if ((reg == F_SETUP) && (fifo_mode(gyro) == FIFO_OFF)) {
+        gyro->fifo_count = 0;
+        gyro->overflow = 0;
+    }
+    update(gyro);
+}
+
+void sim_fxas21002c_init(struct sim_fxas21002c *gyro, uint8_t int_port, uint8_t int_num)
+{
+    memset(gyro, 0, sizeof(*gyro));
+    gyro->int_port = int_port;
+    gyro->int_num = int_num;
+    gyro->dev.regs[WHO_AM_I] = DEVICE_ID;
+    gyro->dev.before_read = before_read;
+    gyro->dev.after_write = after_write;
+    gyro->dev.next = next;
+    gyro->sample.fn = take_sample;
+    gyro->sample.context = gyro;
+    sim_i2c_registers_attach(&gyro->dev, ADDRESS);
+    sim_timer_start(&gyro->sample, sim_cycles + sim_ms(10));
+    update(gyro);
+}
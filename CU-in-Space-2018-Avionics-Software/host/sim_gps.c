@@ -0,0 +1,72 @@
+//
+//  sim_gps.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated FGPMMOPA6H GPS module, sends RMC sentences from sim_world
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PERIOD  1000    // ms
+
+static uint8_t gps_uart;
+
+static void send_fix(void *context)
+{
+    struct sim_gps *gps = context;
+    sim_timer_start(&gps->fix, gps->fix.at + sim_ms(gps->period));
+
+    uint32_t ms = (uint32_t)(sim_time() * 1000);
+    double latitude = fabs(sim_world.latitude);
+    double longitude = fabs(sim_world.longitude);
+    double lat_minutes = (latitude - floor(latitude)) * 60;
+    double lon_minutes = (longitude - floor(longitude)) * 60;
+
+    char body[100];
+    snprintf(body, sizeof(body), "GPRMC,%02u%02u%02u.%03u,%c,%02u%07.4f,%c,%03u%07.4f,%c,%.2f,%.2f,010618,,,A",
+             (ms / 3600000) % 24, (ms / 60000) % 60, (ms / 1000) % 60, ms % 1000, sim_world.gps_fix ? 'A' : 'V',
+             (unsigned)latitude, lat_minutes, (sim_world.latitude < 0) ? 'S' : 'N', (unsigned)longitude, lon_minutes,
+             (sim_world.longitude < 0) ? 'W' : 'E', sim_world.speed, sim_world.course);
+
+    uint8_t checksum = 0;
+    for (char *c = body; *c != '\0'; c++) {
+        checksum ^= *c;
+    }
+    char sentence[110];
+    int length = snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    sim_uart_send(gps_uart, (uint8_t *)sentence, length);
+    gps->sentences++;
+}
+
+static void receive_command(void *context, uint8_t byte)
+{
+    struct sim_gps *gps = context;
+
+    if (byte == '\n') {
+        gps->command[gps->command_length] = '\0';
+        if (!strncmp(gps->command, "$PMTK220,", 9)) {
+            uint32_t period = strtoul(gps->command + 9, NULL, 10);
+            if (period >= 100) {
+                gps->period = period;
+            }
+        }
+        gps->command_length = 0;
+    } else if (gps->command_length < (sizeof(gps->command) - 1)) {
+        gps->command[gps->command_length++] = byte;
+    }
+}
+
+void sim_gps_init(struct sim_gps *gps, uint8_t uart)
+{
+    memset(gps, 0, sizeof(*gps));
+    gps_uart = uart;
+    gps->period = DEFAULT_PERIOD;
+    gps->fix.fn = send_fix;
+    gps->fix.context = gps;
+    sim_uart_attach(uart, receive_command, gps);
+    sim_timer_start(&gps->fix, sim_cycles + sim_ms(DEFAULT_PERIOD));
+}
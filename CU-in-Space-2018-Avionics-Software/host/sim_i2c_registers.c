@@ -0,0 +1,66 @@
+//
+//  sim_i2c_registers.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Register file I2C peripheral shared by the simulated sensors
+//
+
+#include "sim_devices.h"
+
+#include <stddef.h>
+
+static void start(struct sim_i2c_device *i2c, uint8_t read)
+{
+    struct sim_i2c_registers *device = (struct sim_i2c_registers *)i2c;
+    // The first byte of a write sets the register pointer, reads continue from where it was left
+    device->expect_pointer = !read;
+}
+
+static uint8_t write(struct sim_i2c_device *i2c, uint8_t byte)
+{
+    struct sim_i2c_registers *device = (struct sim_i2c_registers *)i2c;
+
+    if (device->expect_pointer) {
+        device->pointer = byte;
+        device->expect_pointer = 0;
+        return 1;
+    }
+    uint8_t reg = device->pointer;
+    device->regs[reg] = byte;
+    device->pointer = (device->next != NULL) ? device->next(device, reg) : reg + 1;
+    if (device->after_write != NULL) {
+        device->after_write(device, reg);
+    }
+    return 1;
+}
+
+static uint8_t read(struct sim_i2c_device *i2c, uint8_t ack)
+{
+    struct sim_i2c_registers *device = (struct sim_i2c_registers *)i2c;
+
+    uint8_t reg = device->pointer;
+    if (device->before_read != NULL) {
+        device->before_read(device, reg);
+    }
+    uint8_t value = device->regs[reg];
+    device->pointer = (device->next != NULL) ? device->next(device, reg) : reg + 1;
+    return value;
+}
+
+static void stop(struct sim_i2c_device *i2c)
+{
+    struct sim_i2c_registers *device = (struct sim_i2c_registers *)i2c;
+    if (device->end != NULL) {
+        device->end(device);
+    }
+}
+
+void sim_i2c_registers_attach(struct sim_i2c_registers *device, uint8_t address)
+{
+    device->i2c.address = address;
+    device->i2c.start = start;
+    device->i2c.write = write;
+    device->i2c.read = read;
+    device->i2c.stop = stop;
+    sim_i2c_attach(&device->i2c);
+}
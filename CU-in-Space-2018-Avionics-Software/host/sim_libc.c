@@ -0,0 +1,68 @@
+//
+//  sim_libc.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  The avr-libc extensions to stdlib.h which are not in the host C library
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "include/host_libc.h"
+
+static char *unsigned_to_string(unsigned long value, char *str, int radix, uint8_t negative)
+{
+    char digits[sizeof(unsigned long) * 8 + 1];
+    uint8_t length = 0;
+
+    do {
+        uint8_t digit = value % radix;
+        digits[length++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+        value /= radix;
+    } while (value != 0);
+
+    char *out = str;
+    if (negative) {
+        *out++ = '-';
+    }
+    while (length != 0) {
+        *out++ = digits[--length];
+    }
+    *out = '\0';
+    return str;
+}
+
+char *ltoa(long value, char *str, int radix)
+{
+    // As in avr-libc, only base 10 values are signed
+    if ((radix == 10) && (value < 0)) {
+        return unsigned_to_string(-(unsigned long)value, str, radix, 1);
+    }
+    return unsigned_to_string((unsigned long)value, str, radix, 0);
+}
+
+char *ultoa(unsigned long value, char *str, int radix)
+{
+    return unsigned_to_string(value, str, radix, 0);
+}
+
+char *itoa(int value, char *str, int radix)
+{
+    // int is 16 bits on the AVR
+    if (radix == 10) {
+        return ltoa((int16_t)value, str, radix);
+    }
+    return unsigned_to_string((uint16_t)value, str, radix, 0);
+}
+
+char *utoa(unsigned int value, char *str, int radix)
+{
+    return unsigned_to_string((uint16_t)value, str, radix, 0);
+}
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *str)
+{
+    sprintf(str, "%*.*f", width, precision, value);
+    return str;
+}
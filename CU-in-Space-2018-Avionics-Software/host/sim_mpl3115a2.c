@@ -0,0 +1,106 @@
+//
+//  sim_mpl3115a2.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated MPL3115A2 barometric altimeter
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "Barometer-MPL3115A2-Registers.h"
+
+#define DEVICE_ID           0xC4
+#define SEA_LEVEL_PRESSURE  101326.0    // Pa, the reset value of BAR_IN
+
+/** Measurement time in milliseconds for each oversample setting */
+static const double measurement_time[8] = {6, 10, 18, 34, 66, 130, 258, 512};
+
+static double pressure_at(double altitude)
+{
+    return 101325.0 * pow(1 - (altitude / 44330.77), 5.255877);
+}
+
+static void update_int(struct sim_mpl3115a2 *baro)
+{
+    uint8_t *regs = baro->dev.regs;
+    uint8_t asserted = baro->drdy && (regs[CTRL_REG4] & (1<<CTRL_REG4_EN_DRDY)) &&
+                       (regs[CTRL_REG5] & (1<<CTRL_REG5_EN_DRDY));
+    uint8_t active_high = !!(regs[CTRL_REG3] & (1<<CTRL_REG3_IPOL1));
+    sim_drive_pin(baro->int_port, baro->int_num, asserted ? active_high : !active_high);
+}
+
+static void measurement_done(void *context)
+{
+    struct sim_mpl3115a2 *baro = context;
+    uint8_t *regs = baro->dev.regs;
+    double pressure = pressure_at(sim_world.ground_altitude + sim_world.altitude);
+
+    if (regs[CTRL_REG1] & (1<<CTRL_REG1_ALT)) {
+        // Altitude in meters as Q16.4, relative to the sea level pressure in BAR_IN (2 Pa per LSB)
+        uint16_t bar_in = (regs[BAR_IN_MSB] << 8) | regs[BAR_IN_LSB];
+        double altitude = 44330.77 * (1 - pow(pressure / (bar_in * 2.0), 0.1902632));
+        int32_t raw = (int32_t)lround(altitude * 16);
+        regs[OUT_P_MSB] = (raw >> 12) & 0xFF;
+        regs[OUT_P_CSB] = (raw >> 4) & 0xFF;
+        regs[OUT_P_LSB] = (raw & 0x0F) << 4;
+    } else {
+        // Pressure in Pa as unsigned Q18.2
+        uint32_t raw = (uint32_t)lround(pressure * 4);
+        regs[OUT_P_MSB] = (raw >> 12) & 0xFF;
+        regs[OUT_P_CSB] = (raw >> 4) & 0xFF;
+        regs[OUT_P_LSB] = (raw & 0x0F) << 4;
+    }
+    int16_t temp = (int16_t)lround(sim_world.temperature * 16);
+    regs[OUT_T_MSB] = (temp >> 4) & 0xFF;
+    regs[OUT_T_MSB + 1] = (temp & 0x0F) << 4;
+
+    regs[DR_STATUS] |= (1<<DR_STATUS_PTDR) | (1<<DR_STATUS_PDR) | (1<<DR_STATUS_PTR);
+    regs[STATUS] = regs[DR_STATUS];
+    regs[CTRL_REG1] &= ~(1<<CTRL_REG1_OST);
+    baro->drdy = 1;
+    baro->samples++;
+    update_int(baro);
+}
+
+static void before_read(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_mpl3115a2 *baro = (struct sim_mpl3115a2 *)device;
+
+    if (reg == OUT_P_MSB) {
+        // Reading the data clears the data ready flags and the interupt
+        device->regs[DR_STATUS] &= ~((1<<DR_STATUS_PTDR) | (1<<DR_STATUS_PDR) | (1<<DR_STATUS_PTR));
+        device->regs[STATUS] = device->regs[DR_STATUS];
+        baro->drdy = 0;
+        update_int(baro);
+    }
+}
+
+static void after_write(struct sim_i2c_registers *device, uint8_t reg)
+{
+    struct sim_mpl3115a2 *baro = (struct sim_mpl3115a2 *)device;
+
+    if ((reg == CTRL_REG1) && (device->regs[CTRL_REG1] & (1<<CTRL_REG1_OST)) && !baro->measurement.active) {
+        uint8_t oversample = (device->regs[CTRL_REG1] >> CTRL_REG1_OS0) & 0x07;
+        sim_timer_start(&baro->measurement, sim_cycles + sim_ms(measurement_time[oversample]));
+    }
+    update_int(baro);
+}
+
+void sim_mpl3115a2_init(struct sim_mpl3115a2 *baro, uint8_t int_port, uint8_t int_num)
+{
+    memset(baro, 0, sizeof(*baro));
+    baro->int_port = int_port;
+    baro->int_num = int_num;
+    baro->measurement.fn = measurement_done;
+    baro->measurement.context = baro;
+    baro->dev.regs[WHO_AM_I] = DEVICE_ID;
+    baro->dev.regs[BAR_IN_MSB] = (uint16_t)(SEA_LEVEL_PRESSURE / 2) >> 8;
+    baro->dev.regs[BAR_IN_LSB] = (uint16_t)(SEA_LEVEL_PRESSURE / 2) & 0xFF;
+    baro->dev.before_read = before_read;
+    baro->dev.after_write = after_write;
+    sim_i2c_registers_attach(&baro->dev, ADDRESS);
+    update_int(baro);
+}
@@ -0,0 +1,132 @@
+//
+//  sim_xbee.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Simulated XBee in API mode on SPI, answers transmit requests with transmit status frames
+//
+
+#include "sim_devices.h"
+
+#include <string.h>
+
+#include "Radio_commands.h"
+
+#define TRANSMIT_HEADER_LENGTH  14  // Frame type, frame ID, 64 and 16 bit addresses, radius and options
+
+#define DELIVERY_SUCCESS        0x00
+#define DELIVERY_TOO_LARGE      0x74    // Data payload too large
+
+static void update_attn(struct sim_xbee *xbee)
+{
+    // Asserted low while the module has data for the microcontroller
+    sim_drive_pin(xbee->attn_port, xbee->attn_num, xbee->out_count == 0);
+}
+
+static void send_frame(struct sim_xbee *xbee, const uint8_t *frame, uint16_t length)
+{
+    uint8_t header[3] = {DELIMITER_COMMAND, length >> 8, length & 0xFF};
+    uint8_t sum = 0;
+
+    if ((xbee->out_count + length + 4) > sizeof(xbee->out)) {
+        // The module's buffers are full, the frame is lost
+        return;
+    }
+    for (uint16_t i = 0; i < length + 4; i++) {
+        uint8_t byte;
+        if (i < 3) {
+            byte = header[i];
+        } else if (i < length + 3) {
+            byte = frame[i - 3];
+            sum += byte;
+        } else {
+            byte = 0xFF - sum;
+        }
+        xbee->out[(xbee->out_head + xbee->out_count++) % sizeof(xbee->out)] = byte;
+    }
+    update_attn(xbee);
+}
+
+static void handle_frame(struct sim_xbee *xbee, const uint8_t *frame, uint16_t length)
+{
+    xbee->frames++;
+    if ((frame[0] != TRANSMIT_REQUEST) || (length < TRANSMIT_HEADER_LENGTH)) return;
+
+    uint16_t payload_length = length - TRANSMIT_HEADER_LENGTH;
+    uint8_t delivery = DELIVERY_SUCCESS;
+    xbee->transmit_requests++;
+    if (payload_length > xbee->largest_payload) {
+        xbee->largest_payload = payload_length;
+    }
+    if (payload_length > SIM_XBEE_NP) {
+        xbee->oversized++;
+        delivery = DELIVERY_TOO_LARGE;
+    } else {
+        xbee->payload_bytes += payload_length;
+        if (xbee->on_payload != NULL) {
+            xbee->on_payload(xbee->context, frame + TRANSMIT_HEADER_LENGTH, payload_length);
+        }
+    }
+
+    if (frame[1] != 0) {
+        // Frame ID, 16 bit destination, retry count, delivery status and discovery status
+        uint8_t status[7] = {ZIGBEE_TRANSMIT_STATUS, frame[1], 0xFF, 0xFE, 0, delivery, 0};
+        send_frame(xbee, status, sizeof(status));
+        xbee->statuses++;
+    }
+}
+
+static void receive_byte(struct sim_xbee *xbee, uint8_t byte)
+{
+    if ((xbee->in_length == 0) && (byte != DELIMITER_COMMAND)) {
+        // Padding sent while reading from the module
+        return;
+    }
+    if (xbee->in_length == sizeof(xbee->in)) {
+        xbee->in_length = 0;
+        return;
+    }
+    xbee->in[xbee->in_length++] = byte;
+    if (xbee->in_length < 3) return;
+
+    uint16_t length = (xbee->in[1] << 8) | xbee->in[2];
+    if (xbee->in_length < length + 4) return;
+
+    uint8_t sum = 0;
+    for (uint16_t i = 0; i <= length; i++) {
+        sum += xbee->in[3 + i];
+    }
+    if (sum == 0xFF) {
+        handle_frame(xbee, xbee->in + 3, length);
+    } else {
+        xbee->bad_checksums++;
+    }
+    xbee->in_length = 0;
+}
+
+static uint8_t exchange(struct sim_spi_device *device, uint8_t out)
+{
+    struct sim_xbee *xbee = (struct sim_xbee *)device;
+    uint8_t in = 0;
+
+    if (xbee->out_count != 0) {
+        in = xbee->out[xbee->out_head];
+        xbee->out_head = (xbee->out_head + 1) % sizeof(xbee->out);
+        xbee->out_count--;
+        xbee->bytes_read++;
+    }
+    receive_byte(xbee, out);
+    update_attn(xbee);
+    return in;
+}
+
+void sim_xbee_init(struct sim_xbee *xbee, uint8_t cs_port, uint8_t cs_num, uint8_t attn_port, uint8_t attn_num)
+{
+    memset(xbee, 0, sizeof(*xbee));
+    xbee->attn_port = attn_port;
+    xbee->attn_num = attn_num;
+    xbee->spi.cs_port = cs_port;
+    xbee->spi.cs_num = cs_num;
+    xbee->spi.exchange = exchange;
+    sim_spi_attach(&xbee->spi);
+    update_attn(xbee);
+}
@@ -0,0 +1,126 @@
+//
+//  bench_eeprom.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Measures sustained page write bandwidth of the 25LC1024 driver against two simulated eeproms, with the log striped
+//  across both of them and with every page going to the first one
+//
+
+#include "sim_devices.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pindefinitions.h"
+#include "SPI.h"
+#include "25LC1024.h"
+
+#define BENCH_PAGES         256     // The number of pages written in each run
+#define MAX_OUTSTANDING     3       // The most writes kept queued at once, as the logger can have
+
+static struct sim_25lc1024 eeproms[2];
+
+/**
+ *  Write pages at the end of the log as fast as the driver accepts them, keeping several writes queued like the
+ *  logger does, and check that every page reached the right eeprom
+ *  @param striped 1 if consecutive pages should alternate between the eeproms, 0 if they should all go to the first
+ *  @param outstanding The number of writes kept queued
+ *  @return The number of bytes written per simulated second
+ */
+static double bench(uint8_t striped, uint8_t outstanding)
+{
+    static uint8_t data[MAX_OUTSTANDING][EEPROM_25LC1024_PAGE_LENGTH];
+    uint8_t ids[MAX_OUTSTANDING] = {0};
+    uint16_t started = 0;
+    uint16_t finished = 0;
+
+    // The last pages of the striped address space, or the last pages of the first eeprom
+    uint32_t base = (striped ? EEPROM_25LC1024_SIZE : (EEPROM_25LC1024_SIZE / 2)) -
+                    ((uint32_t)BENCH_PAGES * EEPROM_25LC1024_PAGE_LENGTH);
+    uint32_t write_cycles[2] = {eeproms[0].write_cycles, eeproms[1].write_cycles};
+
+    uint64_t start = sim_cycles;
+    while (finished < BENCH_PAGES) {
+        eeprom_25lc1024_service();
+        spi_service();
+        for (uint8_t i = 0; i < outstanding; i++) {
+            if ((ids[i] != 0) && eeprom_25lc1024_transaction_done(ids[i])) {
+                eeprom_25lc1024_clear_transaction(ids[i]);
+                ids[i] = 0;
+                finished++;
+            }
+            if ((ids[i] == 0) && (started < BENCH_PAGES)) {
+                uint32_t address = base + ((uint32_t)started * EEPROM_25LC1024_PAGE_LENGTH);
+                if (striped) {
+                    address = eeprom_25lc1024_stripe(address);
+                }
+                // Each page is filled with its own number so that misplaced pages are found
+                memset(data[i], started, EEPROM_25LC1024_PAGE_LENGTH);
+                if (!eeprom_25lc1024_write(ids + i, address, EEPROM_25LC1024_PAGE_LENGTH, data[i])) {
+                    started++;
+                }
+            }
+        }
+    }
+    double seconds = (double)(sim_cycles - start) / SIM_F_CPU;
+
+    // Let the last write cycle finish before the next run
+    sim_idle(sim_ms(10));
+
+    for (uint16_t page = 0; page < BENCH_PAGES; page++) {
+        uint32_t address = base + ((uint32_t)page * EEPROM_25LC1024_PAGE_LENGTH);
+        if (striped) {
+            address = eeprom_25lc1024_stripe(address);
+        }
+        const struct sim_25lc1024 *chip = eeproms + (address >= SIM_25LC1024_SIZE);
+        const uint8_t *memory = chip->memory + (address % SIM_25LC1024_SIZE);
+        for (uint16_t i = 0; i < EEPROM_25LC1024_PAGE_LENGTH; i++) {
+            if (memory[i] != (uint8_t)page) {
+                sim_fail("page %u was not written to 0x%x", page, address);
+            }
+        }
+    }
+
+    printf("%-8s %11u %11.0f %11.2f %8u %8u\n", striped ? "striped" : "single", outstanding,
+           BENCH_PAGES * EEPROM_25LC1024_PAGE_LENGTH / seconds, seconds * 1000 / BENCH_PAGES,
+           eeproms[0].write_cycles - write_cycles[0], eeproms[1].write_cycles - write_cycles[1]);
+    return BENCH_PAGES * EEPROM_25LC1024_PAGE_LENGTH / seconds;
+}
+
+int main(void)
+{
+    sim_init();
+    sim_25lc1024_init(&eeproms[0], SIM_PORT_B, EEPROM_CS_NUM);
+    sim_25lc1024_init(&eeproms[1], SIM_PORT_B, EEPROM2_CS_NUM);
+    // Chip select pins are outputs driven high, as set up by initIO() in main.c
+    EEPROM_CS_DDR |= (1 << EEPROM_CS_NUM);
+    EEPROM_CS_PORT |= (1 << EEPROM_CS_NUM);
+    EEPROM2_CS_DDR |= (1 << EEPROM2_CS_NUM);
+    EEPROM2_CS_PORT |= (1 << EEPROM2_CS_NUM);
+    sim_sync();
+    init_spi(&SPI_PORT, &SPI_PIN);
+    init_25lc1024(EEPROM_CS_NUM, EEPROM2_CS_NUM);
+    sei();
+
+    // Writes are only overlapped with the other eeprom's write cycle while the eeproms are kept awake, as in flight
+    eeprom_25lc1024_set_keep_awake(1);
+
+    printf("%u pages of %u bytes per run\n", BENCH_PAGES, EEPROM_25LC1024_PAGE_LENGTH);
+    printf("%-8s %11s %11s %11s %8s %8s\n", "layout", "outstanding", "bytes/s", "ms/page", "chip 1", "chip 2");
+    double speedup = 0;
+    for (uint8_t outstanding = 1; outstanding <= MAX_OUTSTANDING; outstanding++) {
+        double single = bench(0, outstanding);
+        double striped = bench(1, outstanding);
+        speedup = striped / single;
+    }
+    printf("Striping speedup with %u writes outstanding: %.2fx\n", MAX_OUTSTANDING, speedup);
+
+    for (uint8_t i = 0; i < 2; i++) {
+        if (eeproms[i].errors != 0) {
+            sim_fail("eeprom %u saw %u commands which the real part would have rejected", i + 1, eeproms[i].errors);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+//
+//  bench_spi_priority.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Measures the queueing delay of each SPI priority class with the bus saturated by a log download while log pages
+//  and telemetry frames are sent, with priorities set and with every transaction in the same class as in the old
+//  round robin queue
+//
+
+#include "sim_devices.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include "pindefinitions.h"
+#include "SPI.h"
+#include "25LC1024-Commands.h"
+
+#define RUN_TIME            2000    // Simulated milliseconds per run
+#define MAX_SLOTS           3       // The most transactions any one class has queued
+#define COMMAND_LENGTH      4       // READ and a 24 bit address
+
+/**
+ *  The traffic in one priority class, each class talks to its own simulated eeprom so that the data read back shows
+ *  that every transaction ran intact
+ */
+struct traffic {
+    const char *name;
+    spi_priority_t priority;
+    uint8_t cs_num;
+    /** The number of bytes read by each transaction */
+    uint16_t length;
+    /** Milliseconds between transactions, or 0 if MAX_SLOTS transactions are kept queued */
+    uint8_t period;
+    uint64_t next_arrival;
+    struct sim_25lc1024 chip;
+
+    uint8_t ids[MAX_SLOTS];
+    uint64_t queued[MAX_SLOTS];
+    uint8_t command[MAX_SLOTS][COMMAND_LENGTH];
+    uint8_t in[MAX_SLOTS][256];
+
+    /** The time taken by one transaction on an idle bus in cycles */
+    uint64_t unloaded;
+    uint32_t done;
+    uint32_t dropped;
+    uint64_t total_latency;
+    uint64_t max_latency;
+};
+
+static struct traffic traffic[SPI_NUM_PRIORITIES] = {
+    // Log pages
+    {.name = "critical", .priority = SPI_PRIORITY_CRITICAL, .cs_num = EEPROM_CS_NUM, .length = 256, .period = 10},
+    // Aggregate telemetry frames, with an eeprom standing in for the XBee on its chip select
+    {.name = "normal", .priority = SPI_PRIORITY_NORMAL, .cs_num = RADIO_CS_NUM, .length = 100, .period = 5},
+    // A log download
+    {.name = "bulk", .priority = SPI_PRIORITY_BULK, .cs_num = EEPROM2_CS_NUM, .length = 256, .period = 0}
+};
+
+static double cycles_to_us(double cycles)
+{
+    return cycles * 1e6 / SIM_F_CPU;
+}
+
+/**
+ *  Queue a read in a free slot of a class
+ *  @return 0 if the transaction was queued
+ */
+static uint8_t queue_read(struct traffic *c, uint8_t slot, uint8_t prioritized)
+{
+    c->command[slot][0] = READ;
+    c->command[slot][1] = 0;
+    c->command[slot][2] = slot;
+    c->command[slot][3] = 0;
+    memset(c->in[slot], 0, c->length);
+
+    if (spi_start_half_duplex(c->ids + slot, c->cs_num, c->command[slot], COMMAND_LENGTH, c->in[slot], c->length)) {
+        c->ids[slot] = 0;
+        return 1;
+    }
+    if (prioritized) {
+        spi_set_priority(c->ids[slot], c->priority);
+    }
+    c->queued[slot] = sim_cycles;
+    return 0;
+}
+
+/**
+ *  Clear a finished transaction and record its latency
+ */
+static void finish_read(struct traffic *c, uint8_t slot)
+{
+    uint64_t latency = sim_cycles - c->queued[slot];
+    spi_clear_transaction(c->ids[slot]);
+    c->ids[slot] = 0;
+
+    for (uint16_t i = 0; i < c->length; i++) {
+        if (c->in[slot][i] != c->cs_num) {
+            sim_fail("%s read %u got 0x%02x at byte %u", c->name, c->done, c->in[slot][i], i);
+        }
+    }
+    c->done++;
+    c->total_latency += latency;
+    if (latency > c->max_latency) {
+        c->max_latency = latency;
+    }
+}
+
+/**
+ *  Time one transaction of each class with nothing else on the bus
+ */
+static void measure_unloaded(void)
+{
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        struct traffic *c = traffic + i;
+        queue_read(c, 0, 0);
+        while (!spi_transaction_done(c->ids[0])) {
+            spi_service();
+        }
+        c->unloaded = sim_cycles - c->queued[0];
+        spi_clear_transaction(c->ids[0]);
+        c->ids[0] = 0;
+    }
+}
+
+/**
+ *  Run the main loop's SPI service with every class busy
+ *  @param prioritized 1 if each class sets its priority, 0 if every transaction is left in the normal class
+ */
+static void run(uint8_t prioritized)
+{
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        struct traffic *c = traffic + i;
+        c->done = 0;
+        c->dropped = 0;
+        c->total_latency = 0;
+        c->max_latency = 0;
+        c->next_arrival = sim_cycles;
+    }
+
+    uint64_t start = sim_cycles;
+    uint64_t spi_bytes = sim_stats.spi_bytes;
+    uint64_t end = start + sim_ms(RUN_TIME);
+    while (sim_cycles < end) {
+        spi_service();
+
+        for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+            struct traffic *c = traffic + i;
+            // Periodic traffic can queue another transaction before the last one is done, a transaction which can not
+            // be queued is dropped
+            uint8_t arrival = (c->period != 0) && (sim_cycles >= c->next_arrival);
+            uint8_t queued = 0;
+            for (uint8_t slot = 0; slot < MAX_SLOTS; slot++) {
+                if ((c->ids[slot] != 0) && spi_transaction_done(c->ids[slot])) {
+                    finish_read(c, slot);
+                }
+                if ((c->ids[slot] == 0) && ((c->period == 0) || (arrival && !queued))) {
+                    queued = !queue_read(c, slot, prioritized);
+                }
+            }
+            if (arrival) {
+                if (!queued) {
+                    c->dropped++;
+                }
+                c->next_arrival += sim_ms(c->period);
+            }
+        }
+    }
+
+    // Let the transactions still queued finish so that the next run starts with an empty queue
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        struct traffic *c = traffic + i;
+        for (uint8_t slot = 0; slot < MAX_SLOTS; slot++) {
+            while ((c->ids[slot] != 0) && !spi_transaction_done(c->ids[slot])) {
+                spi_service();
+            }
+            if (c->ids[slot] != 0) {
+                spi_clear_transaction(c->ids[slot]);
+                c->ids[slot] = 0;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        const struct traffic *c = traffic + i;
+        if (c->done == 0) {
+            printf("%-12s %-9s %6u %8u\n", prioritized ? "priority" : "round robin", c->name, c->done, c->dropped);
+            continue;
+        }
+        // Queueing delay is the latency beyond the time the transaction takes on an idle bus
+        double mean = ((double)c->total_latency / c->done) - c->unloaded;
+        printf("%-12s %-9s %6u %8u %10.0f %10.0f %10.0f %10.0f\n", prioritized ? "priority" : "round robin",
+               c->name, c->done, c->dropped, cycles_to_us(mean), cycles_to_us(c->max_latency - c->unloaded),
+               cycles_to_us((double)c->total_latency / c->done), cycles_to_us(c->max_latency));
+    }
+    printf("%-12s %.0f bytes/s on the bus\n", prioritized ? "priority" : "round robin",
+           (sim_stats.spi_bytes - spi_bytes) / ((double)(sim_cycles - start) / SIM_F_CPU));
+}
+
+int main(void)
+{
+    sim_init();
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        struct traffic *c = traffic + i;
+        sim_25lc1024_init(&c->chip, SIM_PORT_B, c->cs_num);
+        // The 25LC1024 driver is not used, so the eeproms are woken up here instead of with RDID
+        c->chip.asleep = 0;
+        memset(c->chip.memory, c->cs_num, sizeof(c->chip.memory));
+        // Chip select pins are outputs driven high, as set up by initIO() in main.c
+        DDRB |= (1 << c->cs_num);
+        PORTB |= (1 << c->cs_num);
+    }
+    sim_sync();
+    init_spi(&SPI_PORT, &SPI_PIN);
+    sei();
+
+    measure_unloaded();
+    printf("%u ms per run, a %u byte read every %u ms in the critical class and every %u ms in the normal class, "
+           "%u reads of %u bytes kept queued in the bulk class\n", RUN_TIME, traffic[SPI_PRIORITY_CRITICAL].length,
+           traffic[SPI_PRIORITY_CRITICAL].period, traffic[SPI_PRIORITY_NORMAL].period, MAX_SLOTS,
+           traffic[SPI_PRIORITY_BULK].length);
+    printf("Time on an idle bus: critical %.0f us, normal %.0f us, bulk %.0f us\n",
+           cycles_to_us(traffic[SPI_PRIORITY_CRITICAL].unloaded), cycles_to_us(traffic[SPI_PRIORITY_NORMAL].unloaded),
+           cycles_to_us(traffic[SPI_PRIORITY_BULK].unloaded));
+    printf("%-12s %-9s %6s %8s %10s %10s %10s %10s\n", "queue", "class", "done", "dropped", "wait (us)",
+           "max wait", "latency", "max lat.");
+    run(0);
+    run(1);
+
+    for (uint8_t i = 0; i < SPI_NUM_PRIORITIES; i++) {
+        if (traffic[i].chip.errors != 0) {
+            sim_fail("%s eeprom saw %u commands which the real part would have rejected", traffic[i].name,
+                     traffic[i].chip.errors);
+        }
+    }
+    return EXIT_SUCCESS;
+}
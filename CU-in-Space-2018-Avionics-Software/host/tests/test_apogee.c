@@ -0,0 +1,440 @@
+//
+//  test_apogee.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Checks the Kalman filter gains against the model they were calculated from, then replays flights through the FSM
+//  transition detector as advance_fsm() would feed it and checks when each transition happens against the true flight
+//
+//  Usage: test_apogee [trace.csv ...], traces in the sim_trace_load() format are replayed along with generated flights
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Firmware code is built with -fpack-struct
+#pragma pack(push, 1)
+#include "fsm.h"
+#include "kalman.h"
+#include "Accel-ADXL343.h"
+#include "Barometer-MPL3115A2.h"
+#pragma pack(pop)
+
+#define ACCEL_PERIOD        (1.0 / ADXL343_DATA_RATE)           // s
+#define BARO_PERIOD         (MPL3115A2_SAMPLE_PERIOD / 1000.0)  // s
+#define ACCEL_LSB_PER_G     256     // 3.9mg per least signifigant bit
+#define ACCEL_LIMIT         4095    // ±16g in full resolution mode
+#define ALTITUDE_LSB_PER_M  16
+
+// The model from which the gains in kalman.c were calculated
+#define MODEL_ALTITUDE_NOISE    1.0     // m
+#define MODEL_ACCEL_NOISE       1.0     // m/s^2
+#define MODEL_JERK              5.0     // m/s^3
+#define GAIN_TOLERANCE          0.01    // Relative
+
+// Limits on the transitions of replayed flights
+#define LAUNCH_MAX_LATENCY      0.1     // s after ignition
+#define APOGEE_EARLIEST         -0.2    // s after the true apogee, less than 0.2m below it
+#define APOGEE_MAX_LATENCY      1.2     // s after the true apogee with a working accelerometer
+#define FALLBACK_MAX_LATENCY    2.5     // s after the true apogee from the altitude drop alone
+#define VELOCITY_CHECK_BELOW    50.0    // m/s, the velocity estimate is checked for the end of the coast
+#define VELOCITY_MAX_ERROR      3.0     // m/s once the estimator has settled
+
+static unsigned failures;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+// MARK: Gains
+/**
+ *  Calculate the steady state Kalman gains for a constant acceleration model with piecewise constant jerk which
+ *  measures altitude and acceleration, by iterating the Riccati equation
+ *  @param dt The sample period in seconds
+ *  @param gains Gains from the altitude and acceleration errors (columns) to each estimate (rows)
+ */
+static void steady_state_gains(double dt, double gains[3][2])
+{
+    const double f[3][3] = {{1, dt, dt * dt / 2}, {0, 1, dt}, {0, 0, 1}};
+    const double g[3] = {dt * dt * dt / 6, dt * dt / 2, dt};
+    const double r[2] = {MODEL_ALTITUDE_NOISE * MODEL_ALTITUDE_NOISE, MODEL_ACCEL_NOISE * MODEL_ACCEL_NOISE};
+    double p[3][3] = {{100, 0, 0}, {0, 100, 0}, {0, 0, 100}};
+
+    for (uint16_t n = 0; n < 2000; n++) {
+        // Predict, P = F P F' + Q
+        double fp[3][3] = {{0}};
+        double predicted[3][3] = {{0}};
+        for (uint8_t i = 0; i < 3; i++) {
+            for (uint8_t j = 0; j < 3; j++) {
+                for (uint8_t k = 0; k < 3; k++) {
+                    fp[i][j] += f[i][k] * p[k][j];
+                }
+            }
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            for (uint8_t j = 0; j < 3; j++) {
+                for (uint8_t k = 0; k < 3; k++) {
+                    predicted[i][j] += fp[i][k] * f[j][k];
+                }
+                predicted[i][j] += MODEL_JERK * MODEL_JERK * g[i] * g[j];
+            }
+        }
+
+        // Gain, K = P H' (H P H' + R)^-1 where H picks out altitude (0) and acceleration (2)
+        double s[2][2] = {{predicted[0][0] + r[0], predicted[0][2]}, {predicted[2][0], predicted[2][2] + r[1]}};
+        double det = (s[0][0] * s[1][1]) - (s[0][1] * s[1][0]);
+        double s_inv[2][2] = {{s[1][1] / det, -s[0][1] / det}, {-s[1][0] / det, s[0][0] / det}};
+        for (uint8_t i = 0; i < 3; i++) {
+            for (uint8_t j = 0; j < 2; j++) {
+                gains[i][j] = (predicted[i][0] * s_inv[0][j]) + (predicted[i][2] * s_inv[1][j]);
+            }
+        }
+
+        // Correct, P = (I - K H) P
+        for (uint8_t i = 0; i < 3; i++) {
+            for (uint8_t j = 0; j < 3; j++) {
+                p[i][j] = predicted[i][j] - (gains[i][0] * predicted[0][j]) - (gains[i][1] * predicted[2][j]);
+            }
+        }
+    }
+}
+
+/**
+ *  Measure the gains used by kalman_update() from its response to an error in one measurment
+ */
+static void measure_gains(double gains[3][2])
+{
+    const int32_t altitude = 1500L * ALTITUDE_LSB_PER_M;
+    const int32_t altitude_error = 100L * ALTITUDE_LSB_PER_M;
+    const int16_t accel_error = 4 * ACCEL_LSB_PER_G;
+
+    for (uint8_t column = 0; column < 2; column++) {
+        struct kalman_state state;
+        init_kalman(&state);
+        // At rest, so that the prediction does not change the estimates
+        kalman_update(&state, 1000, altitude, UPRIGHT_ACCEL_THRESOLD);
+        int32_t before[3] = {state.altitude, state.velocity, state.accel};
+        double error;
+        if (column == 0) {
+            kalman_update(&state, 1000 + MPL3115A2_SAMPLE_PERIOD, altitude + altitude_error, UPRIGHT_ACCEL_THRESOLD);
+            error = (double)altitude_error * (1L << KALMAN_FRACTION_BITS);
+        } else {
+            kalman_update(&state, 1000 + MPL3115A2_SAMPLE_PERIOD, altitude, UPRIGHT_ACCEL_THRESOLD + accel_error);
+            error = (double)accel_error * KALMAN_ACCEL_SCALE;
+        }
+        int32_t after[3] = {state.altitude, state.velocity, state.accel};
+        for (uint8_t row = 0; row < 3; row++) {
+            gains[row][column] = (after[row] - before[row]) / error;
+        }
+    }
+}
+
+static void test_gains(void)
+{
+    static const char *estimates[3] = {"altitude", "velocity", "acceleration"};
+    static const char *measurments[2] = {"altitude", "acceleration"};
+    double expected[3][2];
+    double measured[3][2];
+
+    steady_state_gains(BARO_PERIOD, expected);
+    measure_gains(measured);
+    for (uint8_t row = 0; row < 3; row++) {
+        for (uint8_t column = 0; column < 2; column++) {
+            CHECK(fabs(measured[row][column] - expected[row][column]) <=
+                  (GAIN_TOLERANCE * fabs(expected[row][column])) + (2.0 / 65536),
+                  "%s gain from %s error is %.5f, expected %.5f for a %u ms sample period", estimates[row],
+                  measurments[column], measured[row][column], expected[row][column], MPL3115A2_SAMPLE_PERIOD);
+        }
+    }
+
+    // Once settled after starting at rest, the velocity estimate of a rocket coasting upwards without noise must have
+    // the right sign and be within VELOCITY_MAX_ERROR
+    const double climb = 100;   // m/s at the first update
+    struct kalman_state state;
+    init_kalman(&state);
+    for (uint8_t i = 0; i <= KALMAN_SETTLE_UPDATES; i++) {
+        double t = i * BARO_PERIOD;
+        double altitude = 1500 + (climb * t) - (0.5 * 9.80665 * t * t);
+        kalman_update(&state, 1000 + (i * MPL3115A2_SAMPLE_PERIOD), lround(altitude * ALTITUDE_LSB_PER_M), 0);
+    }
+    double t = KALMAN_SETTLE_UPDATES * BARO_PERIOD;
+    double velocity = (double)state.velocity / (ALTITUDE_LSB_PER_M << KALMAN_FRACTION_BITS);
+    CHECK(KALMAN_SETTLED(&state), "not settled after %u updates", KALMAN_SETTLE_UPDATES + 1);
+    CHECK(fabs(velocity - (climb - (9.80665 * t))) <= VELOCITY_MAX_ERROR,
+          "velocity estimate is %.1f m/s after %u updates, expected %.1f m/s", velocity, KALMAN_SETTLE_UPDATES,
+          climb - (9.80665 * t));
+}
+
+// MARK: Replay
+/**
+ *  The outcome of replaying a flight through the detector, times are in seconds into the trace and negative if the
+ *  transition did not happen
+ */
+struct replay_result {
+    double transition[RECOVERY + 1];
+    /** 1 if the apogee was detected from the velocity estimate rather than the altitude drop */
+    uint8_t from_velocity;
+    /** The largest error in the velocity estimate once the estimator had settled, from when the rocket slowed to
+        VELOCITY_CHECK_BELOW until apogee */
+    double velocity_error;
+};
+
+/**
+ *  A sensor fault to be injected while replaying
+ */
+enum replay_fault {
+    FAULT_NONE,
+    /** The accelerometer keeps reporting the sample on which burnout was detected, as if its FIFO had stopped */
+    FAULT_ACCEL_STUCK
+};
+
+/**
+ *  Interpolate a trace at a time
+ *  @param index The index of the sample at or before the last time looked up, updated
+ */
+static struct sim_trace_sample interpolate(const struct sim_trace *trace, double t, uint32_t *index)
+{
+    while (((*index + 1) < trace->length) && (trace->samples[*index + 1].time <= t)) {
+        (*index)++;
+    }
+    const struct sim_trace_sample *a = trace->samples + *index;
+    if ((*index + 1) == trace->length) return *a;
+
+    const struct sim_trace_sample *b = a + 1;
+    double f = fmax(0, (t - a->time) / (b->time - a->time));
+    struct sim_trace_sample s = *a;
+    s.altitude += f * (b->altitude - a->altitude);
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        s.accel[axis] += f * (b->accel[axis] - a->accel[axis]);
+    }
+    return s;
+}
+
+static int16_t accel_counts(double g)
+{
+    double counts = round(g * ACCEL_LSB_PER_G);
+    return (int16_t)fmax(-ACCEL_LIMIT, fmin(ACCEL_LIMIT, counts));
+}
+
+/**
+ *  Feed a flight to the detector at the rates of the sensors, one accelerometer sample per call and a barometer sample
+ *  with the first accelerometer sample after it is taken
+ *  @param trace The measured flight
+ *  @param truth The flight without noise, used for the velocity error, may be NULL
+ *  @param start The time at which the board starts, as if reset
+ *  @param state The state restored from EEPROM at the start
+ */
+static struct replay_result replay(const struct sim_trace *trace, const struct sim_trace *truth, double start,
+                                   global_state_t state, enum replay_fault fault)
+{
+    struct replay_result result = {.velocity_error = 0};
+    struct fsm_detector detector;
+    struct fsm_sample sample = {.armed = 1};
+    uint32_t index = 0;
+    uint32_t truth_before = 0;
+    uint32_t truth_after = 0;
+    double next_baro = start;
+    double end = trace->samples[trace->length - 1].time;
+
+    for (uint8_t i = 0; i <= RECOVERY; i++) {
+        result.transition[i] = -1;
+    }
+    init_fsm_detector(&detector);
+
+    for (double t = start; t <= end; t += ACCEL_PERIOD) {
+        struct sim_trace_sample s = interpolate(trace, t, &index);
+        // millis is never 0 once a sample has been taken
+        uint32_t millis = (uint32_t)(t * 1000) + 1;
+
+        if (!((fault == FAULT_ACCEL_STUCK) && (state >= COASTING_ASCENT))) {
+            sample.accel_x = accel_counts(s.accel[0]);
+            sample.accel_y = accel_counts(s.accel[1]);
+            sample.accel_z = accel_counts(s.accel[2]);
+        }
+        sample.new_accel = 1;
+        sample.new_altitude = t >= next_baro;
+        if (sample.new_altitude) {
+            next_baro += BARO_PERIOD;
+            sample.prev_altitude = sample.altitude;
+            sample.altitude = lround((sim_world.ground_altitude + s.altitude) * ALTITUDE_LSB_PER_M);
+            sample.time = millis;
+        }
+
+        global_state_t next = fsm_detect_transition(&detector, state, &sample, &fsm_default_thresholds);
+
+        if ((truth != NULL) && sample.new_altitude && (state == COASTING_ASCENT) && (t < truth->apogee_time) &&
+            KALMAN_SETTLED(&detector.estimator)) {
+            // Central difference of the altitude without noise
+            struct sim_trace_sample a = interpolate(truth, t - 0.05, &truth_before);
+            struct sim_trace_sample b = interpolate(truth, t + 0.05, &truth_after);
+            double velocity = (b.altitude - a.altitude) / 0.1;
+            double estimate = (double)detector.estimator.velocity / (ALTITUDE_LSB_PER_M << KALMAN_FRACTION_BITS);
+            if (velocity < VELOCITY_CHECK_BELOW) {
+                result.velocity_error = fmax(result.velocity_error, fabs(estimate - velocity));
+            }
+        }
+
+        if (next != state) {
+            result.transition[next] = t;
+            if (next == DESCENT) {
+                result.from_velocity = KALMAN_SETTLED(&detector.estimator) &&
+                                       (detector.descending >= APOGEE_VELOCITY_SAMPLES);
+            }
+            state = next;
+        }
+    }
+    return result;
+}
+
+/**
+ *  Replay a flight from power on through to landing and check each transition
+ *  @return The apogee detection latency in seconds
+ */
+static double check_flight(const char *name, const struct sim_trace *trace, const struct sim_trace *truth,
+                           double ignition, double burnout)
+{
+    struct replay_result r = replay(trace, truth, 0, STANDBY, FAULT_NONE);
+    double apogee = trace->apogee_time;
+    double latency = r.transition[DESCENT] - apogee;
+
+    printf("%-28s apogee %5.0f m at %5.2f s, coast at %5.2f s, deploy %+.2f s from %s, velocity error %4.1f m/s\n",
+           name, trace->apogee_altitude, apogee, r.transition[COASTING_ASCENT], latency,
+           r.from_velocity ? "velocity" : "altitude", r.velocity_error);
+
+    CHECK(r.transition[PRE_FLIGHT] >= 0, "%s: never armed", name);
+    if (ignition >= 0) {
+        CHECK((r.transition[POWERED_ASCENT] >= ignition) &&
+              (r.transition[POWERED_ASCENT] <= ignition + LAUNCH_MAX_LATENCY),
+              "%s: launch detected at %.2f s, ignition at %.2f s", name, r.transition[POWERED_ASCENT], ignition);
+    } else {
+        CHECK(r.transition[POWERED_ASCENT] >= 0, "%s: launch not detected", name);
+    }
+    CHECK((r.transition[COASTING_ASCENT] >= burnout) && (r.transition[COASTING_ASCENT] < apogee),
+          "%s: burnout detected at %.2f s, burnout at %.2f s and apogee at %.2f s", name,
+          r.transition[COASTING_ASCENT], burnout, apogee);
+    CHECK((latency >= APOGEE_EARLIEST) && (latency <= APOGEE_MAX_LATENCY),
+          "%s: apogee detected at %.2f s, true apogee at %.2f s", name, r.transition[DESCENT], apogee);
+    CHECK(r.from_velocity, "%s: apogee detected from the altitude drop", name);
+    CHECK(r.velocity_error <= VELOCITY_MAX_ERROR, "%s: velocity estimate off by %.1f m/s", name, r.velocity_error);
+    CHECK(r.transition[RECOVERY] > r.transition[DESCENT], "%s: landing not detected", name);
+    return latency;
+}
+
+/**
+ *  Replay a flight as if the board reset during the coast, so that the estimator starts from rest while the rocket
+ *  is climbing
+ */
+static void check_reset(const char *name, const struct sim_trace *trace, double reset)
+{
+    struct replay_result r = replay(trace, NULL, reset, COASTING_ASCENT, FAULT_NONE);
+    // If the estimator has not settled by apogee only the altitude drop can be relied on
+    double settled = reset + ((KALMAN_SETTLE_UPDATES - 1) * BARO_PERIOD);
+    double latency = (settled < trace->apogee_time) ? APOGEE_MAX_LATENCY : FALLBACK_MAX_LATENCY;
+    CHECK((r.transition[DESCENT] >= trace->apogee_time + APOGEE_EARLIEST) &&
+          (r.transition[DESCENT] <= trace->apogee_time + latency),
+          "%s: reset at %.2f s, apogee detected at %.2f s, true apogee at %.2f s", name, reset, r.transition[DESCENT],
+          trace->apogee_time);
+}
+
+/**
+ *  Replay a flight in which the accelerometer stops updating at burnout, so that only the altitude drop can be relied
+ *  on
+ */
+static void check_fallback(const char *name, const struct sim_trace *trace)
+{
+    struct replay_result r = replay(trace, NULL, 0, STANDBY, FAULT_ACCEL_STUCK);
+    CHECK((r.transition[DESCENT] >= trace->apogee_time + APOGEE_EARLIEST) &&
+          (r.transition[DESCENT] <= trace->apogee_time + FALLBACK_MAX_LATENCY),
+          "%s: apogee detected at %.2f s with a stuck accelerometer, true apogee at %.2f s", name,
+          r.transition[DESCENT], trace->apogee_time);
+}
+
+static void test_generated_flights(void)
+{
+    static const struct {
+        const char *name;
+        struct sim_flight_profile profile;
+    } flights[] = {
+        {"low", {.pad_time = 5, .boost_accel = 5, .burn_time = 2, .drag = 0.001, .descent_rate = 20}},
+        {"nominal", {.pad_time = 5, .boost_accel = 8, .burn_time = 3, .drag = 0.0004, .descent_rate = 20}},
+        {"high", {.pad_time = 5, .boost_accel = 12, .burn_time = 4, .drag = 0.0002, .descent_rate = 25}}
+    };
+    static const struct {
+        const char *name;
+        double accel;       // g
+        double altitude;    // m
+    } noise[] = {{"quiet", 0.02, 0.5}, {"noisy", 0.1, 2.0}};
+    const uint8_t seeds = 5;
+    double worst = 0;
+
+    for (uint8_t f = 0; f < sizeof(flights) / sizeof(flights[0]); f++) {
+        struct sim_flight_profile profile = flights[f].profile;
+        struct sim_trace truth;
+        sim_trace_generate(&truth, &profile, ACCEL_PERIOD);
+        double ignition = profile.pad_time;
+        double burnout = profile.pad_time + profile.burn_time;
+
+        for (uint8_t n = 0; n < sizeof(noise) / sizeof(noise[0]); n++) {
+            for (uint8_t seed = 1; seed <= seeds; seed++) {
+                char name[32];
+                snprintf(name, sizeof(name), "%s, %s, seed %u", flights[f].name, noise[n].name, seed);
+                profile.accel_noise = noise[n].accel;
+                profile.altitude_noise = noise[n].altitude;
+                profile.seed = seed;
+
+                struct sim_trace trace;
+                sim_trace_generate(&trace, &profile, ACCEL_PERIOD);
+                // The noise does not change the flight
+                trace.apogee_time = truth.apogee_time;
+                trace.apogee_altitude = truth.apogee_altitude;
+
+                worst = fmax(worst, check_flight(name, &trace, &truth, ignition, burnout));
+                // Resets from just after burnout up to a second before apogee
+                for (double reset = burnout + 0.5; reset < truth.apogee_time - 1; reset += 1.0) {
+                    check_reset(name, &trace, reset);
+                }
+                check_fallback(name, &trace);
+                free(trace.samples);
+            }
+        }
+        free(truth.samples);
+    }
+    printf("Worst apogee detection latency %.2f s\n", worst);
+}
+
+static void test_recorded_flights(int count, char **paths)
+{
+    for (int i = 0; i < count; i++) {
+        struct sim_trace trace;
+        if (sim_trace_load(&trace, paths[i]) != 0) {
+            CHECK(0, "could not load %s", paths[i]);
+            continue;
+        }
+        // The ignition and burnout times are not known for recorded flights
+        check_flight(paths[i], &trace, NULL, -1, 0);
+        free(trace.samples);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // Firmware code counts simulated cycles as it runs
+    sim_init();
+    test_gains();
+    test_generated_flights();
+    test_recorded_flights(argc - 1, argv + 1);
+
+    if (failures != 0) {
+        printf("%u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("apogee: all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+//
+//  test_crc.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Checks crc.c against a bit at a time implementation of CRC-16/CCITT-FALSE, then verifies the CRC of every
+//  telemetry frame sent over the simulated XBee during a flight and estimates the cost of the CRC of each frame
+//
+
+#include "sim_devices.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+// Firmware code is built with -fpack-struct
+#pragma pack(push, 1)
+#include "telemetry_format.h"
+#include "log_format.h"
+#pragma pack(pop)
+
+#define FLIGHT_TIME     60  // Simulated seconds
+#define FRAME_START     0x52
+#define FRAME_END       0xCC
+#define CRC_PRESENT     0x80    // crc_present in the high byte of the length field
+
+extern int firmware_main(void);
+
+static struct sim_board board;
+static struct sim_trace trace;
+static unsigned failures;
+static unsigned frames_checked[FRAME_TYPE_ROCKET_AGGREGATE + 1];
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+/** CRC-16/CCITT-FALSE a bit at a time, as in the specification */
+static uint16_t reference_crc(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void test_vectors(void)
+{
+    // The check value from the CRC catalogue
+    const char *check = "123456789";
+    CHECK(crc16((const uint8_t *)check, 9) == 0x29B1, "got %04x", crc16((const uint8_t *)check, 9));
+    CHECK(crc16(NULL, 0) == CRC16_INIT, "empty data");
+
+    uint8_t data[256];
+    uint32_t seed = 1;
+    for (uint16_t length = 0; length <= sizeof(data); length++) {
+        for (uint16_t i = 0; i < sizeof(data); i++) {
+            seed = (seed * 1103515245) + 12345;
+            data[i] = seed >> 16;
+        }
+        uint16_t expected = reference_crc(data, length);
+        CHECK(crc16(data, length) == expected, "length %u", length);
+        // Calculating the CRC in two parts gives the same result
+        uint16_t split = length / 3;
+        CHECK(crc16_update(crc16(data, split), data + split, length - split) == expected, "length %u split", length);
+    }
+}
+
+static void test_check(void)
+{
+    uint8_t record[LOG_FORMAT_BLOCK_LENGTH];
+    for (uint8_t i = 0; i < LOG_FORMAT_DATA_LENGTH; i++) {
+        record[i] = i * 7;
+    }
+    uint16_t crc = crc16(record, LOG_FORMAT_DATA_LENGTH);
+    record[LOG_FORMAT_DATA_LENGTH] = crc & 0xFF;
+    record[LOG_FORMAT_DATA_LENGTH + 1] = crc >> 8;
+    CHECK(crc16_check(record, sizeof(record)) == 0, "good record rejected");
+    CHECK(crc16_check(record, 1) != 0, "a record too short for a CRC was accepted");
+
+    // Every single bit error and every burst of up to 16 bits is detected
+    for (uint16_t bit = 0; bit < (sizeof(record) * 8); bit++) {
+        for (uint8_t burst = 1; (burst <= 16) && ((bit + burst) <= (sizeof(record) * 8)); burst++) {
+            uint8_t corrupted[sizeof(record)];
+            memcpy(corrupted, record, sizeof(record));
+            // A burst starts and ends with a flipped bit
+            corrupted[bit / 8] ^= 0x80 >> (bit % 8);
+            if (burst > 1) {
+                uint16_t last = bit + burst - 1;
+                corrupted[last / 8] ^= 0x80 >> (last % 8);
+            }
+            CHECK(crc16_check(corrupted, sizeof(corrupted)) != 0, "burst of %u at bit %u not detected", burst, bit);
+        }
+    }
+}
+
+/**
+ *  Estimate the CPU cycles used by the firmware's CRC of a frame from the simulator's cost model
+ */
+static double crc_cycles(uint16_t length)
+{
+    static uint8_t frame[256];
+    uint64_t start = sim_cycles;
+    crc16(frame, length);
+    return (double)(sim_cycles - start);
+}
+
+/**
+ *  The host side verifier, drops any frame which does not have a good CRC
+ */
+static void check_payload(void *context, const uint8_t *payload, uint8_t length)
+{
+    if ((length < 6) || (payload[0] != FRAME_START)) {
+        CHECK(0, "%u byte payload is not a telemetry frame", length);
+        return;
+    }
+    uint8_t type = payload[3];
+    CHECK(payload[5] & CRC_PRESENT, "frame of type %u has no CRC", type);
+    CHECK(payload[length - 1] == FRAME_END, "frame of type %u has no end delimiter", type);
+    CHECK(crc16_check(payload, length - 1) == 0, "frame of type %u has a bad CRC", type);
+    if (type < (sizeof(frames_checked) / sizeof(frames_checked[0]))) {
+        frames_checked[type]++;
+    }
+}
+
+static void finish(void)
+{
+    printf("Verified %u primary and %u aggregate frames from a %u s flight\n", frames_checked[FRAME_TYPE_ROCKET_PRIMARY],
+           frames_checked[FRAME_TYPE_ROCKET_AGGREGATE], FLIGHT_TIME);
+    CHECK(frames_checked[FRAME_TYPE_ROCKET_PRIMARY] != 0, "no primary frames");
+    CHECK(frames_checked[FRAME_TYPE_ROCKET_AGGREGATE] != 0, "no aggregate frames");
+    CHECK(board.xbee.oversized == 0, "%u frames were over NP", board.xbee.oversized);
+
+    if (failures != 0) {
+        printf("%u checks failed\n", failures);
+        exit(EXIT_FAILURE);
+    }
+    printf("crc: all checks passed\n");
+}
+
+int main(void)
+{
+    // Firmware code counts simulated cycles as it runs, so the simulator is reset before crc.c is used
+    sim_init();
+    test_vectors();
+    test_check();
+
+    sim_board_init(&board, 1);
+    // The simulator's cost model counts calls and memory accesses, including each table lookup
+    uint16_t primary = offsetof(struct telemetry_api_frame_with_crc, crc);
+    uint16_t aggregate = offsetof(struct telemetry_api_aggregate_frame, crc);
+    printf("Estimated CRC cost: %.0f cycles per primary frame (%u bytes), %.0f per aggregate frame (%u bytes), "
+           "%.0f per log record (%u bytes), %.1f per byte\n", crc_cycles(primary), primary, crc_cycles(aggregate),
+           aggregate, crc_cycles(LOG_FORMAT_DATA_LENGTH), LOG_FORMAT_DATA_LENGTH, crc_cycles(256) / 256);
+
+    struct sim_flight_profile profile = {
+        .pad_time = 10,
+        .boost_accel = 8,
+        .burn_time = 3,
+        .drag = 0.0004,
+        .descent_rate = 20,
+        .accel_noise = 0.02,
+        .altitude_noise = 0.5,
+        .seed = 19
+    };
+    sim_trace_generate(&trace, &profile, 0.01);
+    sim_flight_start(&trace);
+    board.xbee.on_payload = check_payload;
+
+    sim_stop_at(sim_cycles + sim_ms(FLIGHT_TIME * 1000), finish);
+    firmware_main();
+    return EXIT_FAILURE;
+}
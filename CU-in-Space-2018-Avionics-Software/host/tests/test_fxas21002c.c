@@ -0,0 +1,127 @@
+//
+//  test_fxas21002c.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Runs the FXAS21002C driver against the simulated gyroscope's register map and checks that every sample reaches the
+//  ring buffer with its value and timestamp
+//
+
+#include "sim_devices.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <avr/interrupt.h>
+#include "pindefinitions.h"
+#include "I2C.h"
+// Firmware code is built with -fpack-struct
+#pragma pack(push, 1)
+#include "Gyro-FXAS21002C.h"
+#pragma pack(pop)
+
+#define RUN_TIME            5000    // Simulated milliseconds
+#define SERVICE_PERIOD      0.25    // Milliseconds between calls to the services, as if the main loop were busy
+#define SLOW_PERIOD         20      // Milliseconds between calls to the services in the slow main loop test
+#define RATE_LSB            16.0    // LSB per º/s with the 2000º/s range used by the driver
+
+extern volatile uint32_t millis;
+
+static struct sim_fxas21002c gyro;
+static unsigned failures;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+/** The simulated roll rate at a time in milliseconds, a ramp so that each sample can be matched with its time */
+static double roll_rate(double ms)
+{
+    return ms / 10.0;
+}
+
+static void run_services(uint32_t duration, double period)
+{
+    uint16_t checked = fxas21002c_sample_count;
+    uint32_t end = millis + duration;
+
+    while (millis < end) {
+        // The driver and I2C queue are run as they would be by the main loop
+        fxas21002c_service();
+        i2c_service();
+        sim_idle(sim_ms(period));
+        millis = (uint32_t)(sim_time() * 1000);
+        sim_world.rate[0] = roll_rate(millis);
+
+        // Check each new sample against the rate at its timestamp
+        for (; checked != fxas21002c_sample_count; checked++) {
+            if ((uint16_t)(fxas21002c_sample_count - checked) > FXAS21002C_RING_LENGTH) {
+                CHECK(0, "samples %u to %u were overwritten before they were checked", checked,
+                      fxas21002c_sample_count - FXAS21002C_RING_LENGTH);
+                checked = fxas21002c_sample_count - FXAS21002C_RING_LENGTH;
+            }
+            struct fxas21002c_sample *s = fxas21002c_samples + (checked % FXAS21002C_RING_LENGTH);
+            double expected = roll_rate(s->time) * RATE_LSB;
+            // The rate changes by 16 LSB per ms, timestamps are good to within a sample period and millis rounding
+            CHECK(fabs(s->roll - expected) <= 16 * ((1000.0 / FXAS21002C_DATA_RATE) + 2),
+                  "sample %u at %u ms has roll %d, expected about %.0f", checked, s->time, s->roll, expected);
+            CHECK((s->pitch == 0) && (s->yaw == 0), "sample %u has pitch %d and yaw %d", checked, s->pitch, s->yaw);
+            if (checked != 0) {
+                struct fxas21002c_sample *last = fxas21002c_samples + ((checked - 1) % FXAS21002C_RING_LENGTH);
+                CHECK(s->time >= last->time, "sample %u at %u ms is older than the one before it", checked, s->time);
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    sim_init();
+    sim_fxas21002c_init(&gyro, SIM_PORT_C, GYRO_INT_NUM);
+    init_i2c();
+    sei();
+
+    CHECK(init_fxas21002c() == 0, "init failed");
+    while (!fxas21002c_init_done()) {
+        run_services(1, SERVICE_PERIOD);
+    }
+    CHECK(fxas21002c_init_succesful(), "configuration writes failed");
+
+    // Samples taken before the driver starts draining the FIFO may have been lost, only later ones are counted
+    run_services(100, SERVICE_PERIOD);
+    uint32_t produced = gyro.samples;
+    uint32_t overruns = gyro.overruns;
+    uint16_t stored = fxas21002c_sample_count;
+
+    run_services(RUN_TIME, SERVICE_PERIOD);
+    uint32_t expected = gyro.samples - produced;
+    uint16_t received = fxas21002c_sample_count - stored;
+    printf("Busy main loop: %u samples taken, %u stored, %u lost in the FIFO\n", expected, received,
+           gyro.overruns - overruns);
+    CHECK(gyro.overruns == overruns, "the FIFO overflowed");
+    // Samples still in the FIFO are not counted
+    CHECK((expected - received) <= 32, "%u samples taken, %u stored", expected, received);
+
+    // With the main loop only running every 20ms the FIFO holds more than the watermark when it is drained
+    produced = gyro.samples;
+    overruns = gyro.overruns;
+    stored = fxas21002c_sample_count;
+    run_services(RUN_TIME, SLOW_PERIOD);
+    expected = gyro.samples - produced;
+    received = fxas21002c_sample_count - stored;
+    printf("Slow main loop: %u samples taken, %u stored, %u lost in the FIFO\n", expected, received,
+           gyro.overruns - overruns);
+    CHECK(gyro.overruns == overruns, "the FIFO overflowed");
+    CHECK((expected - received) <= 32, "%u samples taken, %u stored", expected, received);
+
+    if (failures != 0) {
+        printf("%u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("fxas21002c: all checks passed\n");
+    return EXIT_SUCCESS;
+}
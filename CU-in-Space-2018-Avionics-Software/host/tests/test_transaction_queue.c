@@ -0,0 +1,126 @@
+//
+//  test_transaction_queue.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Checks the transaction ID and queue slot helpers shared by the drivers
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transaction_queue.h"
+
+#define QUEUE_LENGTH    5
+
+/** A transaction with an odd size, packed as it would be in firmware code */
+struct test_transaction {
+    uint8_t id;
+    uint32_t address;
+    uint8_t done: 1;
+    uint8_t active: 1;
+    uint16_t length;
+} __attribute__((packed));
+
+static struct test_transaction queue[QUEUE_LENGTH];
+static uint8_t generations[QUEUE_LENGTH];
+static unsigned failures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static struct test_transaction *get_transaction_with_id(uint8_t id)
+{
+    return transaction_get_with_id(queue, QUEUE_LENGTH, sizeof(*queue), id);
+}
+
+static struct test_transaction *get_next_free_transaction(uint8_t head)
+{
+    return transaction_get_next_free(queue, QUEUE_LENGTH, sizeof(*queue), head);
+}
+
+static uint8_t add_transaction(uint8_t head)
+{
+    struct test_transaction *t = get_next_free_transaction(head);
+    if (t == NULL) return TRANSACTION_ID_INVALID;
+
+    uint8_t index = t - queue;
+    t->id = transaction_new_id(generations + index, index);
+    t->address = 0xFFFFFFFF;
+    t->length = 0xFFFF;
+    return t->id;
+}
+
+static void test_lookup(void)
+{
+    uint8_t ids[QUEUE_LENGTH];
+    for (uint8_t i = 0; i < QUEUE_LENGTH; i++) {
+        ids[i] = add_transaction(0);
+        CHECK(ids[i] != TRANSACTION_ID_INVALID);
+        CHECK(get_transaction_with_id(ids[i]) == queue + i);
+    }
+    // The queue is full
+    CHECK(add_transaction(0) == TRANSACTION_ID_INVALID);
+    CHECK(get_next_free_transaction(3) == NULL);
+
+    // IDs which can never be in the queue
+    CHECK(get_transaction_with_id(TRANSACTION_ID_INVALID) == NULL);
+    CHECK(get_transaction_with_id(QUEUE_LENGTH) == NULL);
+    CHECK(get_transaction_with_id((1 << TRANSACTION_INDEX_BITS) | QUEUE_LENGTH) == NULL);
+    CHECK(get_transaction_with_id(ids[2] & TRANSACTION_INDEX_MASK) == NULL);
+
+    // A cleared slot is found by searching from any head, and its old ID no longer matches once it is reused
+    queue[2].id = TRANSACTION_ID_INVALID;
+    CHECK(get_transaction_with_id(ids[2]) == NULL);
+    CHECK(get_next_free_transaction(0) == queue + 2);
+    CHECK(get_next_free_transaction(3) == queue + 2);
+    uint8_t reused = add_transaction(3);
+    CHECK((reused & TRANSACTION_INDEX_MASK) == 2);
+    CHECK(reused != ids[2]);
+    CHECK(get_transaction_with_id(reused) == queue + 2);
+    CHECK(get_transaction_with_id(ids[2]) == NULL);
+
+    // The search wraps around from the head of the queue
+    queue[0].id = TRANSACTION_ID_INVALID;
+    queue[4].id = TRANSACTION_ID_INVALID;
+    CHECK(get_next_free_transaction(1) == queue + 4);
+    CHECK(get_next_free_transaction(4) == queue + 4);
+    CHECK(get_next_free_transaction(0) == queue + 0);
+}
+
+static void test_generations(void)
+{
+    memset(queue, 0, sizeof(queue));
+    memset(generations, 0, sizeof(generations));
+
+    // An ID is not given out again by a slot until all of the generations have been used
+    uint8_t seen[256] = {0};
+    for (uint8_t i = 0; i < TRANSACTION_NUM_GENERATIONS; i++) {
+        uint8_t id = add_transaction(1);
+        CHECK((id & TRANSACTION_INDEX_MASK) == 1);
+        CHECK((id >> TRANSACTION_INDEX_BITS) != 0);
+        CHECK(!seen[id]);
+        seen[id] = 1;
+        CHECK(get_transaction_with_id(id) == queue + 1);
+        queue[1].id = TRANSACTION_ID_INVALID;
+    }
+    uint8_t id = add_transaction(1);
+    CHECK(seen[id]);
+}
+
+int main(void)
+{
+    test_lookup();
+    test_generations();
+
+    if (failures != 0) {
+        printf("%u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("transaction queue: all checks passed\n");
+    return EXIT_SUCCESS;
+}
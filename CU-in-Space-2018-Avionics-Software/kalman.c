@@ -0,0 +1,76 @@
+//
+//  kalman.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Estimate altitude, vertical velocity and vertical acceleration from barometer and accelerometer data
+//
+
+#include "kalman.h"
+
+// MARK: Constants
+// Steady state Kalman gains for a constant acceleration model sampled every MPL3115A2_SAMPLE_PERIOD (140ms), with 1m
+// of barometer noise, 1 m/s^2 of accelerometer noise and 5 m/s^3 of jerk as process noise. Gains have 16 fractional
+// bits and must be recalculated if the sample period changes.
+#define GAIN_ALT_ALT        11694   // Altitude correction from altitude error
+#define GAIN_ALT_ACCEL      951     // Altitude correction from acceleration error (s^2)
+#define GAIN_VEL_ALT        8248    // Velocity correction from altitude error (1/s)
+#define GAIN_VEL_ACCEL      6603    // Velocity correction from acceleration error (s)
+#define GAIN_ACCEL_ALT      951     // Acceleration correction from altitude error (1/s^2)
+#define GAIN_ACCEL_ACCEL    32525   // Acceleration correction from acceleration error
+
+#define GAIN_FRACTION_BITS  16
+
+// MARK: Function Definitions
+void init_kalman(struct kalman_state *state)
+{
+    state->altitude = 0;
+    state->velocity = 0;
+    state->accel = 0;
+    state->time = 0;
+    state->updates = 0;
+    state->initialized = 0;
+}
+
+/**
+ *  Multiply an error by a gain
+ */
+static int32_t apply_gain(int32_t error, int32_t gain)
+{
+    return ((int64_t)error * gain) >> GAIN_FRACTION_BITS;
+}
+
+void kalman_update(struct kalman_state *state, uint32_t time, int32_t altitude, int16_t accel)
+{
+    if (state->updates < KALMAN_SETTLE_UPDATES) {
+        state->updates++;
+    }
+
+    // Multiply rather than shift since altitude may be negative
+    int32_t measured_alt = altitude * (1L << KALMAN_FRACTION_BITS);
+    int32_t measured_accel = (int32_t)(accel - UPRIGHT_ACCEL_THRESOLD) * KALMAN_ACCEL_SCALE;
+
+    if (!state->initialized) {
+        // Start at rest at the measured altitude
+        state->altitude = measured_alt;
+        state->velocity = 0;
+        state->accel = measured_accel;
+        state->time = time;
+        state->initialized = 1;
+        return;
+    }
+
+    // Predict
+    int64_t dt = time - state->time;
+    state->time = time;
+
+    state->altitude += ((state->velocity * dt) / 1000) + ((state->accel * dt * dt) / 2000000);
+    state->velocity += (state->accel * dt) / 1000;
+
+    // Correct
+    int32_t alt_error = measured_alt - state->altitude;
+    int32_t accel_error = measured_accel - state->accel;
+
+    state->altitude += apply_gain(alt_error, GAIN_ALT_ALT) + apply_gain(accel_error, GAIN_ALT_ACCEL);
+    state->velocity += apply_gain(alt_error, GAIN_VEL_ALT) + apply_gain(accel_error, GAIN_VEL_ACCEL);
+    state->accel += apply_gain(alt_error, GAIN_ACCEL_ALT) + apply_gain(accel_error, GAIN_ACCEL_ACCEL);
+}
@@ -0,0 +1,67 @@
+//
+//  kalman.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Estimate altitude, vertical velocity and vertical acceleration from barometer and accelerometer data
+//
+
+#ifndef kalman_h
+#define kalman_h
+
+#include "global.h"
+
+// MARK: Constants
+#define KALMAN_FRACTION_BITS    8       // The number of fractional bits in each of the estimates
+#define KALMAN_ACCEL_SCALE      157     // 3.9mg in 1/16 m/s^2 with KALMAN_FRACTION_BITS fractional bits
+#define KALMAN_SETTLE_UPDATES   25      // The number of updates after which the estimates are trusted (about 3.5s)
+
+// MARK: Types
+/**
+ *  The state of the estimator, all estimates have KALMAN_FRACTION_BITS fractional bits
+ */
+struct kalman_state {
+    /** The estimated altitude in 1/16m per least signifigant bit */
+    int32_t altitude;
+    /** The estimated vertical velocity in 1/16 m/s per least signifigant bit */
+    int32_t velocity;
+    /** The estimated vertical acceleration, not including gravity, in 1/16 m/s^2 per least signifigant bit */
+    int32_t accel;
+    /** The time of the last measurment in milliseconds */
+    uint32_t time;
+    /** The number of measurments which have been made, stops counting at KALMAN_SETTLE_UPDATES */
+    uint8_t updates;
+    /** 1 if at least one measurment has been made */
+    uint8_t initialized:1;
+};
+
+// MARK: Macros
+/**
+ *  Get the whole part of an estimate
+ */
+#define KALMAN_WHOLE(x) ((x) >> KALMAN_FRACTION_BITS)
+
+/**
+ *  Determine whether the estimator has had enough measurments to have converged from its initial state
+ */
+#define KALMAN_SETTLED(state) ((state)->updates >= KALMAN_SETTLE_UPDATES)
+
+// MARK: Function declarations
+/**
+ *  Reset an estimator to its initial state
+ *  @param state The estimator to be reset
+ */
+extern void init_kalman(struct kalman_state *state);
+
+/**
+ *  Update the estimates with a new set of measurments
+ *  @note The gains used are the steady state gains for the nominal barometer sample period, the period used for
+ *        prediction is taken from the measurment times.
+ *  @param state The estimator to be updated
+ *  @param time The time at which the measurments where taken in milliseconds
+ *  @param altitude The measured altitude in 1/16m per least signifigant bit
+ *  @param accel The measured acceleration along the vertical axis, including gravity, in 3.9mg per least signifigant
+ *               bit
+ */
+extern void kalman_update(struct kalman_state *state, uint32_t time, int32_t altitude, int16_t accel);
+
+#endif /* kalman_h */
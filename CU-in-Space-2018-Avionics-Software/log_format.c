@@ -0,0 +1,233 @@
+//
+//  log_format.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Compact encoding of telemetry frames for the flight log
+//
+
+#include "log_format.h"
+
+#include "crc.h"
+
+#include <string.h>
+
+// MARK: Constants
+/**
+ *  The size in bytes of each field of struct telemetry_frame, in order. Each group of ADC value and flags is
+ *  treated as one field, as are the three bytes of the altitude and the two of the altimeter temperature.
+ */
+static const uint8_t field_sizes[LOG_FORMAT_NUM_FIELDS] = {
+    4,                          // Mission time
+    2, 2, 2, 2, 2, 2, 2, 2,     // ADC values and flags
+    2, 2, 2,                    // Acceleration
+    2, 2, 2, 1,                 // Angular rates and gyroscope temperature
+    3, 2,                       // Altitude and altimeter temperature
+    4, 4, 4, 2, 2, 4            // GPS
+};
+
+#define BITMAP_LENGTH ((LOG_FORMAT_NUM_FIELDS + 7) / 8)
+
+_Static_assert(sizeof(struct telemetry_frame) == LOG_FORMAT_FRAME_LENGTH,
+               "field_sizes does not match the layout of struct telemetry_frame");
+_Static_assert(LOG_FORMAT_FRAME_LENGTH <= LOG_FORMAT_DATA_LENGTH, "A keyframe does not fit in a record");
+
+// MARK: Function Definitions
+/**
+ *  Read a little endian field
+ */
+static uint32_t read_field(const uint8_t *p, uint8_t size)
+{
+    uint32_t value = 0;
+    for (uint8_t i = size; i > 0; i--) {
+        value = (value << 8) | p[i - 1];
+    }
+    return value;
+}
+
+/**
+ *  Write a little endian field
+ */
+static void write_field(uint8_t *p, uint8_t size, uint32_t value)
+{
+    for (uint8_t i = 0; i < size; i++) {
+        p[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+/**
+ *  Encode the difference between a frame and a keyframe
+ *  @param record The buffer in which the record is placed
+ *  @param max_length The length of the buffer
+ *  @return The length of the record, 0 if it did not fit
+ */
+static uint8_t encode_delta(const uint8_t *keyframe, const uint8_t *frame, uint8_t *record, uint8_t max_length)
+{
+    uint8_t length = BITMAP_LENGTH;
+    memset(record, 0, BITMAP_LENGTH);
+    
+    for (uint8_t i = 0; i < LOG_FORMAT_NUM_FIELDS; i++) {
+        uint8_t size = field_sizes[i];
+        uint32_t delta = read_field(frame, size) - read_field(keyframe, size);
+        keyframe += size;
+        frame += size;
+        
+        // Sign extend the difference from the width of the field so that small changes in either direction are small
+        uint8_t shift = 32 - (size * 8);
+        int32_t signed_delta = ((int32_t)(delta << shift)) >> shift;
+        if (signed_delta == 0) continue;
+        
+        // Zigzag encode so that the sign is in the least signifigant bit
+        uint32_t value = ((uint32_t)signed_delta << 1) ^ (uint32_t)(signed_delta >> 31);
+        
+        record[i / 8] |= (1 << (i % 8));
+        do {
+            if (length == max_length) return 0;
+            record[length++] = (value & 0x7F) | ((value > 0x7F) ? 0x80 : 0);
+            value >>= 7;
+        } while (value != 0);
+    }
+    
+    return length;
+}
+
+/**
+ *  Decode a frame from a compact block
+ *  @param keyframe The keyframe against which the record was encoded
+ *  @param record The record
+ *  @param length The number of bytes left in the block
+ *  @param frame The buffer in which the frame is placed
+ *  @return The number of bytes used by the record, 0 if the record is incomplete
+ */
+static uint8_t decode_delta(const uint8_t *keyframe, const uint8_t *record, uint8_t length, uint8_t *frame)
+{
+    if (length < BITMAP_LENGTH) return 0;
+    uint8_t used = BITMAP_LENGTH;
+    
+    for (uint8_t i = 0; i < LOG_FORMAT_NUM_FIELDS; i++) {
+        uint8_t size = field_sizes[i];
+        uint32_t value = 0;
+        
+        if (record[i / 8] & (1 << (i % 8))) {
+            uint8_t shift = 0;
+            uint8_t byte;
+            do {
+                if ((used == length) || (shift > 28)) return 0;
+                byte = record[used++];
+                value |= (uint32_t)(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            
+            // Undo zigzag encoding
+            value = (value >> 1) ^ -(value & 1);
+        }
+        
+        write_field(frame, size, read_field(keyframe, size) + value);
+        keyframe += size;
+        frame += size;
+    }
+    
+    return used;
+}
+
+/**
+ *  Pad a record, add its CRC and store it
+ *  @param record A buffer of LOG_FORMAT_BLOCK_LENGTH bytes which holds the record
+ *  @param length The length of the record
+ */
+static void emit_record(uint8_t type, uint8_t *record, uint8_t length, log_format_emit_t emit)
+{
+    memset(record + length, 0xFF, LOG_FORMAT_DATA_LENGTH - length);
+    uint16_t crc = crc16(record, LOG_FORMAT_DATA_LENGTH);
+    record[LOG_FORMAT_DATA_LENGTH] = crc & 0xFF;
+    record[LOG_FORMAT_DATA_LENGTH + 1] = crc >> 8;
+    emit(type, record, LOG_FORMAT_BLOCK_LENGTH);
+}
+
+void init_log_format_encoder(struct log_format_encoder *encoder)
+{
+    encoder->block[0] = 0;
+    encoder->block_length = 1;
+    encoder->frame_count = 0;
+}
+
+void log_format_flush(struct log_format_encoder *encoder, log_format_emit_t emit)
+{
+    if (encoder->block[0] != 0) {
+        emit_record(LOG_FORMAT_TYPE_COMPACT, encoder->block, encoder->block_length, emit);
+    }
+    encoder->block[0] = 0;
+    encoder->block_length = 1;
+}
+
+void log_format_add_frame(struct log_format_encoder *encoder, const struct telemetry_frame *frame,
+                          log_format_emit_t emit)
+{
+    uint8_t record[LOG_FORMAT_BLOCK_LENGTH];
+    uint8_t length = 0;
+    
+    if ((encoder->frame_count != 0) && (encoder->frame_count < LOG_FORMAT_KEYFRAME_INTERVAL)) {
+        length = encode_delta((const uint8_t*)&encoder->keyframe, (const uint8_t*)frame, record,
+                              LOG_FORMAT_DATA_LENGTH - 1);
+    }
+    
+    if (length == 0) {
+        // Time for a new keyframe, or the frame differs too much from the last one to fit in a block
+        log_format_flush(encoder, emit);
+        memcpy(record, frame, LOG_FORMAT_FRAME_LENGTH);
+        emit_record(LOG_FORMAT_TYPE_KEYFRAME, record, LOG_FORMAT_FRAME_LENGTH, emit);
+        encoder->keyframe = *frame;
+        encoder->frame_count = 1;
+        return;
+    }
+    
+    if ((encoder->block_length + length) > LOG_FORMAT_DATA_LENGTH) {
+        log_format_flush(encoder, emit);
+    }
+    memcpy(encoder->block + encoder->block_length, record, length);
+    encoder->block_length += length;
+    encoder->block[0]++;
+    encoder->frame_count++;
+}
+
+void init_log_format_decoder(struct log_format_decoder *decoder)
+{
+    decoder->has_keyframe = 0;
+}
+
+uint8_t log_format_decode(struct log_format_decoder *decoder, uint8_t type, const uint8_t *data,
+                          uint8_t length, log_format_frame_callback_t callback)
+{
+    if ((length < LOG_FORMAT_BLOCK_LENGTH) || crc16_check(data, LOG_FORMAT_BLOCK_LENGTH)) {
+        if (type == LOG_FORMAT_TYPE_KEYFRAME) {
+            // The frames after this keyframe can not be trusted either
+            decoder->has_keyframe = 0;
+        }
+        return 0;
+    }
+    length = LOG_FORMAT_DATA_LENGTH;
+    
+    if (type == LOG_FORMAT_TYPE_KEYFRAME) {
+        memcpy(&decoder->keyframe, data, LOG_FORMAT_FRAME_LENGTH);
+        decoder->has_keyframe = 1;
+        callback(&decoder->keyframe);
+        return 1;
+    } else if ((type != LOG_FORMAT_TYPE_COMPACT) || !decoder->has_keyframe) {
+        return 0;
+    }
+    
+    struct telemetry_frame frame;
+    uint8_t count = data[0];
+    uint8_t offset = 1;
+    uint8_t decoded = 0;
+    
+    for (; decoded < count; decoded++) {
+        uint8_t used = decode_delta((const uint8_t*)&decoder->keyframe, data + offset, length - offset,
+                                    (uint8_t*)&frame);
+        if (used == 0) break;
+        offset += used;
+        callback(&frame);
+    }
+    
+    return decoded;
+}
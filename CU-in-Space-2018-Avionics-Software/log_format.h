@@ -0,0 +1,110 @@
+//
+//  log_format.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Compact encoding of telemetry frames for the flight log
+//
+
+#ifndef log_format_h
+#define log_format_h
+
+#include "global.h"
+#include "telemetry_format.h"
+
+// MARK: Constants
+#define LOG_FORMAT_BLOCK_LENGTH         60  // The largest record which can be logged, the size of a logger slot
+#define LOG_FORMAT_CRC_LENGTH           2   // Each record ends with a CRC of the rest of the record
+#define LOG_FORMAT_DATA_LENGTH          (LOG_FORMAT_BLOCK_LENGTH - LOG_FORMAT_CRC_LENGTH)  // Must fit a keyframe
+#define LOG_FORMAT_KEYFRAME_INTERVAL    32  // The number of frames encoded against each keyframe, including itself
+#define LOG_FORMAT_NUM_FIELDS           24  // The number of fields which are delta encoded in each frame
+#define LOG_FORMAT_FRAME_LENGTH         58  // The total size of the fields, the length of a keyframe
+
+/** The record types used in the log */
+#define LOG_FORMAT_TYPE_KEYFRAME        0   // A complete struct telemetry_frame
+#define LOG_FORMAT_TYPE_COMPACT         1   // A block of frames encoded against the last keyframe
+
+// MARK: Types
+/**
+ *  A function which stores a record in the log
+ *  @param type The type of the record
+ *  @param data The contents of the record
+ *  @param length The length of the record, always LOG_FORMAT_BLOCK_LENGTH
+ *  @return 0 if the record was stored
+ */
+typedef uint8_t (*log_format_emit_t)(uint8_t type, const uint8_t *data, uint8_t length);
+
+/**
+ *  A function to which decoded frames are passed
+ */
+typedef void (*log_format_frame_callback_t)(const struct telemetry_frame *frame);
+
+/**
+ *  State kept between frames while encoding
+ */
+struct log_format_encoder {
+    /** The frame which the frames in compact blocks are encoded against */
+    struct telemetry_frame keyframe;
+    /** The compact block currently being filled, the first byte is the number of frames in the block */
+    uint8_t block[LOG_FORMAT_BLOCK_LENGTH];
+    /** The number of bytes used in the block */
+    uint8_t block_length;
+    /** The number of frames which have been encoded since the last keyframe, including the keyframe */
+    uint8_t frame_count;
+};
+
+/**
+ *  State kept between records while decoding
+ */
+struct log_format_decoder {
+    /** The most recent keyframe */
+    struct telemetry_frame keyframe;
+    /** 1 if a keyframe has been found */
+    uint8_t has_keyframe:1;
+};
+
+// MARK: Function declarations
+/**
+ *  Reset an encoder so that the next frame is stored as a keyframe
+ */
+extern void init_log_format_encoder(struct log_format_encoder *encoder);
+
+/**
+ *  Encode a frame for the log
+ *  @note Frames are stored as a keyframe once every LOG_FORMAT_KEYFRAME_INTERVAL frames. The frames in between are
+ *        stored in compact blocks, each field which differs from the keyframe is stored as a zigzag encoded varint
+ *        of the difference. A compact block is stored when the next frame does not fit in it. Every record is
+ *        padded to LOG_FORMAT_DATA_LENGTH bytes and followed by its CRC-16 (see crc.h).
+ *  @param encoder The encoder state
+ *  @param frame The frame to be logged
+ *  @param emit The function used to store finished records
+ */
+extern void log_format_add_frame(struct log_format_encoder *encoder, const struct telemetry_frame *frame,
+                                 log_format_emit_t emit);
+
+/**
+ *  Store the compact block currently being filled, even if it is not full
+ */
+extern void log_format_flush(struct log_format_encoder *encoder, log_format_emit_t emit);
+
+/**
+ *  Reset a decoder
+ */
+extern void init_log_format_decoder(struct log_format_decoder *decoder);
+
+/**
+ *  Reconstruct the frames stored in a record from the log
+ *  @note The decoder only depends on telemetry_format.h and crc.c so that it can be built into ground station
+ *        software. Records must be passed in the order in which they were logged. Records with a bad CRC are
+ *        skipped, if a keyframe is bad the compact blocks after it are skipped as well.
+ *  @param decoder The decoder state
+ *  @param type The type of the record
+ *  @param data The contents of the record
+ *  @param length The length of the record
+ *  @param callback The function to which each frame is passed
+ *  @return The number of frames which where decoded, compact blocks can not be decoded before the first keyframe
+ *          and records with a bad CRC are not decoded
+ */
+extern uint8_t log_format_decode(struct log_format_decoder *decoder, uint8_t type, const uint8_t *data,
+                                 uint8_t length, log_format_frame_callback_t callback);
+
+#endif /* log_format_h */
@@ -0,0 +1,447 @@
+//
+//  logger.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Collect records in RAM and store them in a circular log in the external EEPROM one full page at a time
+//
+
+#include "logger.h"
+
+#include <string.h>
+
+#include "EEPROM.h"
+
+// MARK: Constants
+#define PAGE_NONE           0xFFFF      // Page number used where there is no page
+#define HINT_WINDOW         (LOGGER_HINT_INTERVAL + 4)  // The head should be at most this many pages after the hint
+
+// MARK: Types
+struct page_buffer {
+    /** The contents of the page */
+    uint8_t data[EEPROM_25LC1024_PAGE_LENGTH];
+    /** The page number at which this page will be written, PAGE_NONE if one has not been assigned yet */
+    uint16_t number;
+    /** The ID of the EEPROM transaction writing this page, 0 if the page is not being written */
+    uint8_t transaction_id;
+    /** The number of slots which contain records */
+    uint8_t slots;
+    /** 1 if the page is full and waiting to be written */
+    uint8_t pending:1;
+};
+
+/**
+ *  Stages of the search for the head of the log which is done after a reset
+ */
+typedef enum {SEARCH_REFERENCE, SEARCH_PROBE, SEARCH_DONE} search_state_t;
+
+/**
+ *  Whether the records from the flight are protected from being overwritten
+ */
+typedef enum {PROTECT_NONE, PROTECT_REQUESTED, PROTECT_ACTIVE} protect_state_t;
+
+// MARK: Variable Definitions
+uint16_t logger_dropped;
+
+/** Two page buffers so that one can be filled while the other is being written */
+static struct page_buffer pages[2];
+/** The index of the page buffer currently being filled */
+static uint8_t fill_index;
+/** The number of slots which have been used in the page being filled */
+static uint8_t fill_slots;
+/** The value of millis when the first record was added to the page being filled */
+static uint32_t fill_start;
+
+/** Records kept in RAM before launch, and records waiting to be logged after them once launch is detected */
+static uint8_t pretrigger_records[LOGGER_PRETRIGGER_LENGTH][LOGGER_RECORD_LENGTH];
+/** The type of each record in the pre-trigger buffer */
+static uint8_t pretrigger_types[LOGGER_PRETRIGGER_LENGTH];
+/** The index of the oldest record in the pre-trigger buffer */
+static uint8_t pretrigger_head;
+/** The number of records in the pre-trigger buffer */
+static uint8_t pretrigger_count;
+/** 1 if records are being kept in the pre-trigger buffer until launch */
+static uint8_t pretrigger_active;
+
+/** The page number which will be given to the next page to be written */
+static uint16_t page_number;
+/** The sequence number which will be given to the first record in the next page to be written */
+static uint32_t sequence;
+
+/** The page from which the search for the head of the log starts, as stored in internal EEPROM */
+static uint16_t stored_hint;
+/** Whether the records from the flight are protected */
+static protect_state_t protect_state;
+/** The first page written after launch */
+static uint16_t protected_page;
+/** The number of pages which can be written before the first page after launch would be overwritten */
+static uint16_t pages_left;
+/** 1 if the hint should be written to internal EEPROM right away */
+static uint8_t hint_dirty;
+/** 1 if the protected page should be written to internal EEPROM */
+static uint8_t protect_dirty;
+static uint8_t internal_eeprom_transaction_id;
+
+/** The current stage of the search for the head of the log */
+static search_state_t search_state;
+static uint8_t search_transaction_id;
+/** The sequence number and type read by the last probe */
+static uint32_t search_key;
+/** The page which the pages probed are compared to */
+static uint16_t search_ref;
+/** The sequence number of the reference page */
+static uint32_t search_ref_key;
+/** The sequence number of the newest page found so far */
+static uint32_t search_newest_key;
+/** The head is known to be between search_low and search_high pages after the reference page */
+static uint16_t search_low;
+static uint16_t search_high;
+/** The page being probed, relative to the reference page */
+static uint16_t search_mid;
+
+// MARK: Function Definitions
+void init_logger(void)
+{
+    memset(pages, 0xFF, sizeof(pages));
+    for (uint8_t i = 0; i < 2; i++) {
+        pages[i].transaction_id = 0;
+        pages[i].slots = 0;
+        pages[i].pending = 0;
+    }
+    
+    stored_hint = eeprom_read_byte_sync(EEPROM_ADDR_TELEMETRY_LOCATION) |
+                  (eeprom_read_byte_sync(EEPROM_ADDR_TELEMETRY_LOCATION + 1) << 8);
+    protected_page = eeprom_read_byte_sync(EEPROM_ADDR_LOGGER_PROTECTED) |
+                     (eeprom_read_byte_sync(EEPROM_ADDR_LOGGER_PROTECTED + 1) << 8);
+    
+    if (stored_hint >= LOGGER_NUM_PAGES) {
+        stored_hint = 0;
+    }
+    if (protected_page < LOGGER_NUM_PAGES) {
+        protect_state = PROTECT_ACTIVE;
+    }
+    
+    // The head of the log is found by the logger service once the external EEPROMs are ready
+    search_ref = stored_hint;
+    search_state = SEARCH_REFERENCE;
+}
+
+/**
+ *  Get the address of a page in the log
+ */
+static inline uint32_t page_address(uint16_t number)
+{
+    // Consecutive pages alternate between the two eeproms
+    return eeprom_25lc1024_stripe((uint32_t)number * EEPROM_25LC1024_PAGE_LENGTH);
+}
+
+/**
+ *  Start logging from the head of the log once it has been found
+ *  @param head The first page which does not contain the newest records
+ *  @param next_sequence The sequence number for the first record to be written
+ */
+static void finish_search(uint16_t head, uint32_t next_sequence)
+{
+    page_number = head;
+    sequence = next_sequence;
+    search_state = SEARCH_DONE;
+    
+    if (protect_state == PROTECT_ACTIVE) {
+        pages_left = (protected_page + LOGGER_NUM_PAGES - head) % LOGGER_NUM_PAGES;
+    }
+}
+
+/**
+ *  Find the head of the log after a reset, one page at a time
+ *  @note Within the pages written since the reference page every page has a higher sequence number than the one
+ *        before it, so the head is the first page which is erased or older than the reference page. The hint in
+ *        internal EEPROM is used as the reference page so that the first probe is likely to narrow the search to a
+ *        few pages.
+ */
+static void search_service(void)
+{
+    if (search_transaction_id != 0) {
+        if (!eeprom_25lc1024_transaction_done(search_transaction_id)) return;
+        eeprom_25lc1024_clear_transaction(search_transaction_id);
+        search_transaction_id = 0;
+        
+        if (search_state == SEARCH_DONE) {
+            // The log was reset during the search
+            return;
+        } else if (search_state == SEARCH_REFERENCE) {
+            if (search_key != LOGGER_SEQUENCE_ERASED) {
+                search_ref_key = search_key & LOGGER_SEQUENCE_MASK;
+                search_newest_key = search_ref_key;
+                search_low = 1;
+                search_high = LOGGER_NUM_PAGES;
+                search_mid = (HINT_WINDOW < LOGGER_NUM_PAGES) ? HINT_WINDOW : (LOGGER_NUM_PAGES / 2);
+                search_state = SEARCH_PROBE;
+            } else if (search_ref != 0) {
+                // The hint does not point to a page which has been written, search from the first page instead
+                search_ref = 0;
+            } else {
+                // The log is empty
+                finish_search(0, 0);
+                return;
+            }
+        } else {
+            if ((search_key != LOGGER_SEQUENCE_ERASED) && ((search_key & LOGGER_SEQUENCE_MASK) >= search_ref_key)) {
+                // Page was written after the reference page
+                search_low = search_mid + 1;
+                search_newest_key = search_key & LOGGER_SEQUENCE_MASK;
+            } else {
+                search_high = search_mid;
+            }
+            
+            if (search_low == search_high) {
+                finish_search((search_ref + search_low) % LOGGER_NUM_PAGES, search_newest_key + LOGGER_SLOTS_PER_PAGE);
+                return;
+            }
+            search_mid = search_low + ((search_high - search_low) / 2);
+        }
+    }
+    
+    uint16_t page = (search_state == SEARCH_REFERENCE) ? search_ref : ((search_ref + search_mid) % LOGGER_NUM_PAGES);
+    eeprom_25lc1024_read(&search_transaction_id, page_address(page), sizeof(search_key), (uint8_t*)&search_key);
+}
+
+/**
+ *  Mark the page being filled as ready to be written and start filling the other page
+ */
+static void commit_page(void)
+{
+    pages[fill_index].slots = fill_slots;
+    pages[fill_index].pending = 1;
+    fill_index ^= 1;
+    fill_slots = 0;
+}
+
+/**
+ *  Add a record to the page being filled
+ *  @return 0 if the record was added, 1 if the page buffer has not been written since it was last filled
+ */
+static uint8_t add_record(uint8_t type, const uint8_t *data, uint8_t length)
+{
+    struct page_buffer *page = pages + fill_index;
+    if (page->pending || (page->transaction_id != 0)) return 1;
+    
+    if (fill_slots == 0) {
+        fill_start = millis;
+    }
+    // The sequence number is added to the header when the page is written
+    uint8_t *slot = page->data + (fill_slots * LOGGER_SLOT_LENGTH);
+    uint32_t header = (uint32_t)type << LOGGER_TYPE_SHIFT;
+    memcpy(slot, &header, LOGGER_SEQUENCE_LENGTH);
+    memcpy(slot + LOGGER_SEQUENCE_LENGTH, data, length);
+    fill_slots++;
+    
+    if (fill_slots == LOGGER_SLOTS_PER_PAGE) {
+        commit_page();
+    }
+    return 0;
+}
+
+/**
+ *  Add a record to the end of the pre-trigger buffer
+ *  @note While waiting for launch the oldest record is replaced when the buffer is full
+ *  @return 0 if the record was added
+ */
+static uint8_t pretrigger_push(uint8_t type, const uint8_t *data, uint8_t length)
+{
+    if (pretrigger_count == LOGGER_PRETRIGGER_LENGTH) {
+        if (!pretrigger_active) return 1;
+        pretrigger_head = (pretrigger_head + 1) % LOGGER_PRETRIGGER_LENGTH;
+        pretrigger_count--;
+    }
+    
+    uint8_t index = (pretrigger_head + pretrigger_count) % LOGGER_PRETRIGGER_LENGTH;
+    uint8_t *record = pretrigger_records[index];
+    pretrigger_types[index] = type;
+    memcpy(record, data, length);
+    memset(record + length, 0xFF, LOGGER_RECORD_LENGTH - length);
+    pretrigger_count++;
+    return 0;
+}
+
+/**
+ *  Move as many records as possible from the pre-trigger buffer to the page buffers once launch has been detected
+ */
+static void drain_pretrigger(void)
+{
+    while (!pretrigger_active && (pretrigger_count != 0) &&
+           !add_record(pretrigger_types[pretrigger_head], pretrigger_records[pretrigger_head], LOGGER_RECORD_LENGTH)) {
+        pretrigger_head = (pretrigger_head + 1) % LOGGER_PRETRIGGER_LENGTH;
+        pretrigger_count--;
+    }
+}
+
+/**
+ *  Give a page its place in the log and the sequence numbers for its records
+ *  @return 0 if the page can be written, 1 if writing it would overwrite records from the flight
+ */
+static uint8_t assign_page(struct page_buffer *page)
+{
+    if (protect_state == PROTECT_REQUESTED) {
+        protect_state = PROTECT_ACTIVE;
+        protected_page = page_number;
+        pages_left = LOGGER_NUM_PAGES;
+        protect_dirty = 1;
+    }
+    
+    if (protect_state == PROTECT_ACTIVE) {
+        if (pages_left == 0) return 1;
+        pages_left--;
+    }
+    
+    page->number = page_number;
+    page_number = (page_number + 1) % LOGGER_NUM_PAGES;
+    
+    for (uint8_t i = 0; i < page->slots; i++) {
+        uint8_t *slot = page->data + (i * LOGGER_SLOT_LENGTH);
+        uint32_t header;
+        memcpy(&header, slot, LOGGER_SEQUENCE_LENGTH);
+        header |= (sequence + i) & LOGGER_SEQUENCE_MASK;
+        memcpy(slot, &header, LOGGER_SEQUENCE_LENGTH);
+    }
+    sequence += LOGGER_SLOTS_PER_PAGE;
+    return 0;
+}
+
+/**
+ *  Mark a page buffer as free to be filled
+ */
+static void free_page(struct page_buffer *page)
+{
+    page->number = PAGE_NONE;
+    page->pending = 0;
+    memset(page->data, 0xFF, EEPROM_25LC1024_PAGE_LENGTH);
+}
+
+void logger_service(void)
+{
+    if ((search_state != SEARCH_DONE) || (search_transaction_id != 0)) {
+        search_service();
+    }
+    
+    for (uint8_t i = 0; i < 2; i++) {
+        struct page_buffer *page = pages + i;
+        if ((page->transaction_id != 0) && eeprom_25lc1024_transaction_done(page->transaction_id)) {
+            // Page has been written, mark it as free
+            eeprom_25lc1024_clear_transaction(page->transaction_id);
+            page->transaction_id = 0;
+            free_page(page);
+        }
+    }
+    
+    drain_pretrigger();
+    
+    uint8_t busy = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+        // If both pages are pending the page being filled was committed first
+        struct page_buffer *page = pages + (fill_index ^ i);
+        if (page->pending && (search_state == SEARCH_DONE)) {
+            if ((page->number == PAGE_NONE) && assign_page(page)) {
+                // The log is full
+                logger_dropped += page->slots;
+                free_page(page);
+            } else if (!eeprom_25lc1024_write(&page->transaction_id, page_address(page->number),
+                                              EEPROM_25LC1024_PAGE_LENGTH, page->data)) {
+                page->pending = 0;
+            }
+        }
+        busy |= page->pending || (page->transaction_id != 0);
+    }
+    
+    if ((fill_slots != 0) && ((millis - fill_start) > LOGGER_FLUSH_PERIOD)) {
+        logger_flush();
+    }
+    
+    if ((internal_eeprom_transaction_id != 0) && eeprom_transaction_done(internal_eeprom_transaction_id)) {
+        eeprom_clear_transaction(internal_eeprom_transaction_id);
+        internal_eeprom_transaction_id = 0;
+    }
+    
+    if ((internal_eeprom_transaction_id != 0) || busy || (search_state != SEARCH_DONE)) return;
+    
+    // All pages before the current one have been written, the internal EEPROM can be updated
+    if (protect_dirty) {
+        protect_dirty = 0;
+        eeprom_write(&internal_eeprom_transaction_id, EEPROM_ADDR_LOGGER_PROTECTED, (uint8_t*)&protected_page,
+                     sizeof(protected_page));
+    } else if (hint_dirty ||
+               (((page_number + LOGGER_NUM_PAGES - stored_hint) % LOGGER_NUM_PAGES) > LOGGER_HINT_INTERVAL)) {
+        // Point the hint at the last page which was written
+        hint_dirty = 0;
+        stored_hint = (page_number + LOGGER_NUM_PAGES - 1) % LOGGER_NUM_PAGES;
+        eeprom_write(&internal_eeprom_transaction_id, EEPROM_ADDR_TELEMETRY_LOCATION, (uint8_t*)&stored_hint,
+                     sizeof(stored_hint));
+    }
+}
+
+uint8_t logger_log(uint8_t type, const uint8_t *data, uint8_t length)
+{
+    if ((length > LOGGER_RECORD_LENGTH) || (type > LOGGER_MAX_TYPE)) {
+        return 1;
+    }
+    
+    drain_pretrigger();
+    
+    uint8_t full;
+    if (pretrigger_active || (pretrigger_count != 0)) {
+        // Keep records in order behind those from before launch
+        full = pretrigger_push(type, data, length);
+    } else {
+        full = add_record(type, data, length);
+    }
+    
+    if (full) {
+        logger_dropped++;
+    }
+    return full;
+}
+
+void logger_flush(void)
+{
+    if (fill_slots != 0) {
+        commit_page();
+    }
+}
+
+void logger_pretrigger(void)
+{
+    pretrigger_active = 1;
+}
+
+void logger_protect(void)
+{
+    // The records from before launch are logged first
+    pretrigger_active = 0;
+    
+    if (protect_state == PROTECT_NONE) {
+        protect_state = PROTECT_REQUESTED;
+    }
+}
+
+void logger_reset(void)
+{
+    for (uint8_t i = 0; i < 2; i++) {
+        if (pages[i].pending) {
+            free_page(pages + i);
+        }
+    }
+    fill_slots = 0;
+    pretrigger_count = 0;
+    page_number = 0;
+    sequence = 0;
+    search_state = SEARCH_DONE;
+    
+    protect_state = PROTECT_NONE;
+    protected_page = PAGE_NONE;
+    protect_dirty = 1;
+    stored_hint = 0;
+    hint_dirty = 1;
+}
+
+uint32_t logger_address(void)
+{
+    return ((uint32_t)page_number * EEPROM_25LC1024_PAGE_LENGTH) + (fill_slots * LOGGER_SLOT_LENGTH);
+}
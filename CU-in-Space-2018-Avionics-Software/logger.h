@@ -0,0 +1,92 @@
+//
+//  logger.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Collect records in RAM and store them in a circular log in the external EEPROM one full page at a time
+//
+
+#ifndef logger_h
+#define logger_h
+
+#include "global.h"
+#include "25LC1024.h"
+
+// MARK: Constants
+#define LOGGER_SLOT_LENGTH      64      // The space used by each record in the EEPROM
+#define LOGGER_SEQUENCE_LENGTH  4       // Each slot starts with the type and sequence number of its record
+#define LOGGER_RECORD_LENGTH    (LOGGER_SLOT_LENGTH - LOGGER_SEQUENCE_LENGTH)
+#define LOGGER_SLOTS_PER_PAGE   (EEPROM_25LC1024_PAGE_LENGTH / LOGGER_SLOT_LENGTH)
+#define LOGGER_NUM_PAGES        (EEPROM_25LC1024_SIZE / EEPROM_25LC1024_PAGE_LENGTH)
+#define LOGGER_FLUSH_PERIOD     2000    // The longest time that a record can wait in RAM before being stored
+#define LOGGER_HINT_INTERVAL    64      // The number of pages written between updates of the hint in internal EEPROM
+#define LOGGER_PRETRIGGER_LENGTH 64     // The number of records kept in RAM before launch (3840 bytes)
+
+#define LOGGER_SEQUENCE_ERASED  0xFFFFFFFF  // The header read from a slot which has not been written
+#define LOGGER_SEQUENCE_MASK    0x0FFFFFFF  // The part of the slot header which is the sequence number
+#define LOGGER_TYPE_SHIFT       28          // The type of the record is stored in the top bits of the slot header
+#define LOGGER_MAX_TYPE         0xE
+
+// MARK: Variables
+/**
+ *  The number of records which could not be logged because both page buffers where busy
+ */
+extern uint16_t logger_dropped;
+
+// MARK: Function declarations
+/**
+ *  Initilize the logger
+ *  @note The log wraps around to the start of the EEPROM when it reaches the end. Every record is stored with a
+ *        sequence number which is one higher than that of the record before it, the first slot in the oldest
+ *        page of the log is found after a reset by searching for the page where the sequence numbers drop. A
+ *        page number from which to start the search is kept in internal EEPROM and updated every
+ *        LOGGER_HINT_INTERVAL pages.
+ */
+extern void init_logger(void);
+
+/**
+ *  Code to be run in each iteration of the main loop
+ */
+extern void logger_service(void);
+
+/**
+ *  Add a record to the log
+ *  @param type A number from 0 to LOGGER_MAX_TYPE which is stored with the record to identify its format
+ *  @param data The record to be logged
+ *  @param length The length of the record, at most LOGGER_RECORD_LENGTH
+ *  @return 0 if the record was added to the log
+ */
+extern uint8_t logger_log(uint8_t type, const uint8_t *data, uint8_t length);
+
+/**
+ *  Store the records currently waiting in RAM, even if the current page is not full
+ *  @note The rest of the page is left unused
+ */
+extern void logger_flush(void);
+
+/**
+ *  Keep only the most recent LOGGER_PRETRIGGER_LENGTH records in RAM instead of storing them until logger_protect
+ *  is called
+ */
+extern void logger_pretrigger(void);
+
+/**
+ *  Store the records kept in RAM since logger_pretrigger was called, followed by any new records, and stop the log
+ *  from wrapping around onto them
+ *  @note This is meant to be called at launch so that the flight is kept if logging continues for a long time after
+ *        landing. Once the log has filled up again records are dropped. The first protected page is kept in
+ *        internal EEPROM.
+ */
+extern void logger_protect(void);
+
+/**
+ *  Start logging from the begining of the EEPROM again, records which have not yet been written are discarded
+ *  @note The EEPROM should have been erased first
+ */
+extern void logger_reset(void);
+
+/**
+ *  Get the address of the next record to be stored in the striped EEPROM address space
+ */
+extern uint32_t logger_address(void);
+
+#endif /* logger_h */
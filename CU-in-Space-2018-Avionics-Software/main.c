@@ -9,14 +9,16 @@
 #include <avr/interrupt.h>
 #include <avr/power.h>
 #include <avr/wdt.h>
-#include <math.h>
-#include <stdlib.h>
-
 #include "pindefinitions.h"
 
 #include "ematch_detect.h"
+#include "fsm.h"
 #include "menu.h"
+#include "replay.h"
+#include "profiling.h"
+#include "deferred.h"
 #include "telemetry.h"
+#include "logger.h"
 #include "SPI.h"
 #include "I2C.h"
 #include "ADC.h"
@@ -52,7 +54,11 @@ volatile static uint32_t last_led;
 
 global_state_t fsm_state;
 
-static uint32_t max_alt;
+static struct fsm_detector fsm_detector;
+/** The time of the last barometer sample given to the FSM detector */
+static uint32_t fsm_altitude_time;
+/** The number of accelerometer samples from the ring buffer which have been given to the FSM detector */
+static uint16_t fsm_accel_count;
 
 // Mirror of MCUSR created during init process before watchdog is reset
 uint8_t mcusr_mirror __attribute__ ((section (".noinit")));
@@ -150,6 +156,8 @@ static void init_sensors (void)
 
 static void init_fsm (void)
 {
+    init_fsm_detector(&fsm_detector);
+    
     if (RESET_JUMPER_PIN & (1<<RESET_JUMPER_NUM)) {
         // Reset jumper not shorted
         fsm_state = eeprom_read_byte_sync(EEPROM_ADDR_FSM_STATE);
@@ -161,30 +169,42 @@ static void init_fsm (void)
     
     switch (fsm_state) {
         case STANDBY:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_EXTRA_LOW;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_EXTRA_LOW, TELEMETRY_RADIO_PERIOD_EXTRA_LOW);
             eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_LOW;
             break;
         case PRE_FLIGHT:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_MEDIUM;
-            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_LOW;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_MEDIUM, TELEMETRY_RADIO_PERIOD_MEDIUM);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_PRETRIGGER;
+            logger_pretrigger();
             break;
         case POWERED_ASCENT:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_HIGH;
-            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_HIGH, TELEMETRY_RADIO_PERIOD_HIGH);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_ASCENT;
+            aggregate_telemetry_period = TELEMETRY_AGGREGATE_PERIOD_FLIGHT;
             break;
         case COASTING_ASCENT:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_HIGH;
-            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_HIGH, TELEMETRY_RADIO_PERIOD_HIGH);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_ASCENT;
+            aggregate_telemetry_period = TELEMETRY_AGGREGATE_PERIOD_FLIGHT;
             break;
         case DESCENT:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_HIGH;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_HIGH, TELEMETRY_RADIO_PERIOD_HIGH);
             eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
+            aggregate_telemetry_period = TELEMETRY_AGGREGATE_PERIOD_FLIGHT;
             break;
         case RECOVERY:
-            radio_telemetry_period = TELEMETRY_RADIO_PERIOD_LOW;
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_LOW, TELEMETRY_RADIO_PERIOD_LOW);
             eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
             break;
     }
+    
+    if ((fsm_state != STANDBY) && (fsm_state != PRE_FLIGHT)) {
+        // Reset during flight, make sure the flight is not overwritten
+        logger_protect();
+    }
+    
+    // Only leave the external EEPROMs awake while logging at a high rate
+    eeprom_25lc1024_set_keep_awake((fsm_state != STANDBY) && (fsm_state != RECOVERY));
 }
 
 int main(void)
@@ -209,13 +229,14 @@ int main(void)
     init_adc();
 #endif
 #ifdef ENABLE_SPI
-    init_spi(&SPI_PORT);
+    init_spi(&SPI_PORT, &SPI_PIN);
 #endif
 #ifdef ENABLE_I2C
     init_i2c();
 #endif
     
     // Initilize software modules
+    init_logger();
     init_fsm();
     init_menu();
     init_telemetry();
@@ -244,6 +265,10 @@ static void main_loop ()
 {
     wdt_reset(); // Pat the dog
     
+#ifdef ENABLE_PROFILING
+    profiling_loop_service();
+#endif
+    
 #ifdef ENABLE_DEBUG_FLASH
     // Flash LED
     if ((millis - last_led) > 250) {
@@ -254,53 +279,62 @@ static void main_loop ()
     
     // Run IO Services
 #ifdef ENABLE_ADC
-    adc_service();
+    PROFILE(PROFILE_ADC, adc_service());
 #endif
 #ifdef ENABLE_SPI
-    spi_service();
+    PROFILE(PROFILE_SPI, spi_service());
 #endif
 #ifdef ENABLE_I2C
-    i2c_service();
+    PROFILE(PROFILE_I2C, i2c_service());
 #endif
+    // Run the callbacks for transactions which have finished since the last iteration
+    PROFILE(PROFILE_DEFERRED, deferred_service());
     
     // Run Peripheral Services
 #ifndef ENABLE_SENSORS_AT_RESET
     if (fsm_state != STANDBY) {
 #endif
 #ifdef ENABLE_ALTIMETER
-        mpl3115a2_service();        // Barometric Altimeter
+        PROFILE(PROFILE_MPL3115A2, mpl3115a2_service());        // Barometric Altimeter
 #endif
 #ifdef ENABLE_ACCELEROMETER
-        adxl343_service();          // Accelerometer
+        PROFILE(PROFILE_ADXL343, adxl343_service());            // Accelerometer
 #endif
 #ifdef ENABLE_GYROSCOPE
-        fxas21002c_service();       // Gyroscope
+        PROFILE(PROFILE_FXAS21002C, fxas21002c_service());      // Gyroscope
 #endif
 #ifdef ENABLE_GPS
-        fgpmmopa6h_service();       // GPS
+        PROFILE(PROFILE_FGPMMOPA6H, fgpmmopa6h_service());      // GPS
 #endif
 #ifndef ENABLE_SENSORS_AT_RESET
     }
 #endif
     
 #ifdef ENABLE_EEPROM
-        eeprom_25lc1024_service();  // EEPROM
+        PROFILE(PROFILE_25LC1024, eeprom_25lc1024_service());   // EEPROM
 #endif
 #ifdef ENABLE_XBEE
-        xbee_service();             // XBee
+        PROFILE(PROFILE_XBEE, xbee_service());                  // XBee
 #endif
     
-    if (mpl3115a2_alt > max_alt) {
-        max_alt = mpl3115a2_alt;
-    }
-    
     // Run Software Module Services
-    advance_fsm();
+    PROFILE(PROFILE_FSM, advance_fsm());
     
-    ematch_detect_service();
-    telemetry_service();
-    menu_service();
-    eeprom_service();
+    PROFILE(PROFILE_EMATCH, ematch_detect_service());
+    PROFILE(PROFILE_TELEMETRY, telemetry_service());
+    PROFILE(PROFILE_LOGGER, logger_service());
+    PROFILE(PROFILE_MENU, menu_service());
+    PROFILE(PROFILE_REPLAY, replay_service());
+    PROFILE(PROFILE_EEPROM, eeprom_service());
+}
+
+/**
+ *  Called from the main loop once the current state has been stored in EEPROM so that the state machine is not held
+ *  up until the next iteration
+ */
+static void state_stored (uint8_t transaction_id, void *context)
+{
+    advance_fsm();
 }
 
 static void advance_fsm (void)
@@ -314,95 +348,102 @@ static void advance_fsm (void)
         return;
     }
     
+    if ((fsm_state == DESCENT) || (fsm_state == RECOVERY)) {
+        if (adc_avg_data[0] < CAP_DISCARGE_THRESHOLD) {
+            // Disable trigger and turn on cap discarge circuit
+            ENABLE_12V_PORT &= ~(1<<ENABLE_12V_NUM);
+            MAIN_TRIGGER_PORT &= ~(1<<MAIN_TRIGGER_NUM);
+            CAP_DISCHARGE_PORT |= (1<<CAP_DISCHARGE_NUM);
+        }
+    }
     
+    struct fsm_sample sample = {
+        .time = mpl3115a2_sample_time,
+        .altitude = mpl3115a2_alt,
+        .prev_altitude = mpl3115a2_prev_alt,
+        .accel_x = adxl343_accel_x,
+        .accel_y = adxl343_accel_y,
+        .accel_z = adxl343_accel_z,
+        .armed = ematch_1_is_ready() && ematch_2_is_ready(),
+        // The sample time is 0 until the barometer has taken its first sample
+        .new_altitude = mpl3115a2_sample_time != fsm_altitude_time
+    };
+    fsm_altitude_time = mpl3115a2_sample_time;
     
-    switch (fsm_state) {
+    // Every accelerometer sample is given to the detector, if it has fallen a full ring behind the oldest samples have
+    // already been overwritten and are skipped
+    if ((uint16_t)(adxl343_sample_count - fsm_accel_count) > ADXL343_RING_LENGTH) {
+        fsm_accel_count = adxl343_sample_count - ADXL343_RING_LENGTH;
+    }
+    
+    global_state_t next_state;
+    do {
+        if (fsm_accel_count != adxl343_sample_count) {
+            struct adxl343_sample *accel = adxl343_samples + (fsm_accel_count % ADXL343_RING_LENGTH);
+            sample.accel_x = accel->x;
+            sample.accel_y = accel->y;
+            sample.accel_z = accel->z;
+            sample.new_accel = 1;
+            fsm_accel_count++;
+        }
+        
+        next_state = fsm_detect_transition(&fsm_detector, fsm_state, &sample, &fsm_default_thresholds);
+        // The barometer sample is only new for the first call, any remaining accelerometer samples are left for the
+        // next iteration of the main loop if there is a transition
+        sample.new_altitude = 0;
+    } while ((next_state == fsm_state) && (fsm_accel_count != adxl343_sample_count));
+    
+    if (next_state == fsm_state) {
+        return;
+    }
+    
+    switch (next_state) {
         case STANDBY:
-            // Wait for rocket to be armed
-            if (ematch_1_is_ready() && ematch_2_is_ready()) {
-                // Rocket is armed
-#ifndef ENABLE_SENSORS_AT_RESET
-                init_sensors();
-#endif
-
-                radio_telemetry_period = TELEMETRY_RADIO_PERIOD_MEDIUM;
-                
-                telemetry_send_packet();
-                fsm_state = PRE_FLIGHT;
-                eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
-            }
+            // Should not happen
             break;
         case PRE_FLIGHT:
-            // Wait for engine to start
-            if ((hypot(hypot(adxl343_accel_x, adxl343_accel_y), adxl343_accel_z) > LAUNCH_ACCEL_THRESHOLD) && (mpl3115a2_alt > LAUNCH_ALT_THRESHOLD)) {
-                // Engine has started
-                radio_telemetry_period = TELEMETRY_RADIO_PERIOD_HIGH;
-                eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
-                
-                telemetry_send_packet();
-                fsm_state = POWERED_ASCENT;
-                eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
-            }
+            // Rocket is armed
+#ifndef ENABLE_SENSORS_AT_RESET
+            init_sensors();
+#endif
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_MEDIUM, TELEMETRY_RADIO_PERIOD_MEDIUM);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_PRETRIGGER;
+            logger_pretrigger();
             break;
         case POWERED_ASCENT:
-            // Wait for engine to burn out
-            if ((hypot(hypot(adxl343_accel_x, adxl343_accel_y), adxl343_accel_z) < COASTING_ACCEL_THRESHOLD) || (mpl3115a2_alt > COASTING_ALT_THRESOLD)) {
-                // Engine has burnt out
-                
-                ENABLE_12V_PORT |= (1<<ENABLE_12V_NUM); // Start charging capacitors for deployment
-                
-                telemetry_send_packet();
-                fsm_state = COASTING_ASCENT;
-                eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
-            }
+            // Engine has started
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_HIGH, TELEMETRY_RADIO_PERIOD_HIGH);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_ASCENT;
+            aggregate_telemetry_period = TELEMETRY_AGGREGATE_PERIOD_FLIGHT;
+            logger_protect();
             break;
         case COASTING_ASCENT:
-            // Wait for apogee
-            if ((max_alt - mpl3115a2_alt) > ALTITUDE_COMPARISON_RANGE) {
-                // Rocket is descending
-                
-                // Deploy parachute
-                ENABLE_12V_PORT &= ~(1<<ENABLE_12V_NUM);
+            // Engine has burnt out
+            ENABLE_12V_PORT |= (1<<ENABLE_12V_NUM); // Start charging capacitors for deployment
+            break;
+        case DESCENT:
+            // Rocket is descending, deploy parachute
+            ENABLE_12V_PORT &= ~(1<<ENABLE_12V_NUM);
+            eeprom_telemetry_period = TELEMETRY_EEPROM_PERIOD_HIGH;
 #ifdef ENABLE_DEPLOYMENT
-                MAIN_TRIGGER_PORT |= (1<<MAIN_TRIGGER_NUM);
+            MAIN_TRIGGER_PORT |= (1<<MAIN_TRIGGER_NUM);
 #else
-                LED_PORT |= (1<<LED_NUM);
+            LED_PORT |= (1<<LED_NUM);
 #endif
-                
-                telemetry_send_packet();
-                fsm_state = DESCENT;
-                eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
-            }
-            break;
-        case DESCENT:
-            if (adc_avg_data[0] < CAP_DISCARGE_THRESHOLD) {
-                // Disable trigger and turn on cap discarge circuit
-                ENABLE_12V_PORT &= ~(1<<ENABLE_12V_NUM);
-                MAIN_TRIGGER_PORT &= ~(1<<MAIN_TRIGGER_NUM);
-                CAP_DISCHARGE_PORT |= (1<<CAP_DISCHARGE_NUM);
-            }
-            
-            // Wait for altitude to stop changing (landing)
-            if (abs(mpl3115a2_prev_alt - mpl3115a2_alt) < ALTITUDE_COMPARISON_RANGE) {
-                // Rocket has stopped moving
-                radio_telemetry_period = TELEMETRY_RADIO_PERIOD_LOW;
-                
-                telemetry_send_packet();
-                fsm_state = RECOVERY;
-                eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
-            }
             break;
         case RECOVERY:
-            if (adc_avg_data[0] < CAP_DISCARGE_THRESHOLD) {
-                // Disable trigger and turn on cap discarge circuit
-                ENABLE_12V_PORT &= ~(1<<ENABLE_12V_NUM);
-                MAIN_TRIGGER_PORT &= ~(1<<MAIN_TRIGGER_NUM);
-                CAP_DISCHARGE_PORT |= (1<<CAP_DISCHARGE_NUM);
-            }
-            
-            // Wait to be found
+            // Rocket has stopped moving
+            telemetry_set_radio_period(TELEMETRY_RADIO_MIN_PERIOD_LOW, TELEMETRY_RADIO_PERIOD_LOW);
+            aggregate_telemetry_period = TELEMETRY_AGGREGATE_PERIOD_OFF;
             break;
     }
+    
+    eeprom_25lc1024_set_keep_awake((next_state != STANDBY) && (next_state != RECOVERY));
+    
+    telemetry_send_packet();
+    fsm_state = next_state;
+    eeprom_write(&eeprom_transaction_id, EEPROM_ADDR_FSM_STATE, &fsm_state, 1);
+    eeprom_set_callback(eeprom_transaction_id, state_stored, NULL);
 }
 
 // MARK: Interupt Service Routines
@@ -46,6 +46,7 @@ void init_menu(void)
 void menu_service(void)
 {
     serial_0_service();
+    if (flags & (1<<FLAG_REPLAY_ACTIVE)) return;    // Lines are being consumed by replay_service
     if (serial_0_has_line('\n')) {
         serial_0_get_line('\n', menu_buffer, MENU_BUFFER_SIZE);
         char *line = menu_buffer;
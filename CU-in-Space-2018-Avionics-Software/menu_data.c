@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include <util/atomic.h>
 #include <avr/wdt.h>
@@ -18,6 +19,9 @@
 #include "serial0.h"
 
 #include "bus_tests.h"
+#include "profiling.h"
+#include "replay.h"
+#include "logger.h"
 
 #include "ematch_detect.h"
 
@@ -35,6 +39,7 @@
 #include "GPS-FGPMMOPA6H.h"
 
 #include "telemetry_format.h"
+#include "crc.h"
 
 
 #define STR_LEN 128
@@ -243,12 +248,7 @@ void menu_cmd_stat_handler(uint8_t arg_len, char** args)
     serial_0_put_string_P((ematch_2_is_ready()) ? stat_str_state_ematch_t : stat_str_state_ematch_f);
     // EEPROM Address
     serial_0_put_string_P(stat_str_eeprom_addr);
-    uint32_t addr;
-    uint8_t eeprom_id;
-    eeprom_read(&eeprom_id, EEPROM_ADDR_TELEMETRY_LOCATION, (uint8_t*)&addr, 4);
-    while (!eeprom_transaction_done(eeprom_id)) eeprom_service();
-    eeprom_clear_transaction(eeprom_id);
-    ultoa(addr, str, 10);
+    ultoa(logger_address(), str, 10);
     serial_0_put_string(str);
     serial_0_put_string_P(string_nl);
     while (!serial_0_out_buffer_empty());
@@ -311,17 +311,158 @@ void menu_cmd_stat_handler(uint8_t arg_len, char** args)
     }
 }
 
+// Loopstat
+static const char menu_cmd_loopstat_string[] PROGMEM = "loopstat";
+static const char menu_help_loopstat[] PROGMEM = "Get main loop throughput and per service timing as CSV.\nValid Usage: loopstat [reset]\n";
+
+#ifdef ENABLE_PROFILING
+static const char loopstat_string_reset[] PROGMEM = "reset";
+static const char loopstat_string_rate[] PROGMEM = "loop_rate,";
+static const char loopstat_string_header[] PROGMEM = "service,calls,avg_cycles,max_cycles\n";
+#else
+static const char loopstat_string_disabled[] PROGMEM = "Profiling is not enabled.\n";
+#endif
+
+void menu_cmd_loopstat_handler(uint8_t arg_len, char** args)
+{
+#ifndef ENABLE_PROFILING
+    serial_0_put_string_P(loopstat_string_disabled);
+#else
+    if (arg_len == 2 && !strcasecmp_P(args[1], loopstat_string_reset)) {
+        profiling_reset();
+        return;
+    } else if (arg_len != 1) {
+        serial_0_put_string_P(menu_help_loopstat);
+        return;
+    }
+    
+    serial_0_put_string_P(loopstat_string_rate);
+    utoa(profiling_loop_rate, str, 10);
+    serial_0_put_string(str);
+    serial_0_put_byte('\n');
+    
+    serial_0_put_string_P(loopstat_string_header);
+    for (uint8_t i = 0; i < PROFILING_NUM_SERVICES; i++) {
+        struct profiling_stats stats = profiling_stats[i];
+        
+        serial_0_put_string_P(profiling_service_name(i));
+        serial_0_put_byte(',');
+        ultoa(stats.calls, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte(',');
+        ultoa((stats.calls == 0) ? 0 : ((uint32_t)(stats.total / stats.calls) * PROFILING_CYCLES_PER_TICK), str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte(',');
+        ultoa(stats.max * PROFILING_CYCLES_PER_TICK, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_byte('\n');
+    }
+#endif
+}
+
+// CRCbench
+static const char menu_cmd_crcbench_string[] PROGMEM = "crcbench";
+static const char menu_help_crcbench[] PROGMEM = "Measure the time taken to calculate the CRC of a telemetry frame.\n";
+
+static const char crcbench_string_frame[] PROGMEM = "cycles per frame: ";
+static const char crcbench_string_byte[] PROGMEM = "cycles per byte: ";
+
+#define CRCBENCH_RUNS   100
+
+void menu_cmd_crcbench_handler(uint8_t arg_len, char** args)
+{
+    if (arg_len != 1) {
+        serial_0_put_string_P(menu_help_crcbench);
+        return;
+    }
+    
+    struct telemetry_api_frame_with_crc frame;
+    memset(&frame, 0x55, sizeof(frame));
+    uint16_t length = offsetof(struct telemetry_api_frame_with_crc, crc);
+    
+    uint32_t start = profiling_timestamp();
+    for (uint8_t i = 0; i < CRCBENCH_RUNS; i++) {
+        frame.crc = crc16((uint8_t*)&frame, length);
+    }
+    uint32_t cycles = ((profiling_timestamp() - start) * PROFILING_CYCLES_PER_TICK) / CRCBENCH_RUNS;
+    
+    serial_0_put_string_P(crcbench_string_frame);
+    ultoa(cycles, str, 10);
+    serial_0_put_string(str);
+    serial_0_put_byte('\n');
+    serial_0_put_string_P(crcbench_string_byte);
+    ultoa(cycles / length, str, 10);
+    serial_0_put_string(str);
+    serial_0_put_byte('\n');
+}
+
 // EEPROM
 static const char menu_cmd_eeprom_string[] PROGMEM = "eeprom";
-static const char menu_help_eeprom[] PROGMEM = "Test external 25LC1024 EEPROM.\nValid Usage:\n\tRead: eeprom read <address>\n\tWrite: eeprom write <address> <data>\n\tErase: eeprom erase\n";
+static const char menu_help_eeprom[] PROGMEM = "Test external 25LC1024 EEPROM.\nValid Usage:\n\tRead: eeprom read <address>\n\tWrite: eeprom write <address> <data>\n\tErase: eeprom erase\n\tSPI usage: eeprom stat\n\tDownload: eeprom stream\n\tWrite bandwidth: eeprom bench (overwrites the end of the log)\n";
 
 static const char eeprom_string_read[] PROGMEM = "read";
 static const char eeprom_string_write[] PROGMEM = "write";
 static const char eeprom_string_erase[] PROGMEM = "erase";
 static const char eeprom_string_dump[] PROGMEM = "dump";
+static const char eeprom_string_stat[] PROGMEM = "stat";
+static const char eeprom_string_stream[] PROGMEM = "stream";
+static const char eeprom_string_streaming[] PROGMEM = "Streaming 262144 bytes at 500000 baud, pages alternate between the first and second half\n";
+static const char eeprom_string_overhead[] PROGMEM = "Overhead bytes: ";
+static const char eeprom_string_payload[] PROGMEM = "Payload bytes: ";
+static const char eeprom_string_bench[] PROGMEM = "bench";
+static const char eeprom_string_striped[] PROGMEM = "striped bytes/s: ";
+static const char eeprom_string_single[] PROGMEM = "single bytes/s: ";
 
 static const char eeprom_string_hex[] PROGMEM = "0x";
 
+#define EEPROM_BENCH_PAGES          64  // The number of pages written in each run of the bench
+#define EEPROM_BENCH_OUTSTANDING    3   // The number of bench writes kept queued
+
+/**
+ *  Time sustained page writes at the end of the eeproms, keeping several writes queued at once like the logger does
+ *  @param striped 1 if consecutive pages should alternate between the eeproms, 0 if they should all go to the first
+ *  @return The number of bytes written per second
+ */
+static uint32_t eeprom_bench (uint8_t striped)
+{
+    static uint8_t data[EEPROM_25LC1024_PAGE_LENGTH];
+    uint8_t ids[EEPROM_BENCH_OUTSTANDING];
+    uint8_t started = 0;
+    uint8_t finished = 0;
+    
+    memset(data, 0x55, sizeof(data));
+    memset(ids, 0, sizeof(ids));
+    
+    // Use the last pages of the striped address space, or the last pages of the first eeprom
+    uint32_t base = (striped ? EEPROM_25LC1024_SIZE : (EEPROM_25LC1024_SIZE / 2)) -
+                    ((uint32_t)EEPROM_BENCH_PAGES * EEPROM_25LC1024_PAGE_LENGTH);
+    
+    uint32_t start = millis;
+    while (finished < EEPROM_BENCH_PAGES) {
+        eeprom_25lc1024_service();
+        for (uint8_t i = 0; i < EEPROM_BENCH_OUTSTANDING; i++) {
+            if ((ids[i] != 0) && eeprom_25lc1024_transaction_done(ids[i])) {
+                eeprom_25lc1024_clear_transaction(ids[i]);
+                ids[i] = 0;
+                finished++;
+            }
+            if ((ids[i] == 0) && (started < EEPROM_BENCH_PAGES)) {
+                uint32_t address = base + ((uint32_t)started * EEPROM_25LC1024_PAGE_LENGTH);
+                if (striped) {
+                    address = eeprom_25lc1024_stripe(address);
+                }
+                if (!eeprom_25lc1024_write(ids + i, address, EEPROM_25LC1024_PAGE_LENGTH, data)) {
+                    started++;
+                }
+            }
+        }
+        wdt_reset();
+    }
+    uint32_t time = millis - start;
+    
+    return ((uint32_t)EEPROM_BENCH_PAGES * EEPROM_25LC1024_PAGE_LENGTH * 1000) / ((time == 0) ? 1 : time);
+}
+
 void menu_cmd_epprom_handler(uint8_t arg_len, char** args)
 {
     if (arg_len < 2) {
@@ -377,15 +518,63 @@ void menu_cmd_epprom_handler(uint8_t arg_len, char** args)
         
         while (!eeprom_25lc1024_transaction_done(id)) eeprom_25lc1024_service();
         
+        logger_reset();
+        
+    } else if (!strcasecmp_P(args[1], eeprom_string_stat)) {
+        if (arg_len != 2) {
+            goto invalid_args;
+        }
+        
+        serial_0_put_string_P(eeprom_string_overhead);
+        ultoa(eeprom_25lc1024_overhead_bytes, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_string_P(string_nl);
+        serial_0_put_string_P(eeprom_string_payload);
+        ultoa(eeprom_25lc1024_payload_bytes, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_string_P(string_nl);
+    } else if (!strcasecmp_P(args[1], eeprom_string_stream)) {
+        if (arg_len != 2) {
+            goto invalid_args;
+        }
+        
+        serial_0_put_string_P(eeprom_string_streaming);
+        while (flags & (1<<FLAG_SERIAL_0_TX_LOCK));     // Wait for the message to be sent
+        
+        UCSR0A |= (1<<U2X0);                            // Set baud rate: 500Kbaud at 12mhz clock, 0% error
+        UBRR0L = 2;
         
-        uint32_t addr = 0;
-        uint8_t eep_id;
-        eeprom_write(&eep_id, EEPROM_ADDR_TELEMETRY_LOCATION, (uint8_t*)&addr, 4);
+        // Stream the raw contents of both eeproms, data is copied to the serial buffer as it is sent
+        eeprom_25lc1024_stream(&id, 0, EEPROM_25LC1024_SIZE, serial_0_put_bytes);
         
-        while (!eeprom_transaction_done(eep_id)) eeprom_service();
+        while (!eeprom_25lc1024_transaction_done(id)) {
+            eeprom_25lc1024_service();
+            wdt_reset();
+        }
+        while (flags & (1<<FLAG_SERIAL_0_TX_LOCK));
+        
+        UCSR0A &= ~(1<<U2X0);                           // Set baud rate: 9.6Kbaud at 12mhz clock, 0.1602564103% error
+        UBRR0L = 77;
+    } else if (!strcasecmp_P(args[1], eeprom_string_bench)) {
+        if (arg_len != 2) {
+            goto invalid_args;
+        }
         
-        eeprom_clear_transaction(eep_id);
+        // Writes are only overlapped with the other eeprom's write cycle while the eeproms are kept awake, as in flight
+        eeprom_25lc1024_set_keep_awake(1);
+        uint32_t striped = eeprom_bench(1);
+        uint32_t single = eeprom_bench(0);
+        eeprom_25lc1024_set_keep_awake((fsm_state != STANDBY) && (fsm_state != RECOVERY));
         
+        serial_0_put_string_P(eeprom_string_striped);
+        ultoa(striped, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_string_P(string_nl);
+        serial_0_put_string_P(eeprom_string_single);
+        ultoa(single, str, 10);
+        serial_0_put_string(str);
+        serial_0_put_string_P(string_nl);
+        return;
     } else if (!strcasecmp_P(args[1], eeprom_string_dump)) {
         if (arg_len != 2) {
             return;
@@ -401,7 +590,8 @@ void menu_cmd_epprom_handler(uint8_t arg_len, char** args)
         UCSR0C = (1<<UCSZ00)|(1<<UCSZ01);   // Set frame format: 8 data, 1 stop bit(s)
         
         for (uint32_t i = 0; i < EEPROM_25LC1024_MAX; i += step) {
-            eeprom_25lc1024_read(&id, i, step, (uint8_t*)str);
+            // Dump in the order used by the logger
+            eeprom_25lc1024_read(&id, eeprom_25lc1024_stripe(i), step, (uint8_t*)str);
             
             while (!eeprom_25lc1024_transaction_done(id)) eeprom_25lc1024_service();
             
@@ -1121,7 +1311,7 @@ void menu_cmd_xbeetelem_handler(uint8_t arg_len, char** args)
         return;
     }
     
-    struct telemetry_api_frame frame;
+    struct telemetry_api_frame_with_crc frame;
 
     // Generate telemetry frame
     frame.start_delimiter = FRAME_START_DELIMITER;
@@ -1129,7 +1319,7 @@ void menu_cmd_xbeetelem_handler(uint8_t arg_len, char** args)
     frame.destination_address = ADDRESS_GROUND_STATION;
     frame.payload_type = FRAME_TYPE_ROCKET_PRIMARY;
     frame.length = sizeof(frame.payload);
-    frame.crc_present = 0;
+    frame.crc_present = 1;
     frame.end_delimiter = FRAME_END_DELIMITER;
     
     frame.payload.mission_time = millis;
@@ -1165,6 +1355,8 @@ void menu_cmd_xbeetelem_handler(uint8_t arg_len, char** args)
     frame.payload.course_over_ground = fgpmmopa6h_course;
     frame.payload.gps_sample_time = fgpmmopa6h_sample_time;
     
+    frame.crc = crc16((uint8_t*)&frame, offsetof(struct telemetry_api_frame_with_crc, crc));
+    
     // Send frame
     uint8_t t_id;
     xbee_transmit_command(&t_id, 0, XBEE_ADDRESS_64_BROADCAST, XBEE_ADDRESS_16_UNKOWN, 0, 0, (uint8_t*)&frame, sizeof(frame));
@@ -1320,17 +1512,20 @@ invalid_args:
 }
 
 
-const uint8_t menu_num_items = 27;
+const uint8_t menu_num_items = 31;
 const menu_item_t menu_items[] PROGMEM = {
     {.string = menu_cmd_version_string, .handler = menu_cmd_version_handler, .help_string = menu_help_version},
     {.string = menu_cmd_help_string, .handler = menu_cmd_help_handler, .help_string = menu_help_help},
     {.string = menu_cmd_clear_string, .handler = menu_cmd_clear_handler, .help_string = menu_help_clear},
     {.string = menu_cmd_reset_string, .handler = menu_cmd_reset_handler, .help_string = menu_help_reset},
     {.string = menu_cmd_stat_string, .handler = menu_cmd_stat_handler, .help_string = menu_help_stat},
+    {.string = menu_cmd_loopstat_string, .handler = menu_cmd_loopstat_handler, .help_string = menu_help_loopstat},
+    {.string = menu_cmd_crcbench_string, .handler = menu_cmd_crcbench_handler, .help_string = menu_help_crcbench},
     {.string = menu_cmd_eeprom_string, .handler = menu_cmd_epprom_handler, .help_string = menu_help_eeprom},
     {.string = menu_cmd_spitest_string, .handler = menu_cmd_spitest_handler, .help_string = menu_help_spitest},
     {.string = menu_cmd_spiraw_string, .handler = menu_cmd_spiraw_handler, .help_string = menu_help_spiraw},
     {.string = menu_cmd_spiconc_string, .handler = menu_cmd_spiconc_handler, .help_string = menu_help_spiconc},
+    {.string = menu_cmd_spiprio_string, .handler = menu_cmd_spiprio_handler, .help_string = menu_help_spiprio},
     {.string = menu_cmd_analog_string, .handler = menu_cmd_analog_handler, .help_string = menu_help_analog},
     {.string = menu_cmd_sensors_string, .handler = menu_cmd_sensors_handler, .help_string = menu_help_sensors},
     {.string = menu_cmd_gps_string, .handler = menu_cmd_gps_handler, .help_string = menu_help_gps},
@@ -1348,5 +1543,6 @@ const menu_item_t menu_items[] PROGMEM = {
     {.string = menu_cmd_deploy_string, .handler = menu_cmd_deploy_handler, .help_string = menu_help_deploy},
     {.string = menu_cmd_capdis_string, .handler = menu_cmd_capdis_handler, .help_string = menu_help_capdis},
     {.string = menu_cmd_setalt_string, .handler = menu_cmd_setalt_handler, .help_string = menu_help_setalt},
-    {.string = menu_cmd_setaltraw_string, .handler = menu_cmd_setaltraw_handler, .help_string = menu_help_setaltraw}
+    {.string = menu_cmd_setaltraw_string, .handler = menu_cmd_setaltraw_handler, .help_string = menu_help_setaltraw},
+    {.string = menu_cmd_replay_string, .handler = menu_cmd_replay_handler, .help_string = menu_help_replay}
 };
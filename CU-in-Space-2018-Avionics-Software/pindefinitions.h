@@ -9,6 +9,7 @@
 #define pindefinitions_h
 
 // MARK: Flags
+#define FLAG_REPLAY_ACTIVE      3
 #define FLAG_SERIAL_1_LOOPBACK  4
 #define FLAG_SERIAL_1_TX_LOCK   5
 #define FLAG_SERIAL_0_LOOPBACK  6
@@ -82,6 +83,7 @@
 #define RADIO_CS_NUM        PINB4
 
 #define SPI_PORT            PORTB
+#define SPI_PIN             PINB
 
 #define SPI_MOSI_DDR        DDRB
 #define SPI_MOSI_NUM        PINB5
@@ -0,0 +1,111 @@
+//
+//  profiling.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Measure main loop throughput and service latency using timer 1
+//
+
+#include "profiling.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+// MARK: Constants
+static const char name_main_loop[] PROGMEM = "main_loop";
+static const char name_adc[] PROGMEM = "adc_service";
+static const char name_spi[] PROGMEM = "spi_service";
+static const char name_i2c[] PROGMEM = "i2c_service";
+static const char name_deferred[] PROGMEM = "deferred_service";
+static const char name_mpl3115a2[] PROGMEM = "mpl3115a2_service";
+static const char name_adxl343[] PROGMEM = "adxl343_service";
+static const char name_fxas21002c[] PROGMEM = "fxas21002c_service";
+static const char name_fgpmmopa6h[] PROGMEM = "fgpmmopa6h_service";
+static const char name_25lc1024[] PROGMEM = "eeprom_25lc1024_service";
+static const char name_xbee[] PROGMEM = "xbee_service";
+static const char name_fsm[] PROGMEM = "advance_fsm";
+static const char name_ematch[] PROGMEM = "ematch_detect_service";
+static const char name_telemetry[] PROGMEM = "telemetry_service";
+static const char name_logger[] PROGMEM = "logger_service";
+static const char name_menu[] PROGMEM = "menu_service";
+static const char name_replay[] PROGMEM = "replay_service";
+static const char name_eeprom[] PROGMEM = "eeprom_service";
+
+static const char * const service_names[] PROGMEM = {name_main_loop, name_adc, name_spi, name_i2c, name_deferred,
+                                                     name_mpl3115a2, name_adxl343, name_fxas21002c, name_fgpmmopa6h,
+                                                     name_25lc1024, name_xbee, name_fsm, name_ematch, name_telemetry,
+                                                     name_logger, name_menu, name_replay, name_eeprom};
+
+// MARK: Variable Definitions
+uint16_t profiling_loop_rate;
+struct profiling_stats profiling_stats[PROFILING_NUM_SERVICES];
+
+/** The timestamp taken at the start of the current main loop iteration */
+static uint32_t loop_start;
+/** The number of main loop iterations which have started in the current window */
+static uint16_t loop_count;
+/** The value of millis at the start of the current window */
+static uint32_t window_start;
+
+// MARK: Function Definitions
+uint32_t profiling_timestamp(void)
+{
+    uint32_t ms;
+    uint16_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = millis;
+        ticks = TCNT1;
+        if ((TIFR1 & (1<<OCF1A)) && (ticks < (PROFILING_TICKS_PER_MS / 2))) {
+            // The timer has been cleared but the ISR that increments millis has not run yet
+            ms++;
+        }
+    }
+
+    return (ms * PROFILING_TICKS_PER_MS) + ticks;
+}
+
+void profiling_loop_service(void)
+{
+    uint32_t now = profiling_timestamp();
+
+    if (loop_start != 0) {
+        profiling_record(PROFILE_MAIN_LOOP, loop_start);
+    }
+    loop_start = now;
+
+    loop_count++;
+    if ((millis - window_start) >= PROFILING_WINDOW) {
+        profiling_loop_rate = loop_count;
+        loop_count = 0;
+        window_start = millis;
+    }
+}
+
+void profiling_record(profiling_service_t service, uint32_t start)
+{
+    uint32_t period = profiling_timestamp() - start;
+    struct profiling_stats *stats = profiling_stats + service;
+
+    stats->calls++;
+    stats->total += period;
+    if (period > stats->max) {
+        stats->max = period;
+    }
+}
+
+const char *profiling_service_name(profiling_service_t service)
+{
+    return (const char*)pgm_read_word(service_names + service);
+}
+
+void profiling_reset(void)
+{
+    for (uint8_t i = 0; i < PROFILING_NUM_SERVICES; i++) {
+        profiling_stats[i].calls = 0;
+        profiling_stats[i].total = 0;
+        profiling_stats[i].max = 0;
+    }
+    // Do not count the iteration in which the reset happened
+    loop_start = 0;
+}
@@ -0,0 +1,115 @@
+//
+//  profiling.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Measure main loop throughput and service latency using timer 1
+//
+
+#ifndef profiling_h
+#define profiling_h
+
+#include "global.h"
+
+// MARK: Constants
+#define PROFILING_TICKS_PER_MS      1501    // Timer 1 counts from 0 to OCR1A (1500) once every millisecond
+#define PROFILING_CYCLES_PER_TICK   8       // Timer 1 runs from the system clock with a prescaler of 8
+#define PROFILING_WINDOW            1000    // The period over which the main loop rate is measured in milliseconds
+
+// MARK: Types
+/**
+ *  The parts of the main loop for which timing information is kept
+ */
+typedef enum {
+    PROFILE_MAIN_LOOP,
+    PROFILE_ADC,
+    PROFILE_SPI,
+    PROFILE_I2C,
+    PROFILE_DEFERRED,
+    PROFILE_MPL3115A2,
+    PROFILE_ADXL343,
+    PROFILE_FXAS21002C,
+    PROFILE_FGPMMOPA6H,
+    PROFILE_25LC1024,
+    PROFILE_XBEE,
+    PROFILE_FSM,
+    PROFILE_EMATCH,
+    PROFILE_TELEMETRY,
+    PROFILE_LOGGER,
+    PROFILE_MENU,
+    PROFILE_REPLAY,
+    PROFILE_EEPROM,
+    PROFILING_NUM_SERVICES
+} profiling_service_t;
+
+/**
+ *  Timing information for one part of the main loop
+ */
+struct profiling_stats {
+    /** The number of times that the service has run since the last reset */
+    uint32_t calls;
+    /** The total time spent in the service since the last reset in timer ticks, 64 bits so that it does not wrap */
+    uint64_t total;
+    /** The longest single run of the service since the last reset in timer ticks */
+    uint32_t max;
+};
+
+// MARK: Macros
+#ifdef ENABLE_PROFILING
+/**
+ *  Run a statement and record how long it took
+ *  @param service The profiling_service_t under which the time is recorded
+ *  @param call The statement to be run
+ */
+#define PROFILE(service, call) do {\
+    uint32_t profile_start = profiling_timestamp();\
+    call;\
+    profiling_record(service, profile_start);\
+} while (0)
+#else
+#define PROFILE(service, call) call
+#endif
+
+// MARK: Variables
+/**
+ *  The number of main loop iterations which completed in the last full measurment window
+ */
+extern uint16_t profiling_loop_rate;
+
+/**
+ *  Timing information for each part of the main loop, the entry for PROFILE_MAIN_LOOP covers whole iterations
+ */
+extern struct profiling_stats profiling_stats[PROFILING_NUM_SERVICES];
+
+// MARK: Function declarations
+/**
+ *  Get a timestamp with a resolution of one timer 1 tick
+ *  @note Timestamps wrap around after about 47 minutes, only the difference between two timestamps is meaningful
+ *  @return The number of timer 1 ticks since initilization
+ */
+extern uint32_t profiling_timestamp(void);
+
+/**
+ *  Code to be run at the start of each iteration of the main loop
+ */
+extern void profiling_loop_service(void);
+
+/**
+ *  Record the time taken by one run of a service
+ *  @param service The service which was run
+ *  @param start The timestamp taken immediately before the service was run
+ */
+extern void profiling_record(profiling_service_t service, uint32_t start);
+
+/**
+ *  Get the name of a service
+ *  @param service The service for which the name should be found
+ *  @return A pointer to the name of the service in program memory
+ */
+extern const char *profiling_service_name(profiling_service_t service);
+
+/**
+ *  Clear the timing information for all services
+ */
+extern void profiling_reset(void);
+
+#endif /* profiling_h */
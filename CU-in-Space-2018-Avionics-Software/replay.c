@@ -0,0 +1,213 @@
+//
+//  replay.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Replay recorded flight data through the main FSM transition detection
+//
+
+#include "replay.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pindefinitions.h"
+#include "serial0.h"
+#include "menu_data.h"
+#include "fsm.h"
+
+// MARK: Constants
+#define LINE_LENGTH 64
+
+// MARK: Variables
+static char line[LINE_LENGTH];
+static char str[12];
+
+/** The thresholds used for the current replay */
+static struct fsm_thresholds thresholds;
+/** The detector used for the current replay, kept seperate from the one used in flight */
+static struct fsm_detector detector;
+/** The most recent sample which has been replayed */
+static struct fsm_sample sample;
+/** The state of the replayed FSM */
+static global_state_t state;
+/** 1 if no samples have been replayed yet */
+static uint8_t first_sample;
+/** Whether serial 0 loopback was enabled before the replay started */
+static uint8_t loopback;
+
+/** The time and altitude of the highest sample */
+static uint32_t apogee_time;
+static int32_t apogee_alt;
+/** The time at which the replayed FSM entered DESCENT */
+static uint32_t deploy_time;
+/** 1 if the replayed FSM has entered DESCENT */
+static uint8_t deployed;
+
+// MARK: Strings
+static const char string_nl[] PROGMEM = "\n";
+static const char string_comma[] PROGMEM = ",";
+
+const char menu_cmd_replay_string[] PROGMEM = "replay";
+const char menu_help_replay[] PROGMEM = "Run recorded samples through the FSM, starting from PRE-FLIGHT.\nValid Usage: replay [<launch accel> <launch alt> <coasting accel> <coasting alt> <alt range>]\nSamples are sent one per line as \"<time> <altitude> <accel x> <accel y> <accel z>\" and the replay is ended with \"end\".\n";
+
+static const char replay_string_ready[] PROGMEM = "Ready for samples\n";
+static const char replay_string_end[] PROGMEM = "end";
+static const char replay_string_invalid[] PROGMEM = "Invalid sample: ";
+static const char replay_string_state[] PROGMEM = "state,";
+static const char replay_string_apogee[] PROGMEM = "apogee,";
+static const char replay_string_deploy[] PROGMEM = "deploy,";
+
+// MARK: Functions
+/**
+ *  Parse a whitespace seperated list of integers
+ *  @param s The string to be parsed
+ *  @param values The array in which the parsed values will be placed
+ *  @param num_values The number of values to be parsed
+ *  @return 0 if all values where parsed successfully
+ */
+static uint8_t parse_values (char *s, int32_t *values, uint8_t num_values)
+{
+    char *end;
+    for (uint8_t i = 0; i < num_values; i++) {
+        values[i] = strtol(s, &end, 0);
+        if ((end == s) || (!isspace(*end) && (*end != '\0'))) {
+            return 1;
+        }
+        s = end;
+    }
+    return *end != '\0';
+}
+
+/**
+ *  Write a comma seperated pair of values followed by a newline
+ */
+static void put_pair (const char *title, int32_t first, int32_t second)
+{
+    serial_0_put_string_P(title);
+    ltoa(first, str, 10);
+    serial_0_put_string(str);
+    serial_0_put_string_P(string_comma);
+    ltoa(second, str, 10);
+    serial_0_put_string(str);
+    serial_0_put_string_P(string_nl);
+}
+
+/**
+ *  Remove whitespace, including the carriage return of CRLF line endings, from the end of a string
+ */
+static void strip_trailing_space (char *s)
+{
+    char *end = s + strlen(s);
+    while ((end != s) && isspace(*(end - 1))) {
+        end--;
+    }
+    *end = '\0';
+}
+
+/**
+ *  Print the results of the replay and go back to accepting menu commands
+ */
+static void finish_replay (void)
+{
+    if (!first_sample) {
+        put_pair(replay_string_apogee, apogee_time, apogee_alt);
+    }
+    if (deployed) {
+        // Deployment time and latency relative to the highest recorded sample
+        put_pair(replay_string_deploy, deploy_time, (int32_t)(deploy_time - apogee_time));
+    }
+    
+    flags &= ~(1<<FLAG_REPLAY_ACTIVE);
+    flags |= loopback;
+    serial_0_put_string_P(prompt_string);
+}
+
+void replay_service(void)
+{
+    if (!(flags & (1<<FLAG_REPLAY_ACTIVE)) || !serial_0_has_line('\n')) return;
+    serial_0_get_line('\n', line, LINE_LENGTH);
+    strip_trailing_space(line);
+    
+    if (line[0] == '\0') return;
+    if (!strcasecmp_P(line, replay_string_end)) {
+        finish_replay();
+        return;
+    }
+    
+    // Time, altitude, accel x, accel y, accel z
+    int32_t values[5];
+    if (parse_values(line, values, 5)) {
+        serial_0_put_string_P(replay_string_invalid);
+        serial_0_put_string(line);
+        serial_0_put_string_P(string_nl);
+        return;
+    }
+    
+    sample.time = values[0];
+    sample.prev_altitude = (first_sample) ? values[1] : sample.altitude;
+    sample.altitude = values[1];
+    sample.accel_x = values[2];
+    sample.accel_y = values[3];
+    sample.accel_z = values[4];
+    first_sample = 0;
+    
+    if (sample.altitude > apogee_alt) {
+        apogee_alt = sample.altitude;
+        apogee_time = sample.time;
+    }
+    
+    global_state_t next_state = fsm_detect_transition(&detector, state, &sample, &thresholds);
+    if (next_state != state) {
+        state = next_state;
+        put_pair(replay_string_state, sample.time, state);
+        
+        if (state == DESCENT) {
+            deploy_time = sample.time;
+            deployed = 1;
+        }
+    }
+}
+
+void menu_cmd_replay_handler(uint8_t arg_len, char** args)
+{
+    thresholds = fsm_default_thresholds;
+    
+    if (arg_len == 6) {
+        char* end;
+        thresholds.launch_accel = strtol(args[1], &end, 0);
+        if (*end != '\0') goto invalid_args;
+        thresholds.launch_alt = strtol(args[2], &end, 0);
+        if (*end != '\0') goto invalid_args;
+        thresholds.coasting_accel = strtol(args[3], &end, 0);
+        if (*end != '\0') goto invalid_args;
+        thresholds.coasting_alt = strtol(args[4], &end, 0);
+        if (*end != '\0') goto invalid_args;
+        thresholds.altitude_range = strtol(args[5], &end, 0);
+        if (*end != '\0') goto invalid_args;
+    } else if (arg_len != 1) {
+        goto invalid_args;
+    }
+    
+    init_fsm_detector(&detector);
+    sample = (struct fsm_sample){.armed = 1, .new_altitude = 1, .new_accel = 1};
+    state = PRE_FLIGHT;
+    first_sample = 1;
+    
+    apogee_time = 0;
+    apogee_alt = INT32_MIN;
+    deploy_time = 0;
+    deployed = 0;
+    
+    // Samples should not be echoed back
+    loopback = flags & (1<<FLAG_SERIAL_0_LOOPBACK);
+    flags &= ~(1<<FLAG_SERIAL_0_LOOPBACK);
+    
+    // Lines are passed to replay_service instead of the menu until the replay is ended
+    flags |= (1<<FLAG_REPLAY_ACTIVE);
+    serial_0_put_string_P(replay_string_ready);
+    return;
+    
+invalid_args:
+    serial_0_put_string_P(menu_help_replay);
+}
@@ -0,0 +1,24 @@
+//
+//  replay.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Replay recorded flight data through the main FSM transition detection
+//
+
+#ifndef replay_h
+#define replay_h
+
+#include "global.h"
+#include <avr/pgmspace.h>
+
+/**
+ *  Replay the next sample if one has been received, to be run in each iteration of the main loop
+ */
+extern void replay_service(void);
+
+// Replay
+extern const char menu_cmd_replay_string[] PROGMEM;
+extern const char menu_help_replay[] PROGMEM;
+extern void menu_cmd_replay_handler(uint8_t arg_len, char** args);
+
+#endif /* replay_h */
@@ -133,10 +133,29 @@ void serial_0_put_byte (char c)
     }
 }
 
+uint16_t serial_0_put_bytes (const uint8_t *data, uint16_t length)
+{
+    // Only the ISR changes the withdraw position, and it can only make more space
+    uint8_t space = out_buffer_withdraw_p - out_buffer_insert_p - 1;
+    if (length > space) {
+        length = space;
+    }
+    
+    for (uint16_t i = 0; i < length; i++) {
+        serial_out_buffer[(uint8_t)(out_buffer_insert_p + i)] = data[i];
+    }
+    out_buffer_insert_p += length;
+    
+    ATOMIC_BLOCK(ATOMIC_FORCEON) {
+        serial_0_service();                           // Start transmition right away
+    }
+    return length;
+}
+
 int serial_0_has_line (char delim)
 {
     ATOMIC_BLOCK(ATOMIC_FORCEON) {
-        for (int i = in_buffer_withdraw_p; i != in_buffer_insert_p; i++) {
+        for (uint8_t i = in_buffer_withdraw_p; i != in_buffer_insert_p; i++) {
             if (serial_in_buffer[i] == delim) {
                 return 1;
             }
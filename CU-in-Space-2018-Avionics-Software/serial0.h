@@ -45,6 +45,16 @@ extern void serial_0_put_from_eeprom (uint16_t addr);
  */
 extern void serial_0_put_byte (char c);
 
+/**
+ *  Write binary data to the serial output without overwriting data which has not been sent yet
+ *  @note Unlike the other output functions no carriage returns are inserted
+ *  @note This function should not be called from within an interupt
+ *  @param data The bytes to be written
+ *  @param length The number of bytes to be written
+ *  @return The number of bytes which fit in the output buffer
+ */
+extern uint16_t serial_0_put_bytes (const uint8_t *data, uint16_t length);
+
 /**
  *  Read a bytes from the serial input as a string
  *  @note This function should not be called from within an interupt
@@ -135,7 +135,7 @@ void serial_1_put_byte (char c)
 int serial_1_has_line (char delim)
 {
     ATOMIC_BLOCK(ATOMIC_FORCEON) {
-        for (int i = in_buffer_withdraw_p; i != in_buffer_insert_p; i++) {
+        for (uint8_t i = in_buffer_withdraw_p; i != in_buffer_insert_p; i++) {
             if (serial_in_buffer[i] == delim) {
                 return 1;
             }
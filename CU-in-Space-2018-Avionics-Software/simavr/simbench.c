@@ -0,0 +1,161 @@
+//
+//  simbench.c
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Runs a profiling build of the firmware (make PROFILE=1) under simavr and prints the loopstat table as CSV, so that
+//  per-service cycle counts can be compared between builds without a board. No peripherals are attached and the
+//  e-matches read as disconnected, so the firmware stays in STANDBY with its sensors not responding.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_io.h>
+#include <simavr/avr_uart.h>
+
+#define MCU                 "atmega1284p"
+#define F_CPU               12000000
+#define DEFAULT_DURATION    10      // Simulated seconds for which the table is collected
+#define WARMUP_TIME         2       // Simulated seconds before the table is reset, covers initialization
+#define RESPONSE_TIME       2       // Simulated seconds allowed for the table to be sent at 9600 baud
+#define OUTPUT_LENGTH       4096
+
+static avr_t *avr;
+static avr_irq_t *uart_in;
+
+static char output[OUTPUT_LENGTH];
+static size_t output_length;
+
+static void uart_output(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    if (output_length < (OUTPUT_LENGTH - 1)) {
+        output[output_length++] = value;
+    }
+}
+
+/**
+ *  Type a menu command into serial 0
+ */
+static void send_command(const char *command)
+{
+    for (const char *c = command; *c != '\0'; c++) {
+        avr_raise_irq(uart_in, *c);
+    }
+    avr_raise_irq(uart_in, '\n');
+}
+
+/**
+ *  Run the simulation for a number of simulated seconds
+ */
+static void run_for(double seconds)
+{
+    avr_cycle_count_t end = avr->cycle + (avr_cycle_count_t)(seconds * F_CPU);
+    while (avr->cycle < end) {
+        int state = avr_run(avr);
+        if ((state == cpu_Done) || (state == cpu_Crashed)) {
+            fprintf(stderr, "Firmware stopped after %.3f s\n", (double)avr->cycle / F_CPU);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ *  Print the lines of the loopstat output which make up the table, from the loop rate through the last service
+ *  @return 0 if the table was found
+ */
+static int print_table(void)
+{
+    output[output_length] = '\0';
+    char *line = strstr(output, "loop_rate,");
+    if (line == NULL) {
+        return 1;
+    }
+
+    unsigned rows = 0;
+    while (line != NULL) {
+        char *end = strchr(line, '\n');
+        if (end == NULL) break;
+        *end = '\0';
+
+        // The loop rate has one field and the header and each service have four
+        unsigned commas = 0;
+        for (char *c = line; *c != '\0'; c++) {
+            commas += *c == ',';
+        }
+        if ((commas != 1) && (commas != 3)) break;
+        printf("%s\n", line);
+        rows++;
+        line = end + 1;
+    }
+    return rows < 3;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t seconds] firmware.elf\n", name);
+    fprintf(stderr, "  -t  Simulated time over which the table is collected (default %u)\n", DEFAULT_DURATION);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    double duration = DEFAULT_DURATION;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't':
+                duration = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != (argc - 1)) {
+        usage(argv[0]);
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+        fprintf(stderr, "Could not load %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    avr = avr_make_mcu_by_name(MCU);
+    if (avr == NULL) {
+        fprintf(stderr, "simavr does not support the %s\n", MCU);
+        return EXIT_FAILURE;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = F_CPU;
+
+    // Serial 0 is the menu, its output is captured rather than printed by simavr
+    uint32_t flags = 0;
+    avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), uart_output, NULL);
+    uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+    // Initialization is not counted
+    run_for(WARMUP_TIME);
+    send_command("loopstat reset");
+    run_for(duration);
+
+    output_length = 0;
+    send_command("loopstat");
+    run_for(RESPONSE_TIME);
+
+    if (print_table()) {
+        fprintf(stderr, "No loopstat table was received, was the firmware built with PROFILE=1?\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -8,10 +8,11 @@
 #include "telemetry_format.h"
 
 #include "ematch_detect.h"
-#include "EEPROM.h"
 
 #include "XBee.h"
-#include "25LC1024.h"
+#include "logger.h"
+#include "log_format.h"
+#include "crc.h"
 
 #include "ADC.h"
 #include "Barometer-MPL3115A2.h"
@@ -19,126 +20,343 @@
 #include "Gyro-FXAS21002C.h"
 #include "GPS-FGPMMOPA6H.h"
 
-#define EEPROM_TELEMETRY_SPACING    64
+#include <stddef.h>
 
 #define RADIO_WARMUP_TIME   250
 
+#define RADIO_PERIOD_STEPS      16  // The number of delivered frames needed to go from the longest to the shortest period
+#define RADIO_MAX_OUTSTANDING   3   // The number of frames which can be waiting for a transmit status
+
+#define NUM_FRAME_BUFFERS       4   // One being assembled, one collecting samples and two being sent
+
+_Static_assert(sizeof(struct telemetry_api_frame_with_crc) <= XBEE_MAX_PAYLOAD,
+               "A primary frame does not fit in one XBee transmission");
+_Static_assert(sizeof(struct telemetry_api_aggregate_frame) <= XBEE_MAX_PAYLOAD,
+               "An aggregate frame does not fit in one XBee transmission");
+
+/**
+ *  A frame with space around it for the XBee driver to send it in place
+ */
+struct frame_buffer {
+    uint8_t headroom[XBEE_TRANSMIT_HEADROOM];
+    union {
+        struct telemetry_api_frame_with_crc primary;
+        struct telemetry_api_aggregate_frame aggregate;
+    } frame;
+    uint8_t tailroom[XBEE_TRANSMIT_TAILROOM];
+    
+    /** The XBee transaction sending this frame, 0 if it is not being sent */
+    uint8_t transaction_id;
+    /** 1 if this buffer is being assembled, collecting samples or being sent */
+    uint8_t in_use:1;
+};
+
 static uint32_t last_eeprom_time;
 static uint32_t last_radio_time;
+static uint32_t last_aggregate_time;
 
 static uint8_t  has_sent_packet;
 
 uint32_t eeprom_telemetry_period;
 uint32_t radio_telemetry_period;
+uint8_t aggregate_telemetry_period;
 
-static uint16_t eeprom_frame_number;
+static uint32_t radio_min_period;
+static uint32_t radio_max_period;
+static uint32_t radio_period_step;
+/** The number of frames sent for which no transmit status has been received */
+static uint8_t radio_outstanding;
 
-static uint8_t eeprom_transaction_id;
-static uint8_t internal_eeprom_transaction_id;
-static uint8_t xbee_transaction_id;
+static struct frame_buffer frame_buffers[NUM_FRAME_BUFFERS];
+/** The buffer in which the next primary frame is assembled, it is never being sent */
+static struct frame_buffer *assembly_buffer;
+/** The buffer in which samples are being collected for an aggregate frame, NULL if collection has not started */
+static struct frame_buffer *aggregate_buffer;
 
-static struct telemetry_api_frame frame;
+static int32_t last_aggregate_altitude;
+
+static struct log_format_encoder log_encoder;
 
 
 static void update_telemetry_packet (void)
 {
-    frame.payload.mission_time = millis;
+    struct telemetry_frame *payload = &assembly_buffer->frame.primary.payload;
+    
+    payload->mission_time = millis;
     
     /*** ADC Data and Flags ***/
     
     // ADC0
-    frame.payload.state = fsm_state;
-    frame.payload.flag_ematch_1_present = ematch_1_is_ready();
-    frame.payload.flag_ematch_2_present = ematch_2_is_ready();
-    frame.payload.flag_parachute_deployed = 0;
-    frame.payload.adc_cap_voltage = adc_avg_data[0];
+    payload->state = fsm_state;
+    payload->flag_ematch_1_present = ematch_1_is_ready();
+    payload->flag_ematch_2_present = ematch_2_is_ready();
+    payload->flag_parachute_deployed = 0;
+    payload->adc_cap_voltage = adc_avg_data[0];
     // ADC1
-    frame.payload.flag_gps_data_valid = (fgpmmopa6h_data_valid & 1);
-    frame.payload.adc_temp_1 = adc_avg_data[1];
+    payload->flag_gps_data_valid = (fgpmmopa6h_data_valid & 1);
+    payload->adc_temp_1 = adc_avg_data[1];
     // ADC2
-    frame.payload.adc_temp_2 = adc_avg_data[2];
+    payload->adc_temp_2 = adc_avg_data[2];
     // ADC3
-    frame.payload.adc_3 = adc_avg_data[3];
+    payload->adc_3 = adc_avg_data[3];
     // ADC4
-    frame.payload.adc_4 = adc_avg_data[4];
+    payload->adc_4 = adc_avg_data[4];
     // ADC5
-    frame.payload.adc_5 = adc_avg_data[5];
+    payload->adc_5 = adc_avg_data[5];
     // ADC6
-    frame.payload.adc_6 = adc_avg_data[6];
+    payload->adc_6 = adc_avg_data[6];
     // ADC7
-    frame.payload.adc_batt_voltage = adc_avg_data[7];
+    payload->adc_batt_voltage = adc_avg_data[7];
     
     /*** Accelerometer ***/
-    frame.payload.acceleration_x = adxl343_accel_x;
-    frame.payload.acceleration_y = adxl343_accel_y;
-    frame.payload.acceleration_z = adxl343_accel_z;
+    payload->acceleration_x = adxl343_accel_x;
+    payload->acceleration_y = adxl343_accel_y;
+    payload->acceleration_z = adxl343_accel_z;
     
     /*** Gyroscope ***/
-    frame.payload.pitch_rate = fxas21002c_pitch_rate;
-    frame.payload.roll_rate = fxas21002c_roll_rate;
-    frame.payload.yaw_rate = fxas21002c_yaw_rate;
-    frame.payload.gyro_temp = fxas21002c_temp;
+    payload->pitch_rate = fxas21002c_pitch_rate;
+    payload->roll_rate = fxas21002c_roll_rate;
+    payload->yaw_rate = fxas21002c_yaw_rate;
+    payload->gyro_temp = fxas21002c_temp;
     
     /*** Altimiter ***/
-    frame.payload.altitude_lsb = mpl3115a2_alt_lsb;
-    frame.payload.altitude_csb = mpl3115a2_alt_csb;
-    frame.payload.altitude_msb = mpl3115a2_alt_msb;
-    frame.payload.alt_temp_lsb = mpl3115a2_temp_lsb;
-    frame.payload.alt_temp_msb = mpl3115a2_temp_msb;
+    payload->altitude_lsb = mpl3115a2_alt_lsb;
+    payload->altitude_csb = mpl3115a2_alt_csb;
+    payload->altitude_msb = mpl3115a2_alt_msb;
+    payload->alt_temp_lsb = mpl3115a2_temp_lsb;
+    payload->alt_temp_msb = mpl3115a2_temp_msb;
     
     /*** GPS ***/
-    frame.payload.gps_time = fgpmmopa6h_utc_time;
-    frame.payload.latitude = fgpmmopa6h_latitude;
-    frame.payload.longitude = fgpmmopa6h_longitude;
-    frame.payload.ground_speed = fgpmmopa6h_speed;
-    frame.payload.course_over_ground = fgpmmopa6h_course;
-    frame.payload.gps_sample_time = fgpmmopa6h_sample_time;
+    payload->gps_time = fgpmmopa6h_utc_time;
+    payload->latitude = fgpmmopa6h_latitude;
+    payload->longitude = fgpmmopa6h_longitude;
+    payload->ground_speed = fgpmmopa6h_speed;
+    payload->course_over_ground = fgpmmopa6h_course;
+    payload->gps_sample_time = fgpmmopa6h_sample_time;
 }
 
-void init_telemetry (void) {
-    frame.start_delimiter = FRAME_START_DELIMITER;
+/**
+ *  Get a buffer which is not in use
+ *  @return The buffer, which is marked as in use, or NULL if all buffers are in use
+ */
+static struct frame_buffer *get_free_buffer (void)
+{
+    for (struct frame_buffer *b = frame_buffers; b < frame_buffers + NUM_FRAME_BUFFERS; b++) {
+        if (!b->in_use) {
+            b->in_use = 1;
+            return b;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Check whether a buffer is available without taking it
+ */
+static uint8_t has_free_buffer (void)
+{
+    for (struct frame_buffer *b = frame_buffers; b < frame_buffers + NUM_FRAME_BUFFERS; b++) {
+        if (!b->in_use) return 1;
+    }
+    return 0;
+}
+
+/**
+ *  Free the buffers which have finished being sent
+ */
+static void release_sent_buffers (void)
+{
+    for (struct frame_buffer *b = frame_buffers; b < frame_buffers + NUM_FRAME_BUFFERS; b++) {
+        if ((b->transaction_id != 0) && xbee_transaction_done(b->transaction_id)) {
+            xbee_clear_transaction(b->transaction_id);
+            b->transaction_id = 0;
+            b->in_use = 0;
+        }
+    }
+}
+
+/**
+ *  Send a buffer over the radio, the buffer is freed once it has been sent
+ *  @param length The length of the frame in the buffer
+ *  @return 0 if the frame was queued
+ */
+static uint8_t send_buffer (struct frame_buffer *buffer, uint8_t length)
+{
+    if (xbee_transmit_in_place(&buffer->transaction_id, 1, XBEE_ADDRESS_64_BROADCAST, XBEE_ADDRESS_16_UNKOWN, 0, 0,
+                               (uint8_t*)&buffer->frame, length)) {
+        buffer->transaction_id = 0;
+        return 1;
+    }
+    radio_outstanding++;
+    return 0;
+}
+
+/**
+ *  Fill in the parts of a primary frame which do not change
+ */
+static void init_primary_frame (struct telemetry_api_frame_with_crc *frame)
+{
+    frame->start_delimiter = FRAME_START_DELIMITER;
     
-    frame.source_address = ADDRESS_ROCKET;
-    frame.destination_address = ADDRESS_GROUND_STATION;
+    frame->source_address = ADDRESS_ROCKET;
+    frame->destination_address = ADDRESS_GROUND_STATION;
     
-    frame.payload_type = FRAME_TYPE_ROCKET_PRIMARY;
+    frame->payload_type = FRAME_TYPE_ROCKET_PRIMARY;
     
-    frame.length = sizeof(frame.payload);
-    frame.crc_present = 0;
+    frame->length = sizeof(frame->payload);
+    frame->crc_present = 1;
     
-    frame.end_delimiter = FRAME_END_DELIMITER;
+    frame->end_delimiter = FRAME_END_DELIMITER;
+}
+
+/**
+ *  Fill in the parts of an aggregate frame which do not change
+ */
+static void init_aggregate_frame (struct telemetry_api_aggregate_frame *frame)
+{
+    frame->start_delimiter = FRAME_START_DELIMITER;
+    
+    frame->source_address = ADDRESS_ROCKET;
+    frame->destination_address = ADDRESS_GROUND_STATION;
     
-    // Read address of next eeprom telemetry frame
-    eeprom_read(&internal_eeprom_transaction_id, EEPROM_ADDR_TELEMETRY_LOCATION, (uint8_t*)&eeprom_frame_number, sizeof(eeprom_frame_number));
+    frame->payload_type = FRAME_TYPE_ROCKET_AGGREGATE;
+    
+    frame->length = sizeof(frame->payload);
+    frame->crc_present = 1;
+    
+    frame->end_delimiter = FRAME_END_DELIMITER;
+    
+    frame->payload.num_samples = 0;
+}
+
+void init_telemetry (void) {
+    assembly_buffer = get_free_buffer();
+    init_primary_frame(&assembly_buffer->frame.primary);
+    
+    init_log_format_encoder(&log_encoder);
     
     update_telemetry_packet();
 }
 
+void telemetry_set_radio_period (uint32_t min_period, uint32_t max_period)
+{
+    radio_min_period = min_period;
+    radio_max_period = max_period;
+    radio_period_step = (max_period - min_period) / RADIO_PERIOD_STEPS;
+    
+    if ((radio_telemetry_period == 0) || (radio_telemetry_period > max_period)) {
+        radio_telemetry_period = max_period;
+    } else if (radio_telemetry_period < min_period) {
+        radio_telemetry_period = min_period;
+    }
+}
+
+/**
+ *  Back off after a failed transmission or when the XBee is not keeping up
+ */
+static void radio_period_increase (void)
+{
+    radio_telemetry_period = ((radio_telemetry_period * 2) < radio_max_period) ? (radio_telemetry_period * 2) :
+                                                                                 radio_max_period;
+}
+
+/**
+ *  Send a little more often after a clean transmission
+ */
+static void radio_period_decrease (void)
+{
+    radio_telemetry_period = ((radio_telemetry_period - radio_min_period) > radio_period_step) ?
+                                (radio_telemetry_period - radio_period_step) : radio_min_period;
+}
+
+/**
+ *  Adjust the radio period based on the transmit statuses received from the XBee
+ */
+static void radio_rate_service (void)
+{
+    struct xbee_transmit_status status;
+    
+    while (!xbee_get_transmit_status(&status)) {
+        if (radio_outstanding != 0) radio_outstanding--;
+        
+        if (status.delivery_status != XBEE_DELIVERY_SUCCESS) {
+            radio_period_increase();
+        } else if (status.retry_count == 0) {
+            radio_period_decrease();
+        }
+    }
+}
+
 void telemetry_send_packet (void)
 {
     has_sent_packet = 0;
 }
 
-void telemetry_service(void)
+/**
+ *  Collect sub-samples for aggregate frames and send each frame once it is full
+ */
+static void aggregate_service (void)
 {
-    if ((eeprom_transaction_id != 0) && eeprom_25lc1024_transaction_done(eeprom_transaction_id)) {
-        eeprom_25lc1024_clear_transaction(eeprom_transaction_id);
-        eeprom_transaction_id = 0;
+    if ((aggregate_buffer != NULL) &&
+        ((aggregate_buffer->frame.aggregate.payload.num_samples == TELEMETRY_AGGREGATE_SAMPLES) ||
+         (aggregate_telemetry_period == 0))) {
+        // Send the frame when it is full, or what has been collected when sampling is turned off
+        struct telemetry_api_aggregate_frame *frame = &aggregate_buffer->frame.aggregate;
+        frame->crc = crc16((uint8_t*)frame, offsetof(struct telemetry_api_aggregate_frame, crc));
+        if (send_buffer(aggregate_buffer, sizeof(struct telemetry_api_aggregate_frame))) {
+            // Wait for the radio, samples missed in the mean time show up as a gap before the next frame
+            return;
+        }
+        aggregate_buffer = NULL;
+    }
+    
+    if ((aggregate_telemetry_period == 0) || ((millis - last_aggregate_time) < aggregate_telemetry_period)) {
+        return;
+    }
+    last_aggregate_time = millis;
+    
+    if (aggregate_buffer == NULL) {
+        // Start a new frame, if there is no buffer available this sample is missed
+        aggregate_buffer = get_free_buffer();
+        if (aggregate_buffer == NULL) return;
+        init_aggregate_frame(&aggregate_buffer->frame.aggregate);
     }
     
-    if ((internal_eeprom_transaction_id != 0) && eeprom_transaction_done(internal_eeprom_transaction_id)) {
-        eeprom_clear_transaction(internal_eeprom_transaction_id);
-        internal_eeprom_transaction_id = 0;
+    struct telemetry_aggregate_frame *payload = &aggregate_buffer->frame.aggregate.payload;
+    if (payload->num_samples == 0) {
+        payload->mission_time = millis;
+        payload->altitude = mpl3115a2_alt;
+        payload->sample_period = aggregate_telemetry_period;
+        last_aggregate_altitude = mpl3115a2_alt;
     }
     
-    if ((xbee_transaction_id != 0) && xbee_transaction_done(xbee_transaction_id)) {
-        xbee_clear_transaction(xbee_transaction_id);
-        xbee_transaction_id = 0;
+    struct telemetry_aggregate_sample *sample = payload->samples + payload->num_samples;
+    sample->altitude_delta = (int16_t)(mpl3115a2_alt - last_aggregate_altitude);
+    sample->acceleration_x = adxl343_accel_x;
+    sample->acceleration_y = adxl343_accel_y;
+    sample->acceleration_z = adxl343_accel_z;
+    last_aggregate_altitude = mpl3115a2_alt;
+    
+    payload->num_samples++;
+}
+
+void telemetry_service(void)
+{
+    release_sent_buffers();
+    radio_rate_service();
+    aggregate_service();
+    
+    uint8_t radio_due = (radio_telemetry_period != 0) && ((millis - last_radio_time) > radio_telemetry_period);
+    if (radio_due && (!has_free_buffer() || (radio_outstanding >= RADIO_MAX_OUTSTANDING))) {
+        // The link is not keeping up, back off and try again after the new period
+        radio_period_increase();
+        radio_outstanding = 0;
+        last_radio_time = millis;
+        radio_due = 0;
     }
     
-    uint16_t eeprom_addr = EEPROM_TELEMETRY_SPACING * eeprom_frame_number;
-    uint8_t save_packet = (eeprom_telemetry_period != 0) && ((millis - last_eeprom_time) > eeprom_telemetry_period) && (eeprom_transaction_id == 0) && (internal_eeprom_transaction_id == 0) && (eeprom_addr < EEPROM_25LC1024_MAX);
-    uint8_t send_packet = ((radio_telemetry_period != 0) && ((millis - last_radio_time) > radio_telemetry_period) && (xbee_transaction_id == 0)) || (!has_sent_packet && (millis > RADIO_WARMUP_TIME));
+    uint8_t save_packet = (eeprom_telemetry_period != 0) && ((millis - last_eeprom_time) > eeprom_telemetry_period);
+    uint8_t send_packet = radio_due || (!has_sent_packet && (millis > RADIO_WARMUP_TIME));
     
     if (send_packet || save_packet) {
         // Need to generate a new telemetry packet
@@ -149,16 +367,18 @@ void telemetry_service(void)
     
     if (save_packet) {
         // Save telemetry to EEPROM
-        eeprom_25lc1024_write(&eeprom_transaction_id, eeprom_addr, sizeof(frame.payload), (uint8_t*)&frame.payload);
+        log_format_add_frame(&log_encoder, &assembly_buffer->frame.primary.payload, logger_log);
         last_eeprom_time = millis;
-        // Save updated eeprom frame number to internal eeprom
-        eeprom_frame_number++;
-        eeprom_write(&internal_eeprom_transaction_id, EEPROM_ADDR_TELEMETRY_LOCATION, (uint8_t*)&eeprom_frame_number, sizeof(eeprom_frame_number));
     }
     
-    if (send_packet) {
-        // Send telemetry over radio
-        xbee_transmit_command(&xbee_transaction_id, 0, XBEE_ADDRESS_64_BROADCAST, XBEE_ADDRESS_16_UNKOWN, 0, 0, (uint8_t*)&frame, sizeof(frame));
+    if (send_packet && has_free_buffer()) {
+        // Send telemetry over radio, the next frame is assembled in another buffer while this one is sent
+        struct telemetry_api_frame_with_crc *frame = &assembly_buffer->frame.primary;
+        frame->crc = crc16((uint8_t*)frame, offsetof(struct telemetry_api_frame_with_crc, crc));
+        if (send_buffer(assembly_buffer, sizeof(struct telemetry_api_frame_with_crc))) return;
+        
+        assembly_buffer = get_free_buffer();
+        init_primary_frame(&assembly_buffer->frame.primary);
         last_radio_time = millis;
         has_sent_packet = 1;
     }
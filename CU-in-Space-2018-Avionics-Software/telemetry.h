@@ -13,20 +13,41 @@
 
 #define TELEMETRY_EEPROM_PERIOD_LOW         0
 #define TELEMETRY_EEPROM_PERIOD_HIGH        250
+#define TELEMETRY_EEPROM_PERIOD_ASCENT      25
+#define TELEMETRY_EEPROM_PERIOD_PRETRIGGER  TELEMETRY_EEPROM_PERIOD_ASCENT  // Kept in RAM until launch
 
 #define TELEMETRY_RADIO_PERIOD_EXTRA_LOW    15000
 #define TELEMETRY_RADIO_PERIOD_LOW          15000
 #define TELEMETRY_RADIO_PERIOD_MEDIUM       5000
 #define TELEMETRY_RADIO_PERIOD_HIGH         1000
 
+// The shortest periods to which the radio period can adapt from each of the periods above
+#define TELEMETRY_RADIO_MIN_PERIOD_EXTRA_LOW    15000
+#define TELEMETRY_RADIO_MIN_PERIOD_LOW          5000
+#define TELEMETRY_RADIO_MIN_PERIOD_MEDIUM       1000
+#define TELEMETRY_RADIO_MIN_PERIOD_HIGH         200
+
+#define TELEMETRY_AGGREGATE_PERIOD_OFF      0
+#define TELEMETRY_AGGREGATE_PERIOD_FLIGHT   100     // Sub-sample period for aggregate frames, at most 255
+
 extern uint32_t eeprom_telemetry_period;
 extern uint32_t radio_telemetry_period;
+extern uint8_t aggregate_telemetry_period;
 
 /**
  *  Initilize the telmetry service
  */
 extern void init_telemetry (void);
 
+/**
+ *  Set the range within which the radio telemetry period adapts to the link
+ *  @note The period shrinks by a fixed step for each frame which the XBee reports as delivered on the first try and
+ *        doubles when a transmission fails or frames start to back up. The current period is kept if it is in range.
+ *  @param min_period The shortest period to use when the link is clean
+ *  @param max_period The longest period to use when the link is poor
+ */
+extern void telemetry_set_radio_period (uint32_t min_period, uint32_t max_period);
+
 /**
  *  Send a telemetry packet on the next call to telemetry_service
  */
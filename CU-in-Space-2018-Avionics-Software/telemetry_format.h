@@ -22,10 +22,13 @@
 #define FRAME_TYPE_ROCKET_SECONDARY     0x2
 #define FRAME_TYPE_PAYLOAD_UAV          0x3
 #define FRAME_TYPE_PAYLOAD_CONTAINER    0x4
+#define FRAME_TYPE_ROCKET_AGGREGATE     0x5
+
+#define TELEMETRY_AGGREGATE_SAMPLES     8   // The number of sub-samples carried in each aggregate frame (83 byte frames)
 
 
 enum DeviceAddress {GROUND_STATION = 0b00, ROCKET = 0b10, PAYLOAD_UAV = 0b11, PAYLOAD_CONTAINER = 0b100};
-enum PayloadType {ROCKET_PRI_TELEM = 0x1, ROCKET_AUX_TELEM = 0x2, PAYLOAD_UAV_TELEM = 0x3, PAYLOAD_CONTAINER_TELEM = 0x4};
+enum PayloadType {ROCKET_PRI_TELEM = 0x1, ROCKET_AUX_TELEM = 0x2, PAYLOAD_UAV_TELEM = 0x3, PAYLOAD_CONTAINER_TELEM = 0x4, ROCKET_AGGREGATE_TELEM = 0x5};
 
 struct telemetry_frame {
     uint32_t mission_time;
@@ -124,7 +127,7 @@ struct telemetry_frame {
     uint16_t ground_speed;
     uint16_t course_over_ground;
     uint32_t gps_sample_time;
-};
+} __attribute__ ((packed));     // Packed so that the layout is the same when built for the ground station
 
 
 // Note when using these structures, source_address, destintation_address and payload_type should be cast to and from their
@@ -145,6 +148,8 @@ struct telemetry_api_frame {
     uint8_t end_delimiter;              // 0xCC
 };
 
+// The CRC is CRC-16/CCITT-FALSE (see crc.h) of every byte of the frame from start_delimiter up to the CRC, stored
+// little endian.
 struct telemetry_api_frame_with_crc {
     uint8_t start_delimiter;
     
@@ -158,9 +163,48 @@ struct telemetry_api_frame_with_crc {
     
     struct telemetry_frame payload;
     
-    uint8_t crc;
+    uint16_t crc;
     
     uint8_t end_delimiter;
 };
 
+
+/*** Aggregate Frames ***/
+
+// Aggregate frames carry the altitude and acceleration at a higher rate than primary frames can be sent. Each sample
+// stores its altitude as the change from the sample before it, the first sample's altitude is the base altitude.
+struct telemetry_aggregate_sample {
+    int16_t altitude_delta;             // Change in altitude since the previous sample in 1/16 m
+    int16_t acceleration_x;
+    int16_t acceleration_y;
+    int16_t acceleration_z;
+};
+
+struct telemetry_aggregate_frame {
+    uint32_t mission_time;              // Mission time of the first sample
+    int32_t altitude;                   // Altitude of the first sample in 1/16 m
+    uint8_t sample_period;              // Time between samples in milliseconds
+    uint8_t num_samples;                // Number of valid entries in samples
+    
+    struct telemetry_aggregate_sample samples[TELEMETRY_AGGREGATE_SAMPLES];
+};
+
+struct telemetry_api_aggregate_frame {
+    uint8_t start_delimiter;            // 0x52
+    
+    uint8_t source_address;
+    uint8_t destination_address;
+    
+    uint8_t payload_type;
+    
+    uint16_t length:15;
+    uint16_t crc_present:1;
+    
+    struct telemetry_aggregate_frame payload;
+    
+    uint16_t crc;                       // Calculated as for struct telemetry_api_frame_with_crc
+    
+    uint8_t end_delimiter;              // 0xCC
+};
+
 #endif /* telemetry_format_h */
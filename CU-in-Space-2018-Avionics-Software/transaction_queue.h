@@ -0,0 +1,100 @@
+//
+//  transaction_queue.h
+//  CU-in-Space-2018-Avionics-Software
+//
+//  Transaction IDs shared by the driver queues
+//
+
+#ifndef transaction_queue_h
+#define transaction_queue_h
+
+#include "global.h"
+
+#include <stddef.h> //NULL, size_t
+
+// MARK: Constants
+#define TRANSACTION_ID_INVALID          0       // The transaction ID for an unused transaction
+#define TRANSACTION_INDEX_BITS          4       // The low bits of an ID are the index of the transaction in its queue
+#define TRANSACTION_INDEX_MASK          ((1 << TRANSACTION_INDEX_BITS) - 1)
+#define TRANSACTION_INDEX_NONE          0xFF    // Returned by transaction_index for IDs which are not in the queue
+#define TRANSACTION_MAX_QUEUE_LENGTH    (1 << TRANSACTION_INDEX_BITS)
+#define TRANSACTION_NUM_GENERATIONS     15      // Generation 0 is not used so that no valid ID has it
+
+// MARK: Types
+/**
+ *  A function which is called once a transaction is done
+ *  @param transaction_id The transaction which is done
+ *  @param context The pointer which was given when the callback was set
+ */
+typedef void (*transaction_callback_t)(uint8_t transaction_id, void *context);
+
+// MARK: Function declarations
+/**
+ *  Create the ID for a new transaction
+ *  @note An ID is the index of the transaction in its queue combined with a generation number which is advanced each
+ *        time the slot is used. A driver can find a transaction from its ID without searching the queue, and an ID
+ *        which is kept after its transaction is cleared does not match the next transaction in the same slot.
+ *  @param generation The generation of the slot, which is advanced
+ *  @param index The index of the slot in the queue, less than TRANSACTION_MAX_QUEUE_LENGTH
+ *  @return The ID for the transaction
+ */
+static inline uint8_t transaction_new_id(uint8_t *generation, uint8_t index)
+{
+    *generation = (*generation % TRANSACTION_NUM_GENERATIONS) + 1;
+    return (*generation << TRANSACTION_INDEX_BITS) | index;
+}
+
+/**
+ *  Get the index in its queue of the transaction with an ID
+ *  @note The caller must still check that the slot holds a transaction with this ID, it may have been cleared
+ *  @param id The ID of the transaction
+ *  @param queue_length The length of the queue
+ *  @return The index of the transaction or TRANSACTION_INDEX_NONE if the ID can not be in the queue, which includes
+ *          TRANSACTION_ID_INVALID and any other ID with generation 0
+ */
+static inline uint8_t transaction_index(uint8_t id, uint8_t queue_length)
+{
+    uint8_t index = id & TRANSACTION_INDEX_MASK;
+    return (((id >> TRANSACTION_INDEX_BITS) == 0) || (index >= queue_length)) ? TRANSACTION_INDEX_NONE : index;
+}
+
+/**
+ *  Get the transaction with an ID from a queue
+ *  @note Every transaction type has its ID as its first member
+ *  @param queue The first transaction in the queue
+ *  @param queue_length The number of transactions in the queue
+ *  @param stride The size of a transaction
+ *  @param id The ID to look up
+ *  @return The transaction, or NULL if there is no transaction with the ID
+ */
+static inline void *transaction_get_with_id(const volatile void *queue, uint8_t queue_length, size_t stride,
+                                            uint8_t id)
+{
+    uint8_t i = transaction_index(id, queue_length);
+    if (i == TRANSACTION_INDEX_NONE) return NULL;
+    
+    const volatile uint8_t *t = (const volatile uint8_t *)queue + (i * stride);
+    return (*t == id) ? (void *)t : NULL;
+}
+
+/**
+ *  Get the next slot in a queue which is not in use, searching from the head of the queue
+ *  @param queue The first transaction in the queue
+ *  @param queue_length The number of transactions in the queue
+ *  @param stride The size of a transaction
+ *  @param head The index of the head of the queue
+ *  @return The free transaction, or NULL if every slot is in use
+ */
+static inline void *transaction_get_next_free(const volatile void *queue, uint8_t queue_length, size_t stride,
+                                              uint8_t head)
+{
+    uint8_t i = head;
+    do {
+        const volatile uint8_t *t = (const volatile uint8_t *)queue + (i * stride);
+        if (*t == TRANSACTION_ID_INVALID) return (void *)t;
+        i = (i + 1) % queue_length;
+    } while (i != head);
+    return NULL;
+}
+
+#endif /* transaction_queue_h */